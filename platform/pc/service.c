@@ -202,11 +202,48 @@ void start_secondary_cores(kernel_heaps kh)
 
 #endif
 
+closure_func_basic(srat_handler, void, numa_affinity_handler,
+                   u8 type, void *p)
+{
+    switch (type) {
+    case ACPI_SRAT_LAPIC: {
+        acpi_srat_lapic l = p;
+        if (l->flags & SRAT_ENABLED)
+            numa_add_cpu(l->apic_id, l->domain_lo | (l->domain_hi[0] << 8) |
+                         (l->domain_hi[1] << 16) | (l->domain_hi[2] << 24));
+        break;
+    }
+    case ACPI_SRAT_MEMORY: {
+        acpi_srat_mem m = p;
+        if (m->flags & SRAT_ENABLED)
+            numa_add_memory(m->domain, ((u64)m->base_hi << 32) | m->base_lo,
+                            ((u64)m->length_hi << 32) | m->length_lo);
+        break;
+    }
+    case ACPI_SRAT_X2APIC: {
+        acpi_srat_x2apic x = p;
+        if (x->flags & SRAT_ENABLED)
+            numa_add_cpu(x->x2apic_id, x->domain);
+        break;
+    }
+    }
+}
+
+closure_func_basic(slit_handler, void, numa_distance_handler,
+                   u32 from, u32 to, u8 distance)
+{
+    numa_set_distance(from, to, distance);
+}
+
 void count_cpus_present(void)
 {
     /* Read ACPI tables for MADT access */
     init_acpi_tables(get_kernel_heaps());
 
+    /* NUMA topology, if any */
+    if (acpi_walk_srat(stack_closure_func(srat_handler, numa_affinity_handler)))
+        acpi_walk_slit(stack_closure_func(slit_handler, numa_distance_handler));
+
 #ifdef SMP_ENABLE
     if (acpi_walk_madt(stack_closure_func(madt_handler, count_processors_handler))) {
         init_debug("ACPI reports %d processors", present_processors);
@@ -202,6 +202,7 @@ void synchronous_handler(void)
 {
     cpuinfo ci = current_cpu();
     bitmap_set_atomic(idle_cpu_mask, ci->id, 0);
+    page_invalidate_idle_exit();
     context ctx = get_current_context(ci);
     context_frame f = ctx->frame;
     u32 esr = esr_from_frame(f);
@@ -254,6 +255,7 @@ void irq_handler(void)
 {
     cpuinfo ci = current_cpu();
     bitmap_set_atomic(idle_cpu_mask, ci->id, 0);
+    page_invalidate_idle_exit();
     context ctx = get_current_context(ci);
     context_frame f = ctx->frame;
     u64 i;
@@ -175,6 +175,7 @@
 
 /* bits [58:55] reserved for sw use */
 #define PAGE_NO_BLOCK       U64_FROM_BIT(55)
+#define PAGE_SPLIT          U64_FROM_BIT(56)    /* page split from a block mapping */
 
 #ifndef physical_from_virtual
 
@@ -367,6 +368,17 @@ static inline u64 flags_from_pte(u64 pte)
     return pte & PAGE_FLAGS_MASK;
 }
 
+/* flags for the next-level entries replacing a block mapping */
+static inline u64 flags_from_block_pte(u64 pte)
+{
+    return flags_from_pte(pte) | PAGE_SPLIT;
+}
+
+static inline boolean pte_is_split(pte entry)
+{
+    return (entry & PAGE_SPLIT) != 0;
+}
+
 static inline pageflags pageflags_from_pte(pte pte)
 {
     return (pageflags){.w = flags_from_pte(pte)};
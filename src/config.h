@@ -81,6 +81,13 @@
 #define PAGECACHE_PAGES_RETAIN          64
 #define PAGECACHE_COMPLETIONS_RETAIN    64
 
+/* per-cpu magazines in front of locked heaps */
+#define HEAP_MAGAZINE_SIZE          32  /* objects per magazine */
+#define HEAP_MAGAZINE_MAX_ORDER     11  /* largest object size served by magazines */
+#define HEAP_DEPOT_MAX_MAGAZINES    16  /* full or empty magazines kept per size class */
+
+#define NUMA_MAX_NODES  8
+
 /* must be large enough for vendor code that use malloc/free interface */
 #define MAX_MCACHE_ORDER 16
 #define MAX_LOWMEM_MCACHE_ORDER 11
@@ -31,6 +31,37 @@ boolean acpi_walk_madt(madt_handler mh)
     return true;
 }
 
+boolean acpi_walk_srat(srat_handler sh)
+{
+    ACPI_TABLE_HEADER *srat;
+    ACPI_STATUS rv = AcpiGetTable(ACPI_SIG_SRAT, 1, &srat);
+    if (ACPI_FAILURE(rv))
+        return false;
+    u8 *p = (u8 *)srat + sizeof(ACPI_TABLE_SRAT);
+    u8 *pe = (u8 *)srat + srat->Length;
+    for (; p < pe && p[1]; p += p[1])
+        apply(sh, p[0], p);
+    AcpiPutTable(srat);
+    return true;
+}
+
+boolean acpi_walk_slit(slit_handler sh)
+{
+    ACPI_TABLE_HEADER *slit;
+    ACPI_STATUS rv = AcpiGetTable(ACPI_SIG_SLIT, 1, &slit);
+    if (ACPI_FAILURE(rv))
+        return false;
+    ACPI_TABLE_SLIT *t = (ACPI_TABLE_SLIT *)slit;
+    u64 n = t->LocalityCount;
+    if (sizeof(*t) - 1 + n * n <= slit->Length) {
+        for (u64 from = 0; from < n; from++)
+            for (u64 to = 0; to < n; to++)
+                apply(sh, from, to, t->Entry[from * n + to]);
+    }
+    AcpiPutTable(slit);
+    return true;
+}
+
 boolean acpi_walk_mcfg(mcfg_handler h)
 {
     ACPI_TABLE_HEADER *mcfg;
@@ -29,6 +29,13 @@
 #define ACPI_MADT_GEN_TRANS 15
 
 #define MADT_LAPIC_ENABLED  1
+
+/* SRAT affinity structure types */
+#define ACPI_SRAT_LAPIC     0
+#define ACPI_SRAT_MEMORY    1
+#define ACPI_SRAT_X2APIC    2
+
+#define SRAT_ENABLED        1
 /* ACPI table structures */
 typedef struct acpi_rsdp {
     u8 sig[8];
@@ -144,6 +151,42 @@ typedef struct acpi_gen_trans { /* Generic Translator */
     u32 res2;
 } __attribute__((packed)) *acpi_gen_trans;
 
+typedef struct acpi_srat_lapic {
+    u8 type;
+    u8 length;
+    u8 domain_lo;
+    u8 apic_id;
+    u32 flags;
+    u8 sapic_eid;
+    u8 domain_hi[3];
+    u32 clock_domain;
+} __attribute__((packed)) *acpi_srat_lapic;
+
+typedef struct acpi_srat_mem {
+    u8 type;
+    u8 length;
+    u32 domain;
+    u16 res;
+    u32 base_lo;
+    u32 base_hi;
+    u32 length_lo;
+    u32 length_hi;
+    u32 res2;
+    u32 flags;
+    u64 res3;
+} __attribute__((packed)) *acpi_srat_mem;
+
+typedef struct acpi_srat_x2apic {
+    u8 type;
+    u8 length;
+    u16 res;
+    u32 domain;
+    u32 x2apic_id;
+    u32 flags;
+    u32 clock_domain;
+    u32 res2;
+} __attribute__((packed)) *acpi_srat_x2apic;
+
 static inline boolean acpi_checksum(void *a, u8 len)
 {
     u8 *addr = a;
@@ -156,12 +199,16 @@ static inline boolean acpi_checksum(void *a, u8 len)
 closure_type(madt_handler, void, u8 type, void *p);
 closure_type(mcfg_handler, boolean, u64 addr, u16 segment, u8 bus_start, u8 bus_end);
 closure_type(spcr_handler, void, u8 type, u64 addr);
+closure_type(srat_handler, void, u8 type, void *p);
+closure_type(slit_handler, void, u32 from, u32 to, u8 distance);
 
 void init_acpi(kernel_heaps kh);
 void init_acpi_tables(kernel_heaps kh);
 void acpi_save_rsdp(u64 rsdp);
 void acpi_register_irq_handler(int irq, thunk t, sstring name);
 boolean acpi_walk_madt(madt_handler mh);
+boolean acpi_walk_srat(srat_handler sh);
+boolean acpi_walk_slit(slit_handler sh);
 boolean acpi_walk_mcfg(mcfg_handler mh);
 boolean acpi_parse_spcr(spcr_handler h);
 
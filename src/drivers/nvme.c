@@ -9,6 +9,7 @@
 #define NVME_CAP    0x0
 #define NVME_CAP_DSTRD(cap) (((cap) >> 32) & 0xF)
 #define NVME_CAP_MQES(cap) (((cap) & 0xFFFF) + 1)
+#define NVME_CAP_MPSMIN(cap) (((cap) >> 48) & 0xF)
 
 #define NVME_VS 0x8
 #define NVME_VS_MJR(vs) ((vs) >> 16)
@@ -34,8 +35,7 @@
 #define NVME_AQ_IDX     0   /* admin queue index */
 #define NVME_AQ_MSIX    0   /* admin queue MSI-X slot */
 
-#define NVME_IOQ_IDX    1   /* I/O queue index and identifier */
-#define NVME_IOQ_MSIX   1   /* I/O queue MSI-X slot */
+/* I/O queue pairs use identifiers and MSI-X slots starting from 1. */
 
 /* command Dword 0 */
 #define NVME_CID(id)    ((id) << 16)
@@ -52,6 +52,7 @@
 #define NVME_PHASE_TAG(dw3)     (((dw3) >> 16) & 0x1)
 #define NVME_CMD_ID(dw3)        ((dw3) & 0xFFFF)
 #define NVME_SC_OK  0
+#define NVME_SC_INVALID_FIELD   0x02
 
 /* Admin command set opcodes */
 #define NVME_OPC_DEL_IOSQ   0x00
@@ -85,6 +86,9 @@
 #define CNS_NVM_SET_LIST        4
 #define NVME_IDENTIFY_RESP_SIZE 4096
 
+/* Set Features command */
+#define NVME_FEAT_NUM_QUEUES    0x07
+
 /* NVM command set opcodes */
 #define NVME_OPC_FLUSH      0x00
 #define NVME_OPC_WRITE      0x01
@@ -104,6 +108,10 @@
 
 #define NVME_CID_MAX    0xFFFE
 
+/* Each I/O command has a page for its PRP list or SGL segment. */
+#define NVME_CMD_LIST_SIZE      PAGESIZE
+#define NVME_CMD_LIST_ENTRIES   (NVME_CMD_LIST_SIZE / sizeof(struct nvme_sgl))
+
 #define AMZN_NVME_VID   0x1D0F
 #define AMZN_BDEV_SIZE  32
 
@@ -124,6 +132,10 @@ struct nvme_sgl {
     u8 id;
 } __attribute__((packed));
 
+/* SGL descriptor identifiers (type and sub type) */
+#define NVME_SGL_DATA_BLOCK     0x00
+#define NVME_SGL_LAST_SEGMENT   0x30
+
 struct nvme_sqe {   /* submission queue entry */
     u32 cdw0;
     u32 nsid;
@@ -166,9 +178,23 @@ typedef struct nvme_cq {
 
 closure_type(nvme_ac_handler, void, struct nvme_cqe *cqe);
 
-declare_closure_struct(3, 3, void, nvme_io,
-                       struct nvme *, n, u32, namespace, boolean, write,
-                       void *buf, range blocks, status_handler sh);
+declare_closure_struct(2, 1, void, nvme_req,
+                       struct nvme *, n, u32, namespace,
+                       storage_req req);
+
+typedef struct nvme_ioq {
+    struct nvme *n;
+    int idx;    /* queue identifier and MSI-X slot */
+    range cpus; /* CPUs submitting to this queue, and handling its interrupts */
+    struct nvme_sq sq;
+    struct nvme_cq cq;
+    closure_struct(thunk, irq);
+    struct list pending_reqs, free_reqs, done_reqs;
+    vector cmds;
+    struct list free_cmds;
+    closure_struct(thunk, bh_service);
+    struct spinlock lock;
+} *nvme_ioq;
 
 typedef struct nvme {
     heap general, contiguous;
@@ -176,30 +202,31 @@ typedef struct nvme {
     struct pci_bar bar;
     u32 vs; /* controller version */
     int dstrd;  /* doorbell stride */
+    int mps_min;    /* minimum memory page size (log2) */
     struct nvme_sq asq; /* admin submission queue */
     struct nvme_cq acq; /* admin completion queue */
     closure_struct(thunk, admin_irq);
     nvme_ac_handler ac_handler; /* admin completion handler */
+    int msix_count;
     int ioq_order;     /* I/O queue size */
-    struct nvme_sq iosq;    /* I/O submission queue */
-    struct nvme_cq iocq;    /* I/O completion queue */
+    int max_ioqs;   /* number of allocated I/O queue pairs */
+    int num_ioqs;   /* number of created I/O queue pairs */
+    nvme_ioq ioqs;      /* I/O queue pairs */
+    nvme_ioq *ioq_map;  /* I/O queue pair for each CPU */
+    u64 max_xfer;   /* maximum data transfer size of a command */
+    boolean sgl;    /* SGL support */
+    boolean vwc;    /* volatile write cache */
     int attach_id;
-    closure_struct(thunk, io_irq);
-    struct list pending_reqs, free_reqs, done_reqs;
-    vector cmds;
-    struct list free_cmds;
-    closure_struct(thunk, bh_service);
-    closure_struct(nvme_io, r);
-    closure_struct(nvme_io, w);
-    closure_struct(storage_simple_req_handler, req_handler);
-    struct spinlock lock;
+    closure_struct(nvme_req, req_handler);
 } *nvme;
 
 typedef struct nvme_ioreq {
     struct list l;
     u32 namespace;
-    boolean write;
-    void *buf;
+    u8 op;
+    void *buf;      /* current data buffer */
+    u64 buf_len;
+    sg_list sg;     /* remaining data buffers for scatter-gather requests */
     range blocks;
     u64 pending_cmds;
     status_handler sh;
@@ -210,6 +237,8 @@ typedef struct nvme_iocmd {
     struct list l;
     u16 id;
     nvme_ioreq req;
+    void *list;     /* PRP list or SGL segment */
+    u64 list_phys;
 } *nvme_iocmd;
 
 static boolean nvme_init_sq(nvme n, nvme_sq sq, int order)
@@ -290,38 +319,46 @@ static inline void nvme_cq_doorbell(nvme n, int q_idx, nvme_cq q)
     pci_bar_write_4(&n->bar, cqhdbl, q->head);
 }
 
-static nvme_ioreq nvme_get_ioreq(nvme n)
+static nvme_ioreq nvme_get_ioreq(nvme_ioq q)
 {
     nvme_ioreq req;
-    spin_lock(&n->lock);
-    list l = list_get_next(&n->free_reqs);
+    u64 irqflags = spin_lock_irq(&q->lock);
+    list l = list_get_next(&q->free_reqs);
     if (l) {
         list_delete(l);
         req = struct_from_list(l, nvme_ioreq, l);
     } else {
         nvme_debug("new request allocation");
-        req = allocate(n->general, sizeof(*req));
+        req = allocate(q->n->general, sizeof(*req));
     }
-    spin_unlock(&n->lock);
+    spin_unlock_irq(&q->lock, irqflags);
     return req;
 }
 
-/* Called with the lock held. */
-static nvme_iocmd nvme_get_iocmd(nvme n, boolean allocate)
+/* Called with the queue lock held. */
+static nvme_iocmd nvme_get_iocmd(nvme_ioq q, boolean allocate)
 {
-    list l = list_get_next(&n->free_cmds);
+    list l = list_get_next(&q->free_cmds);
     if (l) {
         list_delete(l);
         return struct_from_list(l, nvme_iocmd, l);
-    } else if (allocate && (vector_length(n->cmds) <= NVME_CID_MAX)) {
+    } else if (allocate && (vector_length(q->cmds) <= NVME_CID_MAX)) {
         nvme_debug("new command allocation");
+        nvme n = q->n;
         nvme_iocmd cmd = allocate(n->general, sizeof(*cmd));
         if (cmd == INVALID_ADDRESS) {
             nvme_debug("command allocation failed");
             return cmd;
         }
-        cmd->id = vector_length(n->cmds);
-        vector_push(n->cmds, cmd);
+        cmd->list = allocate(n->contiguous, NVME_CMD_LIST_SIZE);
+        if (cmd->list == INVALID_ADDRESS) {
+            nvme_debug("command list allocation failed");
+            deallocate(n->general, cmd, sizeof(*cmd));
+            return INVALID_ADDRESS;
+        }
+        cmd->list_phys = physical_from_virtual(cmd->list);
+        cmd->id = vector_length(q->cmds);
+        vector_push(q->cmds, cmd);
         return cmd;
     } else {
         nvme_debug("no available commands");
@@ -329,90 +366,228 @@ static nvme_iocmd nvme_get_iocmd(nvme n, boolean allocate)
     }
 }
 
-/* Called with the lock held. */
-static void nvme_service_pending(nvme n, boolean allocate)
+/* Consumes request data, possibly spanning multiple scatter-gather buffers. */
+static void nvme_req_consume(nvme_ioreq req, u64 len)
+{
+    while (len > 0) {
+        if (req->buf_len == 0) {
+            sg_buf sgb = sg_list_head_peek(req->sg);
+            assert(sgb != INVALID_ADDRESS);
+            req->buf = sgb->buf + sgb->offset;
+            req->buf_len = sg_buf_len(sgb);
+        }
+        u64 n = MIN(req->buf_len, len);
+        req->buf += n;
+        req->buf_len -= n;
+        if (req->sg)
+            sg_consume(req->sg, n);
+        len -= n;
+    }
+}
+
+/* Sets up the data pointer of a read or write command so that it covers as much of the remaining
+ * request data as possible; returns the number of blocks covered, and sets the PRP or SGL data
+ * transfer type in cdw0. The data is described with PRPs if possible, otherwise with an SGL if the
+ * controller supports it; without SGL support, the command ends where the data is not suitable for
+ * a PRP list, and the data past the last whole sector is left to the next command. Returns 0 if
+ * not even one sector can be described. */
+static u64 nvme_setup_data(nvme n, nvme_iocmd cmd, nvme_ioreq req, struct nvme_sqe *sqe)
+{
+    struct nvme_sgl *desc = cmd->list;
+    u64 max = MIN(range_span(req->blocks) * SECTOR_SIZE, n->max_xfer);
+    u64 len = 0;
+    int count = 0;
+    boolean prp = true;
+
+    /* look ahead in the request data without consuming it */
+    void *buf = req->buf;
+    u64 buf_len = req->buf_len;
+    u64 sg_index = (buf_len != 0) ? 1 : 0;
+    while ((len < max) && (count < NVME_CMD_LIST_ENTRIES)) {
+        if (buf_len == 0) {
+            sg_buf sgb = sg_list_peek_at(req->sg, sg_index++);
+            assert(sgb != INVALID_ADDRESS);
+            buf = sgb->buf + sgb->offset;
+            buf_len = sg_buf_len(sgb);
+        }
+        u64 phys = physical_from_virtual(buf);
+        u64 frag_len = MIN(MIN(buf_len, PAGESIZE - (phys & PAGEMASK)), max - len);
+
+        /* Each PRP entry except the first must be page-aligned, and each PRP entry except the last
+         * must end at a page boundary. */
+        if ((count > 0) &&
+            ((phys & PAGEMASK) || ((desc[count - 1].addr + desc[count - 1].len) & PAGEMASK))) {
+            if (!n->sgl)
+                break;
+            prp = false;
+        }
+        desc[count].addr = phys;
+        desc[count].len = frag_len;
+        zero(desc[count].reserved, sizeof(desc[count].reserved));
+        desc[count].id = NVME_SGL_DATA_BLOCK;
+        count++;
+        len += frag_len;
+        buf += frag_len;
+        buf_len -= frag_len;
+    }
+
+    /* trim the data to whole sectors */
+    u64 excess = len & (SECTOR_SIZE - 1);
+    len -= excess;
+    while (excess > 0) {
+        struct nvme_sgl *last = &desc[count - 1];
+        if (last->len <= excess) {
+            excess -= last->len;
+            count--;
+        } else {
+            last->len -= excess;
+            excess = 0;
+        }
+    }
+    if (len == 0)
+        return 0;
+    nvme_req_consume(req, len);
+    if (prp) {
+        sqe->cdw0 = NVME_CMD_PRP;
+        sqe->dptr.prp1 = desc[0].addr;
+        if (count == 1) {
+            sqe->dptr.prp2 = 0;
+        } else if (count == 2) {
+            sqe->dptr.prp2 = desc[1].addr;
+        } else {
+            /* Convert the descriptors into a PRP list in place: each entry is written below the
+             * descriptors that have yet to be read. */
+            u64 *prp_list = cmd->list;
+            for (int i = 1; i < count; i++)
+                prp_list[i - 1] = desc[i].addr;
+            sqe->dptr.prp2 = cmd->list_phys;
+        }
+    } else {
+        sqe->cdw0 = NVME_SGL_B;
+        sqe->dptr.sgl1.addr = cmd->list_phys;
+        sqe->dptr.sgl1.len = count * sizeof(struct nvme_sgl);
+        zero(sqe->dptr.sgl1.reserved, sizeof(sqe->dptr.sgl1.reserved));
+        sqe->dptr.sgl1.id = NVME_SGL_LAST_SEGMENT;
+    }
+    return len / SECTOR_SIZE;
+}
+
+/* Called with the queue lock held. */
+static void nvme_service_pending(nvme_ioq q, boolean allocate)
 {
     boolean new_reqs = false;
     list l;
-    while ((l = list_get_next(&n->pending_reqs))) {
-        nvme_iocmd cmd = nvme_get_iocmd(n, allocate);
+    while ((l = list_get_next(&q->pending_reqs))) {
+        nvme_iocmd cmd = nvme_get_iocmd(q, allocate);
         if (cmd == INVALID_ADDRESS)
             break;
-        struct nvme_sqe *sqe = nvme_get_sqe(&n->iosq);
+        struct nvme_sqe *sqe = nvme_get_sqe(&q->sq);
         if (!sqe) {
-            list_insert_before(list_begin(&n->free_cmds), &cmd->l);
+            list_insert_before(list_begin(&q->free_cmds), &cmd->l);
             break;
         }
-        new_reqs = true;
         nvme_ioreq req = struct_from_list(l, nvme_ioreq, l);
-        sqe->cdw0 = NVME_CID(cmd->id) | NVME_CMD_PRP |
-                (req->write ? NVME_OPC_WRITE : NVME_OPC_READ);
         sqe->nsid = req->namespace;
-        u64 buf_start = physical_from_virtual(req->buf);
-        u64 nlb = range_span(req->blocks);
-        u64 buf_end = buf_start + nlb * SECTOR_SIZE;
-        sqe->dptr.prp1 = buf_start;
-        if (buf_end > (buf_start & ~PAGEMASK) + PAGESIZE) {
-            sqe->dptr.prp2 = (buf_start & ~PAGEMASK) + PAGESIZE;
-            if (buf_end > sqe->dptr.prp2 + PAGESIZE) {
-                nlb = (sqe->dptr.prp2 + PAGESIZE - buf_start) / SECTOR_SIZE;
-                req->buf += nlb * SECTOR_SIZE;
+        if (req->op == STORAGE_OP_FLUSH) {
+            nvme_debug("request flush, cmd ID 0x%0x", cmd->id);
+            sqe->cdw0 = NVME_CID(cmd->id) | NVME_CMD_PRP | NVME_OPC_FLUSH;
+            list_delete(l);
+        } else {
+            boolean write = (req->op == STORAGE_OP_WRITE) || (req->op == STORAGE_OP_WRITESG);
+            u64 nlb = nvme_setup_data(q->n, cmd, req, sqe);
+            if (nlb == 0) {
+                /* a sector is split in a way that a PRP list cannot describe */
+                msg_err("request data not suitable for PRPs\n");
+                q->sq.tail = (q->sq.tail - 1) & MASK(q->sq.order);
+                list_insert_before(list_begin(&q->free_cmds), &cmd->l);
+                list_delete(l);
+                req->sc = NVME_SC_INVALID_FIELD;
+                req->blocks.start = req->blocks.end;
+                if (!req->pending_cmds) {
+                    if (list_empty(&q->done_reqs))
+                        async_apply_bh((thunk)&q->bh_service);
+                    list_push_back(&q->done_reqs, &req->l);
+                }
+                continue;
             }
+            sqe->cdw0 |= NVME_CID(cmd->id) | (write ? NVME_OPC_WRITE : NVME_OPC_READ);
+            if (nlb == range_span(req->blocks))
+                list_delete(l);
+            nvme_debug("request sectors [0x%x, 0x%x), cmd ID 0x%0x",
+                       req->blocks.start, req->blocks.start + nlb, cmd->id);
+            sqe->cdw10 = req->blocks.start;
+            sqe->cdw11 = req->blocks.start >> 32;
+            sqe->cdw12 = nlb - 1;
+            req->blocks.start += nlb;
         }
-        if (nlb == range_span(req->blocks))
-            list_delete(l);
-        nvme_debug("request sectors [0x%x, 0x%x), cmd ID 0x%0x",
-                   req->blocks.start, req->blocks.start + nlb, cmd->id);
-        sqe->cdw10 = req->blocks.start;
-        sqe->cdw12 = nlb - 1;
         cmd->req = req;
         req->pending_cmds++;
-        req->blocks.start += nlb;
         new_reqs = true;
     }
     if (new_reqs)
-        nvme_sq_doorbell(n, NVME_IOQ_IDX, &n->iosq);
+        nvme_sq_doorbell(q->n, q->idx, &q->sq);
 }
 
-define_closure_function(3, 3, void, nvme_io,
-                        nvme, n, u32, namespace, boolean, write,
-                        void *buf, range blocks, status_handler sh)
+/* Requests are submitted to the I/O queue pair of the current CPU, whose completion interrupt is
+ * routed to the same CPU(s). */
+define_closure_function(2, 1, void, nvme_req,
+                        nvme, n, u32, namespace,
+                        storage_req req)
 {
     nvme n = bound(n);
-    u32 namespace = bound(namespace);
-    boolean write = bound(write);
-    nvme_debug("[%d] %c %R", namespace, write ? 'w' : 'r', blocks);
-    nvme_ioreq req = nvme_get_ioreq(n);
-    if (req == INVALID_ADDRESS) {
+    status_handler sh = req->completion;
+    nvme_debug("[%d] op %d %R", bound(namespace), req->op, req->blocks);
+    if ((req->op == STORAGE_OP_FLUSH) ? !n->vwc : (range_span(req->blocks) == 0)) {
+        async_apply_status_handler(sh, STATUS_OK);
+        return;
+    }
+    nvme_ioq q = n->ioq_map[current_cpu()->id];
+    nvme_ioreq r = nvme_get_ioreq(q);
+    if (r == INVALID_ADDRESS) {
         apply(sh, timm("result", "request allocation failed"));
         return;
     }
-    req->namespace = namespace;
-    req->write = write;
-    req->buf = buf;
-    req->blocks = blocks;
-    req->pending_cmds = 0;
-    req->sh = sh;
-    req->sc = NVME_SC_OK;
-    u64 irqflags = spin_lock_irq(&n->lock);
-    list_push_back(&n->pending_reqs, &req->l);
-    nvme_service_pending(n, true);
-    spin_unlock_irq(&n->lock, irqflags);
+    r->namespace = bound(namespace);
+    r->op = req->op;
+    switch (req->op) {
+    case STORAGE_OP_READSG:
+    case STORAGE_OP_WRITESG:
+        r->sg = req->data;
+        r->buf_len = 0;
+        break;
+    case STORAGE_OP_READ:
+    case STORAGE_OP_WRITE:
+        r->sg = 0;
+        r->buf = req->data;
+        r->buf_len = range_span(req->blocks) * SECTOR_SIZE;
+        break;
+    default:
+        r->sg = 0;
+        r->buf_len = 0;
+    }
+    r->blocks = req->blocks;
+    r->pending_cmds = 0;
+    r->sh = sh;
+    r->sc = NVME_SC_OK;
+    u64 irqflags = spin_lock_irq(&q->lock);
+    list_push_back(&q->pending_reqs, &r->l);
+    nvme_service_pending(q, true);
+    spin_unlock_irq(&q->lock, irqflags);
 }
 
 closure_func_basic(thunk, void, nvme_io_irq)
 {
     nvme_debug("%s", func_ss);
-    nvme n = struct_from_closure(nvme, io_irq);
-    spin_lock(&n->lock);
-    boolean done_empty = list_empty(&n->done_reqs);
+    nvme_ioq q = struct_from_closure(nvme_ioq, irq);
+    spin_lock(&q->lock);
+    boolean done_empty = list_empty(&q->done_reqs);
     struct nvme_cqe *cqe;
-    while ((cqe = nvme_get_cqe(&n->iocq))) {
-        n->iosq.head = NVME_SQ_HEAD(cqe->dw2);
-        nvme_iocmd cmd = vector_get(n->cmds, NVME_CMD_ID(cqe->dw3));
-        nvme_debug("  cmd ID 0x%0x complete", cmd->id);
+    while ((cqe = nvme_get_cqe(&q->cq))) {
+        q->sq.head = NVME_SQ_HEAD(cqe->dw2);
+        nvme_iocmd cmd = vector_get(q->cmds, NVME_CMD_ID(cqe->dw3));
+        nvme_debug("  queue %d cmd ID 0x%0x complete", q->idx, cmd->id);
         nvme_ioreq req = cmd->req;
-        list_insert_before(list_begin(&n->free_cmds), &cmd->l);
+        list_insert_before(list_begin(&q->free_cmds), &cmd->l);
         int sc = NVME_STATUS_CODE(cqe->dw3);
         u64 remaining = range_span(req->blocks);
         if ((sc != NVME_SC_OK) && (remaining != 0))
@@ -421,32 +596,32 @@ closure_func_basic(thunk, void, nvme_io_irq)
             req->sc = sc;
         boolean req_complete = !(--req->pending_cmds) && (!remaining || (sc != NVME_SC_OK));
         if (req_complete)
-            list_push_back(&n->done_reqs, &req->l);
+            list_push_back(&q->done_reqs, &req->l);
     }
-    nvme_cq_doorbell(n, NVME_IOQ_IDX, &n->iocq);
-    nvme_service_pending(n, false);
-    if (done_empty && !list_empty(&n->done_reqs))
-        async_apply_bh((thunk)&n->bh_service);
-    spin_unlock(&n->lock);
+    nvme_cq_doorbell(q->n, q->idx, &q->cq);
+    nvme_service_pending(q, false);
+    if (done_empty && !list_empty(&q->done_reqs))
+        async_apply_bh((thunk)&q->bh_service);
+    spin_unlock(&q->lock);
 }
 
 closure_func_basic(thunk, void, nvme_bh_service)
 {
     nvme_debug("%s", func_ss);
-    nvme n = struct_from_closure(nvme, bh_service);
+    nvme_ioq q = struct_from_closure(nvme_ioq, bh_service);
     list l;
-    u64 irqflags = spin_lock_irq(&n->lock);
-    while ((l = list_get_next(&n->done_reqs))) {
+    u64 irqflags = spin_lock_irq(&q->lock);
+    while ((l = list_get_next(&q->done_reqs))) {
         list_delete(l);
-        spin_unlock_irq(&n->lock, irqflags);
+        spin_unlock_irq(&q->lock, irqflags);
         nvme_ioreq req = struct_from_list(l, nvme_ioreq, l);
         apply(req->sh, (req->sc == NVME_SC_OK) ? STATUS_OK :
                 timm("result", "NVMe status code 0x%x", req->sc));
-        irqflags = spin_lock_irq(&n->lock);
-        list_insert_before(list_begin(&n->free_reqs), l);
+        irqflags = spin_lock_irq(&q->lock);
+        list_insert_before(list_begin(&q->free_reqs), l);
     }
-    nvme_service_pending(n, true);
-    spin_unlock_irq(&n->lock, irqflags);
+    nvme_service_pending(q, true);
+    spin_unlock_irq(&q->lock, irqflags);
 }
 
 closure_function(4, 0, void, nvme_ns_attach,
@@ -455,10 +630,7 @@ closure_function(4, 0, void, nvme_ns_attach,
     nvme n = bound(n);
     u32 ns_id = bound(ns_id);
     u64 disk_size = bound(disk_size);
-    apply(bound(a),
-          storage_init_req_handler(&n->req_handler, init_closure(&n->r, nvme_io, n, ns_id, false),
-                                   init_closure(&n->w, nvme_io, n, ns_id, true)),
-          disk_size, n->attach_id);
+    apply(bound(a), init_closure(&n->req_handler, nvme_req, n, ns_id), disk_size, n->attach_id);
     closure_finish();
 }
 
@@ -557,6 +729,8 @@ closure_function(5, 1, void, nvme_ns_query_resp_active,
     nvme_ns_query_next_active(n, ns_list, ++bound(index), ns_resp);
 }
 
+static boolean nvme_get_active_namespaces(nvme n, u32 start_id, storage_attach a);
+
 closure_function(3, 1, void, nvme_identify_controller_resp,
                  nvme, n, void *, resp, storage_attach, a,
                  struct nvme_cqe *cqe)
@@ -566,11 +740,19 @@ closure_function(3, 1, void, nvme_identify_controller_resp,
     int sc = NVME_STATUS_CODE(cqe->dw3);
     if (sc != NVME_SC_OK) {
         msg_err("failed to identify controller: status code 0x%x\n", sc);
-        goto error;
+        goto free_resp;
     }
     u16 vid = *(u16 *)resp; /* PCI Vendor ID */
+    u8 mdts = *(u8 *)(resp + 77);   /* maximum data transfer size */
     u32 nn = *(u32 *)(resp + 516);  /* number of namespaces */
-    nvme_debug("controller (vendor ID 0x%x) reports %d namespace(s)", vid, nn);
+    u8 vwc = *(u8 *)(resp + 525);   /* volatile write cache */
+    u32 sgls = *(u32 *)(resp + 536);    /* SGL support */
+    nvme_debug("controller (vendor ID 0x%x) reports %d namespace(s), MDTS %d, VWC 0x%x, SGLS 0x%x",
+               vid, nn, mdts, vwc, sgls);
+    if (mdts)
+        n->max_xfer = MIN(n->max_xfer, U64_FROM_BIT(mdts + n->mps_min));
+    n->vwc = (vwc & 0x1) != 0;
+    n->sgl = (sgls & 0x3) != 0;
     if (vid == AMZN_NVME_VID) {
         /* Retrieve block device name in vendor-specific field.
          * Expected name format (after trimming whitespace): '/dev/sd[a-z]' */
@@ -589,6 +771,10 @@ closure_function(3, 1, void, nvme_identify_controller_resp,
             }
         }
     }
+    if (n->vs >= NVME_VER(1, 1, 0)) {
+        nvme_get_active_namespaces(n, 0, bound(a));
+        goto free_resp;
+    }
     n->ac_handler = closure(n->general, nvme_ns_query_resp, n, 1, nn, resp, bound(a));
     if (n->ac_handler != INVALID_ADDRESS) {
         nvme_ns_query_next(n, 1, nn, resp);
@@ -596,7 +782,7 @@ closure_function(3, 1, void, nvme_identify_controller_resp,
     } else {
         msg_err("failed to allocate completion handler\n");
     }
-  error:
+  free_resp:
     deallocate(n->contiguous, resp, NVME_IDENTIFY_RESP_SIZE);
   done:
     closure_finish();
@@ -679,93 +865,275 @@ static boolean nvme_get_active_namespaces(nvme n, u32 start_id, storage_attach a
     return true;
 }
 
-closure_function(2, 1, void, nvme_create_iosq_resp,
-                 nvme, n, storage_attach, a,
+static void nvme_ioq_deinit_cq(nvme n, nvme_ioq q)
+{
+    pci_teardown_msix(n->d, q->idx);
+    nvme_deinit_cq(n, &q->cq);
+}
+
+static void nvme_ioq_free_cmds(nvme n, nvme_ioq q)
+{
+    nvme_iocmd cmd;
+    vector_foreach(q->cmds, cmd) {
+        deallocate(n->contiguous, cmd->list, NVME_CMD_LIST_SIZE);
+        deallocate(n->general, cmd, sizeof(*cmd));
+    }
+    deallocate_vector(q->cmds);
+}
+
+static void nvme_free_ioqs(nvme n, int num)
+{
+    for (int i = 0; i < num; i++)
+        nvme_ioq_free_cmds(n, &n->ioqs[i]);
+    deallocate(n->general, n->ioq_map, total_processors * sizeof(n->ioq_map[0]));
+    deallocate(n->general, n->ioqs, n->max_ioqs * sizeof(n->ioqs[0]));
+}
+
+/* Allocates I/O queue pair descriptors, distributing CPUs evenly among queue pairs. */
+static boolean nvme_alloc_ioqs(nvme n, int num)
+{
+    n->max_ioqs = num;
+    n->ioqs = allocate_zero(n->general, num * sizeof(n->ioqs[0]));
+    if (n->ioqs == INVALID_ADDRESS)
+        goto error;
+    n->ioq_map = allocate(n->general, total_processors * sizeof(n->ioq_map[0]));
+    if (n->ioq_map == INVALID_ADDRESS) {
+        deallocate(n->general, n->ioqs, num * sizeof(n->ioqs[0]));
+        goto error;
+    }
+    u64 cpus_per_q = total_processors / num;
+    u64 excess_cpus = total_processors - cpus_per_q * num;
+    u64 first_cpu = 0;
+    for (int i = 0; i < num; i++) {
+        nvme_ioq q = &n->ioqs[i];
+        u64 num_cpus = (i < excess_cpus) ? (cpus_per_q + 1) : cpus_per_q;
+        q->cmds = allocate_vector(n->general, U64_FROM_BIT(n->ioq_order));
+        if (q->cmds == INVALID_ADDRESS) {
+            nvme_free_ioqs(n, i);
+            goto error;
+        }
+        q->n = n;
+        q->idx = i + 1;
+        q->cpus = irangel(first_cpu, num_cpus);
+        first_cpu += num_cpus;
+        list_init(&q->pending_reqs);
+        list_init(&q->free_reqs);
+        list_init(&q->done_reqs);
+        list_init(&q->free_cmds);
+        spin_lock_init(&q->lock);
+        init_closure_func(&q->bh_service, thunk, nvme_bh_service);
+    }
+    return true;
+  error:
+    msg_err("failed to allocate I/O queues\n");
+    return false;
+}
+
+/* Called when I/O queue pair creation is complete: each CPU whose queue pair could not be created
+ * is assigned to one of the queue pairs that have been created. */
+static void nvme_ioqs_ready(nvme n, int num, storage_attach a)
+{
+    for (int i = num; i < n->max_ioqs; i++)
+        nvme_ioq_free_cmds(n, &n->ioqs[i]);
+    if (num == 0) {
+        msg_err("no I/O queues available\n");
+        nvme_free_ioqs(n, 0);
+        return;
+    }
+    nvme_debug("%d I/O queue pair(s)", num);
+    for (u64 cpu = 0; cpu < total_processors; cpu++) {
+        nvme_ioq q = &n->ioqs[cpu % num];
+        for (int i = 0; i < num; i++) {
+            if (point_in_range(n->ioqs[i].cpus, cpu)) {
+                q = &n->ioqs[i];
+                break;
+            }
+        }
+        n->ioq_map[cpu] = q;
+    }
+    n->num_ioqs = num;
+    nvme_identify_controller(n, a);
+}
+
+static boolean nvme_create_iocq(nvme n, nvme_ioq q, storage_attach a);
+
+closure_function(3, 1, void, nvme_delete_iocq_resp,
+                 nvme, n, nvme_ioq, q, storage_attach, a,
+                 struct nvme_cqe *cqe)
+{
+    nvme n = bound(n);
+    nvme_ioq q = bound(q);
+    int sc = NVME_STATUS_CODE(cqe->dw3);
+    if (sc == NVME_SC_OK) {
+        nvme_debug("I/O CQ %d deleted", q->idx);
+        nvme_ioq_deinit_cq(n, q);
+    } else {
+        /* the controller may still own the queue memory: leave it allocated */
+        msg_err("failed to delete I/O CQ %d: status code 0x%x\n", q->idx, sc);
+        pci_teardown_msix(n->d, q->idx);
+    }
+    nvme_ioqs_ready(n, q->idx - 1, bound(a));
+    closure_finish();
+}
+
+/* Called when the submission queue of a queue pair could not be created after its completion queue
+ * has been created: the completion queue is deleted before its memory is released, then queue pair
+ * creation completes with the preceding queue pairs. */
+static void nvme_abort_ioq(nvme n, nvme_ioq q, storage_attach a)
+{
+    n->ac_handler = closure(n->general, nvme_delete_iocq_resp, n, q, a);
+    if (n->ac_handler == INVALID_ADDRESS) {
+        msg_err("failed to allocate completion handler\n");
+        pci_teardown_msix(n->d, q->idx);
+        nvme_ioqs_ready(n, q->idx - 1, a);
+        return;
+    }
+    struct nvme_sqe *cmd = nvme_get_sqe(&n->asq);
+    assert(cmd);
+    zero(cmd, sizeof(*cmd));
+    cmd->cdw0 = NVME_CID(n->asq.tail) | NVME_CMD_PRP | NVME_OPC_DEL_IOCQ;
+    cmd->cdw10 = q->idx;    /* queue ID */
+    nvme_sq_doorbell(n, NVME_AQ_IDX, &n->asq);
+}
+
+closure_function(3, 1, void, nvme_create_iosq_resp,
+                 nvme, n, nvme_ioq, q, storage_attach, a,
                  struct nvme_cqe *cqe)
 {
     nvme n = bound(n);
+    nvme_ioq q = bound(q);
     storage_attach a = bound(a);
     int sc = NVME_STATUS_CODE(cqe->dw3);
     if (sc == NVME_SC_OK) {
-        nvme_debug("I/O SQ created");
-        if (n->vs >= NVME_VER(1, 1, 0))
-            nvme_get_active_namespaces(n, 0, a);
-        else
-            nvme_identify_controller(n, a);
+        nvme_debug("I/O SQ %d created", q->idx);
+        if ((q->idx == n->max_ioqs) || !nvme_create_iocq(n, q + 1, a))
+            nvme_ioqs_ready(n, q->idx, a);
     } else {
-        msg_err("failed to create I/O SQ: status code 0x%x\n", sc);
+        msg_err("failed to create I/O SQ %d: status code 0x%x\n", q->idx, sc);
+        nvme_deinit_sq(n, &q->sq);
+        nvme_abort_ioq(n, q, a);
     }
     closure_finish();
 }
 
-static boolean nvme_create_iosq(nvme n, storage_attach a)
+static boolean nvme_create_iosq(nvme n, nvme_ioq q, storage_attach a)
 {
-    if (!nvme_init_sq(n, &n->iosq, n->ioq_order)) {
+    if (!nvme_init_sq(n, &q->sq, n->ioq_order)) {
         msg_err("failed to initialize queue\n");
         return false;
     }
-    n->ac_handler = closure(n->general, nvme_create_iosq_resp, n, a);
+    n->ac_handler = closure(n->general, nvme_create_iosq_resp, n, q, a);
     if (n->ac_handler == INVALID_ADDRESS) {
         msg_err("failed to allocate completion handler\n");
-        nvme_deinit_sq(n, &n->iosq);
+        nvme_deinit_sq(n, &q->sq);
         return false;
     }
 
     /* Zero out all submission queue entries, so that when submitting an entry
      * only used fields need to be set. This relies on the fact that all I/O
      * commands use the same set of fields. */
-    zero(n->iosq.ring, U64_FROM_BIT(n->iosq.order) * sizeof(struct nvme_sqe));
+    zero(q->sq.ring, U64_FROM_BIT(q->sq.order) * sizeof(struct nvme_sqe));
 
     struct nvme_sqe *cmd = nvme_get_sqe(&n->asq);
     assert(cmd);
     zero(cmd, sizeof(*cmd));
     cmd->cdw0 = NVME_CID(n->asq.tail) | NVME_CMD_PRP | NVME_OPC_CRE_IOSQ;
-    cmd->dptr.prp1 = physical_from_virtual(n->iosq.ring);
-    cmd->cdw10 = (MASK(n->ioq_order) << 16) | NVME_IOQ_IDX; /* queue size and queue ID */
-    cmd->cdw11 = (NVME_IOQ_IDX << 16) | 0x01;  /* completion queue ID, physically contiguous */
+    cmd->dptr.prp1 = physical_from_virtual(q->sq.ring);
+    cmd->cdw10 = (MASK(n->ioq_order) << 16) | q->idx;   /* queue size and queue ID */
+    cmd->cdw11 = (q->idx << 16) | 0x01; /* completion queue ID, physically contiguous */
     nvme_sq_doorbell(n, NVME_AQ_IDX, &n->asq);
     return true;
 }
 
-closure_function(2, 1, void, nvme_create_iocq_resp,
-                 nvme, n, storage_attach, a,
+closure_function(3, 1, void, nvme_create_iocq_resp,
+                 nvme, n, nvme_ioq, q, storage_attach, a,
                  struct nvme_cqe *cqe)
 {
     nvme n = bound(n);
+    nvme_ioq q = bound(q);
     int sc = NVME_STATUS_CODE(cqe->dw3);
     if (sc == NVME_SC_OK) {
-        nvme_debug("I/O CQ created");
-        nvme_create_iosq(n, bound(a));
+        nvme_debug("I/O CQ %d created", q->idx);
+        if (!nvme_create_iosq(n, q, bound(a)))
+            nvme_abort_ioq(n, q, bound(a));
     } else {
-        msg_err("failed to create I/O CQ: status code 0x%x\n", sc);
+        msg_err("failed to create I/O CQ %d: status code 0x%x\n", q->idx, sc);
+        nvme_ioq_deinit_cq(n, q);
+        nvme_ioqs_ready(n, q->idx - 1, bound(a));
     }
     closure_finish();
 }
 
-static boolean nvme_create_iocq(nvme n, storage_attach a)
+static boolean nvme_create_iocq(nvme n, nvme_ioq q, storage_attach a)
 {
-    if (!nvme_init_cq(n, &n->iocq, n->ioq_order)) {
+    if (!nvme_init_cq(n, &q->cq, n->ioq_order)) {
         msg_err("failed to initialize queue\n");
         return false;
     }
-    n->ac_handler = closure(n->general, nvme_create_iocq_resp, n, a);
+    n->ac_handler = closure(n->general, nvme_create_iocq_resp, n, q, a);
     if (n->ac_handler == INVALID_ADDRESS) {
         msg_err("failed to allocate completion handler\n");
-        nvme_deinit_cq(n, &n->iocq);
+        nvme_deinit_cq(n, &q->cq);
         return false;
     }
-    if (pci_setup_msix(n->d, NVME_IOQ_MSIX, init_closure_func(&n->io_irq, thunk, nvme_io_irq),
-                       ss("nvme I/O")) == INVALID_PHYSICAL) {
+    if (pci_setup_msix_aff(n->d, q->idx, init_closure_func(&q->irq, thunk, nvme_io_irq),
+                           ss("nvme I/O"), q->cpus) == INVALID_PHYSICAL) {
         msg_err("failed to allocate MSI-X vector\n");
+        deallocate_closure(n->ac_handler);
+        nvme_deinit_cq(n, &q->cq);
         return false;
     }
     struct nvme_sqe *cmd = nvme_get_sqe(&n->asq);
     assert(cmd);
     zero(cmd, sizeof(*cmd));
     cmd->cdw0 = NVME_CID(n->asq.tail) | NVME_CMD_PRP | NVME_OPC_CRE_IOCQ;
-    cmd->dptr.prp1 = physical_from_virtual(n->iocq.ring);
-    cmd->cdw10 = (MASK(n->ioq_order) << 16) | NVME_IOQ_IDX; /* queue size and queue ID */
-    cmd->cdw11 = (NVME_IOQ_MSIX << 16) | 0x03;  /* interrupts enabled, physically contiguous */
+    cmd->dptr.prp1 = physical_from_virtual(q->cq.ring);
+    cmd->cdw10 = (MASK(n->ioq_order) << 16) | q->idx;   /* queue size and queue ID */
+    cmd->cdw11 = (q->idx << 16) | 0x03; /* MSI-X slot, interrupts enabled, physically contiguous */
+    nvme_sq_doorbell(n, NVME_AQ_IDX, &n->asq);
+    return true;
+}
+
+closure_function(2, 1, void, nvme_set_num_queues_resp,
+                 nvme, n, storage_attach, a,
+                 struct nvme_cqe *cqe)
+{
+    nvme n = bound(n);
+    int num = n->num_ioqs;
+    int sc = NVME_STATUS_CODE(cqe->dw3);
+    if (sc == NVME_SC_OK) {
+        /* numbers of I/O submission and completion queues allocated by the controller (0-based) */
+        num = MIN(num, MIN((cqe->dw0 & 0xFFFF) + 1, (cqe->dw0 >> 16) + 1));
+    } else {
+        nvme_debug("failed to set number of queues: status code 0x%x", sc);
+        num = 1;
+    }
+    if (nvme_alloc_ioqs(n, num) && !nvme_create_iocq(n, n->ioqs, bound(a)))
+        nvme_free_ioqs(n, num);
+    closure_finish();
+}
+
+/* Requests one I/O queue pair per CPU, up to the number of available MSI-X vectors and the number
+ * set in the "nvme_io_queues" configuration option, if present. */
+static boolean nvme_set_num_queues(nvme n, storage_attach a)
+{
+    u64 num = MIN(total_processors, n->msix_count - 1);
+    tuple root = get_root_tuple();
+    u64 cfg;
+    if (root && get_u64(root, sym(nvme_io_queues), &cfg) && (cfg > 0))
+        num = MIN(num, cfg);
+    n->num_ioqs = num;
+    n->ac_handler = closure(n->general, nvme_set_num_queues_resp, n, a);
+    if (n->ac_handler == INVALID_ADDRESS) {
+        msg_err("failed to allocate completion handler\n");
+        return false;
+    }
+    struct nvme_sqe *cmd = nvme_get_sqe(&n->asq);
+    assert(cmd);
+    zero(cmd, sizeof(*cmd));
+    cmd->cdw0 = NVME_CID(n->asq.tail) | NVME_CMD_PRP | NVME_OPC_SET_FEAT;
+    cmd->cdw10 = NVME_FEAT_NUM_QUEUES;
+    cmd->cdw11 = ((n->num_ioqs - 1) << 16) | (n->num_ioqs - 1);
     nvme_sq_doorbell(n, NVME_AQ_IDX, &n->asq);
     return true;
 }
@@ -824,13 +1192,9 @@ closure_function(3, 1, boolean, nvme_probe,
     n->ioq_order = find_order(mqes);
     if (mqes != U64_FROM_BIT(n->ioq_order))
         n->ioq_order--;
+    n->mps_min = 12 + NVME_CAP_MPSMIN(cap);
     nvme_debug("new controller (version %d.%d.%d), MQES %d, I/O queue order %d",
                NVME_VS_MJR(n->vs), NVME_VS_MNR(n->vs), NVME_VS_TER(n->vs), mqes, n->ioq_order);
-    n->cmds = allocate_vector(general, NVME_CID_MAX + 1);
-    if (n->cmds == INVALID_ADDRESS) {
-        msg_err("failed to allocate request vector\n");
-        goto deinit_acq;
-    }
     pci_bar_write_4(&n->bar, NVME_AQA, NVME_AQA_ACQS(U64_FROM_BIT(NVME_ACQ_ORDER)) |
                     NVME_AQA_ASQS(U64_FROM_BIT(NVME_ASQ_ORDER)));
     pci_bar_write_8(&n->bar, NVME_ASQ, physical_from_virtual(n->asq.ring));
@@ -845,29 +1209,30 @@ closure_function(3, 1, boolean, nvme_probe,
             kernel_delay(milliseconds(1 << retries));
         } else {
             msg_err("failed to enable controller\n");
-            goto free_cmds;
+            goto deinit_acq;
         }
     }
     n->d = d;
-    pci_enable_msix(d);
+    n->msix_count = pci_enable_msix(d);
+    if (n->msix_count < 2) {
+        msg_err("insufficient MSI-X vectors (%d)\n", n->msix_count);
+        goto disable_msix;
+    }
     if (pci_setup_msix(d, NVME_AQ_MSIX, init_closure_func(&n->admin_irq, thunk, nvme_admin_irq),
                        ss("nvme admin")) == INVALID_PHYSICAL) {
         msg_err("failed to allocate MSI-X vector\n");
-        goto free_cmds;
+        goto disable_msix;
     }
+    n->max_xfer = NVME_CMD_LIST_ENTRIES * PAGESIZE;
+    n->sgl = n->vwc = false;
     n->attach_id = -1;
-    list_init(&n->pending_reqs);
-    list_init(&n->free_reqs);
-    list_init(&n->done_reqs);
-    list_init(&n->free_cmds);
-    spin_lock_init(&n->lock);
-    init_closure_func(&n->bh_service, thunk, nvme_bh_service);
-    if (nvme_create_iocq(n, bound(a))) {
+    if (nvme_set_num_queues(n, bound(a))) {
         d->driver_data = n;
         return true;
     }
-  free_cmds:
-    deallocate_vector(n->cmds);
+    pci_teardown_msix(d, NVME_AQ_MSIX);
+  disable_msix:
+    pci_disable_msix(d);
   deinit_acq:
     nvme_deinit_cq(n, &n->acq);
   deinit_asq:
@@ -882,11 +1247,14 @@ closure_function(2, 0, void, nvme_detach_complete,
 {
     nvme_debug("detach complete");
     nvme n = bound(n);
-    pci_teardown_msix(n->d, NVME_IOQ_MSIX);
-    nvme_deinit_cq(n, &n->iocq);
+    for (int i = 0; i < n->num_ioqs; i++) {
+        nvme_ioq q = &n->ioqs[i];
+        nvme_ioq_deinit_cq(n, q);
+        nvme_deinit_sq(n, &q->sq);
+    }
+    nvme_free_ioqs(n, n->num_ioqs);
     pci_teardown_msix(n->d, NVME_AQ_MSIX);
     pci_disable_msix(n->d);
-    deallocate_vector(n->cmds);
     pci_bar_deinit(&n->bar);
     nvme_deinit_cq(n, &n->acq);
     nvme_deinit_sq(n, &n->asq);
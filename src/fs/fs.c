@@ -107,6 +107,65 @@ void filesystem_write_sg(fsfile f, sg_list sg, range q, status_handler completio
     apply(f->write, sg, q, completion);
 }
 
+closure_function(5, 1, void, filesystem_direct_io,
+                 fsfile, f, sg_list, sg, range, q, boolean, write, status_handler, completion,
+                 status s)
+{
+    fsfile f = bound(f);
+    range q = bound(q);
+    status_handler completion = bound(completion);
+    if (!is_ok(s)) {
+        /* cached dirty data could not be committed */
+        apply(completion, s);
+    } else if (bound(write)) {
+        apply(f->direct_write, bound(sg), q, completion);
+    } else {
+        apply(f->direct_read, bound(sg), q, completion);
+    }
+    closure_finish();
+}
+
+closure_function(3, 1, void, filesystem_write_direct_complete,
+                 fsfile, f, range, q, status_handler, completion,
+                 status s)
+{
+    /* drop cached pages that may now be stale */
+    pagecache_node_invalidate_range(bound(f)->cache_node, bound(q));
+    apply(bound(completion), s);
+    closure_finish();
+}
+
+/* Dirty cached pages in the range are committed to storage before the uncached operation is
+ * issued, so that it neither reads stale data nor is later overwritten by writeback. */
+void filesystem_read_direct(fsfile f, sg_list sg, range q, status_handler completion)
+{
+    status_handler sh = closure(f->fs->h, filesystem_direct_io, f, sg, q, false, completion);
+    if (sh == INVALID_ADDRESS) {
+        status s = timm("result", "failed to allocate closure");
+        apply(completion, timm_append(s, "fsstatus", "%d", FS_STATUS_NOMEM));
+        return;
+    }
+    pagecache_sync_node_range(f->cache_node, q, sh);
+}
+
+void filesystem_write_direct(fsfile f, sg_list sg, range q, status_handler completion)
+{
+    heap h = f->fs->h;
+    status_handler write_complete = closure(h, filesystem_write_direct_complete, f, q, completion);
+    if (write_complete == INVALID_ADDRESS)
+        goto alloc_fail;
+    status_handler sh = closure(h, filesystem_direct_io, f, sg, q, true, write_complete);
+    if (sh == INVALID_ADDRESS) {
+        deallocate_closure(write_complete);
+        goto alloc_fail;
+    }
+    pagecache_sync_node_range(f->cache_node, q, sh);
+    return;
+  alloc_fail: ;
+    status s = timm("result", "failed to allocate closure");
+    apply(completion, timm_append(s, "fsstatus", "%d", FS_STATUS_NOMEM));
+}
+
 static inline timestamp filesystem_get_time(filesystem fs, tuple t, symbol s)
 {
     timestamp tim = 0;
@@ -333,10 +392,6 @@ void fsfile_flush(fsfile fsf, boolean datasync, status_handler completion)
         apply(completion, timm("result", "failed to allocate closure"));
         return;
     }
-    if (datasync)
-        fsf->status &= ~FSF_DIRTY_DATASYNC;
-    else
-        fsf->status &= ~FSF_DIRTY;
     pagecache_sync_node(fsf->cache_node, sh);
 }
 
@@ -385,6 +440,7 @@ static fs_status fs_create_dir_entry(filesystem fs, tuple parent, string name, t
         return FS_STATUS_READONLY;
     fs_status s = fs->create(fs, parent, name, md, f);
     if (s == FS_STATUS_OK) {
+        fs_dcache_invalidate(fs, parent, buffer_to_sstring(name));
         symbol name_sym = intern(name);
         set(children(parent), name_sym, md);
         set(md, sym_this(".."), parent);
@@ -590,6 +646,7 @@ fs_status filesystem_delete(filesystem fs, inode cwd, sstring path, boolean dire
     boolean destruct_md;
     fss = fs->unlink(fs, parent, name, t, &destruct_md);
     if (fss == FS_STATUS_OK) {
+        fs_dcache_invalidate(fs, parent, buffer_to_sstring(name));
         symbol name_sym = intern(name);
         set(children(parent), name_sym, 0);
         fs_notify_delete(t, parent, name_sym);
@@ -673,6 +730,8 @@ fs_status filesystem_rename(filesystem oldfs, inode oldwd, sstring oldpath,
     boolean destruct_md;
     s = oldfs->rename(oldfs, oldparent, oldname, old, newparent, newname, new, false, &destruct_md);
     if (s == FS_STATUS_OK) {
+        fs_dcache_invalidate(oldfs, oldparent, buffer_to_sstring(oldname));
+        fs_dcache_invalidate(oldfs, newparent, buffer_to_sstring(newname));
         set(children(oldparent), old_s, 0);
         set(children(newparent), new_s, old);
         set(old, sym_this(".."), newparent);
@@ -746,6 +805,8 @@ fs_status filesystem_exchange(filesystem fs1, inode wd1, sstring path1,
     string name2 = alloca_wrap_sstring(filename_from_path(path2));
     s = fs1->rename(fs1, parent1, name1, n1, parent2, name2, n2, true, 0);
     if (s == FS_STATUS_OK) {
+        fs_dcache_invalidate(fs1, parent1, buffer_to_sstring(name1));
+        fs_dcache_invalidate(fs1, parent2, buffer_to_sstring(name2));
         set(children(parent1), intern(name1), n2);
         set(n2, sym_this(".."), parent1);
         set(children(parent2), intern(name2), n1);
@@ -764,6 +825,196 @@ fs_status filesystem_exchange(filesystem fs1, inode wd1, sstring path1,
 
 #endif /* !FS_READ_ONLY */
 
+#ifdef KERNEL
+
+/* Lock-free lookups (see filesystem_get_node_lockless()) walk the directory entry cache without
+ * looking at filesystem metadata, and detect concurrent changes via the sequence count, which is
+ * odd while the filesystem is locked. Only the node found by a lookup is then accessed: this is
+ * done with the lookup counted in 'lockless_readers', which taking the lock waits to drain. */
+void filesystem_lock(filesystem fs)
+{
+    mutex_lock(&fs->lock);
+    fs->seq++;
+    memory_barrier();
+    while (fs->lockless_readers)
+        kern_pause();
+}
+
+void filesystem_unlock(filesystem fs)
+{
+    memory_barrier();
+    fs->seq++;
+    mutex_unlock(&fs->lock);
+}
+
+/* Directory entry cache: maps (parent directory, name) pairs to child nodes. Entries are inserted
+ * and invalidated with the filesystem locked, and are looked up by lock-free path resolution; when
+ * the cache is full, the oldest entries are evicted. Entries are published only once initialized,
+ * and are freed when no lock-free lookup can be walking through them anymore. */
+#define FS_DCACHE_BUCKETS_ORDER 10
+#define FS_DCACHE_MAX_ENTRIES   4096
+
+/* child node attributes, so that lock-free lookups don't need to access the node */
+#define FS_DENTRY_DIR       U64_FROM_BIT(0)
+#define FS_DENTRY_SYMLINK   U64_FROM_BIT(1)
+#define FS_DENTRY_MOUNT     U64_FROM_BIT(2)
+
+typedef struct fs_dentry {
+    struct fs_dentry *next; /* hash bucket chain */
+    struct list l;          /* insertion order */
+    tuple parent;
+    symbol name;
+    tuple child;
+    u64 flags;
+    heap h;
+    struct epoch_retired retired;
+    closure_struct(thunk, free);
+} *fs_dentry;
+
+struct fs_dcache {
+    fs_dentry buckets[U64_FROM_BIT(FS_DCACHE_BUCKETS_ORDER)];
+    struct list entries;
+    u64 count;
+};
+
+static u64 fs_dcache_hash(tuple parent, sstring name)
+{
+    u64 hash = 0xcbf29ce484222325 ^ u64_from_pointer(parent);
+    for (bytes i = 0; i < name.len; i++) {
+        hash ^= (u8)name.ptr[i];
+        hash *= 1099511628211;
+    }
+    return hash & MASK(FS_DCACHE_BUCKETS_ORDER);
+}
+
+/* Returns the link pointing to the matching entry, or to the null terminator of the bucket chain
+ * if no entry matches. */
+static fs_dentry *fs_dcache_find(struct fs_dcache *dc, tuple parent, sstring name)
+{
+    fs_dentry *link = &dc->buckets[fs_dcache_hash(parent, name)];
+    fs_dentry e;
+    while ((e = *link)) {
+        if ((e->parent == parent) && !buffer_compare_with_sstring(symbol_string(e->name), name))
+            break;
+        link = &e->next;
+    }
+    return link;
+}
+
+closure_func_basic(thunk, void, fs_dentry_free)
+{
+    fs_dentry e = struct_from_field(closure_self(), fs_dentry, free);
+    deallocate(e->h, e, sizeof(*e));
+}
+
+static void fs_dcache_remove(struct fs_dcache *dc, fs_dentry *link)
+{
+    fs_dentry e = *link;
+    *link = e->next;
+    list_delete(&e->l);
+    dc->count--;
+    /* a lock-free lookup may still be walking through this entry */
+    epoch_retire(&e->retired, init_closure_func(&e->free, thunk, fs_dentry_free));
+}
+
+static u64 fs_dentry_flags(tuple child)
+{
+    u64 flags = 0;
+    if (children(child))
+        flags |= FS_DENTRY_DIR;
+    if (is_symlink(child))
+        flags |= FS_DENTRY_SYMLINK;
+    if (get(child, sym(mount)))
+        flags |= FS_DENTRY_MOUNT;
+    return flags;
+}
+
+boolean fs_dcache_init(filesystem fs)
+{
+    struct fs_dcache *dc = allocate_zero(fs->h, sizeof(*dc));
+    if (dc == INVALID_ADDRESS)
+        return false;
+    list_init(&dc->entries);
+    fs->dcache = dc;
+    return true;
+}
+
+static void fs_dcache_destroy(filesystem fs)
+{
+    struct fs_dcache *dc = fs->dcache;
+    list_foreach(&dc->entries, l)
+        deallocate(fs->h, struct_from_list(l, fs_dentry, l), sizeof(struct fs_dentry));
+    deallocate(fs->h, dc, sizeof(*dc));
+    fs->dcache = 0;
+}
+
+/* Called with fs locked. */
+static void fs_dcache_insert(filesystem fs, tuple parent, string name, tuple child)
+{
+    struct fs_dcache *dc = fs->dcache;
+    if (!dc || !buffer_strcmp(name, ".") || !buffer_strcmp(name, ".."))
+        return;
+    sstring name_ss = buffer_to_sstring(name);
+    fs_dentry *link = fs_dcache_find(dc, parent, name_ss);
+    fs_dentry e = *link;
+    u64 flags = fs_dentry_flags(child);
+    if (e && (e->child == child) && (e->flags == flags))
+        return;
+    if (e) {
+        fs_dcache_remove(dc, link);
+    } else if (dc->count >= FS_DCACHE_MAX_ENTRIES) {
+        e = struct_from_list(list_begin(&dc->entries), fs_dentry, l);
+        fs_dcache_remove(dc, fs_dcache_find(dc, e->parent,
+                                            buffer_to_sstring(symbol_string(e->name))));
+
+        /* the bucket chain may have changed */
+        link = fs_dcache_find(dc, parent, name_ss);
+    }
+    e = allocate(fs->h, sizeof(*e));
+    if (e == INVALID_ADDRESS)
+        return;
+    e->parent = parent;
+    e->name = intern(name);
+    e->child = child;
+    e->flags = flags;
+    e->h = fs->h;
+    e->next = *link;
+    write_barrier();
+    *link = e;
+    list_push_back(&dc->entries, &e->l);
+    dc->count++;
+}
+
+/* Called with fs locked, when a directory entry is created, removed or replaced. */
+void fs_dcache_invalidate(filesystem fs, tuple parent, sstring name)
+{
+    struct fs_dcache *dc = fs->dcache;
+    if (!dc)
+        return;
+    fs_dentry *link = fs_dcache_find(dc, parent, name);
+    if (*link)
+        fs_dcache_remove(dc, link);
+}
+
+/* Called with fs locked, when the cached attributes of any node may have changed. */
+static void fs_dcache_flush(filesystem fs)
+{
+    struct fs_dcache *dc = fs->dcache;
+    if (!dc)
+        return;
+    list_foreach(&dc->entries, l) {
+        fs_dentry e = struct_from_list(l, fs_dentry, l);
+        fs_dcache_remove(dc, fs_dcache_find(dc, e->parent,
+                                            buffer_to_sstring(symbol_string(e->name))));
+    }
+}
+
+#else
+
+#define fs_dcache_insert(fs, parent, name, child)
+
+#endif
+
 fs_status fsfile_init(filesystem fs, fsfile f, tuple md, sg_io fs_read, sg_io fs_write,
                       pagecache_node_reserve fs_reserve, thunk fs_free)
 {
@@ -776,6 +1027,8 @@ fs_status fsfile_init(filesystem fs, fsfile f, tuple md, sg_io fs_read, sg_io fs
     f->cache_node = pn;
     f->read = pagecache_node_get_reader(pn);
     f->write = pagecache_node_get_writer(pn);
+    f->direct_read = fs_read;
+    f->direct_write = fs_write;
     init_refcount(&f->refcount, 1, fs_free);
     f->status = 0;
     return FS_STATUS_OK;
@@ -796,6 +1049,11 @@ status filesystem_init(filesystem fs, heap h, u64 size, u64 blocksize, boolean r
     init_refcount(&fs->refcount, 1, init_closure_func(&fs->sync, thunk, fs_sync));
     fs->sync_complete = 0;
     filesystem_lock_init(fs);
+#endif
+#ifdef KERNEL
+    fs->seq = 0;
+    fs->lockless_readers = 0;
+    fs->dcache = 0;
 #endif
     fs->ro = ro;
     return STATUS_OK;
@@ -803,6 +1061,10 @@ status filesystem_init(filesystem fs, heap h, u64 size, u64 blocksize, boolean r
 
 void filesystem_deinit(filesystem fs)
 {
+#ifdef KERNEL
+    if (fs->dcache)
+        fs_dcache_destroy(fs);
+#endif
     pagecache_dealloc_volume(fs->pv);
 }
 
@@ -890,6 +1152,7 @@ static tuple lookup_follow(filesystem *fs, tuple t, string a, tuple *p)
     t = (*fs)->lookup(*fs, t, a);
     if (!t)
         return t;
+    fs_dcache_insert(*fs, *p, a, t);
     if (fs_path_helper.get_mountpoint) {
         tuple m = get_tuple(t, sym(mount));
         if (m) {
@@ -1075,6 +1338,92 @@ int filesystem_follow_links(filesystem *fs, tuple link, tuple parent,
 
 #ifdef KERNEL
 
+/* Resolves a path without locking the filesystem, by looking up each path component in the
+ * directory entry cache (filesystems that enable the cache use node addresses as inode numbers).
+ * Returns 0 (and the caller is expected to fall back to filesystem_get_node()) if the filesystem is
+ * or has been locked meanwhile, if a path component is not cached, or if the path contains "..",
+ * mount points or symbolic links to be followed.
+ * On success, the returned node (and the fsfile, if requested and if the node is a regular file)
+ * can be accessed until filesystem_put_node_lockless() is called, and the calling context must not
+ * block in the meantime. The filesystem returned via the 'fs' pointer (which differs from the
+ * original filesystem only for absolute paths, which are resolved in the root filesystem) is not
+ * reserved. */
+tuple filesystem_get_node_lockless(filesystem *fs, inode cwd, sstring path, boolean nofollow,
+                                   fsfile *f, u64 *irqflags)
+{
+    if (sstring_is_empty(path))
+        return 0;
+    boolean absolute = (path.ptr[0] == '/');
+    filesystem node_fs = absolute ? fs_path_helper.get_root_fs() : *fs;
+    struct fs_dcache *dc = node_fs->dcache;
+    if (!dc)
+        return 0;
+    u64 flags = epoch_enter();
+    word seq = node_fs->seq;
+    if (seq & 1)
+        goto fail;
+    read_barrier();
+    tuple start = absolute ? filesystem_getroot(node_fs) : pointer_from_u64(cwd);
+    tuple t = start;
+    u64 t_flags = FS_DENTRY_DIR;
+    while (true) {
+        while (!sstring_is_empty(path) && (path.ptr[0] == '/')) {
+            path.ptr++;
+            path.len--;
+        }
+        if (sstring_is_empty(path))
+            break;
+        sstring name = path;
+        char *delim = runtime_memchr(path.ptr, '/', path.len);
+        if (delim)
+            name.len = delim - path.ptr;
+        path.ptr += name.len;
+        path.len -= name.len;
+        if ((name.len > NAME_MAX) || !(t_flags & FS_DENTRY_DIR))
+            goto fail;
+        if (!runtime_strcmp(name, ss(".")))
+            continue;
+        if (!runtime_strcmp(name, ss("..")))
+            goto fail;
+        fs_dentry e = *fs_dcache_find(dc, t, name);
+        if (!e)
+            goto fail;
+        t = e->child;
+        t_flags = e->flags;
+        if ((t_flags & FS_DENTRY_MOUNT) ||
+            ((t_flags & FS_DENTRY_SYMLINK) && (delim || !nofollow)) ||
+            (delim && !(t_flags & FS_DENTRY_DIR)))
+            goto fail;
+    }
+
+    /* From here on, the filesystem can't be changed until the node is released. */
+    fetch_and_add(&node_fs->lockless_readers, 1);
+    memory_barrier();
+    if (node_fs->seq != seq)
+        goto fail_release;
+    if (!absolute && (node_fs->get_meta(node_fs, cwd) != start))
+        goto fail_release;
+    if (f) {
+        *f = 0;
+        if (is_regular(t) && (node_fs->get_fsfile(node_fs, t, f) != FS_STATUS_OK))
+            goto fail_release;
+    }
+    *fs = node_fs;
+    *irqflags = flags;
+    return t;
+  fail_release:
+    fetch_and_add(&node_fs->lockless_readers, -1);
+  fail:
+    epoch_exit(flags);
+    return 0;
+}
+
+void filesystem_put_node_lockless(filesystem fs, tuple n, u64 irqflags)
+{
+    fetch_and_add(&fs->lockless_readers, -1);
+    epoch_exit(irqflags);
+}
+
 fs_status filesystem_mk_socket(filesystem *fs, inode cwd, sstring path, void *s, inode *n)
 {
     tuple cwd_t = filesystem_get_meta(*fs, cwd);
@@ -1191,6 +1540,7 @@ fs_status filesystem_mount(filesystem parent, inode mount_dir, filesystem child)
     set(mount, sym(fs), b);
     set(mount, sym(no_encode), null_value); /* non-persistent entry */
     set(mount_dir_t, sym(mount), mount);
+    fs_dcache_flush(parent);
     fss = FS_STATUS_OK;
   out:
     filesystem_unlock(parent);
@@ -1205,6 +1555,7 @@ void filesystem_unmount(filesystem parent, inode mount_dir, filesystem child, th
         tuple mount = get_tuple(mount_dir_t, sym(mount));
         set(mount_dir_t, sym(mount), 0);
         destruct_value(mount, true);
+        fs_dcache_flush(parent);
     }
     child->sync_complete = complete;
     filesystem_unlock(parent);
@@ -17,6 +17,10 @@ void filesystem_read_sg(fsfile f, sg_list sg, range q, status_handler completion
 
 void filesystem_write_sg(fsfile f, sg_list sg, range q, status_handler completion);
 
+/* uncached I/O, kept coherent with the page cache */
+void filesystem_read_direct(fsfile f, sg_list sg, range q, status_handler completion);
+void filesystem_write_direct(fsfile f, sg_list sg, range q, status_handler completion);
+
 /* deprecate these if we can */
 void filesystem_read_linear(fsfile f, void *dest, range q, io_status_handler completion);
 void filesystem_write_linear(fsfile f, void *src, range q, io_status_handler completion);
@@ -103,6 +107,9 @@ struct filesystem {
     tuple root;
 #ifdef KERNEL
     struct mutex lock;
+    word seq;                   /* incremented when locking and unlocking */
+    word lockless_readers;      /* lock-free lookups accessing a node */
+    struct fs_dcache *dcache;   /* directory entry cache, if enabled by the filesystem */
 #endif
     struct refcount refcount;
     closure_struct(thunk, sync);
@@ -117,6 +124,8 @@ struct fsfile {
     tuple md;
     sg_io read;
     sg_io write;
+    sg_io direct_read;
+    sg_io direct_write;
     s64 (*get_blocks)(fsfile f);
     struct refcount refcount;
     closure_struct(status_handler, sync_complete);
@@ -144,8 +153,15 @@ static inline u64 sector_from_offset(filesystem fs, bytes b)
 #ifdef KERNEL
 
 #define filesystem_lock_init(fs)    mutex_init(&(fs)->lock, 0)
-#define filesystem_lock(fs)         mutex_lock(&(fs)->lock)
-#define filesystem_unlock(fs)       mutex_unlock(&(fs)->lock)
+void filesystem_lock(filesystem fs);
+void filesystem_unlock(filesystem fs);
+
+boolean fs_dcache_init(filesystem fs);
+void fs_dcache_invalidate(filesystem fs, tuple parent, sstring name);
+
+tuple filesystem_get_node_lockless(filesystem *fs, inode cwd, sstring path, boolean nofollow,
+                                   fsfile *f, u64 *irqflags);
+void filesystem_put_node_lockless(filesystem fs, tuple n, u64 irqflags);
 
 #else
 
@@ -153,6 +169,8 @@ static inline u64 sector_from_offset(filesystem fs, bytes b)
 #define filesystem_lock(fs)         ((void)fs)
 #define filesystem_unlock(fs)       ((void)fs)
 
+#define fs_dcache_invalidate(fs, parent, name)
+
 #endif
 
 tuple fs_new_entry(filesystem fs);
@@ -83,52 +83,205 @@ static inline extent allocate_extent(heap h, range file_blocks, range storage_bl
     return e;
 }
 
-closure_function(2, 1, boolean, tfs_storage_alloc,
-                 u64, nblocks, u64 *, start_block,
-                 range r)
+/* Free storage space index
+
+   Free storage extents are indexed both by start block (in a rangemap, used to find the extent
+   containing or following a given block and to coalesce adjacent extents when storage is freed)
+   and by length and start block (in an rbtree, used to find the smallest extent that can satisfy
+   an allocation). Allocations first try to place new storage at a goal block, i.e. right after
+   the storage of the preceding file extent or, if there is no such extent, right after the last
+   allocation made from the current CPU, so that files written concurrently from different CPUs do
+   not interleave; if there is no free space at (or shortly after) the goal, the best-fitting free
+   extent is used. All operations take O(log n) time in the number of free extents. */
+
+typedef struct tfs_free_extent {
+    struct rmnode node;         /* must be first */
+    struct rbnode size_node;
+} *tfs_free_extent;
+
+/* Number of free extents following the goal block that are examined before resorting to a
+ * best-fit allocation */
+#define TFS_ALLOC_GOAL_SCAN 4
+
+#ifdef KERNEL
+#define tfs_alloc_cursor_count()    total_processors
+#define tfs_alloc_cursor_id()       current_cpu()->id
+#else
+#define tfs_alloc_cursor_count()    1
+#define tfs_alloc_cursor_id()       0
+#endif
+
+#define tfs_free_extent_from_size_node(n)   struct_from_field(n, tfs_free_extent, size_node)
+
+#ifndef TFS_READ_ONLY
+closure_func_basic(rb_key_compare, int, tfs_free_size_compare,
+                   rbnode a, rbnode b)
 {
-    if (range_span(r) >= bound(nblocks)) {
-        *bound(start_block) = r.start;
+    range ra = tfs_free_extent_from_size_node(a)->node.r;
+    range rb = tfs_free_extent_from_size_node(b)->node.r;
+    u64 la = range_span(ra), lb = range_span(rb);
+    if (la != lb)
+        return la < lb ? -1 : 1;
+    return ra.start == rb.start ? 0 : (ra.start < rb.start ? -1 : 1);
+}
+#endif
+
+static boolean tfs_free_insert(tfs fs, range r)
+{
+    tfs_free_extent fe = allocate(fs->fs.h, sizeof(*fe));
+    if (fe == INVALID_ADDRESS)
         return false;
+    rmnode_init(&fe->node, r);
+    assert(rangemap_insert(fs->free_space, &fe->node));
+    init_rbnode(&fe->size_node);
+    assert(rbtree_insert_node(&fs->free_by_size, &fe->size_node));
+    return true;
+}
+
+static void tfs_free_remove(tfs fs, tfs_free_extent fe)
+{
+    rbtree_remove_node(&fs->free_by_size, &fe->size_node);
+    rangemap_remove_node(fs->free_space, &fe->node);
+    deallocate(fs->fs.h, fe, sizeof(*fe));
+}
+
+/* The new range must not change the position of the extent relative to the other free extents. */
+static void tfs_free_update(tfs fs, tfs_free_extent fe, range r)
+{
+    rbtree_remove_node(&fs->free_by_size, &fe->size_node);
+    fe->node.r = r;
+    init_rbnode(&fe->size_node);
+    assert(rbtree_insert_node(&fs->free_by_size, &fe->size_node));
+}
+
+/* Removes the given blocks, which must be contained in the given free extent, from the free
+ * space index. */
+static boolean tfs_free_carve(tfs fs, tfs_free_extent fe, range r)
+{
+    range left = irange(fe->node.r.start, r.start);
+    range right = irange(r.end, fe->node.r.end);
+    if (range_span(left)) {
+        range old = fe->node.r;
+        tfs_free_update(fs, fe, left);
+        if (range_span(right) && !tfs_free_insert(fs, right)) {
+            tfs_free_update(fs, fe, old);
+            return false;
+        }
+    } else if (range_span(right)) {
+        tfs_free_update(fs, fe, right);
+    } else {
+        tfs_free_remove(fs, fe);
     }
+    fs->free_blocks -= range_span(r);
     return true;
 }
 
-u64 filesystem_allocate_storage(tfs fs, u64 nblocks)
+/* Returns the smallest free extent with at least nblocks blocks. */
+static tfs_free_extent tfs_free_best_fit(tfs fs, u64 nblocks)
 {
-    if (fs->storage) {
+    struct tfs_free_extent k;
+    k.node.r = irange(infinity - (nblocks - 1), infinity);    /* length nblocks - 1 */
+    rbnode n = rbtree_lookup_max_lte(&fs->free_by_size, &k.size_node);
+    n = (n == INVALID_ADDRESS) ? rbtree_find_first(&fs->free_by_size) : rbnode_get_next(n);
+    return (n == INVALID_ADDRESS) ? INVALID_ADDRESS : tfs_free_extent_from_size_node(n);
+}
+
+/* Called with the storage lock held. */
+static u64 tfs_free_alloc(tfs fs, u64 nblocks, u64 goal)
+{
+    tfs_free_extent fe;
+    u64 start_block;
+    if (goal != INVALID_PHYSICAL) {
+        fe = (tfs_free_extent)rangemap_lookup_max_lte(fs->free_space, goal);
+        if ((fe != INVALID_ADDRESS) && (fe->node.r.end >= goal + nblocks)) {
+            start_block = goal;
+            goto found;
+        }
+        fe = (tfs_free_extent)rangemap_lookup_at_or_next(fs->free_space, goal);
+        for (int i = 0; (fe != INVALID_ADDRESS) && (i < TFS_ALLOC_GOAL_SCAN); i++) {
+            if (range_span(fe->node.r) >= nblocks) {
+                start_block = fe->node.r.start;
+                goto found;
+            }
+            fe = (tfs_free_extent)rangemap_next_node(fs->free_space, &fe->node);
+        }
+    }
+    fe = tfs_free_best_fit(fs, nblocks);
+    if (fe == INVALID_ADDRESS)
+        return INVALID_PHYSICAL;
+    start_block = fe->node.r.start;
+  found:
+    if (!tfs_free_carve(fs, fe, irangel(start_block, nblocks)))
+        return INVALID_PHYSICAL;
+    return start_block;
+}
+
+/* Allocates nblocks contiguous storage blocks, preferably starting at the goal block (which can be
+ * INVALID_PHYSICAL if the caller has no preference). */
+u64 filesystem_allocate_storage(tfs fs, u64 nblocks, u64 goal)
+{
+    if (fs->free_space && nblocks) {
         tfs_storage_lock(fs);
-        u64 start_block;
-        int result = rangemap_range_find_gaps(fs->storage,
-                                              irange(0, fs->fs.size >> fs->fs.blocksize_order),
-                                              stack_closure(tfs_storage_alloc,
-                                                            nblocks, &start_block));
-        boolean success = (result == RM_ABORT) &&
-                          rangemap_insert_range(fs->storage, irangel(start_block, nblocks));
+        u64 *cursor = &fs->alloc_cursors[tfs_alloc_cursor_id()];
+        if (goal == INVALID_PHYSICAL)
+            goal = *cursor;
+        u64 start_block = tfs_free_alloc(fs, nblocks, goal);
+        if (start_block != INVALID_PHYSICAL)
+            *cursor = start_block + nblocks;
         tfs_storage_unlock(fs);
-        if (success)
-            return start_block;
+        return start_block;
     }
     return INVALID_PHYSICAL;
 }
 
 boolean filesystem_reserve_storage(tfs fs, range blocks)
 {
-    if (fs->storage) {
+    if (fs->free_space) {
         tfs_storage_lock(fs);
-        boolean success = !rangemap_range_intersects(fs->storage, blocks) &&
-                          rangemap_insert_range(fs->storage, blocks);
+        tfs_free_extent fe = (tfs_free_extent)rangemap_lookup(fs->free_space, blocks.start);
+        boolean success = (fe != INVALID_ADDRESS) && (fe->node.r.end >= blocks.end) &&
+                          tfs_free_carve(fs, fe, blocks);
         tfs_storage_unlock(fs);
         return success;
     }
     return true;
 }
 
+/* Blocks that are already free are ignored. */
 boolean filesystem_free_storage(tfs fs, range blocks)
 {
-    if (fs->storage) {
+    if (fs->free_space) {
+        blocks.end = MIN(blocks.end, fs->fs.size >> fs->fs.blocksize_order);
+        if (blocks.start >= blocks.end)
+            return true;
+        boolean success = true;
         tfs_storage_lock(fs);
-        boolean success = rangemap_insert_hole(fs->storage, blocks);
+
+        /* merge with any free extents overlapping or adjacent to the freed blocks */
+        tfs_free_extent fe = (tfs_free_extent)rangemap_lookup_max_lte(fs->free_space,
+                                                                       blocks.start);
+        if ((fe == INVALID_ADDRESS) || (fe->node.r.end < blocks.start))
+            fe = (tfs_free_extent)rangemap_lookup_at_or_next(fs->free_space, blocks.start);
+        range r = blocks;
+        u64 merged = 0;
+        tfs_free_extent first = INVALID_ADDRESS;
+        while ((fe != INVALID_ADDRESS) && (fe->node.r.start <= blocks.end)) {
+            tfs_free_extent next = (tfs_free_extent)rangemap_next_node(fs->free_space,
+                                                                       &fe->node);
+            r = irange(MIN(r.start, fe->node.r.start), MAX(r.end, fe->node.r.end));
+            merged += range_span(fe->node.r);
+            if (first == INVALID_ADDRESS)
+                first = fe;
+            else
+                tfs_free_remove(fs, fe);
+            fe = next;
+        }
+        if (first != INVALID_ADDRESS)
+            tfs_free_update(fs, first, r);
+        else
+            success = tfs_free_insert(fs, r);
+        if (success)
+            fs->free_blocks += range_span(r) - merged;
         tfs_storage_unlock(fs);
         return success;
     }
@@ -385,7 +538,15 @@ static fs_status tfs_truncate(filesystem fs, fsfile f, u64 len)
 
 */
 
-static fs_status create_extent(tfs fs, range blocks, boolean uninited, extent *ex)
+/* Returns the storage block following the storage of the file extent that precedes the given file
+ * block, or INVALID_PHYSICAL if there is no such extent. */
+static u64 tfs_storage_goal(rangemap extentmap, u64 file_block)
+{
+    extent ex = (extent)rangemap_lookup_max_lte(extentmap, file_block);
+    return (ex == INVALID_ADDRESS) ? INVALID_PHYSICAL : (ex->start_block + ex->allocated);
+}
+
+static fs_status create_extent(tfs fs, range blocks, u64 goal, boolean uninited, extent *ex)
 {
     assert(!fs->fs.ro);
     heap h = fs->fs.h;
@@ -397,12 +558,12 @@ static fs_status create_extent(tfs fs, range blocks, boolean uninited, extent *e
         !filesystem_reserve_log_space(fs, &fs->next_new_log_offset, 0, 0))
         return FS_STATUS_NOSPACE;
 
-    u64 start_block = filesystem_allocate_storage(fs, nblocks);
+    u64 start_block = filesystem_allocate_storage(fs, nblocks, goal);
     while (start_block == u64_from_pointer(INVALID_ADDRESS)) {
         if (nblocks <= (MIN_EXTENT_ALLOC_SIZE >> fs->fs.blocksize_order))
             break;
         nblocks /= 2;
-        start_block = filesystem_allocate_storage(fs, nblocks);
+        start_block = filesystem_allocate_storage(fs, nblocks, goal);
     }
     if (start_block == u64_from_pointer(INVALID_ADDRESS))
         return FS_STATUS_NOSPACE;
@@ -492,12 +653,14 @@ static fs_status add_extents(tfs fs, range i, rangemap rm)
 {
     extent ex;
     fs_status fss;
+    u64 goal = tfs_storage_goal(rm, i.start);
     while (range_span(i)) {
-        fss = create_extent(fs, i, true, &ex);
+        fss = create_extent(fs, i, goal, true, &ex);
         if (fss != FS_STATUS_OK)
             return fss;
         assert(rangemap_insert(rm, &ex->node));
         i.start = ex->node.r.end;
+        goal = ex->start_block + ex->allocated;
     }
     return FS_STATUS_OK;
 }
@@ -598,7 +761,8 @@ static fs_status fill_gap(tfsfile f, sg_list sg, range blocks, merge m, u64 *edg
     tfs_debug("   %s: writing new extent blocks %R\n", func_ss, blocks);
     extent ex;
     tfs fs = tfs_from_file(f);
-    fs_status fss = create_extent(fs, blocks, m ? false : true, &ex);
+    fs_status fss = create_extent(fs, blocks, tfs_storage_goal(f->extentmap, blocks.start),
+                                  m ? false : true, &ex);
     if (fss != FS_STATUS_OK)
         return fss;
     blocks = ex->node.r;
@@ -823,8 +987,8 @@ closure_function(2, 3, void, filesystem_storage_write,
     apply(sh, s);
 }
 
-closure_function(3, 1, void, fs_cache_sync_complete,
-                 tfs, fs, status_handler, completion, boolean, flush_log,
+closure_function(5, 1, void, fs_cache_sync_complete,
+                 tfs, fs, fsfile, fsf, boolean, datasync, status_handler, completion, boolean, log_synced,
                  status s)
 {
     if (!is_ok(s)) {
@@ -836,11 +1000,23 @@ closure_function(3, 1, void, fs_cache_sync_complete,
         closure_finish();
         return;
     }
-    if (bound(flush_log)) {
-        bound(flush_log) = false;
+    if (!bound(log_synced)) {
+        bound(log_synced) = true;
         tfs fs = bound(fs);
+        fsfile fsf = bound(fsf);
         filesystem_lock(&fs->fs);
-        log_flush(fs->tl, (status_handler)closure_self());
+        /* The dirty flags are checked only now, so that metadata written while committing file
+         * data is included. A file without dirty metadata (e.g. after overwriting initialized
+         * blocks) does not need a log write of its own, but metadata staged before an earlier
+         * sync of the file cleared the flags may still be on its way to storage. */
+        u8 dirty = bound(datasync) ? FSF_DIRTY_DATASYNC : FSF_DIRTY;
+        if (!fsf || (fsf->status & dirty)) {
+            if (fsf)
+                fsf->status &= ~dirty;
+            log_flush(fs->tl, (status_handler)closure_self());
+        } else {
+            log_wait(fs->tl, (status_handler)closure_self());
+        }
         filesystem_unlock(&fs->fs);
         return;
     }
@@ -856,12 +1032,7 @@ closure_function(3, 1, void, fs_cache_sync_complete,
 static status_handler tfs_get_sync_handler(filesystem fs, fsfile fsf, boolean datasync,
                                            status_handler completion)
 {
-    boolean flush_log;
-    if (fsf)
-        flush_log = datasync ? (fsf->status & FSF_DIRTY_DATASYNC) : (fsf->status & FSF_DIRTY);
-    else
-        flush_log = true;
-    return closure(fs->h, fs_cache_sync_complete, (tfs)fs, completion, flush_log);
+    return closure(fs->h, fs_cache_sync_complete, (tfs)fs, fsf, datasync, completion, false);
 }
 
 closure_function(2, 1, void, filesystem_op_complete,
@@ -1024,6 +1195,7 @@ static fs_status do_mkentry(tfs fs, tuple parent, sstring name, tuple entry,
     }
 
     if (s == FS_STATUS_OK) {
+        fs_dcache_invalidate(&fs->fs, parent, name);
         set(c, name_sym, entry);
         table_set(fs->files, entry, INVALID_ADDRESS);
         fs_notify_create(entry, parent, name_sym);
@@ -1186,23 +1358,9 @@ static fs_status tfs_rename(filesystem fs, tuple old_parent, string old_name, tu
     return s;
 }
 
-closure_function(1, 1, boolean, tfs_storage_freeblocks,
-                 u64 *, free_blocks,
-                 range r)
-{
-    *bound(free_blocks) += range_span(r);
-    return true;
- }
-
 static u64 tfs_freeblocks(filesystem fs)
 {
-    u64 free_blocks = 0;
-    range q = irangel(0, fs->size >> fs->blocksize_order);
-    tfs tfs = (struct tfs *)fs;
-    tfs_storage_lock(tfs);
-    rangemap_range_find_gaps(tfs->storage, q, stack_closure(tfs_storage_freeblocks, &free_blocks));
-    tfs_storage_unlock(tfs);
-    return free_blocks;
+    return ((tfs)fs)->free_blocks;
 }
 
 void filesystem_log_rebuild(tfs fs, log new_tl, status_handler sh)
@@ -1343,13 +1501,13 @@ boolean filesystem_reserve_log_space(tfs fs, u64 *next_offset, u64 *offset, u64
     if (size == 0)
         size = filesystem_log_blocks(fs);
     if (*next_offset == INVALID_PHYSICAL) {
-        *next_offset = filesystem_allocate_storage(fs, size);
+        *next_offset = filesystem_allocate_storage(fs, size, INVALID_PHYSICAL);
         if (*next_offset == INVALID_PHYSICAL)
             return false;
     }
     if (offset) {
         *offset = *next_offset;
-        *next_offset = filesystem_allocate_storage(fs, size);
+        *next_offset = filesystem_allocate_storage(fs, size, INVALID_PHYSICAL);
     }
     return true;
 }
@@ -1385,6 +1543,10 @@ void create_filesystem(heap h,
     fs->fs.root = 0;
     fs->page_order = pagecache_get_page_order();
     fs->fs.lookup = fs_lookup;
+#ifdef KERNEL
+    /* a failure to allocate the cache only disables lock-free path resolution */
+    fs_dcache_init(&fs->fs);
+#endif
     fs->fs.get_fsfile = tfs_get_fsfile;
     fs->fs.get_inode = fs_get_inode;
     fs->fs.get_meta = tmpfs_get_meta;
@@ -1396,12 +1558,20 @@ void create_filesystem(heap h,
     fs->fs.get_freeblocks = tfs_freeblocks;
     fs->fs.get_sync_handler = tfs_get_sync_handler;
     fs->fs.destroy_fs = destroy_filesystem;
-    fs->storage = allocate_rangemap(h);
-    assert(fs->storage != INVALID_ADDRESS);
+    fs->free_space = allocate_rangemap(h);
+    assert(fs->free_space != INVALID_ADDRESS);
+    init_rbtree(&fs->free_by_size, init_closure_func(&fs->free_size_compare, rb_key_compare,
+                                                     tfs_free_size_compare), 0);
+    fs->free_blocks = 0;
+    fs->alloc_cursors = allocate(h, tfs_alloc_cursor_count() * sizeof(u64));
+    assert(fs->alloc_cursors != INVALID_ADDRESS);
+    for (int i = 0; i < tfs_alloc_cursor_count(); i++)
+        fs->alloc_cursors[i] = INVALID_PHYSICAL;
     spin_lock_init(&fs->storage_lock);
+    assert(filesystem_free_storage(fs, irange(0, size >> fs->fs.blocksize_order)));
     fs->temp_log = 0;
 #else
-    fs->storage = 0;
+    fs->free_space = 0;
 #endif
     if (!sstring_is_null(label)) {
         int label_len = label.len;
@@ -1430,8 +1600,8 @@ closure_function(1, 1, boolean, tfs_storage_destroy,
                  heap, h,
                  rmnode n)
 {
-    deallocate(bound(h), n, sizeof(*n));
-    return false;
+    deallocate(bound(h), n, sizeof(struct tfs_free_extent));
+    return true;
 }
 
 /* If the filesystem is not read-only, this function can only be called after flushing any pending
@@ -1450,7 +1620,8 @@ void destroy_filesystem(filesystem fs)
         destruct_dir_entry(fs->root);
     filesystem_deinit(fs);
     deallocate_table(tfs->files);
-    deallocate_rangemap(tfs->storage, stack_closure(tfs_storage_destroy, fs->h));
+    deallocate_rangemap(tfs->free_space, stack_closure(tfs_storage_destroy, fs->h));
+    deallocate(fs->h, tfs->alloc_cursors, tfs_alloc_cursor_count() * sizeof(u64));
     deallocate(fs->h, fs, sizeof(*fs));
 }
 
@@ -22,6 +22,11 @@ void create_filesystem(heap h,
                        filesystem_complete complete);
 void destroy_filesystem(filesystem fs);
 
+#ifdef KERNEL
+void filesystem_log_config(tuple root);
+void filesystem_log_stats(buffer b);
+#endif
+
 fsfile fsfile_from_node(filesystem fs, tuple n);
 tfsfile allocate_fsfile(tfs fs, tuple md);
 
@@ -13,7 +13,11 @@ typedef struct log *log;
 
 typedef struct tfs {
     struct filesystem fs;   /* must be first */
-    rangemap storage;
+    rangemap free_space;        /* free storage extents, by start block */
+    struct rbtree free_by_size; /* free storage extents, by length and start block */
+    closure_struct(rb_key_compare, free_size_compare);
+    u64 free_blocks;
+    u64 *alloc_cursors;         /* per-CPU allocation goals */
     struct spinlock storage_lock;
     int alignment_order;        /* in blocks */
     int page_order;
@@ -64,8 +68,9 @@ log log_create(heap h, tfs fs, boolean initialize, status_handler sh);
 boolean log_write(log tl, tuple t);
 boolean log_write_eav(log tl, tuple e, symbol a, value v);
 void log_flush(log tl, status_handler completion);
+void log_wait(log tl, status_handler completion);
 void log_destroy(log tl);
-u64 filesystem_allocate_storage(tfs fs, u64 nblocks);
+u64 filesystem_allocate_storage(tfs fs, u64 nblocks, u64 goal);
 boolean filesystem_reserve_storage(tfs fs, range storage_blocks);
 boolean filesystem_free_storage(tfs fs, range storage_blocks);
 void filesystem_storage_op(tfs fs, sg_list sg, range blocks, boolean write,
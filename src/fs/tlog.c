@@ -86,9 +86,12 @@ struct log {
     u64 tuple_bytes_remain;
 
     struct timer flush_timer;
-    vector flush_completions;
+    vector flush_completions;   /* waiting for the flush in progress */
+    vector batch_completions;   /* waiting for the next flush (group commit) */
     boolean dirty;
     boolean flushing;
+    boolean flush_deferred;     /* flush requested while another one was in progress */
+    boolean batch_wait;         /* coalescing window running for the next flush */
     enum {
         TLOG_STATE_INIT,
         TLOG_STATE_LINKED,
@@ -99,6 +102,35 @@ struct log {
     closure_struct(thunk, free);
 };
 
+#ifdef KERNEL
+static struct {
+    timestamp batch_window;     /* how long a sync waits for other syncs to join its flush */
+    u64 writes;                 /* log flushes issued */
+    u64 syncs;                  /* sync requests served by log flushes */
+} tlog_info;
+
+void filesystem_log_config(tuple root)
+{
+    u64 us;
+    if (get_u64(root, sym(fsync_batch_us), &us))
+        tlog_info.batch_window = MIN(microseconds(us), seconds(TFS_LOG_FLUSH_DELAY_SECONDS));
+}
+
+void filesystem_log_stats(buffer b)
+{
+    u64 writes = tlog_info.writes;
+    u64 syncs = tlog_info.syncs;
+    u64 per_write = writes ? (syncs * 100) / writes : 0;
+    bprintf(b, "tfs_log_writes %ld\n", writes);
+    bprintf(b, "tfs_log_syncs %ld\n", syncs);
+    bprintf(b, "tfs_log_syncs_per_write %ld.%02ld\n", per_write / 100, per_write % 100);
+}
+
+#define tlog_stat_inc(name, n)  fetch_and_add(&tlog_info.name, n)
+#else
+#define tlog_stat_inc(name, n)
+#endif
+
 define_closure_function(3, 3, void, log_storage_op,
                         tfs, fs, u64, start_sector, boolean, write,
                         sg_list sg, range q, status_handler sh)
@@ -206,10 +238,15 @@ static log log_new(heap h, tfs fs)
     tl->tuple_bytes_remain = 0;
     tl->dirty = false;
     tl->flushing = false;
+    tl->flush_deferred = false;
+    tl->batch_wait = false;
     init_timer(&tl->flush_timer);
     tl->flush_completions = allocate_vector(tl->h, COMPLETION_QUEUE_SIZE);
     if (tl->flush_completions == INVALID_ADDRESS)
         goto fail_dealloc_encoding_lengths;
+    tl->batch_completions = allocate_vector(tl->h, COMPLETION_QUEUE_SIZE);
+    if (tl->batch_completions == INVALID_ADDRESS)
+        goto fail_dealloc_flush_completions;
     tl->total_entries = tl->obsolete_entries = 0;
 #ifndef TLOG_READ_ONLY
     tl->extensions = allocate_rangemap(h);
@@ -228,6 +265,8 @@ static log log_new(heap h, tfs fs)
     }
     return tl;
   fail_dealloc_completions:
+    deallocate_vector(tl->batch_completions);
+  fail_dealloc_flush_completions:
     deallocate_vector(tl->flush_completions);
   fail_dealloc_encoding_lengths:
     deallocate_vector(tl->encoding_lengths);
@@ -444,18 +483,16 @@ static inline boolean log_write_internal(log tl, merge m)
     return true;
 }
 
-static void run_flush_completions(log tl, status s)
+static void run_flush_completions(vector completions, status s)
 {
-    if (tl->flush_completions) {
-        status_handler sh;
-        vector_foreach(tl->flush_completions, sh)
+    status_handler sh;
+    vector_foreach(completions, sh)
 #ifdef KERNEL
-            async_apply_status_handler(sh, s);
+        async_apply_status_handler(sh, s);
 #else
-            apply(sh, s);
+        apply(sh, s);
 #endif
-        vector_clear(tl->flush_completions);
-    }
+    vector_clear(completions);
 }
 
 closure_function(1, 1, void, log_flush_complete,
@@ -463,12 +500,19 @@ closure_function(1, 1, void, log_flush_complete,
                  status s)
 {
     /* would need to move these to runqueue if a flush is ever invoked from a tfs op */
-    tlog_lock(bound(tl));
-    bound(tl)->dirty = false;
-    run_flush_completions(bound(tl), s);
-    bound(tl)->flushing = false;
-    tlog_unlock(bound(tl));
-    refcount_release(&bound(tl)->refcount);
+    log tl = bound(tl);
+    tlog_lock(tl);
+    run_flush_completions(tl->flush_completions, s);
+    tl->flushing = false;
+
+    /* Syncs that arrived while this flush was in progress have already waited for a log write,
+     * so their batch is issued right away. */
+    if ((vector_length(tl->batch_completions) > 0) || tl->flush_deferred) {
+        tl->flush_deferred = false;
+        log_flush(tl, 0);
+    }
+    tlog_unlock(tl);
+    refcount_release(&tl->refcount);
     closure_finish();
 }
 
@@ -505,7 +549,8 @@ closure_function(2, 1, void, log_switch_complete,
             msg_err("failed to mark to_be_destroyed log at %R as free", ext->r);
     }
 
-    run_flush_completions(old_tl, s);
+    run_flush_completions(old_tl->flush_completions, s);
+    run_flush_completions(old_tl->batch_completions, s);
     filesystem_unlock(&fs->fs);
 
     refcount_release(&to_be_destroyed->refcount);
@@ -513,26 +558,70 @@ closure_function(2, 1, void, log_switch_complete,
     closure_finish();
 }
 
+#ifdef KERNEL
+closure_function(1, 2, void, log_flush_timer_expired,
+                 log, tl,
+                 u64 expiry, u64 overruns)
+{
+    if (overruns != timer_disabled) {
+        tlog_lock(bound(tl));
+        log_flush(bound(tl), 0);
+        tlog_unlock(bound(tl));
+    }
+    closure_finish();
+}
+#endif
+
+static void log_sync_complete(status_handler completion)
+{
+#ifdef KERNEL
+    async_apply_status_handler(completion, STATUS_OK);
+#else
+    apply(completion, STATUS_OK);
+#endif
+}
+
+/* Syncs are batched: a completion joins the flush that will write everything staged so far,
+ * which is the next flush if one is already in progress. With a non-zero batch window, an idle
+ * log waits for that long before issuing a flush for a sync, so that concurrent syncs can join
+ * it. */
 void log_flush(log tl, status_handler completion)
 {
     tlog_debug("%s: log %p, completion %p, dirty %d\n", func_ss, tl, completion, tl->dirty);
     if (!tl->dirty && (tl->state != TLOG_STATE_COMPACTING)) {
         if (completion)
-#ifdef KERNEL
-            async_apply_status_handler(completion, STATUS_OK);
-#else
-            apply(completion, STATUS_OK);
-#endif
+            log_wait(tl, completion);
         return;
     }
-    if (completion)
-        vector_push(tl->flush_completions, completion);
-    if (tl->flushing || (tl->state == TLOG_STATE_COMPACTING))
+    if (completion) {
+        vector_push(tl->batch_completions, completion);
+        tlog_stat_inc(syncs, 1);
+    }
+    if (tl->flushing || (tl->state == TLOG_STATE_COMPACTING)) {
+        if (!completion)
+            tl->flush_deferred = true;
         return;
+    }
 #ifdef KERNEL
+    if (completion && (tlog_info.batch_window != 0)) {
+        if (!tl->batch_wait) {
+            tl->batch_wait = true;
+            remove_timer(kernel_timers, &tl->flush_timer, 0);
+            register_timer(kernel_timers, &tl->flush_timer, CLOCK_ID_MONOTONIC_RAW,
+                           tlog_info.batch_window, false, 0,
+                           closure(tl->h, log_flush_timer_expired, tl));
+        }
+        return;
+    }
     remove_timer(kernel_timers, &tl->flush_timer, 0);
 #endif
+    tl->batch_wait = false;
+    tl->dirty = false;  /* anything staged from now on goes into the next flush */
     tl->flushing = true;
+    vector v = tl->flush_completions;
+    tl->flush_completions = tl->batch_completions;
+    tl->batch_completions = v;
+    tlog_stat_inc(writes, 1);
     refcount_reserve(&tl->refcount);
     merge m = allocate_merge(tl->h, closure(tl->h, log_flush_complete, tl));
     status_handler sh = apply_merge(m);
@@ -584,19 +673,26 @@ void log_flush(log tl, status_handler completion)
     }
 }
 
-#ifdef KERNEL
-closure_function(1, 2, void, log_flush_timer_expired,
-                 log, tl,
-                 u64 expiry, u64 overruns)
+/* Waits for log writes that are in progress or already requested by other syncs, without
+ * requesting a new one: metadata staged before an earlier sync started is covered by them. */
+void log_wait(log tl, status_handler completion)
 {
-    if (overruns != timer_disabled) {
-        tlog_lock(bound(tl));
-        log_flush(bound(tl), 0);
-        tlog_unlock(bound(tl));
+    vector v;
+    if ((vector_length(tl->batch_completions) > 0) || (tl->state == TLOG_STATE_COMPACTING))
+        v = tl->batch_completions;
+    else if (tl->flushing)
+        v = tl->flush_completions;
+    else
+        v = 0;
+    if (v) {
+        vector_push(v, completion);
+        tlog_stat_inc(syncs, 1);
+    } else {
+        log_sync_complete(completion);
     }
-    closure_finish();
 }
 
+#ifdef KERNEL
 static void log_set_dirty(log tl)
 {
     if (tl->dirty) {
@@ -937,6 +1033,7 @@ void log_destroy(log tl)
     remove_timer(kernel_timers, &tl->flush_timer, 0);
 #endif
     deallocate_vector(tl->flush_completions);
+    deallocate_vector(tl->batch_completions);
 #ifndef TLOG_READ_ONLY
     deallocate_rangemap(tl->extensions, stack_closure(log_dealloc_ext_node,
         tl));
@@ -0,0 +1,116 @@
+#include <kernel.h>
+
+/* Epoch-based reclamation for read-mostly data structures
+
+   Readers bracket lookups with epoch_enter() / epoch_exit(), which publish
+   the current global epoch in the per-cpu data for the duration of the
+   (short, non-blocking, interrupts disabled) read-side section. Writers
+   update structures under their own locks and then either:
+
+   - call epoch_synchronize() to wait until every reader that could have
+     observed the previous state has left its read-side section, or
+   - call epoch_retire() to have a thunk invoked once that is the case,
+     typically to free memory that was unpublished.
+
+   Retiring advances the global epoch; an object retired at epoch E can be
+   reclaimed once no cpu is inside a read-side section entered before E.
+*/
+
+//#define EPOCH_DEBUG
+#ifdef EPOCH_DEBUG
+#define epoch_debug(x, ...) do {rprintf("EPOCH: " x, ##__VA_ARGS__);} while(0)
+#else
+#define epoch_debug(x, ...)
+#endif
+
+volatile word epoch_global = 1;
+
+static struct spinlock epoch_lock;
+static struct list epoch_retired_list;
+static u64 epoch_retired_count;
+
+/* Returns the oldest epoch currently observed by a reader, or infinity if
+   no reader is active. */
+static word epoch_min_active(void)
+{
+    word min = infinity;
+    for (int i = 0; i < total_processors; i++) {
+        word e = *(volatile word *)&cpuinfo_from_id(i)->epoch;
+        if (e && e < min)
+            min = e;
+    }
+    return min;
+}
+
+void epoch_synchronize(void)
+{
+    word target = fetch_and_add((word *)&epoch_global, 1) + 1;
+    memory_barrier();
+    cpuinfo self = current_cpu();
+    for (int i = 0; i < total_processors; i++) {
+        cpuinfo ci = cpuinfo_from_id(i);
+        if (ci == self)
+            continue;
+        while (1) {
+            word e = *(volatile word *)&ci->epoch;
+            if (!e || e >= target)
+                break;
+            kern_pause();
+        }
+    }
+}
+
+/* Invoke the reclaim thunks of retired objects whose grace period has
+   elapsed; returns the number of objects reclaimed. */
+u64 epoch_reclaim(void)
+{
+    struct list reclaimed;
+    list_init(&reclaimed);
+    u64 flags = spin_lock_irq(&epoch_lock);
+    word min = epoch_min_active();
+    list_foreach(&epoch_retired_list, l) {
+        epoch_retired r = struct_from_list(l, epoch_retired, l);
+        if (r->epoch > min)
+            break;  /* list is in epoch order */
+        list_delete(l);
+        list_push_back(&reclaimed, l);
+        epoch_retired_count--;
+    }
+    spin_unlock_irq(&epoch_lock, flags);
+    u64 count = 0;
+    list_foreach(&reclaimed, l) {
+        epoch_retired r = struct_from_list(l, epoch_retired, l);
+        list_delete(l);
+        apply(r->reclaim);
+        count++;
+    }
+    epoch_debug("%s: reclaimed %ld, %ld pending\n", func_ss, count, epoch_retired_count);
+    return count;
+}
+
+void epoch_retire(epoch_retired r, thunk reclaim)
+{
+    r->reclaim = reclaim;
+    u64 flags = spin_lock_irq(&epoch_lock);
+    r->epoch = fetch_and_add((word *)&epoch_global, 1) + 1;
+    list_push_back(&epoch_retired_list, &r->l);
+    epoch_retired_count++;
+    spin_unlock_irq(&epoch_lock, flags);
+    epoch_reclaim();
+}
+
+closure_func_basic(mem_cleaner, u64, epoch_mem_cleaner,
+                   u64 clean_bytes)
+{
+    epoch_reclaim();
+    return 0;
+}
+
+void init_epoch(heap h)
+{
+    spin_lock_init(&epoch_lock);
+    list_init(&epoch_retired_list);
+    mem_cleaner cleaner = closure_func(h, mem_cleaner, epoch_mem_cleaner);
+    assert(cleaner != INVALID_ADDRESS);
+    assert(mm_register_mem_cleaner(cleaner));
+}
@@ -1,6 +1,34 @@
 #include <kernel.h>
+#include <management.h>
+
+/* TLB shootdowns
+
+   Each page_invalidate_sync() publishes a flush entry with a new generation
+   number. Rather than interrupting every cpu, only cpus that may be holding
+   stale translations are sent an IPI: a cpu parked in kernel_sleep() is
+   marked as lazy, and catches up with all pending generations on its way
+   out of idle (page_invalidate_idle_exit()) before touching any mapping.
+
+   Each entry carries a bitmap of the cpus that have yet to process it. A
+   cpu clears its own bit (and releases a reference on the entry) when it
+   processes the entry; the initiator clears the bits of lazy cpus on their
+   behalf. Whoever clears a bit releases the corresponding reference, so
+   each reference is released exactly once.
+*/
 
 #define FLUSH_THRESHOLD 32
+/* Above a ceiling number of pages, invalidating them one at a time costs
+   more than a full TLB flush. A full flush costs the flush itself plus the
+   refill of the translations it discards, taken to be FLUSH_REFILL_PAGES
+   page walks, each costing about as much as a single-page invalidation. So
+   the ceiling is FLUSH_REFILL_PAGES plus the measured cost of a full flush
+   in units of the measured cost of a single-page invalidation: it goes up
+   where full flushes are expensive, e.g. when they exit to a hypervisor. */
+#define FLUSH_REFILL_PAGES 32
+#define FLUSH_PAGE_CEILING_MAX 512
+/* costs are moving averages in fixed point, with a weight of 1/8 */
+#define FLUSH_COST_ORDER 8
+#define FLUSH_COST_WEIGHT_ORDER 3
 #define MAX_FLUSH_ENTRIES 1024
 #define COMP_QUEUE_SIZE (MAX_FLUSH_ENTRIES*2)
 #define ENTRIES_SERVICE_THRESHOLD (MAX_FLUSH_ENTRIES/2)
@@ -15,6 +43,20 @@ static volatile boolean service_scheduled;
 BSS_RO_AFTER_INIT static thunk flush_service;
 BSS_RO_AFTER_INIT static queue flush_completion_queue;
 static struct rw_spinlock flush_lock;
+BSS_RO_AFTER_INIT static u64 *flush_target_bitmaps;
+BSS_RO_AFTER_INIT static int flush_target_words;
+
+static struct {
+    u64 syncs;
+    u64 ipis_sent;
+    u64 ipis_avoided;
+    u64 page_invalidations;
+    u64 full_flushes;
+} flush_stats;
+
+/* Updated without synchronization by any cpu: these are only estimates. */
+static s64 flush_page_cost, flush_full_cost;
+static int flush_page_ceiling = FLUSH_REFILL_PAGES;
 
 static void queue_flush_service(void);
 
@@ -25,6 +67,7 @@ struct flush_entry {
     boolean flush;
     u64 pages[FLUSH_THRESHOLD];
     int npages;
+    u64 *targets;       /* cpus that have yet to process this entry */
     status_handler completion;
     closure_struct(thunk, finish);
 };
@@ -34,13 +77,33 @@ closure_func_basic(thunk, void, flush_complete)
     queue_flush_service();
 }
 
+static inline boolean flush_target_clear(flush_entry f, u64 cpu)
+{
+    return atomic_test_and_clear_bit(&f->targets[cpu >> 6], cpu & MASK(6));
+}
+
+static void flush_cost_update(s64 *cost, u64 ticks, u64 n)
+{
+    s64 sample = (ticks << FLUSH_COST_ORDER) / n;
+    s64 c = *cost;
+    *cost = c ? c + ((sample - c) >> FLUSH_COST_WEIGHT_ORDER) : sample;
+    s64 page_cost = flush_page_cost;
+    if (page_cost > 0)
+        flush_page_ceiling = MIN(FLUSH_REFILL_PAGES + flush_full_cost / page_cost,
+                                 FLUSH_PAGE_CEILING_MAX);
+}
+
 /* must be called with interrupts off */
-static void _flush_handler(void)
+static void _flush_handler(boolean full_flush)
 {
     cpuinfo ci = current_cpu();
+    int ceiling = flush_page_ceiling;
     /* Each generation has at least one page, so if the gen difference is
-     * greater than FLUSH_THRESHOLD, just do a full tlb flush */
-    boolean full_flush = inval_gen - ci->inval_gen > FLUSH_THRESHOLD;
+     * greater than the ceiling, just do a full tlb flush */
+    if (inval_gen - ci->inval_gen > ceiling)
+        full_flush = true;
+    int npages = 0;
+    u64 inval_ticks = 0;
 
     spin_rlock(&flush_lock);
     while (ci->inval_gen != inval_gen) {
@@ -53,30 +116,71 @@ static void _flush_handler(void)
             if (f->gen > ci->inval_gen)
                 break;
             if (!full_flush) {
-                if (f->flush)
+                /* switch to a full flush once the pending pages exceed the
+                   ceiling, rather than per entry */
+                if (f->flush || npages + f->npages > ceiling) {
                     full_flush = true;
-                else {
+                } else {
+                    u64 start = rdtsc();
                     for (int i = 0; i < f->npages; i++)
                         invalidate(f->pages[i]);
+                    inval_ticks += rdtsc() - start;
+                    npages += f->npages;
                 }
             }
-            refcount_release(&f->ref);
+            if (flush_target_clear(f, ci->id))
+                refcount_release(&f->ref);
         }
     }
     spin_runlock(&flush_lock);
 
-    flush_tlb(full_flush);
+    if (full_flush) {
+        fetch_and_add(&flush_stats.full_flushes, 1);
+        u64 start = rdtsc();
+        flush_tlb(true);
+        flush_cost_update(&flush_full_cost, rdtsc() - start, 1);
+    } else {
+        if (npages) {
+            fetch_and_add(&flush_stats.page_invalidations, npages);
+            flush_cost_update(&flush_page_cost, inval_ticks, npages);
+        }
+        flush_tlb(false);
+    }
 }
 
 closure_function(0, 0, void, flush_handler)
 {
-    _flush_handler();
+    _flush_handler(false);
 }
 
 void page_invalidate_flush(void)
 {
     if (initialized)
-        _flush_handler();
+        _flush_handler(false);
+}
+
+/* Called by kernel_sleep() with interrupts disabled: from here on, this cpu
+   does not touch any mapping that may be the target of a shootdown until it
+   calls page_invalidate_idle_exit(). */
+void page_invalidate_idle_enter(void)
+{
+    current_cpu()->tlb_lazy = true;
+}
+
+/* Called with interrupts disabled on the first interrupt taken while idle. */
+void page_invalidate_idle_exit(void)
+{
+    cpuinfo ci = current_cpu();
+    if (!ci->tlb_lazy)
+        return;
+    ci->tlb_lazy = false;
+    /* order the clearing of tlb_lazy with the read of inval_gen; pairs with
+       the barrier in page_invalidate_sync() */
+    memory_barrier();
+    /* Entries skipped while idle may have been retired already, so their
+       pages can't be invalidated individually. */
+    if (initialized && ci->inval_gen != inval_gen)
+        _flush_handler(true);
 }
 
 void page_invalidate(flush_entry f, u64 p)
@@ -152,6 +256,9 @@ void page_invalidate_sync(flush_entry f, status_handler completion)
         init_refcount(&f->ref, total_processors,
                       init_closure_func(&f->finish, thunk, flush_complete));
         f->completion = completion;
+        for (int i = 0; i < flush_target_words; i++)
+            f->targets[i] = (i < (total_processors >> 6)) ? -1ull :
+                            MASK(total_processors & 63);
 
         u64 flags = irq_disable_save();
         spin_wlock(&flush_lock);
@@ -175,9 +282,30 @@ void page_invalidate_sync(flush_entry f, status_handler completion)
         f->gen = fetch_and_add((word *)&inval_gen, 1) + 1;
         spin_wunlock(&flush_lock);
 
-        send_ipi(TARGET_EXCLUSIVE_BROADCAST, flush_ipi);
-        _flush_handler();
+        /* Order the publication of the new generation with the reads of
+           tlb_lazy: a cpu leaving idle either is seen as non-lazy here or
+           sees the new generation in page_invalidate_idle_exit(). */
+        memory_barrier();
+        cpuinfo self = current_cpu();
+        u64 sent = 0, avoided = 0;
+        for (int i = 0; i < total_processors; i++) {
+            cpuinfo ci = cpuinfo_from_id(i);
+            if (ci == self)
+                continue;
+            if (ci->tlb_lazy) {
+                if (flush_target_clear(f, i))
+                    refcount_release(&f->ref);
+                avoided++;
+            } else if (ci->inval_gen < f->gen) {
+                send_ipi(i, flush_ipi);
+                sent++;
+            }
+        }
+        _flush_handler(false);
         irq_restore(flags);
+        fetch_and_add(&flush_stats.syncs, 1);
+        fetch_and_add(&flush_stats.ipis_sent, sent);
+        fetch_and_add(&flush_stats.ipis_avoided, avoided);
     } else {
         flush_tlb(false);
         if (completion)
@@ -196,7 +324,7 @@ flush_entry get_page_flush_entry(void)
     /* Do the flush work here if this cpu gets too far behind which
         * can happen with large mapping operations */
     if (inval_gen - current_cpu()->inval_gen > FLUSH_THRESHOLD)
-        _flush_handler();
+        _flush_handler(false);
     irq_restore(flags);
 
     /* This spins because it must succeed */
@@ -204,7 +332,9 @@ flush_entry get_page_flush_entry(void)
         kern_pause();
 
     assert(fe != INVALID_ADDRESS);
+    u64 *targets = fe->targets;
     runtime_memset((void *)fe, 0, sizeof(*fe));
+    fe->targets = targets;
     return fe;
 }
 
@@ -218,7 +348,73 @@ void init_flush(heap h)
     flush_completion_queue = allocate_queue(h, COMP_QUEUE_SIZE);
     flush_entry fa = allocate(h, sizeof(struct flush_entry) * MAX_FLUSH_ENTRIES);
     assert(fa);
-    for (flush_entry f = fa; f < fa + MAX_FLUSH_ENTRIES; f++)
-        assert(enqueue(free_flush_entries, f));
+    flush_target_words = pad(total_processors, 64) >> 6;
+    flush_target_bitmaps = allocate(h, flush_target_words * sizeof(u64) * MAX_FLUSH_ENTRIES);
+    assert(flush_target_bitmaps != INVALID_ADDRESS);
+    for (int i = 0; i < MAX_FLUSH_ENTRIES; i++) {
+        fa[i].targets = flush_target_bitmaps + i * flush_target_words;
+        assert(enqueue(free_flush_entries, &fa[i]));
+    }
     initialized = true;
 }
+
+#define register_stat(tn, t, name)                                      \
+    v = value_from_u64(0);                                              \
+    s = sym(name);                                                      \
+    set(t, s, v);                                                       \
+    tuple_notifier_register_get_notify(tn, s, closure(h, flush_get_ ##name, v));
+
+closure_function(1, 0, value, flush_get_syncs,
+                 value, v)
+{
+    return value_rewrite_u64(bound(v), flush_stats.syncs);
+}
+
+closure_function(1, 0, value, flush_get_ipis_sent,
+                 value, v)
+{
+    return value_rewrite_u64(bound(v), flush_stats.ipis_sent);
+}
+
+closure_function(1, 0, value, flush_get_ipis_avoided,
+                 value, v)
+{
+    return value_rewrite_u64(bound(v), flush_stats.ipis_avoided);
+}
+
+closure_function(1, 0, value, flush_get_page_invalidations,
+                 value, v)
+{
+    return value_rewrite_u64(bound(v), flush_stats.page_invalidations);
+}
+
+closure_function(1, 0, value, flush_get_full_flushes,
+                 value, v)
+{
+    return value_rewrite_u64(bound(v), flush_stats.full_flushes);
+}
+
+closure_function(1, 0, value, flush_get_page_ceiling,
+                 value, v)
+{
+    return value_rewrite_u64(bound(v), flush_page_ceiling);
+}
+
+tuple flush_management(heap h)
+{
+    if (!initialized)
+        return 0;
+    value v;
+    symbol s;
+    tuple t = allocate_tuple();
+    assert(t != INVALID_ADDRESS);
+    tuple_notifier tn = tuple_notifier_wrap(t, false);
+    assert(tn != INVALID_ADDRESS);
+    register_stat(tn, t, syncs);
+    register_stat(tn, t, ipis_sent);
+    register_stat(tn, t, ipis_avoided);
+    register_stat(tn, t, page_invalidations);
+    register_stat(tn, t, full_flushes);
+    register_stat(tn, t, page_ceiling);
+    return (tuple)tn;
+}
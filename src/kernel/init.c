@@ -164,6 +164,12 @@ void init_kernel_heaps(void)
                                                          memory_reserve),
                                     PAGESIZE, is_lowmem ? PAGEHEAP_LOWMEM_PAGESIZE : PAGESIZE_2M,
                                     true);
+    if (!is_lowmem) {
+        /* Page allocations are served from the local NUMA node once the
+           memory topology is known (see init_numa()). */
+        heaps.pages = allocate_numa_pages_heap(&bootstrap, heaps.pages, PAGESIZE_2M);
+        assert(heaps.pages != INVALID_ADDRESS);
+    }
     int max_mcache_order = is_lowmem ? MAX_LOWMEM_MCACHE_ORDER : MAX_MCACHE_ORDER;
     bytes pagesize = is_lowmem ? U64_FROM_BIT(max_mcache_order + 1) : PAGESIZE_2M;
     heaps.general = allocate_mcache(&bootstrap, (heap)heaps.page_backed, 5, max_mcache_order,
@@ -664,11 +670,26 @@ void kernel_runtime_init(kernel_heaps kh)
     init_symtab(kh);
     read_kernel_syms();
     shutdown_completions = allocate_vector(locked, SHUTDOWN_COMPLETIONS_SIZE);
+    init_numa_topology(locked, kh->physical);
     count_cpus_present();
+#if !defined(MEMDEBUG_BACKED) && !defined(MEMDEBUG_ALL)
+    if (!lowmem) {
+        init_debug("init_numa");
+        init_numa(kh);
+    }
+#endif
 
     init_debug("init_kernel_contexts");
     init_kernel_contexts(misc);
 
+#if !defined(MEMDEBUG_MCACHE) && !defined(MEMDEBUG_ALL)
+    if (!lowmem) {
+        init_debug("per-cpu heap magazines");
+        locking_heap_enable_magazines(locked, 5, HEAP_MAGAZINE_MAX_ORDER);
+        locking_heap_enable_magazines(kh->malloc, 5, HEAP_MAGAZINE_MAX_ORDER);
+    }
+#endif
+
     init_debug("init_interrupts");
     init_interrupts(kh);
 
@@ -677,6 +698,7 @@ void kernel_runtime_init(kernel_heaps kh)
 
     init_debug("init_scheduler");
     init_scheduler(locked);
+    init_epoch(locked);
 
     /* platform detection and early init */
     init_debug("probing for hypervisor platform");
@@ -190,6 +190,15 @@ cpuinfo init_cpuinfo(heap backed, int cpu)
     assert(ci->cpu_queue != INVALID_ADDRESS);
     ci->last_timer_update = 0;
     ci->targeted_irqs = 0;
+    ci->smt_group = cpu;    /* refined by machine-specific init, if known */
+    ci->llc_group = 0;
+    ci->numa_node = 0;
+    ci->net_rx_gro = 0;
+    ci->net_tx_batch = 0;
+    list_init(&ci->net_tx_flush);
+    ci->tlb_lazy = false;
+    ci->epoch = 0;
+    ci->epoch_depth = 0;
     ci->mcs_prev = 0;
     ci->mcs_next = 0;
     ci->mcs_waiting = false;
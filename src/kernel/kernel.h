@@ -86,6 +86,18 @@ struct cpuinfo {
     timestamp last_timer_update;
     int targeted_irqs;
     u64 inval_gen; /* Generation number for invalidates */
+    boolean tlb_lazy; /* idle; shootdowns deferred until idle exit */
+    word epoch;       /* epoch observed by current read-side section, or 0 */
+    u32 epoch_depth;
+
+    /* topology: cpus sharing a core (SMT siblings) or a last-level cache */
+    u32 smt_group;
+    u32 llc_group;
+    u32 numa_node;
+
+    struct net_gro *net_rx_gro;     /* receive queue whose packets are being passed to lwIP */
+    u32 net_tx_batch;               /* nesting depth of network transmit batches */
+    struct list net_tx_flush;       /* handlers to call at the end of the transmit batch */
 
     cpuinfo mcs_prev;
     cpuinfo mcs_next;
@@ -387,6 +399,42 @@ static inline cpuinfo cpuinfo_from_id(int cpu)
     return vector_get(cpuinfos, cpu);
 }
 
+/* epoch-based reclamation (see epoch.c) */
+typedef struct epoch_retired {
+    struct list l;
+    word epoch;
+    thunk reclaim;
+} *epoch_retired;
+
+extern volatile word epoch_global;
+
+/* Read-side sections must not block; interrupts are disabled throughout. */
+static inline u64 epoch_enter(void)
+{
+    u64 flags = irq_disable_save();
+    cpuinfo ci = current_cpu();
+    if (ci->epoch_depth++ == 0) {
+        ci->epoch = epoch_global;
+        memory_barrier();   /* publish before loading protected pointers */
+    }
+    return flags;
+}
+
+static inline void epoch_exit(u64 flags)
+{
+    cpuinfo ci = current_cpu();
+    if (--ci->epoch_depth == 0) {
+        memory_barrier();   /* complete protected loads before leaving */
+        ci->epoch = 0;
+    }
+    irq_restore(flags);
+}
+
+void init_epoch(heap h);
+void epoch_synchronize(void);
+void epoch_retire(epoch_retired r, thunk reclaim);
+u64 epoch_reclaim(void);
+
 extern const sstring context_type_strings[CONTEXT_TYPE_MAX];
 
 static inline boolean is_kernel_context(context c)
@@ -780,6 +828,7 @@ backed_heap allocate_page_backed_heap(heap meta, heap virtual, heap physical,
 void page_backed_dealloc_virtual(backed_heap bh, u64 x, bytes length);
 
 backed_heap allocate_linear_backed_heap(heap meta, id_heap physical, range mapped_virt);
+backed_heap clone_linear_backed_heap(heap meta, backed_heap source, id_heap physical);
 
 static inline boolean is_linear_backed_address(u64 address)
 {
@@ -809,6 +858,18 @@ void page_free_phys(u64 phys);
 
 heap allocate_tagged_region(kernel_heaps kh, u64 tag, bytes pagesize, boolean locking);
 heap locking_heap_wrapper(heap meta, heap parent);
+boolean locking_heap_enable_magazines(heap h, int min_order, int max_order);
+
+void init_numa_topology(heap h, id_heap physical);
+void numa_add_memory(u32 node_id, u64 base, u64 length);
+void numa_add_cpu(u32 hw_id, u32 node_id);
+void numa_set_distance(u32 from, u32 to, u8 distance);
+void init_numa(kernel_heaps kh);
+u32 numa_node_from_hw_id(u32 hw_id);
+u32 numa_node_count(void);
+id_heap numa_node_physical(u32 node_id);
+caching_heap allocate_numa_pages_heap(heap meta, caching_heap parent, bytes pagesize);
+tuple numa_management(void);
 
 #endif
 
@@ -150,3 +150,18 @@ backed_heap allocate_linear_backed_heap(heap meta, id_heap physical, range mappe
     }
     return &hb->bh;
 }
+
+/* Create a heap that shares the virtual mapping of source but allocates
+   physical memory from a different id heap (e.g. a NUMA node subset of the
+   source physical heap). */
+backed_heap clone_linear_backed_heap(heap meta, backed_heap source, id_heap physical)
+{
+    linear_backed_heap src = (linear_backed_heap)source;
+    linear_backed_heap hb = allocate(meta, sizeof(*hb));
+    if (hb == INVALID_ADDRESS)
+        return INVALID_ADDRESS;
+    runtime_memcpy(hb, src, sizeof(*hb));
+    hb->meta = meta;
+    hb->physical = physical;
+    return &hb->bh;
+}
@@ -1,6 +1,48 @@
 #include <kernel.h>
 #include <management.h>
 
+/* Per-cpu magazine layer
+
+   Once enabled with locking_heap_enable_magazines(), each cpu keeps a
+   pair of magazines (a loaded and a previous one) for every size class
+   of the underlying mcache. Allocations and deallocations of a known
+   size are serviced from these magazines with interrupts disabled and
+   without taking the heap lock. When both magazines of a class are
+   exhausted (or full), the cpu exchanges one of them with the depot,
+   which holds full and empty magazines under the heap lock. Only when
+   the depot cannot help does the request hit the parent heap.
+
+   Deallocations without a size (malloc-style, -1ull) cannot be
+   classified and always go through the locked path.
+
+   Under memory pressure the depot is drained by a registered mem
+   cleaner; the drain generation is bumped so that each cpu releases
+   its loaded magazines on its next access to the heap.
+*/
+
+typedef struct heap_magazine {
+    struct list l;              /* depot linkage */
+    u64 count;
+    u64 objs[HEAP_MAGAZINE_SIZE];
+} *heap_magazine;
+
+typedef struct heaplock_depot {
+    struct list full;
+    struct list empty;
+    u64 nfull;
+    u64 nempty;
+} *heaplock_depot;
+
+typedef struct heaplock_cpu {
+    u64 drain_gen;
+    u64 hits;
+    u64 misses;
+    struct {
+        heap_magazine loaded;
+        heap_magazine previous;
+    } classes[0];
+} *heaplock_cpu;
+
 typedef struct heaplock {
     struct heap h;
     struct spinlock lock;
@@ -8,14 +50,181 @@ typedef struct heaplock {
     heap meta;
     tuple mgmt;
     tuple parent_mgmt;
+
+    /* magazine layer, protected by lock except for per-cpu state */
+    heaplock_cpu *cpus;
+    int ncpus;
+    int min_order;
+    int nclasses;
+    u64 drain_gen;
+    bytes depot_cached;
+    heaplock_depot depots;
+    closure_struct(mem_cleaner, cleaner);
 } *heaplock;
 
 #define lock_heap(hl) u64 _flags = spin_lock_irq(&hl->lock)
 #define unlock_heap(hl) spin_unlock_irq(&hl->lock, _flags)
 
+#define magazine_class_size(hl, c)  U64_FROM_BIT((hl)->min_order + (c))
+
+static int heaplock_class(heaplock hl, bytes size)
+{
+    int order = find_order(size);
+    if (order < hl->min_order)
+        order = hl->min_order;
+    order -= hl->min_order;
+    return order < hl->nclasses ? order : -1;
+}
+
+static inline heaplock_cpu heaplock_cpu_current(heaplock hl)
+{
+    return hl->cpus[current_cpu()->id];
+}
+
+/* called with heap lock held */
+static heap_magazine heaplock_get_magazine(heaplock hl, heaplock_depot d, boolean full)
+{
+    struct list *l = full ? &d->full : &d->empty;
+    if (!list_empty(l)) {
+        heap_magazine m = struct_from_list(list_begin(l), heap_magazine, l);
+        list_delete(&m->l);
+        if (full) {
+            d->nfull--;
+            hl->depot_cached -= m->count * magazine_class_size(hl, d - hl->depots);
+        } else {
+            d->nempty--;
+        }
+        return m;
+    }
+    if (full)
+        return 0;
+    heap_magazine m = allocate(hl->parent, sizeof(struct heap_magazine));
+    if (m == INVALID_ADDRESS)
+        return 0;
+    m->count = 0;
+    return m;
+}
+
+/* called with heap lock held */
+static void heaplock_magazine_release(heaplock hl, heap_magazine m, bytes size)
+{
+    for (u64 i = 0; i < m->count; i++)
+        deallocate_u64(hl->parent, m->objs[i], size);
+    m->count = 0;
+}
+
+/* called with heap lock held */
+static void heaplock_put_magazine(heaplock hl, heaplock_depot d, heap_magazine m)
+{
+    bytes size = magazine_class_size(hl, d - hl->depots);
+    if (m->count == 0) {
+        if (d->nempty < HEAP_DEPOT_MAX_MAGAZINES) {
+            list_push_back(&d->empty, &m->l);
+            d->nempty++;
+        } else {
+            deallocate(hl->parent, m, sizeof(struct heap_magazine));
+        }
+    } else if (d->nfull < HEAP_DEPOT_MAX_MAGAZINES) {
+        list_push_back(&d->full, &m->l);
+        d->nfull++;
+        hl->depot_cached += m->count * size;
+    } else {
+        heaplock_magazine_release(hl, m, size);
+        heaplock_put_magazine(hl, d, m);
+    }
+}
+
+/* called with interrupts disabled; takes the heap lock */
+static void heaplock_cpu_drain(heaplock hl, heaplock_cpu hc)
+{
+    spin_lock(&hl->lock);
+    for (int c = 0; c < hl->nclasses; c++) {
+        bytes size = magazine_class_size(hl, c);
+        heaplock_magazine_release(hl, hc->classes[c].loaded, size);
+        heaplock_magazine_release(hl, hc->classes[c].previous, size);
+    }
+    hc->drain_gen = hl->drain_gen;
+    spin_unlock(&hl->lock);
+}
+
+static u64 heaplock_cpu_alloc(heaplock hl, int c)
+{
+    u64 flags = irq_disable_save();
+    heaplock_cpu hc = heaplock_cpu_current(hl);
+    if (hc->drain_gen != hl->drain_gen)
+        heaplock_cpu_drain(hl, hc);
+    heap_magazine m = hc->classes[c].loaded;
+    if (m->count == 0 && hc->classes[c].previous->count > 0) {
+        hc->classes[c].loaded = hc->classes[c].previous;
+        hc->classes[c].previous = m;
+        m = hc->classes[c].loaded;
+    }
+    if (m->count > 0) {
+        hc->hits++;
+        u64 a = m->objs[--m->count];
+        irq_restore(flags);
+        return a;
+    }
+    hc->misses++;
+    heaplock_depot d = &hl->depots[c];
+    spin_lock(&hl->lock);
+    heap_magazine full = heaplock_get_magazine(hl, d, true);
+    u64 a;
+    if (full) {
+        heaplock_put_magazine(hl, d, hc->classes[c].previous);
+        hc->classes[c].previous = m;
+        hc->classes[c].loaded = full;
+        a = full->objs[--full->count];
+    } else {
+        a = allocate_u64(hl->parent, magazine_class_size(hl, c));
+    }
+    spin_unlock(&hl->lock);
+    irq_restore(flags);
+    return a;
+}
+
+static void heaplock_cpu_dealloc(heaplock hl, int c, u64 a)
+{
+    u64 flags = irq_disable_save();
+    heaplock_cpu hc = heaplock_cpu_current(hl);
+    if (hc->drain_gen != hl->drain_gen)
+        heaplock_cpu_drain(hl, hc);
+    heap_magazine m = hc->classes[c].loaded;
+    if (m->count == HEAP_MAGAZINE_SIZE && hc->classes[c].previous->count == 0) {
+        hc->classes[c].loaded = hc->classes[c].previous;
+        hc->classes[c].previous = m;
+        m = hc->classes[c].loaded;
+    }
+    if (m->count < HEAP_MAGAZINE_SIZE) {
+        hc->hits++;
+        m->objs[m->count++] = a;
+        irq_restore(flags);
+        return;
+    }
+    hc->misses++;
+    heaplock_depot d = &hl->depots[c];
+    spin_lock(&hl->lock);
+    heap_magazine empty = heaplock_get_magazine(hl, d, false);
+    if (empty) {
+        heaplock_put_magazine(hl, d, hc->classes[c].previous);
+        hc->classes[c].previous = m;
+        hc->classes[c].loaded = empty;
+        empty->objs[empty->count++] = a;
+    } else {
+        deallocate_u64(hl->parent, a, magazine_class_size(hl, c));
+    }
+    spin_unlock(&hl->lock);
+    irq_restore(flags);
+}
+
 static u64 heaplock_alloc(heap h, bytes size)
 {
     heaplock hl = (heaplock)h;
+    if (hl->cpus) {
+        int c = heaplock_class(hl, size);
+        if (c >= 0)
+            return heaplock_cpu_alloc(hl, c);
+    }
     lock_heap(hl);
     u64 a = allocate_u64(hl->parent, size);
     unlock_heap(hl);
@@ -25,12 +234,20 @@ static u64 heaplock_alloc(heap h, bytes size)
 static void heaplock_dealloc(heap h, u64 x, bytes size)
 {
     heaplock hl = (heaplock)h;
+    if (hl->cpus && size != -1ull) {
+        int c = heaplock_class(hl, size);
+        if (c >= 0) {
+            heaplock_cpu_dealloc(hl, c, x);
+            return;
+        }
+    }
     lock_heap(hl);
     deallocate_u64(hl->parent, x, size);
     unlock_heap(hl);
 }
 
-/* assuming no contention on destroy */
+/* assuming no contention on destroy; magazines are allocated from the
+   parent and thus reclaimed with it */
 static void heaplock_destroy(heap h)
 {
     heaplock hl = (heaplock)h;
@@ -38,11 +255,28 @@ static void heaplock_destroy(heap h)
     deallocate(hl->meta, hl, sizeof(*hl));
 }
 
+/* approximate: per-cpu magazines are read without synchronization */
+static bytes heaplock_cached(heaplock hl)
+{
+    bytes cached = hl->depot_cached;
+    for (int i = 0; i < hl->ncpus; i++) {
+        heaplock_cpu hc = hl->cpus[i];
+        for (int c = 0; c < hl->nclasses; c++)
+            cached += (hc->classes[c].loaded->count + hc->classes[c].previous->count) *
+                magazine_class_size(hl, c);
+    }
+    return cached;
+}
+
 static bytes heaplock_allocated(heap h)
 {
     heaplock hl = (heaplock)h;
     lock_heap(hl);
     bytes count = heap_allocated(hl->parent);
+    if (hl->cpus) {
+        bytes cached = heaplock_cached(hl);
+        count = (count > cached) ? count - cached : 0;
+    }
     unlock_heap(hl);
     return count;
 }
@@ -88,6 +322,58 @@ closure_function(1, 1, boolean, heaplock_iterate,
     return result;
 }
 
+closure_function(2, 0, value, heaplock_get_hits,
+                 heaplock_cpu, hc, value, v)
+{
+    return value_rewrite_u64(bound(v), bound(hc)->hits);
+}
+
+closure_function(2, 0, value, heaplock_get_misses,
+                 heaplock_cpu, hc, value, v)
+{
+    return value_rewrite_u64(bound(v), bound(hc)->misses);
+}
+
+closure_function(2, 0, value, heaplock_get_cached,
+                 heaplock, hl, value, v)
+{
+    heaplock hl = bound(hl);
+    lock_heap(hl);
+    bytes cached = heaplock_cached(hl);
+    unlock_heap(hl);
+    return value_rewrite_u64(bound(v), cached);
+}
+
+#define register_stat(hl, o, n, t, name)                                \
+    v = value_from_u64(0);                                              \
+    s = sym(name);                                                      \
+    set(t, s, v);                                                       \
+    tuple_notifier_register_get_notify(n, s, closure(hl->meta, heaplock_get_ ##name, o, v));
+
+static tuple heaplock_magazines_management(heaplock hl)
+{
+    value v;
+    symbol s;
+    tuple t = timm("magazine_size", "%d", HEAP_MAGAZINE_SIZE);
+    t = timm_append(t, "classes", "%d", hl->nclasses);
+    tuple_notifier n = tuple_notifier_wrap(t, false);
+    assert(n != INVALID_ADDRESS);
+    register_stat(hl, hl, n, t, cached);
+    tuple cpus = allocate_tuple();
+    assert(cpus != INVALID_ADDRESS);
+    for (int i = 0; i < hl->ncpus; i++) {
+        tuple ct = allocate_tuple();
+        assert(ct != INVALID_ADDRESS);
+        tuple_notifier cn = tuple_notifier_wrap(ct, false);
+        assert(cn != INVALID_ADDRESS);
+        register_stat(hl, hl->cpus[i], cn, ct, hits);
+        register_stat(hl, hl->cpus[i], cn, ct, misses);
+        set(cpus, intern_u64(i), cn);
+    }
+    set(t, sym(cpus), cpus);
+    return (tuple)n;
+}
+
 static value heaplock_management(heap h)
 {
     heaplock hl = (heaplock)h;
@@ -101,6 +387,8 @@ static value heaplock_management(heap h)
                                        closure(hl->meta, heaplock_set, hl),
                                        closure(hl->meta, heaplock_iterate, hl));
     set(v, sym(parent), ft);
+    if (hl->cpus)
+        set(v, sym(magazines), heaplock_magazines_management(hl));
 
     value pm = heap_management(hl->parent);
     lock_heap(hl);
@@ -127,6 +415,88 @@ heap locking_heap_wrapper(heap meta, heap parent)
     hl->meta = meta;
     hl->mgmt = 0;
     hl->parent_mgmt = 0;
+    hl->cpus = 0;
+    hl->ncpus = 0;
+    hl->depots = 0;
+    hl->depot_cached = 0;
+    hl->drain_gen = 0;
     spin_lock_init(&hl->lock);
     return (heap)hl;
 }
+
+closure_func_basic(mem_cleaner, u64, heaplock_mem_cleaner,
+                   u64 clean_bytes)
+{
+    heaplock hl = struct_from_field(closure_self(), heaplock, cleaner);
+    u64 cleaned = 0;
+    lock_heap(hl);
+    for (int c = 0; c < hl->nclasses; c++) {
+        heaplock_depot d = &hl->depots[c];
+        bytes size = magazine_class_size(hl, c);
+        heap_magazine m;
+        while ((m = heaplock_get_magazine(hl, d, true))) {
+            cleaned += m->count * size;
+            heaplock_magazine_release(hl, m, size);
+            deallocate(hl->parent, m, sizeof(struct heap_magazine));
+        }
+        list_foreach(&d->empty, l) {
+            list_delete(l);
+            deallocate(hl->parent, struct_from_list(l, heap_magazine, l),
+                       sizeof(struct heap_magazine));
+        }
+        d->nempty = 0;
+    }
+    hl->drain_gen++;
+    unlock_heap(hl);
+    return cleaned;
+}
+
+/* Enable per-cpu magazines for size classes [min_order, max_order] of
+   the parent mcache. Must be called once the number of cpus is known
+   and before secondary cores are started. */
+boolean locking_heap_enable_magazines(heap h, int min_order, int max_order)
+{
+    heaplock hl = (heaplock)h;
+    int ncpus = present_processors;
+    int nclasses = max_order - min_order + 1;
+    assert(nclasses > 0);
+    assert(!hl->cpus);
+    lock_heap(hl);
+    heaplock_cpu *cpus = allocate_zero(hl->parent, ncpus * sizeof(heaplock_cpu));
+    if (cpus == INVALID_ADDRESS)
+        goto fail;
+    hl->depots = allocate(hl->parent, nclasses * sizeof(struct heaplock_depot));
+    if (hl->depots == INVALID_ADDRESS)
+        goto fail;
+    for (int c = 0; c < nclasses; c++) {
+        list_init(&hl->depots[c].full);
+        list_init(&hl->depots[c].empty);
+        hl->depots[c].nfull = hl->depots[c].nempty = 0;
+    }
+    bytes cpu_size = sizeof(struct heaplock_cpu) + nclasses * sizeof(cpus[0]->classes[0]);
+    for (int i = 0; i < ncpus; i++) {
+        heaplock_cpu hc = allocate_zero(hl->parent, cpu_size);
+        if (hc == INVALID_ADDRESS)
+            goto fail;
+        cpus[i] = hc;
+        for (int c = 0; c < nclasses; c++) {
+            hc->classes[c].loaded = heaplock_get_magazine(hl, &hl->depots[c], false);
+            hc->classes[c].previous = heaplock_get_magazine(hl, &hl->depots[c], false);
+            if (!hc->classes[c].loaded || !hc->classes[c].previous)
+                goto fail;
+        }
+    }
+    hl->min_order = min_order;
+    hl->nclasses = nclasses;
+    hl->ncpus = ncpus;
+    hl->cpus = cpus;    /* enables the magazine paths */
+    unlock_heap(hl);
+    return mm_register_mem_cleaner(init_closure_func(&hl->cleaner, mem_cleaner,
+                                                     heaplock_mem_cleaner));
+  fail:
+    /* partial allocations are left to the parent; this only happens at boot */
+    hl->depots = 0;
+    unlock_heap(hl);
+    msg_err("out of memory\n");
+    return false;
+}
@@ -0,0 +1,462 @@
+/* NUMA memory topology
+
+   Platform code reports memory and processor affinity (e.g. from the ACPI
+   SRAT) and inter-node distances (ACPI SLIT) before init_numa() is
+   called. For each node, init_numa() creates:
+
+   - an id heap that is a node-local view of the global physical id heap:
+     allocations are constrained to the physical ranges of the node, while
+     the bitmaps remain those of the global heap, so that memory can be
+     freed through either heap;
+   - a page cache (objcache of single pages) backed by the node physical
+     heap.
+
+   The kernel page heap (kernel_heaps.pages) is a wrapper that serves
+   allocations from the page cache of the node of the current cpu, falling
+   back to other nodes in order of distance, and finally to the global
+   page cache. Since anonymous memory faults, page cache pages and thread
+   stacks are all allocated from this heap, they are node-local by default.
+*/
+
+#include <kernel.h>
+#include <management.h>
+
+//#define NUMA_DEBUG
+#ifdef NUMA_DEBUG
+#define numa_debug(x, ...) do {rprintf("NUMA: " x "\n", ##__VA_ARGS__);} while(0)
+#else
+#define numa_debug(x, ...)
+#endif
+
+#define NUMA_LOCAL_DISTANCE     10
+#define NUMA_REMOTE_DISTANCE    20
+
+typedef struct numa_node {
+    struct id_heap physical;    /* must be first */
+    u32 id;
+    u64 fallback_allocs;        /* page allocations that could not be served locally */
+    caching_heap pages;
+    u32 fallback_order[NUMA_MAX_NODES];
+} *numa_node;
+
+typedef struct numa_range {
+    struct rmnode n;
+    numa_node node;
+} *numa_range;
+
+typedef struct numa_pages {
+    struct caching_heap ch;
+    caching_heap parent;
+    bytes pagesize;             /* objcache page size */
+} *numa_pages;
+
+static struct {
+    heap h;
+    id_heap physical;
+    rangemap ranges;
+    table cpus;                 /* hardware cpu id -> node id + 1 */
+    numa_node nodes[NUMA_MAX_NODES];
+    u8 distance[NUMA_MAX_NODES][NUMA_MAX_NODES];
+    u32 node_count;
+    boolean enabled;
+    numa_pages pages;
+} numa;
+
+static numa_node numa_get_node(u32 id, boolean create)
+{
+    if (id >= NUMA_MAX_NODES) {
+        msg_err("proximity domain %d exceeds maximum (%d)\n", id, NUMA_MAX_NODES);
+        return 0;
+    }
+    numa_node n = numa.nodes[id];
+    if (n || !create)
+        return n;
+    n = allocate_zero(numa.h, sizeof(*n));
+    if (n == INVALID_ADDRESS)
+        return 0;
+    n->id = id;
+    numa.nodes[id] = n;
+    numa.node_count++;
+    return n;
+}
+
+void numa_add_memory(u32 node_id, u64 base, u64 length)
+{
+    numa_node n = numa_get_node(node_id, true);
+    if (!n)
+        return;
+    numa_range nr = allocate(numa.h, sizeof(*nr));
+    if (nr == INVALID_ADDRESS)
+        return;
+    rmnode_init(&nr->n, irangel(base, length));
+    nr->node = n;
+    numa_debug("node %d: memory %R", node_id, nr->n.r);
+    if (!rangemap_insert(numa.ranges, &nr->n)) {
+        msg_err("memory range %R overlaps with another node\n", nr->n.r);
+        deallocate(numa.h, nr, sizeof(*nr));
+    }
+}
+
+void numa_add_cpu(u32 hw_id, u32 node_id)
+{
+    if (!numa_get_node(node_id, true))
+        return;
+    numa_debug("node %d: cpu hw id %d", node_id, hw_id);
+    table_set(numa.cpus, pointer_from_u64((u64)hw_id), pointer_from_u64((u64)node_id + 1));
+}
+
+void numa_set_distance(u32 from, u32 to, u8 distance)
+{
+    if (from < NUMA_MAX_NODES && to < NUMA_MAX_NODES)
+        numa.distance[from][to] = distance;
+}
+
+u32 numa_node_from_hw_id(u32 hw_id)
+{
+    if (!numa.enabled)
+        return 0;
+    u64 v = u64_from_pointer(table_find(numa.cpus, pointer_from_u64((u64)hw_id)));
+    return v ? v - 1 : 0;
+}
+
+u32 numa_node_count(void)
+{
+    return numa.enabled ? numa.node_count : 1;
+}
+
+id_heap numa_node_physical(u32 node_id)
+{
+    numa_node n = numa.enabled ? numa_get_node(node_id, false) : 0;
+    return n ? &n->physical : numa.physical;
+}
+
+/* node physical heap */
+
+static u64 numa_node_alloc_subrange(id_heap i, bytes count, u64 start, u64 end)
+{
+    numa_node n = (numa_node)i;
+    range q = irange(start, end);
+    rangemap_foreach(numa.ranges, rn) {
+        numa_range nr = (numa_range)rn;
+        if (nr->node != n)
+            continue;
+        range ri = range_intersection(q, nr->n.r);
+        if (range_span(ri) < count)
+            continue;
+        u64 a = id_heap_alloc_subrange(numa.physical, count, ri.start, ri.end);
+        if (a != INVALID_PHYSICAL) {
+            fetch_and_add(&n->physical.allocated, pad(count, i->h.pagesize));
+            return a;
+        }
+    }
+    return INVALID_PHYSICAL;
+}
+
+static u64 numa_node_alloc(heap h, bytes count)
+{
+    return numa_node_alloc_subrange((id_heap)h, count, 0, infinity);
+}
+
+static void numa_node_dealloc(heap h, u64 a, bytes count)
+{
+    deallocate_u64((heap)numa.physical, a, count);
+    numa_range nr = (numa_range)rangemap_lookup(numa.ranges, a);
+    if (nr != INVALID_ADDRESS)
+        fetch_and_add(&nr->node->physical.allocated, -pad(count, h->pagesize));
+}
+
+static bytes numa_node_allocated(heap h)
+{
+    return ((id_heap)h)->allocated;
+}
+
+static bytes numa_node_total(heap h)
+{
+    return ((id_heap)h)->total;
+}
+
+static boolean numa_node_add_range(id_heap i, u64 base, u64 length)
+{
+    return false;
+}
+
+static boolean numa_node_set_area(id_heap i, u64 base, u64 length, boolean validate,
+                                  boolean allocate)
+{
+    return id_heap_set_area(numa.physical, base, length, validate, allocate);
+}
+
+static void numa_node_set_randomize(id_heap i, boolean randomize)
+{
+}
+
+static void numa_node_set_next(id_heap i, bytes count, u64 next)
+{
+}
+
+closure_function(2, 0, value, numa_node_get_allocated,
+                 numa_node, n, value, v)
+{
+    return value_rewrite_u64(bound(v), bound(n)->physical.allocated);
+}
+
+closure_function(2, 0, value, numa_node_get_total,
+                 numa_node, n, value, v)
+{
+    return value_rewrite_u64(bound(v), bound(n)->physical.total);
+}
+
+closure_function(2, 0, value, numa_node_get_free,
+                 numa_node, n, value, v)
+{
+    numa_node n = bound(n);
+    return value_rewrite_u64(bound(v), n->physical.total - n->physical.allocated);
+}
+
+closure_function(2, 0, value, numa_node_get_fallbacks,
+                 numa_node, n, value, v)
+{
+    return value_rewrite_u64(bound(v), bound(n)->fallback_allocs);
+}
+
+#define register_stat(n, tn, t, name)                                   \
+    v = value_from_u64(0);                                              \
+    s = sym(name);                                                      \
+    set(t, s, v);                                                       \
+    tuple_notifier_register_get_notify(tn, s, closure(numa.h, numa_node_get_ ##name, n, v));
+
+static value numa_node_management(heap h)
+{
+    numa_node n = (numa_node)h;
+    if (n->physical.mgmt)
+        return n->physical.mgmt;
+    value v;
+    symbol s;
+    tuple t = timm("type", "numa_node");
+    t = timm_append(t, "node", "%d", n->id);
+    tuple_notifier tn = tuple_notifier_wrap(t, false);
+    assert(tn != INVALID_ADDRESS);
+    register_stat(n, tn, t, allocated);
+    register_stat(n, tn, t, total);
+    register_stat(n, tn, t, free);
+    register_stat(n, tn, t, fallbacks);
+    n->physical.mgmt = (tuple)tn;
+    return tn;
+}
+
+closure_function(1, 1, boolean, numa_node_total_handler,
+                 numa_node, n,
+                 range r)
+{
+    numa_node n = bound(n);
+    rangemap_foreach(numa.ranges, rn) {
+        numa_range nr = (numa_range)rn;
+        if (nr->node == n)
+            n->physical.total += range_span(range_intersection(r, nr->n.r));
+    }
+    return true;
+}
+
+static void numa_node_init_physical(numa_node n)
+{
+    id_heap i = &n->physical;
+    i->h.alloc = numa_node_alloc;
+    i->h.dealloc = numa_node_dealloc;
+    i->h.destroy = 0;
+    i->h.allocated = numa_node_allocated;
+    i->h.total = numa_node_total;
+    i->h.management = numa_node_management;
+    i->h.pagesize = numa.physical->h.pagesize;
+    i->add_range = numa_node_add_range;
+    i->set_area = numa_node_set_area;
+    i->set_randomize = numa_node_set_randomize;
+    i->alloc_subrange = numa_node_alloc_subrange;
+    i->set_next = numa_node_set_next;
+    i->page_order = numa.physical->page_order;
+    i->meta = numa.h;
+    i->total = 0;
+    i->allocated = 0;
+    i->mgmt = 0;
+    id_heap_range_foreach(numa.physical, stack_closure(numa_node_total_handler, n));
+}
+
+/* Nodes sorted by increasing distance from n (excluding n itself). */
+static void numa_node_init_fallback(numa_node n)
+{
+    int count = 0;
+    for (u32 id = 0; id < NUMA_MAX_NODES; id++) {
+        if (!numa.nodes[id] || id == n->id)
+            continue;
+        u8 d = numa.distance[n->id][id];
+        int j = count++;
+        while (j > 0 && numa.distance[n->id][n->fallback_order[j - 1]] > d) {
+            n->fallback_order[j] = n->fallback_order[j - 1];
+            j--;
+        }
+        n->fallback_order[j] = id;
+    }
+    for (; count < NUMA_MAX_NODES; count++)
+        n->fallback_order[count] = NUMA_MAX_NODES;
+}
+
+/* page heap wrapper */
+
+static u64 numa_pages_alloc(heap h, bytes size)
+{
+    numa_pages np = (numa_pages)h;
+    if (numa.enabled) {
+        numa_node n = numa.nodes[current_cpu()->numa_node];
+        if (n && n->pages) {
+            u64 a = allocate_u64((heap)n->pages, size);
+            if (a != INVALID_PHYSICAL)
+                return a;
+            fetch_and_add(&n->fallback_allocs, 1);
+            for (int i = 0; i < NUMA_MAX_NODES && n->fallback_order[i] < NUMA_MAX_NODES; i++) {
+                numa_node f = numa.nodes[n->fallback_order[i]];
+                if (f->pages && (a = allocate_u64((heap)f->pages, size)) != INVALID_PHYSICAL)
+                    return a;
+            }
+        }
+    }
+    return allocate_u64((heap)np->parent, size);
+}
+
+static void numa_pages_dealloc(heap h, u64 a, bytes size)
+{
+    numa_pages np = (numa_pages)h;
+    heap o = numa.enabled ? objcache_from_object(a, np->pagesize) : INVALID_ADDRESS;
+    if (o == INVALID_ADDRESS)
+        o = (heap)np->parent;
+    deallocate_u64(o, a, size);
+}
+
+static bytes numa_pages_drain(caching_heap ch, bytes len, bytes retain)
+{
+    numa_pages np = (numa_pages)ch;
+    bytes drained = cache_drain(np->parent, len, retain);
+    if (numa.enabled) {
+        for (u32 id = 0; id < NUMA_MAX_NODES && drained < len; id++) {
+            numa_node n = numa.nodes[id];
+            if (n && n->pages)
+                drained += cache_drain(n->pages, len - drained, retain);
+        }
+    }
+    return drained;
+}
+
+static bytes numa_pages_allocated(heap h)
+{
+    numa_pages np = (numa_pages)h;
+    bytes allocated = heap_allocated((heap)np->parent);
+    if (numa.enabled) {
+        for (u32 id = 0; id < NUMA_MAX_NODES; id++) {
+            numa_node n = numa.nodes[id];
+            if (n && n->pages)
+                allocated += heap_allocated((heap)n->pages);
+        }
+    }
+    return allocated;
+}
+
+static bytes numa_pages_total(heap h)
+{
+    numa_pages np = (numa_pages)h;
+    bytes total = heap_total((heap)np->parent);
+    if (numa.enabled) {
+        for (u32 id = 0; id < NUMA_MAX_NODES; id++) {
+            numa_node n = numa.nodes[id];
+            if (n && n->pages)
+                total += heap_total((heap)n->pages);
+        }
+    }
+    return total;
+}
+
+static value numa_pages_management(heap h)
+{
+    return heap_management((heap)((numa_pages)h)->parent);
+}
+
+/* Until init_numa() is called (and on non-NUMA machines), all requests are
+   passed through to the parent page cache. */
+caching_heap allocate_numa_pages_heap(heap meta, caching_heap parent, bytes pagesize)
+{
+    numa_pages np = allocate(meta, sizeof(*np));
+    if (np == INVALID_ADDRESS)
+        return INVALID_ADDRESS;
+    np->ch.h.alloc = numa_pages_alloc;
+    np->ch.h.dealloc = numa_pages_dealloc;
+    np->ch.h.destroy = 0;
+    np->ch.h.allocated = numa_pages_allocated;
+    np->ch.h.total = numa_pages_total;
+    np->ch.h.management = numa_pages_management;
+    np->ch.h.pagesize = parent->h.pagesize;
+    np->ch.drain = numa_pages_drain;
+    np->parent = parent;
+    np->pagesize = pagesize;
+    numa.pages = np;
+    return &np->ch;
+}
+
+tuple numa_management(void)
+{
+    if (!numa.enabled)
+        return 0;
+    tuple t = allocate_tuple();
+    assert(t != INVALID_ADDRESS);
+    for (u32 id = 0; id < NUMA_MAX_NODES; id++) {
+        numa_node n = numa.nodes[id];
+        if (n)
+            set(t, intern_u64(id), heap_management((heap)&n->physical));
+    }
+    return t;
+}
+
+/* Called with the physical and page heaps initialized, after platform code
+   has reported the memory topology. */
+void init_numa(kernel_heaps kh)
+{
+    if (numa.node_count < 2) {
+        numa_debug("%d node(s) reported, NUMA disabled", numa.node_count);
+        return;
+    }
+    bytes reserve = PAGEHEAP_MEMORY_RESERVE / numa.node_count;
+    for (u32 from = 0; from < NUMA_MAX_NODES; from++) {
+        for (u32 to = 0; to < NUMA_MAX_NODES; to++) {
+            if (!numa.distance[from][to])
+                numa.distance[from][to] = (from == to) ? NUMA_LOCAL_DISTANCE :
+                                                         NUMA_REMOTE_DISTANCE;
+        }
+    }
+    for (u32 id = 0; id < NUMA_MAX_NODES; id++) {
+        numa_node n = numa.nodes[id];
+        if (!n)
+            continue;
+        numa_node_init_physical(n);
+        numa_node_init_fallback(n);
+        numa_debug("node %d: %ld bytes", id, n->physical.total);
+        if (!numa.pages || heap_free((heap)&n->physical) <= reserve)
+            continue;
+        backed_heap bh = clone_linear_backed_heap(numa.h, kh->page_backed, &n->physical);
+        if (bh == INVALID_ADDRESS)
+            continue;
+        heap parent = reserve_heap_wrapper(numa.h, (heap)bh, reserve);
+        if (parent == INVALID_ADDRESS)
+            continue;
+        n->pages = allocate_objcache(numa.h, parent, PAGESIZE, numa.pages->pagesize, true);
+        if (n->pages == INVALID_ADDRESS)
+            n->pages = 0;
+    }
+    memory_barrier();
+    numa.enabled = true;
+}
+
+void init_numa_topology(heap h, id_heap physical)
+{
+    numa.h = h;
+    numa.physical = physical;
+    numa.ranges = allocate_rangemap(h);
+    assert(numa.ranges != INVALID_ADDRESS);
+    numa.cpus = allocate_table(h, identity_key, pointer_equal);
+    assert(numa.cpus != INVALID_ADDRESS);
+}
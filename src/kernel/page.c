@@ -205,6 +205,46 @@ boolean validate_virtual_writable(void * base, u64 length)
                          stack_closure_func(entry_handler, validate_entry_writable));
 }
 
+/* called with lock held */
+closure_function(2, 3, boolean, split_entry,
+                 u64, vaddr, flush_entry, fe,
+                 int level, u64 addr, pteptr entry)
+{
+    pte old = pte_from_pteptr(entry);
+    if (level == PT_PTE_LEVEL || !pte_is_present(old) || !pte_is_mapping(level, old) ||
+        addr == bound(vaddr))
+        return true;
+
+    /* the block straddles vaddr: replace it with a table of next-level mappings */
+    u64 tp_phys;
+    u64 *tp = allocate_table_page(&tp_phys);
+    if (tp == INVALID_ADDRESS) {
+        msg_err("failed to allocate page table memory\n");
+        return false;
+    }
+    int next = level + 1;
+    u64 size = U64_FROM_BIT(pt_level_shift(next));
+    u64 phys = page_from_pte(old);
+    u64 flags = flags_from_block_pte(old);
+    for (int i = 0; i < PTE_ENTRIES; i++, phys += size)
+        tp[i] = (next == PT_PTE_LEVEL) ? page_pte(phys, flags) : block_pte(phys, flags);
+    pte_set(entry, new_level_pte(tp_phys));
+#ifdef PAGE_UPDATE_DEBUG
+    page_debug("split level %d entry at 0x%lx for 0x%lx\n", level, addr, bound(vaddr));
+#endif
+    page_invalidate(bound(fe), addr);
+    return true;
+}
+
+/* Split any block mappings straddling the boundaries of [vaddr, vaddr + length), so that
+   operations on the range don't affect pages outside of it. */
+static void split_pages(u64 vaddr, u64 length, flush_entry fe)
+{
+    traverse_ptes(vaddr, PAGESIZE, stack_closure(split_entry, vaddr, fe));
+    u64 end = vaddr + length;
+    traverse_ptes(end, PAGESIZE, stack_closure(split_entry, end, fe));
+}
+
 /* called with lock held */
 closure_function(2, 3, boolean, update_pte_flags,
                  pageflags, flags, flush_entry, fe,
@@ -233,6 +273,7 @@ void update_map_flags_with_complete(u64 vaddr, u64 length, pageflags flags, stat
     /* Catch any attempt to change page flags in a linear_backed mapping */
     assert(!intersects_linear_backed(irangel(vaddr, length)));
     flush_entry fe = get_page_flush_entry();
+    split_pages(vaddr, length, fe);
     traverse_ptes(vaddr, length, stack_closure(update_pte_flags, flags, fe));
     page_invalidate_sync(fe, complete);
 #ifdef PAGE_DUMP_ALL
@@ -254,6 +295,9 @@ closure_function(3, 3, boolean, remap_entry,
     u64 phys = page_from_pte(oldentry);
     u64 flags = flags_from_pte(oldentry);
     int map_order = pte_order(level, oldentry);
+    /* a block moved to a misaligned address is mapped with pages */
+    if (level != PT_PTE_LEVEL && (new_curr & MASK(map_order)))
+        flags = flags_from_block_pte(oldentry);
 
 #ifdef PAGE_UPDATE_DEBUG
     page_debug("level %d, old curr 0x%lx, phys 0x%lx, new curr 0x%lx, entry 0x%lx, *entry 0x%lx, flags 0x%lx\n",
@@ -292,6 +336,7 @@ void remap_pages(u64 vaddr_new, u64 vaddr_old, u64 length)
     assert(range_empty(range_intersection(irange(vaddr_new, vaddr_new + length),
                                           irange(vaddr_old, vaddr_old + length))));
     flush_entry fe = get_page_flush_entry();
+    split_pages(vaddr_old, length, fe);
     traverse_ptes(vaddr_old, length, stack_closure(remap_entry, vaddr_new, vaddr_old, fe));
     page_invalidate_sync(fe, 0);
 #ifdef PAGE_DUMP_ALL
@@ -348,6 +393,7 @@ void unmap_pages_with_handler(u64 virtual, u64 length, range_handler rh)
 {
     assert(!((virtual & PAGEMASK) || (length & PAGEMASK)));
     flush_entry fe = get_page_flush_entry();
+    split_pages(virtual, length, fe);
     traverse_ptes(virtual, length, stack_closure(unmap_page, rh, fe));
     page_invalidate_sync(fe, 0);
 #ifdef PAGE_DUMP_ALL
@@ -547,19 +593,59 @@ void unmap(u64 virtual, u64 length)
     unmap_pages(virtual, length);
 }
 
-closure_function(1, 1, boolean, page_dealloc,
-                 heap, pageheap,
-                 range r)
+/* called with lock held */
+closure_function(2, 3, boolean, unmap_and_free_page,
+                 kernel_heaps, kh, flush_entry, fe,
+                 int level, u64 vaddr, pteptr entry)
 {
-    u64 virt = pagemem.pagevirt.start + r.start;
-    deallocate_u64(bound(pageheap), virt, range_span(r));
+    pte old_entry = pte_from_pteptr(entry);
+    if (pte_is_present(old_entry) && pte_is_mapping(level, old_entry)) {
+        pte_set(entry, 0);
+        page_invalidate(bound(fe), vaddr);
+
+        /* Block mappings (and pages split from them) are allocated from the page-backed heap,
+           single pages from the page cache. */
+        kernel_heaps kh = bound(kh);
+        heap h = (level == PT_PTE_LEVEL && !pte_is_split(old_entry)) ?
+                 (heap)kh->pages : (heap)kh->page_backed;
+        u64 virt = pagemem.pagevirt.start + page_from_pte(old_entry);
+        deallocate_u64(h, virt, pte_map_size(level, old_entry));
+    }
     return true;
 }
 
 void unmap_and_free_phys(u64 virtual, u64 length)
 {
-    unmap_pages_with_handler(virtual, length,
-                             stack_closure(page_dealloc, (heap)get_kernel_heaps()->pages));
+    assert(!((virtual & PAGEMASK) || (length & PAGEMASK)));
+    flush_entry fe = get_page_flush_entry();
+    split_pages(virtual, length, fe);
+    traverse_ptes(virtual, length, stack_closure(unmap_and_free_page, get_kernel_heaps(), fe));
+    page_invalidate_sync(fe, 0);
+}
+
+/* Map a block of size 2^order at v, unless any page in the block range is already mapped. */
+boolean map_block(u64 v, physical p, int order, pageflags flags)
+{
+    assert((v & MASK(order)) == 0);
+    assert((p & MASK(order)) == 0);
+    flags = pageflags_no_minpage(flags);
+    boolean mapped = false;
+    pagetable_lock();
+    u64 *table_ptr = pointer_from_pteaddr(get_pagetable_base(v));
+    u64 *t = table_ptr;
+    for (int level = PT_FIRST_LEVEL; level <= PT_PTE_LEVEL; level++) {
+        int shift = pt_level_shift(level);
+        pte e = t[(v >> shift) & INDEX_MASK];
+        if (!pte_is_present(e))
+            break;
+        if (shift <= order || pte_is_mapping(level, e))
+            goto out;
+        t = pointer_from_pteaddr(page_from_pte(e));
+    }
+    mapped = map_level(table_ptr, PT_FIRST_LEVEL, irangel(v, U64_FROM_BIT(order)), &p, flags.w, 0);
+  out:
+    pagetable_unlock();
+    return mapped;
 }
 
 void page_free_phys(u64 phys)
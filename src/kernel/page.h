@@ -27,6 +27,9 @@ flush_entry get_page_flush_entry();
 void page_invalidate(flush_entry f, u64 address);
 void page_invalidate_sync(flush_entry f, status_handler completion);
 void page_invalidate_flush();
+void page_invalidate_idle_enter(void);
+void page_invalidate_idle_exit(void);
+tuple flush_management(heap h);
 
 void invalidate(u64 page);
 void flush_tlb(boolean full_flush);
@@ -41,6 +44,9 @@ static inline void map(u64 v, physical p, u64 length, pageflags flags)
 
 void map_nolock(u64 v, physical p, u64 length, pageflags flags);
 
+/* map a single block of size 2^order, failing if any page in its range is mapped */
+boolean map_block(u64 v, physical p, int order, pageflags flags);
+
 void update_map_flags_with_complete(u64 vaddr, u64 length, pageflags flags, status_handler complete);
 
 static inline void update_map_flags(u64 vaddr, u64 length, pageflags flags)
@@ -57,6 +57,11 @@ static inline u64 page_offset(pagecache_page pp)
     return pp->state_offset & MASK(PAGECACHE_PAGESTATE_SHIFT);
 }
 
+static inline void pagecache_page_ref(pagecache_page pp)
+{
+    fetch_and_add_32(&pp->refcount, 1);
+}
+
 static inline range byte_range_from_page(pagecache pc, pagecache_page pp)
 {
     return range_lshift(irangel(page_offset(pp), 1), pc->page_order);
@@ -250,7 +255,7 @@ static boolean realloc_pagelocked(pagecache pc, pagecache_page pp)
     if (pp->kvirt == INVALID_ADDRESS) {
         return false;
     }
-    assert(pp->refcount++ == 0);
+    assert(fetch_and_add_32(&pp->refcount, 1) == 0);
     pp->write_count = 0;
     #ifdef KERNEL
     pp->phys = physical_from_virtual(pp->kvirt);
@@ -258,6 +263,7 @@ static boolean realloc_pagelocked(pagecache pc, pagecache_page pp)
     fetch_and_add(&pc->total_pages, 1);
     change_page_state_locked(pc, pp, PAGECACHE_PAGESTATE_ALLOC);
     pp->evicted = false;
+    pp->referenced = false;
     return true;
 }
 
@@ -273,6 +279,22 @@ static sg_buf pagecache_add_sgb(pagecache_page pp, sg_list sg, u64 size)
     return sgb;
 }
 
+/* Lock-free cache hit: with the node locked, a filled page that has not been evicted cannot lose its
+ * cache reference (eviction acquires the node lock before dropping it), so it can be used without
+ * taking the state lock. Instead of moving the page on the LRU lists, the hit is recorded in the
+ * referenced flag, which is consumed by the list scans in balance_page_lists_locked() and
+ * evict_from_list_locked(). */
+static boolean touch_page_nodelocked(pagecache_page pp)
+{
+    int state = page_state(pp);
+    if ((state != PAGECACHE_PAGESTATE_NEW && state != PAGECACHE_PAGESTATE_ACTIVE) || pp->evicted)
+        return false;
+    read_barrier();     /* page contents were filled before the state change */
+    if (!pp->referenced)
+        pp->referenced = true;
+    return true;
+}
+
 /* Returns true if the page is already cached (or is being fetched from disk), false if a disk read
  * needs to be requested to fetch the page (or re-allocation of a freed page failed). */
 static boolean touch_page_locked(pagecache_node pn, pagecache_page pp, merge m)
@@ -337,13 +359,17 @@ static boolean touch_or_fill_page_nodelocked(pagecache_node pn, pagecache_page p
     pagecache pc = pv->pc;
     range r;
 
+    if (touch_page_nodelocked(pp)) {
+        pagecache_page_ref(pp);
+        return true;
+    }
     pagecache_lock_state(pc);
     pagecache_debug("%s: pn %p, pp %p, m %p, state %d\n", func_ss, pn, pp, m, page_state(pp));
     switch (page_state(pp)) {
     case PAGECACHE_PAGESTATE_READING:
         if (m) {
             enqueue_page_completion_statelocked(pc, pp, apply_merge(m));
-            pp->refcount++;
+            pagecache_page_ref(pp);
         }
         pagecache_unlock_state(pc);
         return false;
@@ -366,7 +392,7 @@ static boolean touch_or_fill_page_nodelocked(pagecache_node pn, pagecache_page p
                 zero(pp->kvirt, cache_pagesize(pc));
                 change_page_state_locked(pc, pp, PAGECACHE_PAGESTATE_NEW);
             }
-            pp->refcount++;
+            pagecache_page_ref(pp);
         }
         pagecache_unlock_state(pc);
 
@@ -401,13 +427,20 @@ static boolean touch_or_fill_page_nodelocked(pagecache_node pn, pagecache_page p
     default:
         halt("%s: invalid state %d\n", func_ss, page_state(pp));
     }
-    pp->refcount++;
+    pagecache_page_ref(pp);
     pagecache_unlock_state(pc);
     return true;
 }
 
 #endif
 
+static void pagecache_page_delete_nodelocked(pagecache pc, pagecache_node pn, pagecache_page pp)
+{
+    rbtree_remove_node(&pn->pages, &pp->rbnode);
+    pagelist_remove(&pc->free, pp);
+    deallocate(pc->pp_heap, pp, sizeof(*pp));
+}
+
 static void pagecache_page_delete_locked(pagecache pc, pagecache_page pp)
 {
     pagecache_node pn = pp->node;
@@ -417,15 +450,13 @@ static void pagecache_page_delete_locked(pagecache pc, pagecache_page pp)
     if (!pagecache_trylock_node(pn))
         return;
 
-    rbtree_remove_node(&pn->pages, &pp->rbnode);
+    pagecache_page_delete_nodelocked(pc, pn, pp);
     pagecache_unlock_node(pn);
-    pagelist_remove(&pc->free, pp);
-    deallocate(pc->pp_heap, pp, sizeof(*pp));
 }
 
 static void pagecache_page_release_locked(pagecache pc, pagecache_page pp, boolean full_delete)
 {
-    if (--pp->refcount > 0)
+    if (fetch_and_add_32(&pp->refcount, -1) > 1)
         return;
     pagecache_debug("%s: pp %p state %d\n", func_ss, pp, page_state(pp));
     assert(pp->write_count == 0);
@@ -475,6 +506,7 @@ static pagecache_page allocate_page_nodelocked(pagecache_node pn, u64 offset)
     pp->node = pn;
     pp->l.next = pp->l.prev = 0;
     pp->evicted = false;
+    pp->referenced = false;
 #ifdef KERNEL
     pp->phys = physical_from_virtual(p);
 #endif
@@ -498,14 +530,31 @@ static u64 evict_from_list_locked(pagecache pc, struct pagelist *pl, u64 pages)
         pagecache_page pp = struct_from_list(l, pagecache_page, l);
         if (pp->evicted)
             continue;
+        if (pp->referenced) {
+            /* hit since the last scan: promote new pages, rotate active pages */
+            pp->referenced = false;
+            if (pl == &pc->new)
+                change_page_state_locked(pc, pp, PAGECACHE_PAGESTATE_ACTIVE);
+            else
+                pagelist_touch(pl, pp);
+            continue;
+        }
+
+        /* The node lock keeps lock-free hits (touch_page_nodelocked) from racing with eviction. */
+        pagecache_node pn = pp->node;
+        if (!pagecache_trylock_node(pn))
+            continue;
         assert(pp->refcount != 0);
-        pagecache_debug("%s: list %s, release pp %p - %R, state %d, count %ld\n", func_ss,
+        pagecache_debug("%s: list %s, release pp %p - %R, state %d, count %d\n", func_ss,
                         pl == &pc->new ? ss("new") : ss("active"), pp, byte_range_from_page(pc, pp),
                         page_state(pp), pp->refcount);
         pp->evicted = true;
         if (pp->refcount == 1)
             evicted++;
-        pagecache_page_release_locked(pc, pp, true);
+        pagecache_page_release_locked(pc, pp, false);
+        if (page_state(pp) == PAGECACHE_PAGESTATE_FREE)
+            pagecache_page_delete_nodelocked(pc, pn, pp);
+        pagecache_unlock_node(pn);
     }
     return evicted;
 }
@@ -520,10 +569,14 @@ static void balance_page_lists_locked(pagecache pc)
         if (dp <= 0)
             break;
         pagecache_page pp = struct_from_list(l, pagecache_page, l);
-        /* We don't presently have a notion of "time" in the cache, so
-           just cull unreferenced buffers in LRU fashion until active
-           pages are equivalent to new...loosely inspired by linux
-           approach. */
+        /* Pages hit since the last scan get a second chance; otherwise
+           cull unreferenced buffers in LRU fashion until active pages
+           are equivalent to new...loosely inspired by linux approach. */
+        if (pp->referenced) {
+            pp->referenced = false;
+            pagelist_touch(&pc->active, pp);
+            continue;
+        }
         if (pp->refcount == 1) {
             pagecache_debug("   pp %R -> new\n", byte_range_from_page(pc, pp));
             change_page_state_locked(pc, pp, PAGECACHE_PAGESTATE_NEW);
@@ -797,7 +850,7 @@ closure_function(1, 3, void, pagecache_write_sg,
             err_msg = ss("failed to re-allocate pagecache page");
             break;
         }
-        pp->refcount++;
+        pagecache_page_ref(pp);
         if (page_state(pp) == PAGECACHE_PAGESTATE_READING)
             enqueue_page_completion_statelocked(pc, pp, apply_merge(m));
         pagecache_unlock_state(pc);
@@ -1066,7 +1119,7 @@ define_closure_function(3, 1, void, pagecache_commit_dirty_ranges,
             /* Reserve the page, unless it is in DIRTY state (in which case it has been reserved
              * when switching to DIRTY state). */
             if (page_state(pp) != PAGECACHE_PAGESTATE_DIRTY)
-                pp->refcount++;
+                pagecache_page_ref(pp);
             change_page_state_locked(pc, pp, PAGECACHE_PAGESTATE_WRITING);
             pp->write_count++;
             pagecache_unlock_state(pc);
@@ -1101,9 +1154,11 @@ closure_function(2, 1, boolean, dirty_range_handler,
     return true;
 }
 
-static void pagecache_commit_dirty_node(pagecache_node pn, status_handler complete)
+/* Commits the dirty ranges of the node that intersect q; the completion is invoked when all write
+ * operations previously issued for the node (including the ones issued here) have completed. */
+static void pagecache_commit_dirty_node(pagecache_node pn, range q, status_handler complete)
 {
-    pagecache_debug("committing dirty node %p\n", pn);
+    pagecache_debug("committing dirty node %p, range %R\n", pn, q);
     pagecache_lock_node(pn);
     heap h = pn->pv->pc->h;
     status_handler sh;
@@ -1118,8 +1173,7 @@ static void pagecache_commit_dirty_node(pagecache_node pn, status_handler comple
             deallocate_buffer(b);
             goto oom;
         }
-        rangemap_range_lookup(&pn->dirty, irange(0, infinity),
-                              stack_closure(dirty_range_handler, &pn->dirty, b));
+        rangemap_range_lookup(&pn->dirty, q, stack_closure(dirty_range_handler, &pn->dirty, b));
         op->common.type = PAGECACHE_NODE_OP_COMMIT;
         list_push_back(&pn->ops, &op->common.l);
         sh = init_closure(&op->commit, pagecache_commit_dirty_ranges, pn, b, complete);
@@ -1132,7 +1186,7 @@ static void pagecache_commit_dirty_node(pagecache_node pn, status_handler comple
         list_push_back(&pn->ops, &op->common.l);
     }
     pagecache_lock_volume(pn->pv);
-    if (list_inserted(&pn->l))
+    if (list_inserted(&pn->l) && (rangemap_count(&pn->dirty) == 0))
         list_delete(&pn->l);
     pagecache_unlock_volume(pn->pv);
     pagecache_unlock_node(pn);
@@ -1159,7 +1213,7 @@ static void pagecache_commit_dirty_pages(pagecache pc)
             pagecache_unlock_volume(pv);
             if (l) {
                 pn = struct_from_list(l, pagecache_node, l);
-                pagecache_commit_dirty_node(pn, 0);
+                pagecache_commit_dirty_node(pn, irange(0, infinity), 0);
             } else {
                 pn = 0;
             }
@@ -1192,7 +1246,14 @@ void pagecache_sync_node(pagecache_node pn, status_handler complete)
 {
     pagecache_debug("%s: pn %p, complete %p (%F)\n", func_ss, pn, complete, complete);
     pagecache_scan_node(pn);
-    pagecache_commit_dirty_node(pn, complete);
+    pagecache_commit_dirty_node(pn, irange(0, infinity), complete);
+}
+
+void pagecache_sync_node_range(pagecache_node pn, range q /* bytes */, status_handler complete)
+{
+    pagecache_debug("%s: pn %p, q %R, complete %p (%F)\n", func_ss, pn, q, complete, complete);
+    pagecache_scan_node(pn);
+    pagecache_commit_dirty_node(pn, q, complete);
 }
 
 closure_function(1, 1, boolean, purge_range_handler,
@@ -1252,10 +1313,44 @@ void pagecache_purge_node(pagecache_node pn, status_handler complete)
         apply(complete, s);
 }
 
+/* Drops the clean, unreferenced pages that intersect q, so that subsequent reads fetch the range
+ * from storage again. Pages that are dirty, under I/O or mapped by a user program are left in
+ * place. */
+void pagecache_node_invalidate_range(pagecache_node pn, range q /* bytes */)
+{
+    pagecache pc = pn->pv->pc;
+    range pages = range_rshift_pad(q, pc->page_order);
+    pagecache_debug("%s: pn %p, q %R\n", func_ss, pn, q);
+    if (range_span(pages) == 0)
+        return;
+    struct pagecache_page k;
+    k.state_offset = pages.start;
+    pagecache_lock_node(pn);
+    pagecache_page pp = (pagecache_page)rbtree_lookup_max_lte(&pn->pages, &k.rbnode);
+    if (pp == INVALID_ADDRESS)
+        pp = (pagecache_page)rbtree_find_first(&pn->pages);
+    else if (page_offset(pp) < pages.start)
+        pp = (pagecache_page)rbnode_get_next((rbnode)pp);
+    pagecache_lock_state(pc);
+    while ((pp != INVALID_ADDRESS) && (page_offset(pp) < pages.end)) {
+        pagecache_page next = (pagecache_page)rbnode_get_next((rbnode)pp);
+        int state = page_state(pp);
+        if (((state == PAGECACHE_PAGESTATE_NEW) || (state == PAGECACHE_PAGESTATE_ACTIVE)) &&
+            !pp->evicted && (pp->refcount == 1)) {
+            pp->evicted = true;
+            pagecache_page_release_locked(pc, pp, false);
+            pagecache_page_delete_nodelocked(pc, pn, pp);
+        }
+        pp = next;
+    }
+    pagecache_unlock_state(pc);
+    pagecache_unlock_node(pn);
+}
+
 closure_func_basic(pp_handler, boolean, pagecache_pin_handler,
                    pagecache_page pp)
 {
-    pp->refcount++;
+    pagecache_page_ref(pp);
     return true;
 }
 
@@ -1335,7 +1430,7 @@ static void pagecache_node_fetch_internal(pagecache_node pn, range q, pp_handler
     sg_buf sgb = 0;
     sstring err_msg = sstring_null();
     status_handler fetch_complete = 0;
-    pagecache_lock_state(pc);
+    boolean state_locked = false;
     u64 pi;
     for (pi = k.state_offset; pi < end; pi++) {
         if (pp == INVALID_ADDRESS || page_offset(pp) > pi) {
@@ -1345,7 +1440,16 @@ static void pagecache_node_fetch_internal(pagecache_node pn, range q, pp_handler
                 break;
             }
         }
-        if (touch_page_locked(pn, pp, m)) {
+        boolean cached = touch_page_nodelocked(pp);
+        if (!cached) {
+            /* the state lock is only needed (and then kept) once a page is not a plain hit */
+            if (!state_locked) {
+                pagecache_lock_state(pc);
+                state_locked = true;
+            }
+            cached = touch_page_locked(pn, pp, m);
+        }
+        if (cached) {
             /* This page does not need to be fetched: fetch pages accumulated so far in read_sg. */
             if (read_sg) {
                 pagecache_unlock_state(pc);
@@ -1395,7 +1499,7 @@ static void pagecache_node_fetch_internal(pagecache_node pn, range q, pp_handler
                     break;
                 }
             }
-            pp->refcount++;
+            pagecache_page_ref(pp);
             read_r.end += read_size;
         }
         if (ph && !apply(ph, pp)) {
@@ -1404,7 +1508,8 @@ static void pagecache_node_fetch_internal(pagecache_node pn, range q, pp_handler
         }
         pp = (pagecache_page)rbnode_get_next((rbnode)pp);
     }
-    pagecache_unlock_state(pc);
+    if (state_locked)
+        pagecache_unlock_state(pc);
     pagecache_unlock_node(pn);
     if (read_sg)
         pagecache_node_fetch_sg(pc, pn, read_r, read_sg, fetch_complete);
@@ -1444,7 +1549,7 @@ closure_function(3, 1, boolean, pagecache_read_pp_handler,
     sgb->offset = 0;
     sgb->refcount = &pp->read_refcount;
     if (fetch_and_add(&pp->read_refcount.c, 1) == 0)
-        pp->refcount++;
+        pagecache_page_ref(pp);
     return true;
 }
 
@@ -1462,6 +1567,19 @@ closure_function(1, 3, void, pagecache_read_sg,
 
 
 #ifdef KERNEL
+/* marks a page dirtied through a shared mapping */
+static void pagecache_page_dirty_nodelocked(pagecache pc, pagecache_node pn, pagecache_page pp,
+                                            range r)
+{
+    pagecache_lock_state(pc);
+    if (page_state(pp) != PAGECACHE_PAGESTATE_DIRTY) {
+        change_page_state_locked(pc, pp, PAGECACHE_PAGESTATE_DIRTY);
+        pagecache_page_ref(pp);
+    }
+    pagecache_unlock_state(pc);
+    pagecache_set_dirty(pn, r);
+}
+
 closure_function(3, 3, boolean, pagecache_check_dirty_page,
                  pagecache, pc, pagecache_shared_map, sm, flush_entry, fe,
                  int level, u64 vaddr, pteptr entry)
@@ -1481,13 +1599,7 @@ closure_function(3, 3, boolean, pagecache_check_dirty_page,
         pagecache_lock_node(pn);
         pagecache_page pp = page_lookup_nodelocked(pn, pi);
         assert(pp != INVALID_ADDRESS);
-        pagecache_lock_state(pc);
-        if (page_state(pp) != PAGECACHE_PAGESTATE_DIRTY) {
-            change_page_state_locked(pc, pp, PAGECACHE_PAGESTATE_DIRTY);
-            pp->refcount++;
-        }
-        pagecache_unlock_state(pc);
-        pagecache_set_dirty(pn, r);
+        pagecache_page_dirty_nodelocked(pc, pn, pp, r);
         pagecache_unlock_node(pn);
     }
     return true;
@@ -1619,7 +1731,7 @@ void pagecache_node_scan_and_commit_shared_pages(pagecache_node pn, range q /* b
     flush_entry fe = get_page_flush_entry();
     rangemap_range_lookup(pn->shared_maps, q,
                           stack_closure(scan_shared_pages_intersection, pn->pv->pc, fe));
-    pagecache_commit_dirty_node(pn, 0);
+    pagecache_commit_dirty_node(pn, irange(0, infinity), 0);
     page_invalidate_sync(fe, 0);
 }
 
@@ -1655,10 +1767,20 @@ void pagecache_node_fetch_pages(pagecache_node pn, range r)
     pagecache_node_fetch_internal(pn, r, 0, ignore_status);
 }
 
+/* called with node locked */
 static void map_page(pagecache pc, pagecache_page pp, u64 vaddr, pageflags flags, status_handler complete)
 {
     assert(pp->refcount != 0);
     assert(pp->kvirt != INVALID_ADDRESS);
+    if (physical_from_virtual(pointer_from_u64(vaddr)) != INVALID_PHYSICAL) {
+        /* already mapped, e.g. by a fault-around from a neighboring page fault */
+        pagecache_lock_state(pc);
+        pagecache_page_release_locked(pc, pp, false);
+        pagecache_unlock_state(pc);
+        if (complete)
+            apply(complete, STATUS_OK);
+        return;
+    }
     map_with_complete(vaddr, pp->phys, cache_pagesize(pc), flags, complete);
 }
 
@@ -1667,7 +1789,10 @@ closure_function(5, 1, void, map_page_finish,
                  status s)
 {
     if (is_ok(s)) {
+        pagecache_node pn = bound(pp)->node;
+        pagecache_lock_node(pn);
         map_page(bound(pc), bound(pp), bound(vaddr), bound(flags), bound(complete));
+        pagecache_unlock_node(pn);
     } else {
         apply(bound(complete), s);
     }
@@ -1717,6 +1842,40 @@ boolean pagecache_map_page_if_filled(pagecache_node pn, u64 node_offset, u64 vad
     return mapped;
 }
 
+/* Map the pages in virtual range v (starting at node_offset) which are resident in the cache
+   and not already mapped. Pages not yet filled are skipped; no I/O is initiated. Returns the
+   number of pages mapped. */
+u64 pagecache_map_pages_if_filled(pagecache_node pn, u64 node_offset, range v, pageflags flags)
+{
+    pagecache pc = pn->pv->pc;
+    u64 pagesize = cache_pagesize(pc);
+    u64 mapped = 0;
+    pagecache_lock_node(pn);
+    for (u64 vaddr = v.start; vaddr < v.end; vaddr += pagesize, node_offset += pagesize) {
+        pagecache_page pp = page_lookup_nodelocked(pn, node_offset >> pc->page_order);
+        if (pp == INVALID_ADDRESS)
+            continue;
+        switch (page_state(pp)) {
+        case PAGECACHE_PAGESTATE_NEW:
+        case PAGECACHE_PAGESTATE_ACTIVE:
+        case PAGECACHE_PAGESTATE_WRITING:
+        case PAGECACHE_PAGESTATE_DIRTY:
+            break;
+        default:
+            continue;
+        }
+        if (physical_from_virtual(pointer_from_u64(vaddr)) != INVALID_PHYSICAL)
+            continue;
+        if (touch_or_fill_page_nodelocked(pn, pp, 0)) {
+            map_with_complete(vaddr, pp->phys, pagesize, flags, 0);
+            mapped++;
+        }
+    }
+    pagecache_unlock_node(pn);
+    pagecache_debug("%s: pn %p, v %R, mapped %ld\n", func_ss, pn, v, mapped);
+    return mapped;
+}
+
 closure_function(4, 3, boolean, pagecache_unmap_page_nodelocked,
                  pagecache_node, pn, u64, vaddr_base, u64, node_offset, flush_entry, fe,
                  int level, u64 vaddr, pteptr entry)
@@ -1735,6 +1894,9 @@ closure_function(4, 3, boolean, pagecache_unmap_page_nodelocked,
         if (phys == pp->phys) {
             /* shared or cow */
             assert(pp->refcount >= 1);
+            if (pte_is_dirty(old_entry))
+                pagecache_page_dirty_nodelocked(pc, bound(pn), pp,
+                                                irangel(pi << PAGELOG, cache_pagesize(pc)));
             pagecache_lock_state(pc);
             pagecache_page_release_locked(pc, pp, false);
             pagecache_unlock_state(pc);
@@ -1757,6 +1919,20 @@ void pagecache_node_unmap_pages(pagecache_node pn, range v /* bytes */, u64 node
     pagecache_unlock_node(pn);
     page_invalidate_sync(fe, 0);
 }
+
+/* Unlike pagecache_node_unmap_pages(), the range stays in the shared maps of the node (the mapping
+ * is still in place), so that pages faulted in again and written through the mapping are still
+ * tracked as dirty; the dirty state of the unmapped pages is moved to the page cache. */
+void pagecache_node_drop_mapped_pages(pagecache_node pn, range v /* bytes */, u64 node_offset)
+{
+    pagecache_debug("%s: pn %p, v %R, node_offset 0x%lx\n", func_ss, pn, v, node_offset);
+    flush_entry fe = get_page_flush_entry();
+    pagecache_lock_node(pn);
+    traverse_ptes(v.start, range_span(v), stack_closure(pagecache_unmap_page_nodelocked, pn,
+                                                        v.start, node_offset, fe));
+    pagecache_unlock_node(pn);
+    page_invalidate_sync(fe, 0);
+}
 #endif
 
 closure_func_basic(rbnode_handler, boolean, pagecache_page_print_key,
@@ -11,7 +11,9 @@ u64 pagecache_get_node_length(pagecache_node pn);
 void pagecache_node_finish_pending_writes(pagecache_node pn, status_handler complete);
 
 void pagecache_sync_node(pagecache_node pn, status_handler complete);
+void pagecache_sync_node_range(pagecache_node pn, range q /* bytes */, status_handler complete);
 void pagecache_purge_node(pagecache_node pn, status_handler complete);
+void pagecache_node_invalidate_range(pagecache_node pn, range q /* bytes */);
 
 void pagecache_nodelocked_pin(pagecache_node pn, range pages);
 void pagecache_node_unpin(pagecache_node pn, range pages);
@@ -51,7 +53,11 @@ void pagecache_map_page(pagecache_node pn, u64 node_offset, u64 vaddr, pageflags
 boolean pagecache_map_page_if_filled(pagecache_node pn, u64 node_offset, u64 vaddr, pageflags flags,
                                      status_handler complete);
 
+u64 pagecache_map_pages_if_filled(pagecache_node pn, u64 node_offset, range v, pageflags flags);
+
 void pagecache_node_unmap_pages(pagecache_node pn, range v /* bytes */, u64 node_offset);
+
+void pagecache_node_drop_mapped_pages(pagecache_node pn, range v /* bytes */, u64 node_offset);
 #endif
 
 
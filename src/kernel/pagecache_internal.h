@@ -22,7 +22,8 @@ typedef struct pagecache {
     void *zero_page;            /* for zero-fill dma */
 
     /* state_lock covers list access, page state changes and
-       alterations to page completion vecs */
+       alterations to page completion vecs; cache hits on filled pages
+       are served with only the node lock held (see touch_page_nodelocked) */
 #ifdef KERNEL
     struct spinlock state_lock;
     struct spinlock global_lock;
@@ -55,8 +56,8 @@ typedef struct pagecache_node {
     struct list l;              /* volume-wide node list */
     pagecache_volume pv;
 
-    /* pages_lock covers traversal, insertions and removals - consider
-       changing to a rw lock or semaphore */
+    /* pages_lock covers traversal, insertions and removals, as well as
+       eviction of filled pages - consider changing to a rw lock or semaphore */
 #ifdef KERNEL
     struct spinlock pages_lock;
 #endif
@@ -123,7 +124,7 @@ struct pagecache_page {
     u64 state_offset;           /* 40 - state and offset in pages */
     void *kvirt;                /* 48 */
     int write_count;            /* 56 */
-    int refcount;               /* 60 */
+    u32 refcount;               /* 60 - atomic */
     /* end of first cacheline */
 
     pagecache_node node;
@@ -133,4 +134,5 @@ struct pagecache_page {
 
     closure_struct(thunk, read_release);
     boolean evicted;
+    boolean referenced;         /* hit since last list scan; set without state lock */
 };
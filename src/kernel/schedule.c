@@ -35,6 +35,7 @@ NOTRACE void __attribute__((noreturn)) kernel_sleep(void)
     cpuinfo ci = current_cpu();
     sched_debug("sleep\n");
     ci->state = cpu_idle;
+    page_invalidate_idle_enter();
     bitmap_set_atomic(idle_cpu_mask, ci->id, 1);
 
     while (1) {
@@ -61,11 +62,36 @@ static void wakeup_cpu(u64 cpu)
     }
 }
 
-static sched_task sched_dequeue_for_cpu(sched_queue sq, u64 cpu)
+/* Steal candidates are visited in order of increasing distance from the
+ * stealing cpu, so that migrated threads keep as much cache state as possible. */
+enum {
+    SCHED_STEAL_SMT,
+    SCHED_STEAL_LLC,
+    SCHED_STEAL_REMOTE,
+    SCHED_STEAL_LEVELS
+};
+
+static inline int sched_steal_level(cpuinfo a, cpuinfo b)
+{
+    if (a->smt_group == b->smt_group)
+        return SCHED_STEAL_SMT;
+    if (a->llc_group == b->llc_group)
+        return SCHED_STEAL_LLC;
+    return SCHED_STEAL_REMOTE;
+}
+
+/* If try is true, the queue lock is not waited for, so that a thief never
+ * delays the owner of the queue or another thief. */
+static sched_task sched_dequeue_for_cpu(sched_queue sq, u64 cpu, boolean try)
 {
     u32 i;
     sched_task task;
-    spin_lock(&sq->lock);
+    if (try) {
+        if (!spin_try(&sq->lock))
+            return INVALID_ADDRESS;
+    } else {
+        spin_lock(&sq->lock);
+    }
 
     /* Note: due to weak ordering in the priority queue, this code does NOT guarantee that the
      * chosen task is the highest priority (lowest runtime) task among all eligible tasks; however,
@@ -95,7 +121,7 @@ static sched_task migrate_to_self(sched_task t, u64 self, u64 first_cpu, u64 ncp
             ((cpu = bitmap_range_get_first(idle_cpu_mask, first_cpu, ncpus)) != INVALID_PHYSICAL)) {
         cpuinfo cpui = cpuinfo_from_id(cpu);
         if (t == INVALID_ADDRESS) {
-            t = sched_dequeue_for_cpu(&cpui->thread_queue, self);
+            t = sched_dequeue_for_cpu(&cpui->thread_queue, self, false);
             if (t != INVALID_ADDRESS)
                 sched_debug("migrating thread from idle CPU %d to self\n", cpu);
         }
@@ -116,7 +142,7 @@ static void migrate_from_self(cpuinfo ci, u64 first_cpu, u64 ncpus)
         sched_task task;
         if (!sched_queue_empty(&cpui->thread_queue)) {
             wakeup_cpu(cpu);
-        } else if ((task = sched_dequeue_for_cpu(&ci->thread_queue, cpu)) != INVALID_ADDRESS) {
+        } else if ((task = sched_dequeue_for_cpu(&ci->thread_queue, cpu, false)) != INVALID_ADDRESS) {
             sched_debug("migrating thread from self to idle CPU %d\n", cpu);
             sched_enqueue(&cpui->thread_queue, task);
             wakeup_cpu(cpu);
@@ -126,6 +152,33 @@ static void migrate_from_self(cpuinfo ci, u64 first_cpu, u64 ncpus)
     }
 }
 
+/* Steal a thread from a cpu that is not idle, trying SMT siblings first, then
+ * cpus sharing the last-level cache, then remote cpus. Queues are checked
+ * without locking before attempting a dequeue. */
+static sched_task steal_from_busy(cpuinfo ci)
+{
+    u64 self = ci->id;
+    for (int level = SCHED_STEAL_SMT; level < SCHED_STEAL_LEVELS; level++) {
+        for (u64 cpu = self + 1; ; cpu++) {
+            if (cpu == total_processors)
+                cpu = 0;
+            if (cpu == self)
+                break;
+            cpuinfo cpui = cpuinfo_from_id(cpu);
+            if (cpui->state == cpu_not_present || cpui->state == cpu_idle ||
+                sched_steal_level(ci, cpui) != level ||
+                sched_queue_empty(&cpui->thread_queue))
+                continue;
+            sched_task t = sched_dequeue_for_cpu(&cpui->thread_queue, self, true);
+            if (t != INVALID_ADDRESS) {
+                sched_debug("migrating thread from CPU %d (level %d) to self\n", cpu, level);
+                return t;
+            }
+        }
+    }
+    return INVALID_ADDRESS;
+}
+
 static inline boolean update_timer(timestamp here)
 {
     timestamp next = kernel_timers->next_expiry;
@@ -222,21 +275,8 @@ NOTRACE void __attribute__((noreturn)) runloop_internal(void)
                 t = migrate_to_self(t, self, 0, self);
             if (t == INVALID_ADDRESS) {
                 /* No threads found in idle CPUs: try to steal a thread from a
-                 * CPU that is currently running another thread. */
-                for (u64 cpu = self + 1; ; cpu++) {
-                    if (cpu == total_processors)
-                        cpu = 0;
-                    if (cpu == self)
-                        break;
-                    cpuinfo cpui = cpuinfo_from_id(cpu);
-                    if (cpui->state == cpu_user) {
-                        t = sched_dequeue_for_cpu(&cpui->thread_queue, self);
-                        if (t != INVALID_ADDRESS) {
-                            sched_debug("migrating thread from CPU %d to self\n", cpu);
-                            break;
-                        }
-                    }
-                }
+                 * CPU that is currently busy. */
+                t = steal_from_busy(ci);
             }
         } else {
             /* Wake up idle CPUs that have a non-empty thread queue, and if our
@@ -344,6 +384,10 @@ void sched_enqueue(sched_queue sq, sched_task task)
 
 sched_task sched_dequeue(sched_queue sq)
 {
+    /* The owner avoids the lock when there is nothing to run; a concurrent
+     * enqueue is picked up by the runloop check before sleeping. */
+    if (sched_queue_empty(sq))
+        return INVALID_ADDRESS;
     spin_lock(&sq->lock);
     sched_task task = pqueue_pop(sq->q);
     if (task != INVALID_ADDRESS) {
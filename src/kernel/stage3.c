@@ -47,6 +47,9 @@ static void init_kernel_heaps_management(tuple root)
     set(heaps, sym(physical), heap_management((heap)heap_physical(kh)));
     set(heaps, sym(general), heap_management((heap)heap_general(kh)));
     set(heaps, sym(locked), heap_management((heap)heap_locked(kh)));
+    tuple numa = numa_management();
+    if (numa)
+        set(heaps, sym(numa), numa);
     set(root, sym(heaps), heaps);
 }
 
@@ -68,6 +71,9 @@ closure_function(6, 0, void, startup,
     /* register root tuple with management and kick off interfaces, if any */
     init_management_root(root);
     init_kernel_heaps_management(root);
+    tuple tlb = flush_management(general);
+    if (tlb)
+        set(root, sym(tlb), tlb);
     if (get(root, sym(readonly_rootfs)))
         filesystem_set_readonly(fs);
     value p = get(root, sym(program));
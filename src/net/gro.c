@@ -0,0 +1,336 @@
+/* Generic receive offload: in-order TCP segments of a flow received in the same batch are
+ * coalesced into a single packet (with a chained pbuf) before being passed to lwIP, so that the
+ * TCP input path runs once per batch instead of once per segment.
+ * Segments with congestion notifications (ECE or CWR flags, or the CE codepoint in the IP header)
+ * are not coalesced, and segments are coalesced only with segments having the same IP type of
+ * service (or traffic class), so that ECN signals reach the TCP stack unaltered.
+ * Packets being coalesced are flushed when a segment with the PSH flag or with other flags than
+ * ACK is received, when a segment does not belong to the flow or is out of order, and at the end
+ * of the batch, i.e. when a driver calls net_gro_flush() or, for drivers that process received
+ * packets in separate asynchronous completions, when the async queue entries enqueued before the
+ * first coalesced segment have been processed.
+ * Segment payloads are not read: the checksum of a coalesced packet is derived from the checksums
+ * of its segments, so that the packet fails validation if any of its segments is corrupted. */
+
+#include <kernel.h>
+#include <lwip.h>
+#include <lwip/inet_chksum.h>
+#include <lwip/prot/tcp.h>
+#include <netif/ethernet.h>
+
+#define NET_GRO_ECN_MASK    0x3
+#define NET_GRO_ECN_CE      0x3
+
+typedef struct net_gro_seg {
+    void *iphdr;
+    struct tcp_hdr *tcphdr;
+    u16 hdr_len;    /* link, network and transport headers */
+    u16 data_len;
+    u16 data_csum;
+} *net_gro_seg;
+
+static struct list net_gro_list;
+static struct spinlock net_gro_lock;
+
+static inline u16 csum_add(u16 a, u16 b)
+{
+    u32 acc = (u32)a + b;
+    return (acc & 0xffff) + (acc >> 16);
+}
+
+static u16 net_gro_pseudo_csum(struct pbuf *p, void *iphdr, u16 tcp_len)
+{
+    if (IP_HDR_GET_VERSION(iphdr) == 4) {
+        struct ip_hdr *ip4hdr = iphdr;
+        ip4_addr_t src, dest;
+        ip4_addr_copy(src, ip4hdr->src);
+        ip4_addr_copy(dest, ip4hdr->dest);
+        return ~ip4_chksum_pseudo_partial(p, IP_PROTO_TCP, tcp_len, 0, &src, &dest);
+    } else {
+        struct ip6_hdr *ip6hdr = iphdr;
+        ip6_addr_t src, dest;
+        ip6_addr_copy_from_packed(src, ip6hdr->src);
+        ip6_addr_copy_from_packed(dest, ip6hdr->dest);
+        return ~ip6_chksum_pseudo_partial(p, IP6_NEXTH_TCP, tcp_len, 0, &src, &dest);
+    }
+}
+
+/* type of service (IPv4) or traffic class (IPv6), including the ECN field */
+static u8 net_gro_tos(void *iphdr)
+{
+    if (IP_HDR_GET_VERSION(iphdr) == 4)
+        return IPH_TOS((struct ip_hdr *)iphdr);
+    return IP6H_TC((struct ip6_hdr *)iphdr);
+}
+
+/* Returns true if the packet is a TCP segment with payload that can be coalesced with other
+ * segments. */
+static boolean net_gro_parse(struct pbuf *p, net_gro_seg s)
+{
+    if (p->len < SIZEOF_ETH_HDR + IP_HLEN)
+        return false;
+    struct eth_hdr *ethhdr = p->payload;
+    void *iphdr = p->payload + SIZEOF_ETH_HDR;
+    u16 iphdr_len, ip_len;
+    if (ethhdr->type == PP_HTONS(ETHTYPE_IP)) {
+        struct ip_hdr *ip4hdr = iphdr;
+
+        /* IP options and fragments are not supported */
+        if ((IPH_V(ip4hdr) != 4) || (IPH_HL_BYTES(ip4hdr) != IP_HLEN) ||
+            (IPH_PROTO(ip4hdr) != IP_PROTO_TCP) ||
+            (IPH_OFFSET(ip4hdr) & PP_HTONS(IP_OFFMASK | IP_MF)))
+            return false;
+        iphdr_len = IP_HLEN;
+        ip_len = lwip_ntohs(IPH_LEN(ip4hdr));
+    } else if (ethhdr->type == PP_HTONS(ETHTYPE_IPV6)) {
+        struct ip6_hdr *ip6hdr = iphdr;
+        if ((p->len < SIZEOF_ETH_HDR + IP6_HLEN) || (IP6H_V(ip6hdr) != 6) ||
+            (IP6H_NEXTH(ip6hdr) != IP6_NEXTH_TCP))
+            return false;
+        iphdr_len = IP6_HLEN;
+        ip_len = IP6_HLEN + IP6H_PLEN(ip6hdr);
+    } else {
+        return false;
+    }
+    if (p->len < SIZEOF_ETH_HDR + iphdr_len + TCP_HLEN)
+        return false;
+    struct tcp_hdr *tcphdr = iphdr + iphdr_len;
+    u16 tcphdr_len = TCPH_HDRLEN_BYTES(tcphdr);
+    s->hdr_len = SIZEOF_ETH_HDR + iphdr_len + tcphdr_len;
+
+    /* headers must be in the first pbuf, and the frame must not be padded */
+    if ((tcphdr_len < TCP_HLEN) || (p->len < s->hdr_len) ||
+        (p->tot_len != SIZEOF_ETH_HDR + ip_len) || (p->tot_len <= s->hdr_len))
+        return false;
+    if ((TCPH_FLAGS(tcphdr) & ~TCP_PSH) != TCP_ACK)
+        return false;
+
+    /* TCPH_FLAGS() does not include the ECN flags */
+    if ((lwip_ntohs(tcphdr->_hdrlen_rsvd_flags) & (TCP_ECE | TCP_CWR)) ||
+        ((net_gro_tos(iphdr) & NET_GRO_ECN_MASK) == NET_GRO_ECN_CE))
+        return false;
+    s->iphdr = iphdr;
+    s->tcphdr = tcphdr;
+    s->data_len = p->tot_len - s->hdr_len;
+
+    /* Retrieve the payload checksum from the segment checksum: if the segment is corrupted, so is
+     * the payload checksum. */
+    s->data_csum = ~csum_add(net_gro_pseudo_csum(p, iphdr, tcphdr_len + s->data_len),
+                             lwip_standard_chksum(tcphdr, tcphdr_len));
+    return true;
+}
+
+static boolean net_gro_match(net_gro g, net_gro_seg s)
+{
+    struct pbuf *head = g->head;
+    if ((s->hdr_len != g->hdr_len) || (head->tot_len + s->data_len > U16_MAX) ||
+        (lwip_ntohl(s->tcphdr->seqno) != g->next_seqno))
+        return false;
+    struct tcp_hdr *tcphdr = g->tcphdr;
+    if ((s->tcphdr->src != tcphdr->src) || (s->tcphdr->dest != tcphdr->dest) ||
+        (s->tcphdr->ackno != tcphdr->ackno))
+        return false;
+
+    /* link header, network addresses and TCP options */
+    void *iphdr = head->payload + SIZEOF_ETH_HDR;
+    bytes addr_offset, addr_len;
+    if (IP_HDR_GET_VERSION(iphdr) == 4) {
+        addr_offset = offsetof(struct ip_hdr *, src);
+        addr_len = 2 * sizeof(ip4_addr_p_t);
+    } else {
+        addr_offset = offsetof(struct ip6_hdr *, src);
+        addr_len = 2 * sizeof(ip6_addr_p_t);
+    }
+    return (!runtime_memcmp(s->iphdr - SIZEOF_ETH_HDR, head->payload, SIZEOF_ETH_HDR) &&
+            (IP_HDR_GET_VERSION(s->iphdr) == IP_HDR_GET_VERSION(iphdr)) &&
+            (net_gro_tos(s->iphdr) == net_gro_tos(iphdr)) &&
+            !runtime_memcmp(s->iphdr + addr_offset, iphdr + addr_offset, addr_len) &&
+            !runtime_memcmp(s->tcphdr + 1, tcphdr + 1, TCPH_HDRLEN_BYTES(tcphdr) - TCP_HLEN));
+}
+
+/* Called with the GRO lock held; returns the coalesced packet (if any), with network and transport
+ * headers updated to reflect the coalesced payload. */
+static struct pbuf *net_gro_detach(net_gro g)
+{
+    struct pbuf *p = g->head;
+    if (!p)
+        return 0;
+    g->head = 0;
+    g->packets++;
+    if (g->segs == 1)
+        return p;
+    void *iphdr = p->payload + SIZEOF_ETH_HDR;
+    struct tcp_hdr *tcphdr = g->tcphdr;
+    u16 tcphdr_len = TCPH_HDRLEN_BYTES(tcphdr);
+    u16 tcp_len = tcphdr_len + g->data_len;
+    if (IP_HDR_GET_VERSION(iphdr) == 4) {
+        struct ip_hdr *ip4hdr = iphdr;
+        u16 len = lwip_htons(IP_HLEN + tcp_len);
+
+        /* incremental checksum update (RFC 1624) */
+        IPH_CHKSUM_SET(ip4hdr, (u16)~csum_add(csum_add(~IPH_CHKSUM(ip4hdr), ~IPH_LEN(ip4hdr)), len));
+        IPH_LEN_SET(ip4hdr, len);
+    } else {
+        IP6H_PLEN_SET((struct ip6_hdr *)iphdr, tcp_len);
+    }
+    tcphdr->chksum = 0;
+    tcphdr->chksum = ~csum_add(csum_add(net_gro_pseudo_csum(p, iphdr, tcp_len),
+                                        lwip_standard_chksum(tcphdr, tcphdr_len)),
+                               g->data_csum);
+    return p;
+}
+
+/* The receive queue is recorded in the current CPU while the packet is being processed, so that
+ * sockets can learn which queue to busy-poll. Segments transmitted in response to the packet (e.g.
+ * those allowed by an incoming acknowledgment) are sent in a single transmit batch. A packet
+ * rejected by the network stack is freed. */
+static err_t net_gro_deliver(net_gro g, struct pbuf *p)
+{
+    if (!p)
+        return ERR_OK;
+    cpuinfo ci = current_cpu();
+    net_gro prev = ci->net_rx_gro;
+    ci->net_rx_gro = g;
+    net_tx_batch_begin();
+    err_t err = g->netif->input(p, g->netif);
+    if (err != ERR_OK)
+        pbuf_free(p);
+    net_tx_batch_end();
+    ci->net_rx_gro = prev;
+    return err;
+}
+
+static err_t net_gro_deliver2(net_gro g, struct pbuf *p1, struct pbuf *p2)
+{
+    err_t err1 = net_gro_deliver(g, p1);
+    err_t err2 = net_gro_deliver(g, p2);
+    return (err1 != ERR_OK) ? err1 : err2;
+}
+
+/* Takes ownership of the packet; returns the error from the network stack if a packet passed to it
+ * (the given one or a previously coalesced one) has been dropped. */
+err_t net_gro_input(net_gro g, struct pbuf *p)
+{
+    struct net_gro_seg s;
+    struct pbuf *flushed;
+    if (!net_gro_parse(p, &s)) {
+        spin_lock(&g->lock);
+        flushed = net_gro_detach(g);
+        spin_unlock(&g->lock);
+        return net_gro_deliver2(g, flushed, p);
+    }
+    boolean push = (TCPH_FLAGS(s.tcphdr) & TCP_PSH) != 0;
+    spin_lock(&g->lock);
+    g->segments++;
+    if (g->head && net_gro_match(g, &s)) {
+        /* the payload checksum is byte-swapped if the payload is at an odd offset */
+        if (g->data_len & 1)
+            s.data_csum = SWAP_BYTES_IN_WORD(s.data_csum);
+        g->data_csum = csum_add(g->data_csum, s.data_csum);
+        g->data_len += s.data_len;
+        g->next_seqno += s.data_len;
+        g->segs++;
+        g->tcphdr->wnd = s.tcphdr->wnd;
+        if (push)
+            TCPH_SET_FLAG(g->tcphdr, TCP_PSH);
+        pbuf_remove_header(p, s.hdr_len);
+        pbuf_cat(g->head, p);
+        flushed = push ? net_gro_detach(g) : 0;
+        spin_unlock(&g->lock);
+        return net_gro_deliver(g, flushed);
+    }
+    flushed = net_gro_detach(g);
+    if (push) {
+        g->packets++;
+    } else {
+        g->head = p;
+        g->tcphdr = s.tcphdr;
+        g->hdr_len = s.hdr_len;
+        g->next_seqno = lwip_ntohl(s.tcphdr->seqno) + s.data_len;
+        g->data_len = s.data_len;
+        g->data_csum = s.data_csum;
+        g->segs = 1;
+        if (!g->flush_pending) {
+            g->flush_pending = true;
+            async_apply((thunk)&g->flush);
+        }
+        p = 0;
+    }
+    spin_unlock(&g->lock);
+    return net_gro_deliver2(g, flushed, p);
+}
+
+err_t net_gro_flush(net_gro g)
+{
+    spin_lock(&g->lock);
+    struct pbuf *p = net_gro_detach(g);
+    spin_unlock(&g->lock);
+    return net_gro_deliver(g, p);
+}
+
+closure_func_basic(thunk, void, net_gro_flush_async)
+{
+    net_gro g = struct_from_closure(net_gro, flush);
+    spin_lock(&g->lock);
+    g->flush_pending = false;
+    struct pbuf *p = net_gro_detach(g);
+    spin_unlock(&g->lock);
+    net_gro_deliver(g, p);
+}
+
+void net_gro_init(net_gro g, struct netif *n, net_rx_poll poll)
+{
+    g->netif = n;
+    g->poll = poll;
+    spin_lock_init(&g->lock);
+    g->head = 0;
+    g->flush_pending = false;
+    init_closure_func(&g->flush, thunk, net_gro_flush_async);
+    g->segments = g->packets = 0;
+    spin_lock(&net_gro_lock);
+    list_push_back(&net_gro_list, &g->l);
+    spin_unlock(&net_gro_lock);
+}
+
+void net_gro_deinit(net_gro g)
+{
+    net_gro_flush(g);
+    spin_lock(&net_gro_lock);
+    list_delete(&g->l);
+    spin_unlock(&net_gro_lock);
+}
+
+/* Reports the number of received segments and of packets passed to lwIP for each interface. */
+void net_gro_stats(buffer b)
+{
+    char ifname[3];
+    spin_lock(&net_gro_lock);
+    list_foreach(&net_gro_list, l) {
+        net_gro g = struct_from_list(l, net_gro, l);
+        list e;
+        for (e = list_begin(&net_gro_list); e != l; e = e->next)
+            if (struct_from_list(e, net_gro, l)->netif == g->netif)
+                break;
+        if (e != l)
+            continue;   /* interface already reported */
+        u64 segments = 0, packets = 0;
+        for (e = l; e != list_end(&net_gro_list); e = e->next) {
+            net_gro q = struct_from_list(e, net_gro, l);
+            if (q->netif == g->netif) {
+                segments += q->segments;
+                packets += q->packets;
+            }
+        }
+        bytes len = netif_name_cpy(ifname, g->netif);
+        u64 ratio = packets ? segments * 100 / packets : 0;
+        bprintf(b, "%s: %ld segments %ld packets ratio %ld.%02ld\n", isstring(ifname, len),
+                segments, packets, ratio / 100, ratio % 100);
+    }
+    spin_unlock(&net_gro_lock);
+}
+
+void init_net_gro(void)
+{
+    list_init(&net_gro_list);
+    spin_lock_init(&net_gro_lock);
+}
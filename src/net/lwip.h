@@ -41,3 +41,54 @@ bytes netif_name_cpy(char *dest, struct netif *netif);
                                  ARPHRD_VOID)
 
 extern int (*net_ip_input_filter)(struct pbuf *pbuf, struct netif *input_netif);
+
+/* Processes packets available in a receive queue, if any, from the caller context (busy polling);
+ * returns true if any packet has been processed. */
+closure_type(net_rx_poll, boolean);
+
+/* Generic receive offload state, one per receive queue */
+typedef struct net_gro {
+    struct netif *netif;
+    net_rx_poll poll;           /* null if the receive queue does not support busy polling */
+    struct spinlock lock;
+    struct pbuf *head;          /* packet being coalesced */
+    struct tcp_hdr *tcphdr;     /* transport header of head packet */
+    u16 hdr_len;
+    u16 data_len;
+    u16 data_csum;
+    u16 segs;
+    u32 next_seqno;
+    boolean flush_pending;
+    closure_struct(thunk, flush);
+    u64 segments;               /* received segments */
+    u64 packets;                /* packets passed to the network stack */
+    struct list l;
+} *net_gro;
+
+void net_gro_init(net_gro g, struct netif *n, net_rx_poll poll);
+void net_gro_deinit(net_gro g);
+err_t net_gro_input(net_gro g, struct pbuf *p);
+err_t net_gro_flush(net_gro g);
+
+/* Transmit batching: while a batch is open on the current CPU, network drivers may hold the packets
+ * being transmitted (e.g. to coalesce TCP segments into super-segments for devices with TCP
+ * segmentation offload) instead of submitting them to the device right away; held packets are
+ * submitted by a flush handler, which the driver registers with net_tx_batch_defer() and which is
+ * called when the outermost batch is closed. Batches must not span blocking operations, and flush
+ * handlers must not call into lwIP. */
+typedef struct net_tx_flush {
+    thunk handler;
+    struct list l;              /* zero-initialized */
+} *net_tx_flush;
+
+void net_tx_batch_begin(void);
+void net_tx_batch_end(void);
+void net_tx_batch_defer(net_tx_flush f);
+
+static inline boolean net_tx_batching(void)
+{
+    return current_cpu()->net_tx_batch != 0;
+}
+
+/* called by drivers for each super-segment handed to a device */
+void net_tso_count(u16 segs);
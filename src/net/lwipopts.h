@@ -88,6 +88,8 @@ typedef unsigned long size_t;
 #define LWIP_INCLUDED_POLARSSL_MD5  1
 
 #define SO_REUSE 1
+#define LWIP_TCP_PCB_NUM_EXT_ARGS   1   /* zero-copy transmit tracking */
+#define LWIP_CHECKSUM_CTRL_PER_NETIF    1
 #define LWIP_IPV6   1
 #define LWIP_IPV6_DHCP6 1
 #define IPV6_FRAG_COPYHEADER    1
@@ -196,6 +198,8 @@ struct netif;
 static inline int net_ip_input_hook(struct pbuf *pbuf, struct netif *input_netif)
 {
     extern int (*net_ip_input_filter)(struct pbuf *, struct netif *);
+    extern void net_loopback_csum(struct pbuf *, struct netif *);
+    net_loopback_csum(pbuf, input_netif);
     if (net_ip_input_filter && !net_ip_input_filter(pbuf, input_netif))
         return 1;
     return 0;
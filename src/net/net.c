@@ -1,6 +1,7 @@
 #include <kernel.h>
 #include <lwip.h>
 #include <lwip/priv/tcp_priv.h>
+#include <lwip/inet_chksum.h>
 
 /* Network interface flags */
 #define IFF_UP          (1 << 0)
@@ -70,10 +71,13 @@ closure_func_basic(timer_handler, void, dispatch_lwip_timer,
 #ifdef LWIP_DEBUG
     lwip_debug("dispatching timer for %s\n", lt->name);
 #endif
-    if (overruns == timer_disabled)
+    if (overruns == timer_disabled) {
         closure_finish();
-    else
+    } else {
+        net_tx_batch_begin();
         lt->handler();
+        net_tx_batch_end();
+    }
 }
 
 void sys_timeouts_init(void)
@@ -201,6 +205,88 @@ int lwip_strncmp(const char *x, const char *y, unsigned long len)
     return 0;
 }
 
+static struct {
+    u64 packets;        /* super-segments handed to devices */
+    u64 segments;       /* TCP segments coalesced into super-segments */
+} net_tso_info;
+
+void net_tx_batch_begin(void)
+{
+    current_cpu()->net_tx_batch++;
+}
+
+void net_tx_batch_end(void)
+{
+    cpuinfo ci = current_cpu();
+    assert(ci->net_tx_batch > 0);
+    if (--ci->net_tx_batch)
+        return;
+    list l;
+    while ((l = list_get_next(&ci->net_tx_flush))) {
+        list_delete(l);
+        apply(struct_from_list(l, net_tx_flush, l)->handler);
+    }
+}
+
+/* Must be called from the CPU that is transmitting, with a batch open. */
+void net_tx_batch_defer(net_tx_flush f)
+{
+    if (!list_inserted(&f->l))
+        list_push_back(&current_cpu()->net_tx_flush, &f->l);
+}
+
+void net_tso_count(u16 segs)
+{
+    fetch_and_add(&net_tso_info.packets, 1);
+    fetch_and_add(&net_tso_info.segments, segs);
+}
+
+void net_tso_stats(buffer b)
+{
+    u64 packets = net_tso_info.packets;
+    u64 segs = packets ? net_tso_info.segments * 100 / packets : 0;
+    bprintf(b, "tso_packets %ld\ntso_segments %ld\ntso_segments_per_packet %ld.%02ld\n",
+            packets, net_tso_info.segments, segs / 100, segs % 100);
+}
+
+/* TCP segments sent to the address of an interface that offloads transmit checksums are looped
+ * back by lwIP without going through the device, and thus without a checksum: fill it in before
+ * the segment is validated. Packets received from a device use custom pbufs. */
+void net_loopback_csum(struct pbuf *p, struct netif *inp)
+{
+    if (((inp->chksum_flags & (NETIF_CHECKSUM_GEN_TCP | NETIF_CHECKSUM_CHECK_TCP)) !=
+         NETIF_CHECKSUM_CHECK_TCP) || (p->flags & PBUF_FLAG_IS_CUSTOM) || (p->len < IP_HLEN))
+        return;
+    struct tcp_hdr *tcphdr;
+    u16 iphdr_len;
+    if (IP_HDR_GET_VERSION(p->payload) == 4) {
+        struct ip_hdr *ip4hdr = p->payload;
+        iphdr_len = IPH_HL_BYTES(ip4hdr);
+        if ((IPH_PROTO(ip4hdr) != IP_PROTO_TCP) || (p->len < iphdr_len + TCP_HLEN) ||
+            (p->tot_len != lwip_ntohs(IPH_LEN(ip4hdr))))
+            return;
+        tcphdr = p->payload + iphdr_len;
+        ip4_addr_t src, dest;
+        ip4_addr_copy(src, ip4hdr->src);
+        ip4_addr_copy(dest, ip4hdr->dest);
+        pbuf_remove_header(p, iphdr_len);
+        tcphdr->chksum = ip4_chksum_pseudo(p, IP_PROTO_TCP, p->tot_len, &src, &dest);
+    } else {
+        struct ip6_hdr *ip6hdr = p->payload;
+        iphdr_len = IP6_HLEN;
+        if ((IP6H_NEXTH(ip6hdr) != IP6_NEXTH_TCP) || (p->len < iphdr_len + TCP_HLEN) ||
+            (p->tot_len != iphdr_len + IP6H_PLEN(ip6hdr)))
+            return;
+        tcphdr = p->payload + iphdr_len;
+        ip6_addr_t src, dest;
+        ip6_addr_copy_from_packed(src, ip6hdr->src);
+        ip6_addr_copy_from_packed(dest, ip6hdr->dest);
+        pbuf_remove_header(p, iphdr_len);
+        tcphdr->chksum = ip6_chksum_pseudo(p, IP6_NEXTH_TCP, p->tot_len, &src, &dest);
+    }
+    pbuf_add_header(p, iphdr_len);
+}
+
 u16 ifflags_from_netif(struct netif *netif)
 {
     u16 flags = 0;
@@ -438,6 +524,7 @@ void init_net(kernel_heaps kh)
 {
     lwip_heap = kh->malloc;
     list_init(&net_complete_list);
+    init_net_gro();
     lwip_init();
     BSS_RO_AFTER_INIT NETIF_DECLARE_EXT_CALLBACK(netif_callback);
     netif_add_ext_callback(&netif_callback, lwip_ext_callback);
@@ -3,4 +3,7 @@
 
 void init_net(kernel_heaps kh);
 void init_network_iface(tuple root, merge m);
+void init_net_gro(void);
+void net_gro_stats(buffer b);
+void net_tso_stats(buffer b);
 status listen_port(heap h, u16 port, connection_handler c);
@@ -63,6 +63,7 @@ enum protocol_type {
 #define MSG_DONTWAIT    0x00000040
 #define MSG_EOR         0x00000080
 #define MSG_CONFIRM     0x00000800
+#define MSG_ERRQUEUE    0x00002000
 #define MSG_NOSIGNAL    0x00004000
 #define MSG_MORE        0x00008000
 #define MSG_WAITFORONE  0x00010000
@@ -87,6 +87,11 @@ typedef struct netsock {
     queue incoming;
     err_t lwip_error;             /* lwIP error code; ERR_OK if normal */
     u8 ipv6only:1;
+    u8 reuseport:1;
+    struct reuseport_group *reuseport_group;    /* listening TCP sockets with SO_REUSEPORT */
+    int accept_cpu;               /* cpu of the last accept() caller */
+    u32 busy_poll;                /* SO_BUSY_POLL (microseconds) */
+    net_gro rx_gro;               /* receive queue of the last received packet */
     union {
 	struct {
 	    struct tcp_pcb *lw;
@@ -104,6 +109,7 @@ typedef struct netsock {
     closure_struct(fdesc_events, events);
     closure_struct(fdesc_ioctl, ioctl);
     closure_struct(fdesc_close, close);
+    closure_struct(fdesc_busy_poll, fd_busy_poll);
 } *netsock;
 
 /* Mask of TCP flags expressing socket configuration settings (as opposed to flags describing the
@@ -117,6 +123,30 @@ typedef struct netsock {
 
 int so_rcvbuf;
 
+/* default SO_BUSY_POLL value for new sockets */
+static u32 busy_poll;
+
+/* lwIP allows a single listening pcb per address and port, so SO_REUSEPORT
+   is implemented on top of it: the first socket to listen owns the lwIP pcb,
+   and connections it accepts are distributed among the queues of all the
+   sockets in the group. Lock order: socket being added -> reuseport_lock ->
+   group lock -> member socket. */
+typedef struct reuseport_group {
+    struct list l;              /* in reuseport_groups */
+    struct spinlock lock;       /* protects members and listener */
+    heap h;
+    process p;
+    int domain;
+    ip_addr_t addr;
+    u16 port;
+    int backlog;
+    netsock listener;           /* owner of the lwIP listening pcb */
+    vector members;
+} *reuseport_group;
+
+static struct spinlock reuseport_lock;
+static struct list reuseport_groups;
+
 static sysreturn netsock_bind(struct sock *sock, struct sockaddr *addr,
         socklen_t addrlen);
 static sysreturn netsock_listen(struct sock *sock, int backlog);
@@ -137,6 +167,7 @@ static sysreturn netsock_sendmsg(struct sock *sock, const struct msghdr *msg,
                                  int flags, boolean in_bh, io_completion completion);
 static sysreturn netsock_recvmsg(struct sock *sock, struct msghdr *msg,
                                  int flags, boolean in_bh, io_completion completion);
+static err_t accept_tcp_from_lwip(void * z, struct tcp_pcb * lw, err_t err);
 
 BSS_RO_AFTER_INIT static thunk net_loop_poll;
 static boolean net_loop_poll_queued;
@@ -233,6 +264,48 @@ static err_t get_and_clear_lwip_error(netsock s)
 #endif
 }
 
+/* Called with the socket locked when a received packet is queued, to record the receive queue
+ * from which the packet is being delivered, if any. */
+static void netsock_set_rx_queue(netsock s)
+{
+    net_gro g = current_cpu()->net_rx_gro;
+    if (g)
+        s->rx_gro = g;
+}
+
+/* Polls the receive queue that delivered the last packet to the socket directly (instead of waiting
+ * for the device interrupt and the bottom half that process the queue), until the socket has data
+ * to read, *pending (if non-null) becomes non-zero, or the SO_BUSY_POLL time expires. */
+static void netsock_busy_poll_queue(netsock s, u64 *pending)
+{
+    net_gro g = s->rx_gro;
+    if (!s->busy_poll || !g || !g->poll)
+        return;
+    timestamp end = now(CLOCK_ID_MONOTONIC_RAW) + microseconds(s->busy_poll);
+    while (queue_empty(s->incoming) && (get_lwip_error(s) == ERR_OK) &&
+           !(pending && *(volatile u64 *)pending)) {
+        if (!apply(g->poll))
+            kern_pause();
+        if (now(CLOCK_ID_MONOTONIC_RAW) >= end)
+            break;
+    }
+}
+
+/* Called before blocking on a socket, if the socket has no data to read. */
+static void netsock_busy_poll(netsock s, int flags)
+{
+    if ((s->sock.f.flags & SOCK_NONBLOCK) || (flags & MSG_DONTWAIT))
+        return;
+    netsock_busy_poll_queue(s, 0);
+}
+
+/* Called by epoll_wait() before blocking. */
+closure_func_basic(fdesc_busy_poll, void, socket_busy_poll,
+                   u64 *pending)
+{
+    netsock_busy_poll_queue(struct_from_closure(netsock, fd_busy_poll), pending);
+}
+
 /* Called with netsock lock held, returns with lock released. */
 static void netsock_notify_events(netsock s)
 {
@@ -637,11 +710,99 @@ closure_func_basic(file_io, sysreturn, socket_read,
         return io_complete(completion,
             (s->info.tcp.state == TCP_SOCK_UNDEFINED) ? 0 : -ENOTCONN);
 
+    if (!bh)
+        netsock_busy_poll(s, 0);
     blockq_action ba = closure_from_context(ctx, sock_read_bh, s, dest, length, 0, 0,
                                             0, completion);
     return blockq_check(s->sock.rxbq, ba, bh);
 }
 
+/* Zero-copy transmit
+
+   Buffers holding a reference to their backing memory (e.g. page cache pages
+   from sendfile) are passed to tcp_write() without TCP_WRITE_FLAG_COPY, so
+   lwIP references them from the send queues until they are acknowledged. An
+   additional reference is taken for each such write and released once the
+   peer has acked the data, or when the pcb is destroyed.
+
+   User buffers can't be pinned here (unmapping a user page frees it right
+   away), so their data is always copied and SO_ZEROCOPY is not offered.
+
+   The tracking state is attached to the pcb and protected by the pcb lock. */
+typedef struct tcp_zc {
+    struct list pending;        /* tcp_zc_bufs, in sequence order */
+} *tcp_zc;
+
+typedef struct tcp_zc_buf {
+    struct list l;
+    u32 end;                    /* sequence number following the data */
+    refcount refcount;
+} *tcp_zc_buf;
+
+static u8 tcp_zc_ext_id;
+BSS_RO_AFTER_INIT static heap tcp_zc_heap;
+
+static void tcp_zc_complete(tcp_zc_buf b)
+{
+    list_delete(&b->l);
+    refcount_release(b->refcount);
+    deallocate(tcp_zc_heap, b, sizeof(*b));
+}
+
+static void tcp_zc_destroy(u8_t id, void *data)
+{
+    tcp_zc zc = data;
+    list_foreach(&zc->pending, l)
+        tcp_zc_complete(struct_from_list(l, tcp_zc_buf, l));
+    deallocate(tcp_zc_heap, zc, sizeof(*zc));
+}
+
+static const struct tcp_ext_arg_callbacks tcp_zc_callbacks = {
+    .destroy = tcp_zc_destroy,
+};
+
+/* Called with pcb lock held. */
+static tcp_zc_buf tcp_zc_buf_alloc(struct tcp_pcb *lw, refcount r)
+{
+    tcp_zc zc = tcp_ext_arg_get(lw, tcp_zc_ext_id);
+    if (!zc) {
+        zc = allocate(tcp_zc_heap, sizeof(*zc));
+        if (zc == INVALID_ADDRESS)
+            return 0;
+        list_init(&zc->pending);
+        tcp_ext_arg_set_callbacks(lw, tcp_zc_ext_id, &tcp_zc_callbacks);
+        tcp_ext_arg_set(lw, tcp_zc_ext_id, zc);
+    }
+    tcp_zc_buf b = allocate(tcp_zc_heap, sizeof(*b));
+    if (b == INVALID_ADDRESS)
+        return 0;
+    b->refcount = r;
+    return b;
+}
+
+/* Called with pcb lock held, after the data has been passed to tcp_write(). */
+static void tcp_zc_buf_queue(struct tcp_pcb *lw, tcp_zc_buf b)
+{
+    tcp_zc zc = tcp_ext_arg_get(lw, tcp_zc_ext_id);
+    b->end = lw->snd_lbb;
+    refcount_reserve(b->refcount);
+    list_push_back(&zc->pending, &b->l);
+}
+
+/* Called with pcb lock held, when the peer acks data. */
+static void tcp_zc_acked(struct tcp_pcb *lw)
+{
+    tcp_zc zc = tcp_ext_arg_get(lw, tcp_zc_ext_id);
+    if (!zc)
+        return;
+    list_foreach(&zc->pending, l) {
+        tcp_zc_buf b = struct_from_list(l, tcp_zc_buf, l);
+        if ((s32)(lw->lastack - b->end) < 0)
+            break;
+        tcp_zc_complete(b);
+    }
+}
+
 closure_function(6, 1, sysreturn, socket_write_tcp_bh,
                  netsock, s, void *, buf, sg_list, sg, u64, length, int, flags, io_completion, completion,
                  u64 bqflags)
@@ -715,12 +876,15 @@ closure_function(6, 1, sysreturn, socket_write_tcp_bh,
     u64 n;
     while (remain) {
         u8 apiflags = TCP_WRITE_FLAG_COPY;
+        tcp_zc_buf zcb = 0;
         if (sg) {
             sg_buf sgb = sg_list_head_peek(sg);
             buf = sgb->buf + sgb->offset;
             n = sg_buf_len(sgb);
             if (sg_list_peek_at(sg, 1) != INVALID_ADDRESS)
                 apiflags |= TCP_WRITE_FLAG_MORE;
+            if (sgb->refcount && (zcb = tcp_zc_buf_alloc(tcp_lw, sgb->refcount)))
+                apiflags &= ~TCP_WRITE_FLAG_COPY;
         } else {
             n = remain;
         }
@@ -730,6 +894,12 @@ closure_function(6, 1, sysreturn, socket_write_tcp_bh,
         }
 
         err = tcp_write(tcp_lw, buf, n, apiflags);
+        if (zcb) {
+            if (err == ERR_OK)
+                tcp_zc_buf_queue(tcp_lw, zcb);
+            else
+                deallocate(tcp_zc_heap, zcb, sizeof(*zcb));
+        }
         if (err == ERR_OK) {
             if (sg)
                 sg_consume(sg, n);
@@ -756,7 +926,9 @@ closure_function(6, 1, sysreturn, socket_write_tcp_bh,
     if (err == ERR_OK) {
         /* XXX prob add a flag to determine whether to continuously
            post data, e.g. if used by send/sendto... */
+        net_tx_batch_begin();
         err = tcp_output(tcp_lw);
+        net_tx_batch_end();
         if (err == ERR_OK) {
             net_debug(" tcp_write and tcp_output successful for %ld bytes\n", rv);
             netsock_check_loop();
@@ -1136,6 +1308,159 @@ closure_func_basic(fdesc_ioctl, sysreturn, netsock_ioctl,
 /* Must fit in a u8_t, because it may be used as backlog value for tcp_listen_with_backlog(). */
 #define SOCK_QUEUE_LEN 255
 
+/* Called with netsock lock held. */
+static sysreturn netsock_tcp_listen(netsock s, int backlog)
+{
+    struct tcp_pcb * lw = tcp_listen_with_backlog(s->info.tcp.lw, backlog);
+    if (!lw)
+        return -EADDRINUSE;
+    tcp_unref(s->info.tcp.lw);
+    tcp_ref(lw);
+    s->info.tcp.lw = lw;
+    s->info.tcp.state = TCP_SOCK_LISTENING;
+    set_lwip_error(s, ERR_OK);
+    tcp_arg(lw, s);
+    tcp_accept(lw, accept_tcp_from_lwip);
+    return 0;
+}
+
+/* Called with netsock lock held. Adds the socket to the group listening on
+   its address and port, creating the group (and the lwIP listening pcb) if
+   there is none yet. */
+static sysreturn reuseport_listen(netsock s, int backlog)
+{
+    struct tcp_pcb *lw = s->info.tcp.lw;
+    reuseport_group g;
+    sysreturn rv = 0;
+    spin_lock(&reuseport_lock);
+    list_foreach(&reuseport_groups, l) {
+        g = struct_from_list(l, reuseport_group, l);
+        if ((g->p == s->p) && (g->domain == s->sock.domain) && (g->port == lw->local_port) &&
+            ip_addr_cmp(&g->addr, &lw->local_ip))
+            goto join;
+    }
+    heap h = heap_locked((kernel_heaps)s->p->uh);
+    g = allocate(h, sizeof(*g));
+    if (g == INVALID_ADDRESS) {
+        rv = -ENOMEM;
+        goto out;
+    }
+    g->members = allocate_vector(h, 8);
+    if (g->members == INVALID_ADDRESS) {
+        deallocate(h, g, sizeof(*g));
+        rv = -ENOMEM;
+        goto out;
+    }
+    spin_lock_init(&g->lock);
+    g->h = h;
+    g->p = s->p;
+    g->domain = s->sock.domain;
+    ip_addr_copy(g->addr, lw->local_ip);
+    g->port = lw->local_port;
+    g->backlog = backlog;
+    g->listener = s;
+
+    /* the group must be visible to the accept callback as soon as it's installed */
+    s->reuseport_group = g;
+    rv = netsock_tcp_listen(s, backlog);
+    if (rv) {
+        s->reuseport_group = 0;
+        deallocate_vector(g->members);
+        deallocate(h, g, sizeof(*g));
+        goto out;
+    }
+    list_push_back(&reuseport_groups, &g->l);
+  join:
+    spin_lock(&g->lock);
+    vector_push(g->members, s);
+    spin_unlock(&g->lock);
+    s->reuseport_group = g;
+    s->accept_cpu = current_cpu()->id;
+    s->info.tcp.state = TCP_SOCK_LISTENING;
+    net_debug("sock %d joined group %p (port %d), %d members\n", s->sock.fd, g, g->port,
+              vector_length(g->members));
+  out:
+    spin_unlock(&reuseport_lock);
+    return rv;
+}
+
+/* Called with group lock held. Connections are steered to a socket whose
+   last accept() ran on the cpu processing the incoming segment, if any, so
+   that the accepting thread finds the connection in a cache-local queue;
+   otherwise the connection 4-tuple is hashed across all members. */
+static netsock reuseport_select(reuseport_group g, struct tcp_pcb *lw)
+{
+    u64 hash = lw->remote_port | ((u64)lw->local_port << 16);
+    if (IP_IS_V6_VAL(lw->remote_ip)) {
+        for (int i = 0; i < 4; i++)
+            hash ^= (u64)ip_2_ip6(&lw->remote_ip)->addr[i] << (i & 1 ? 32 : 0);
+    } else {
+        hash ^= (u64)ip_2_ip4(&lw->remote_ip)->addr << 32;
+    }
+    hash *= 0x9e3779b97f4a7c15ull;
+    hash >>= 32;
+    int cpu = current_cpu()->id;
+    int local = 0;
+    netsock m;
+    vector_foreach(g->members, m) {
+        if (m->accept_cpu == cpu)
+            local++;
+    }
+    if (local) {
+        int n = hash % local;
+        vector_foreach(g->members, m) {
+            if ((m->accept_cpu == cpu) && (n-- == 0))
+                return m;
+        }
+    }
+    return vector_get(g->members, hash % vector_length(g->members));
+}
+
+/* Called after the socket pcb is closed, so that the group listener can't
+   be in the middle of an accept callback. If the listener is leaving, the
+   lwIP listening pcb is handed over to another member. */
+static void reuseport_leave(netsock s)
+{
+    reuseport_group g = s->reuseport_group;
+    spin_lock(&reuseport_lock);
+    spin_lock(&g->lock);
+    netsock m;
+    vector_foreach(g->members, m) {
+        if (m == s) {
+            vector_delete(g->members, _i);
+            break;
+        }
+    }
+    s->reuseport_group = 0;
+    if (vector_length(g->members) == 0) {
+        spin_unlock(&g->lock);
+        list_delete(&g->l);
+        spin_unlock(&reuseport_lock);
+        net_debug("group %p (port %d) released\n", g, g->port);
+        deallocate_vector(g->members);
+        deallocate(g->h, g, sizeof(*g));
+        return;
+    }
+    if (g->listener == s) {
+        g->listener = 0;
+        vector_foreach(g->members, m) {
+            netsock_lock(m);
+            if ((m->info.tcp.state == TCP_SOCK_LISTENING) &&
+                (netsock_tcp_listen(m, g->backlog) == 0))
+                g->listener = m;
+            netsock_unlock(m);
+            if (g->listener)
+                break;
+        }
+        if (!g->listener)
+            msg_err("failed to hand over listening pcb for port %d\n", g->port);
+        net_debug("group %p (port %d) listener now sock %d\n", g, g->port,
+                  g->listener ? g->listener->sock.fd : -1);
+    }
+    spin_unlock(&g->lock);
+    spin_unlock(&reuseport_lock);
+}
+
 closure_func_basic(fdesc_close, sysreturn, socket_close,
                    context ctx, io_completion completion)
 {
@@ -1155,6 +1480,8 @@ closure_func_basic(fdesc_close, sysreturn, socket_close,
             tcp_unref(tcp_lw);
             netsock_check_loop();
         }
+        if (s->reuseport_group)
+            reuseport_leave(s);
         break;
     case SOCK_DGRAM:
         udp_remove(s->info.udp.lw);
@@ -1286,6 +1613,7 @@ static void udp_input_lower(void *z, struct udp_pcb *pcb, struct pbuf *p,
 	e->rport = port;
 	assert(enqueue(s->incoming, e));
 	s->sock.rx_len += p->tot_len;
+	netsock_set_rx_queue(s);
 	wakeup_sock(s, WAKEUP_SOCK_RX);
     } else {
 	msg_err("null pbuf\n");
@@ -1311,6 +1639,7 @@ static int allocate_sock(process p, int af, int type, u32 flags, boolean alloc_f
     s->sock.f.sg_write = init_closure_func(&s->sg_write, sg_file_io, socket_sg_write);
     s->sock.f.close = init_closure_func(&s->close, fdesc_close, socket_close);
     s->sock.f.events = init_closure_func(&s->events, fdesc_events, socket_events);
+    s->sock.f.busy_poll = init_closure_func(&s->fd_busy_poll, fdesc_busy_poll, socket_busy_poll);
     s->sock.f.ioctl = init_closure_func(&s->ioctl, fdesc_ioctl, netsock_ioctl);
     s->p = p;
 
@@ -1333,6 +1662,11 @@ static int allocate_sock(process p, int af, int type, u32 flags, boolean alloc_f
     s->sock.recvmsg = netsock_recvmsg;
     s->sock.shutdown = netsock_shutdown;
     s->ipv6only = 0;
+    s->reuseport = 0;
+    s->reuseport_group = 0;
+    s->accept_cpu = -1;
+    s->busy_poll = busy_poll;
+    s->rx_gro = 0;
     set_lwip_error(s, ERR_OK);
     if (alloc_fd) {
         fd = s->sock.fd = allocate_fd(p, s);
@@ -1464,6 +1798,7 @@ static err_t tcp_input_lower(void *z, struct tcp_pcb *pcb, struct pbuf *p, err_t
             return ERR_BUF;     /* XXX verify */
         }
         s->sock.rx_len += p->tot_len;
+        netsock_set_rx_queue(s);
     }
     wakeup_sock(s, WAKEUP_SOCK_RX);
 
@@ -1546,6 +1881,7 @@ static void lwip_tcp_conn_err(void * z, err_t err) {
 
 static err_t lwip_tcp_sent(void * arg, struct tcp_pcb * pcb, u16 len)
 {
+    tcp_zc_acked(pcb);
     if (!arg) {
         return ERR_OK;
     }
@@ -1911,6 +2247,7 @@ static sysreturn netsock_recvfrom(struct sock *sock, void *buf, u64 len,
         goto out;
     }
 
+    netsock_busy_poll(s, flags);
     blockq_action ba = contextual_closure(sock_read_bh, s, buf, len, flags,
                                           src_addr, addrlen, (io_completion)&sock->f.io_complete);
     return blockq_check(sock->rxbq, ba, false);
@@ -1945,10 +2282,17 @@ static sysreturn netsock_recvmsg(struct sock *sock, struct msghdr *msg,
     netsock s = (netsock) sock;
     sysreturn rv;
 
+    if (flags & MSG_ERRQUEUE) {
+        /* nothing is ever posted to the error queue */
+        rv = -EAGAIN;
+        goto out;
+    }
     if ((sock->type == SOCK_STREAM) && (s->info.tcp.state != TCP_SOCK_OPEN)) {
         rv = (s->info.tcp.state == TCP_SOCK_UNDEFINED) ? 0 : -ENOTCONN;
         goto out;
     }
+    if (!in_bh)
+        netsock_busy_poll(s, flags);
     blockq_action ba = contextual_closure(recvmsg_bh, s, msg, flags, completion);
     return blockq_check(sock->rxbq, ba, in_bh);
   out:
@@ -2042,12 +2386,17 @@ static err_t accept_tcp_from_lwip(void * z, struct tcp_pcb * lw, err_t err)
         return ERR_CLSD;
     }
     netsock s = z;
+    reuseport_group g = s->reuseport_group;
+    if (g) {
+        spin_lock(&g->lock);
+        s = reuseport_select(g, lw);
+    }
     netsock_lock(s);
 
     if (err == ERR_MEM) {
         set_lwip_error(s, err);
         wakeup_sock(s, WAKEUP_SOCK_EXCEPT);
-        return err;               /* lwIP doesn't care */
+        goto out;
     }
 
     netsock sn;
@@ -2076,10 +2425,14 @@ static err_t accept_tcp_from_lwip(void * z, struct tcp_pcb * lw, err_t err)
     tcp_backlog_delayed(lw);
 
     wakeup_sock(s, WAKEUP_SOCK_RX);
-    return ERR_OK;
+    err = ERR_OK;
+    goto out;
   unlock_out:
     netsock_unlock(s);
-    return err;
+  out:
+    if (g)
+        spin_unlock(&g->lock);
+    return err;     /* lwIP ignores ERR_MEM */
 }
 
 static sysreturn netsock_listen(struct sock *sock, int backlog)
@@ -2094,6 +2447,19 @@ static sysreturn netsock_listen(struct sock *sock, int backlog)
     }
     if (s->info.tcp.state != TCP_SOCK_CREATED) {
         if (s->info.tcp.state == TCP_SOCK_LISTENING) {
+            reuseport_group g = s->reuseport_group;
+            if (g) {
+                /* A listening socket is a group member: release it before taking the group
+                 * lock, so as not to invert the group -> member lock order. */
+                netsock_unlock(s);
+                spin_lock(&g->lock);
+                g->backlog = backlog;
+                if (g->listener == s)
+                    tcp_backlog_set(s->info.tcp.lw, backlog);
+                spin_unlock(&g->lock);
+                rv = 0;
+                goto out;
+            }
             tcp_backlog_set(s->info.tcp.lw, backlog);
             rv = 0;
         } else {
@@ -2101,17 +2467,13 @@ static sysreturn netsock_listen(struct sock *sock, int backlog)
         }
         goto unlock_out;
     }
-    struct tcp_pcb * lw = tcp_listen_with_backlog(s->info.tcp.lw, backlog);
-    tcp_unref(s->info.tcp.lw);
-    tcp_ref(lw);
-    s->info.tcp.lw = lw;
-    s->info.tcp.state = TCP_SOCK_LISTENING;
-    set_lwip_error(s, ERR_OK);
-    tcp_arg(lw, s);
-    tcp_accept(lw, accept_tcp_from_lwip);
-    rv = 0;
+    if (s->reuseport && s->info.tcp.lw->local_port)
+        rv = reuseport_listen(s, backlog);
+    else
+        rv = netsock_tcp_listen(s, backlog);
   unlock_out:
     netsock_unlock(s);
+  out:
     socket_release(sock);
     return rv;
 }
@@ -2237,6 +2599,8 @@ static sysreturn netsock_accept4(struct sock *sock, struct sockaddr *addr,
         goto out;
     }
 
+    if (s->reuseport_group)
+        s->accept_cpu = current_cpu()->id;
     blockq_action ba = contextual_closure(accept_bh, s, current, addr, addrlen, flags);
     return blockq_check(sock->rxbq, ba, false);
   out:
@@ -2396,7 +2760,37 @@ static sysreturn netsock_setsockopt(struct sock *sock, int level,
             }
             break;
         case SO_REUSEPORT:
-            goto unimplemented;
+            rv = sockopt_copy_from_user(optval, optlen, &int_optval, sizeof(int));
+            if (rv)
+                goto out;
+            netsock_lock(s);
+            s->reuseport = !!int_optval;
+            /* lwIP only allows binding a port more than once with SOF_REUSEADDR */
+            if (int_optval) {
+                if (s->sock.type == SOCK_STREAM) {
+                    if (s->info.tcp.lw)
+                        ip_set_option(s->info.tcp.lw, SOF_REUSEADDR);
+                } else if (s->sock.type == SOCK_DGRAM) {
+                    ip_set_option(s->info.udp.lw, SOF_REUSEADDR);
+                }
+            }
+            netsock_unlock(s);
+            break;
+        case SO_ZEROCOPY:
+            /* user buffers are always copied (see zero-copy transmit above): let applications fall
+               back to plain sends, as on kernels without MSG_ZEROCOPY support */
+            rv = -ENOPROTOOPT;
+            goto out;
+        case SO_BUSY_POLL:
+            rv = sockopt_copy_from_user(optval, optlen, &int_optval, sizeof(int));
+            if (rv)
+                goto out;
+            if (int_optval < 0) {
+                rv = -EINVAL;
+                goto out;
+            }
+            s->busy_poll = int_optval;
+            break;
         default:
             goto unimplemented;
         }
@@ -2509,7 +2903,13 @@ static sysreturn netsock_getsockopt(struct sock *sock, int level,
             break;
         }
         case SO_REUSEPORT:
-            ret_optval.val = 0;
+            ret_optval.val = s->reuseport;
+            break;
+        case SO_ZEROCOPY:
+            rv = -ENOPROTOOPT;
+            goto out;
+        case SO_BUSY_POLL:
+            ret_optval.val = s->busy_poll;
             break;
         case SO_PROTOCOL:
             ret_optval.val = s->sock.type == SOCK_STREAM ? IP_PROTO_TCP : IP_PROTO_UDP;
@@ -2634,6 +3034,9 @@ boolean netsyscall_init(unix_heaps uh, tuple cfg)
         so_rcvbuf = MIN(MAX(rcvbuf, 256), MASK(sizeof(so_rcvbuf) * 8 - 1));
     else
         so_rcvbuf = DEFAULT_SO_RCVBUF;
+    u64 busy_poll_us;
+    if (get_u64(cfg, sym(busy_poll), &busy_poll_us))
+        busy_poll = MIN(busy_poll_us, MASK(31));
     kernel_heaps kh = (kernel_heaps)uh;
     heap h = heap_locked(kh);
     caching_heap socket_cache = allocate_objcache(h, (heap)heap_page_backed(kh),
@@ -2641,6 +3044,10 @@ boolean netsyscall_init(unix_heaps uh, tuple cfg)
     if (socket_cache == INVALID_ADDRESS)
 	return false;
     uh->socket_cache = socket_cache;
+    spin_lock_init(&reuseport_lock);
+    list_init(&reuseport_groups);
+    tcp_zc_heap = h;
+    tcp_zc_ext_id = tcp_ext_arg_alloc_id();
     net_loop_poll = closure(h, netsock_poll);
     netlink_init();
     vsock_init();
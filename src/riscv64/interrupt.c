@@ -225,6 +225,7 @@ void trap_interrupt(void)
 
     f[FRAME_FULL] = true;
     context_reserve_refcount(ctx);
+    page_invalidate_idle_exit();
 
     int saved_state = ci->state;
     switch (v) {
@@ -18,6 +18,7 @@ static inline u64 get_pagetable_base(u64 vaddr)
 #define PAGE_GLOBAL     U64_FROM_BIT(5)
 #define PAGE_DIRTY      U64_FROM_BIT(7)
 #define PAGE_NO_BLOCK   U64_FROM_BIT(8) // RSW[0]
+#define PAGE_SPLIT      U64_FROM_BIT(9) // RSW[1]: page split from a block mapping
 #define PAGE_DEFAULT_PERMISSIONS (PAGE_READABLE)
 #define PAGE_PROT_FLAGS (PAGE_USER | PAGE_EXEC | PAGE_WRITABLE)
 
@@ -181,6 +182,17 @@ static inline u64 flags_from_pte(u64 pte)
     return pte & PAGE_FLAGS_MASK;
 }
 
+/* flags for the next-level entries replacing a block mapping */
+static inline u64 flags_from_block_pte(u64 pte)
+{
+    return flags_from_pte(pte) | PAGE_SPLIT;
+}
+
+static inline boolean pte_is_split(pte entry)
+{
+    return (entry & PAGE_SPLIT) != 0;
+}
+
 static inline pageflags pageflags_from_pte(pte pte)
 {
     return (pageflags){.w = flags_from_pte(pte)};
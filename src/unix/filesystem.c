@@ -56,22 +56,90 @@ sysreturn sysreturn_from_fs_status_value(status s)
     return rv;
 }
 
+static struct {
+    u64 min;                    /* initial window */
+    u64 max;                    /* window cap (doubled for POSIX_FADV_SEQUENTIAL) */
+    word issued_bytes;
+    word hit_bytes;             /* bytes read from readahead windows */
+    word waste_bytes;           /* bytes read ahead but not consumed by the stream */
+} readahead_info;
+
+#define file_ra_lock(f)     spin_lock(&(f)->f.lock)
+#define file_ra_unlock(f)   spin_unlock(&(f)->f.lock)
+
+/* Account the unconsumed part of the current stream as wasted and drop the stream. */
+static void file_readahead_reset(struct file_readahead *ra)
+{
+    u64 consumed = MAX(ra->begin, ra->prev_end);
+    if (ra->end > consumed)
+        fetch_and_add(&readahead_info.waste_bytes, ra->end - consumed);
+    ra->begin = ra->end = ra->size = 0;
+}
+
+/* Sequential reads start a stream with a small window; reads that reach the async trigger (the
+ * start of the last window) issue the next window, which doubles up to the cap, so that fetches
+ * stay one window ahead of the reader. A read outside the stream that is not sequential with the
+ * previous read collapses the stream. */
 void file_readahead(file f, u64 offset, u64 len)
 {
-    u64 ra_size = 0;
-    switch (f->fadv) {
-    case POSIX_FADV_NORMAL:
-        ra_size = FILE_READAHEAD_DEFAULT;
-        break;
-    case POSIX_FADV_RANDOM: /* no read-ahead */
-        break;
-    case POSIX_FADV_SEQUENTIAL:
-        ra_size = 2 * FILE_READAHEAD_DEFAULT;
-        break;
+    u64 max = readahead_info.max;
+    if (f->fadv == POSIX_FADV_RANDOM || max == 0 || len == 0)
+        return;
+    if (f->fadv == POSIX_FADV_SEQUENTIAL)
+        max *= 2;
+    pagecache_node pn = fsfile_get_cachenode(f->fsf);
+    struct file_readahead *ra = &f->ra;
+    u64 end = offset + len;
+    range fetch = irange(0, 0);
+    file_ra_lock(f);
+    if (offset >= ra->begin && offset < ra->end) {
+        /* stream hit */
+        fetch_and_add(&readahead_info.hit_bytes, MIN(end, ra->end) - offset);
+        if (end > ra->async_start) {
+            ra->size = MIN(ra->size * 2, max);
+            fetch = irangel(MAX(ra->end, end), ra->size);
+            ra->async_start = fetch.start;
+        }
+    } else if (offset == ra->prev_end) {
+        /* sequential with the previous read: start a new stream */
+        file_readahead_reset(ra);
+        ra->size = MIN(MAX(U64_FROM_BIT(find_order(len)) * 4, readahead_info.min), max);
+        fetch = irangel(end, ra->size);
+        ra->begin = ra->end = ra->async_start = end;
+    } else {
+        file_readahead_reset(ra);
+    }
+    fetch.end = MIN(fetch.end, pagecache_get_node_length(pn));
+    if (range_valid(fetch) && range_span(fetch))
+        ra->end = fetch.end;
+    else
+        fetch = irange(0, 0);
+    ra->prev_end = end;
+    file_ra_unlock(f);
+    if (range_span(fetch)) {
+        fetch_and_add(&readahead_info.issued_bytes, range_span(fetch));
+        pagecache_node_fetch_pages(pn, fetch);
     }
-    if (ra_size > 0)
-        pagecache_node_fetch_pages(fsfile_get_cachenode(f->fsf),
-            irangel(offset + len, ra_size));
+}
+
+void file_readahead_init(tuple root)
+{
+    u64 size;
+    if (get_u64(root, sym(readahead_max_bytes), &size))
+        readahead_info.max = pad(size, PAGESIZE);   /* 0 disables readahead */
+    else
+        readahead_info.max = FILE_READAHEAD_DEFAULT;
+    if (get_u64(root, sym(readahead_min_bytes), &size) && size > 0)
+        readahead_info.min = pad(size, PAGESIZE);
+    else
+        readahead_info.min = FILE_READAHEAD_MIN;
+}
+
+void file_readahead_stats(buffer b)
+{
+    bprintf(b, "readahead_issued_bytes %ld\n", readahead_info.issued_bytes);
+    bprintf(b, "readahead_hit_bytes %ld\n", readahead_info.hit_bytes);
+    bprintf(b, "readahead_waste_bytes %ld\n", readahead_info.waste_bytes);
 }
 
 fs_status filesystem_chdir(process p, sstring path)
@@ -447,6 +515,8 @@ sysreturn fadvise64(int fd, s64 off, u64 len, int advice)
 
 void file_release(file f)
 {
+    if (f->f.type == FDESC_TYPE_REGULAR)
+        file_readahead_reset(&f->ra);
     release_fdesc(&f->f);
     filesystem_release(f->fs);
     if (f->f.type == FDESC_TYPE_SPECIAL)
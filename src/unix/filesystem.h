@@ -29,6 +29,8 @@ sysreturn sysreturn_from_fs_status_value(status s);
  * offset and len arguments refer to the byte range being read from userspace,
  * not to the range to be read ahead. */
 void file_readahead(file f, u64 offset, u64 len);
+void file_readahead_init(tuple root);
+void file_readahead_stats(buffer b);
 
 fs_status filesystem_chdir(process p, sstring path);
 
@@ -1,60 +1,115 @@
 #include <unix_internal.h>
 
+/* Futexes are kept in a per-process hash table of buckets, each with its own lock, so that
+   operations on unrelated futex words don't contend with each other. A futex (along with its
+   wait queue) only exists while it has waiters: it is created by the first waiting thread and
+   removed after the last waiter has been woken, timed out or interrupted. Waking a futex word
+   that has no waiters doesn't allocate anything. */
+
+#define FUTEX_BUCKETS_PER_CPU   16
+
+typedef struct futex_bucket {
+    struct spinlock lock;
+    struct list futexes;
+} *futex_bucket;
+
+struct futex_table {
+    heap h;
+    u64 mask;
+    struct futex_bucket buckets[0];
+};
+
 struct futex {
+    struct list l;          /* bucket list */
+    u64 key;
+    futex_bucket bucket;
     heap h;
-    blockq bq;
-    struct spinlock lock;
+    u32 waiters;            /* protected by bucket lock */
+    struct blockq bq;
+    closure_struct(thunk, free);
 };
 
-#define futex_lock(f)   spin_lock(&(f)->lock)
-#define futex_unlock(f) spin_unlock(&(f)->lock)
+#define futex_bucket_lock(b)    spin_lock(&(b)->lock)
+#define futex_bucket_unlock(b)  spin_unlock(&(b)->lock)
 
-static u64 futex_key_function(void *x)
+static futex_bucket futex_bucket_from_key(process p, u64 key)
 {
-    return u64_from_pointer(x);
+    struct futex_table *ft = p->futices;
+    u64 hash = (key >> 2) * 0x9e3779b97f4a7c15ull;  /* Fibonacci hashing */
+    return &ft->buckets[(hash >> 32) & ft->mask];
 }
 
-static boolean futex_key_equal(void *a, void *b)
+static void futex_lock_buckets(futex_bucket b1, futex_bucket b2)
 {
-    return a == b;
+    if (b1 == b2)
+        futex_bucket_lock(b1);
+    else
+        spin_lock_2(&b1->lock, &b2->lock);
 }
 
-static struct futex * soft_create_futex(process p, u64 key)
+static void futex_unlock_buckets(futex_bucket b1, futex_bucket b2)
 {
-    heap h = heap_locked(get_kernel_heaps());
-    struct futex * f;
+    if (b1 != b2)
+        futex_bucket_unlock(b2);
+    futex_bucket_unlock(b1);
+}
 
-    process_lock(p);
+closure_func_basic(thunk, void, futex_free)
+{
+    struct futex *f = struct_from_field(closure_self(), struct futex *, free);
+    assert(list_empty(&f->bq.waiters_head));
+    deallocate(f->h, f, sizeof(struct futex));
+}
 
-    f = table_find(p->futices, pointer_from_u64(key));
-    if (f)
-        goto out;
+/* called with bucket locked */
+static struct futex *futex_lookup(futex_bucket b, u64 key)
+{
+    list_foreach(&b->futexes, l) {
+        struct futex *f = struct_from_list(l, struct futex *, l);
+        if (f->key == key)
+            return f;
+    }
+    return 0;
+}
 
+/* called with bucket locked */
+static struct futex *futex_lookup_or_create(process p, futex_bucket b, u64 key)
+{
+    struct futex *f = futex_lookup(b, key);
+    if (f)
+        return f;
+    heap h = p->futices->h;
     f = allocate(h, sizeof(struct futex));
     if (f == INVALID_ADDRESS) {
         msg_err("failed to allocate futex\n");
-        goto out;
+        return f;
     }
-
+    f->key = key;
+    f->bucket = b;
     f->h = h;
-    f->bq = allocate_blockq(f->h, ss("futex"));
-    if (f->bq == INVALID_ADDRESS) {
-        msg_err("failed to allocate futex blockq\n");
-        deallocate(f->h, f, sizeof(struct futex));
-        f = INVALID_ADDRESS;
-        goto out;
-    }
-
-    spin_lock_init(&f->lock);
-    table_set(p->futices, pointer_from_u64(key), f);
-  out:
-    process_unlock(p);
+    f->waiters = 0;
+    f->bq.h = h;
+    blockq_init(&f->bq, ss("futex"));
+
+    /* The blockq may be reserved by a thread interrupt past the removal of the futex from the
+       bucket, so the futex memory is released along with the blockq. */
+    init_refcount(&f->bq.refcount, 1, init_closure_func(&f->free, thunk, futex_free));
+    list_push_back(&b->futexes, &f->l);
     return f;
 }
 
+/* called with bucket locked */
+static void futex_put(struct futex *f)
+{
+    if (f->waiters == 0) {
+        list_delete(&f->l);
+        blockq_release(&f->bq);
+    }
+}
+
 static unix_context futex_wake_one(struct futex * f)
 {
-    unix_context t = blockq_wake_one(f->bq);
+    unix_context t = blockq_wake_one(&f->bq);
     if (t != INVALID_ADDRESS)
         return t;
     kern_pause();
@@ -78,20 +133,19 @@ static int futex_wake_many(struct futex * f, int val)
     return nr_woken;
 }
 
+static int futex_wake_key(process p, u64 key, int val)
+{
+    futex_bucket b = futex_bucket_from_key(p, key);
+    futex_bucket_lock(b);
+    struct futex *f = futex_lookup(b, key);
+    int nr_woken = f ? futex_wake_many(f, val) : 0;
+    futex_bucket_unlock(b);
+    return nr_woken;
+}
+
 boolean futex_wake_many_by_uaddr(process p, int *uaddr, int val)
 {
-    struct futex * f;
-
-    process_lock(p);
-    f = table_find(p->futices, (void *)uaddr);
-    process_unlock(p);
-    if (!f)
-        return false;
-
-    futex_lock(f);
-    futex_wake_many(f, val);
-    futex_unlock(f);
-    return true;
+    return futex_wake_key(p, u64_from_pointer(uaddr), val) > 0;
 }
 
 /*
@@ -113,7 +167,7 @@ closure_function(3, 1, sysreturn, futex_bh,
     sysreturn rv;
 
     if (!(flags & BLOCKQ_ACTION_BLOCKED)) {
-        futex_unlock(f);
+        futex_bucket_unlock(f->bucket);
         return BLOCKQ_BLOCK_REQUIRED;
     }
 
@@ -127,14 +181,24 @@ closure_function(3, 1, sysreturn, futex_bh,
     }
 
     closure_finish();
-    return syscall_return(t, rv);
+    syscall_return(t, rv);
+
+    /* f cannot have been requeued past this point, as the thread is no longer waiting */
+    futex_bucket b = f->bucket;
+    futex_bucket_lock(b);
+    f->waiters--;
+    futex_put(f);
+    futex_bucket_unlock(b);
+    return rv;
 }
 
-closure_function(1, 1, void, futex_requeue_handler,
-                 struct futex *, dest,
+closure_function(2, 1, void, futex_requeue_handler,
+                 struct futex *, src, struct futex *, dest,
                  blockq_action action)
 {
     closure_member(futex_bh, action, f) = bound(dest);
+    bound(src)->waiters--;
+    bound(dest)->waiters++;
 }
 
 static timestamp get_timeout_timestamp(int futex_op, u64 val2)
@@ -150,160 +214,191 @@ static timestamp get_timeout_timestamp(int futex_op, u64 val2)
     }
 }
 
+static sysreturn futex_wait(process p, int *uaddr, int val, clock_id clkid, timestamp ts,
+                            boolean absolute)
+{
+    u64 key = u64_from_pointer(uaddr);
+    futex_bucket b = futex_bucket_from_key(p, key);
+    futex_bucket_lock(b);
+    struct futex *f = futex_lookup_or_create(p, b, key);
+    if (f == INVALID_ADDRESS) {
+        futex_bucket_unlock(b);
+        return -ENOMEM;
+    }
+    f->waiters++;
+
+    sysreturn rv;
+    context ctx = get_current_context(current_cpu());
+    if (context_set_err(ctx))
+        rv = -EFAULT;
+    else if (*uaddr != val)
+        rv = -EAGAIN;
+    else
+        /* the bucket is unlocked by futex_bh before blocking */
+        return blockq_check_timeout(&f->bq, contextual_closure(futex_bh, f, current, ts),
+                                    false, clkid, ts, absolute);
+    f->waiters--;
+    futex_put(f);
+    futex_bucket_unlock(b);
+    if (rv != -EFAULT)
+        context_clear_err(ctx);
+    return rv;
+}
+
+/* Wake up to val waiters, then move up to val2 of the remaining waiters to the futex at uaddr2.
+   If cmp is set, the value at uaddr must be equal to val3. */
+static sysreturn futex_requeue(process p, int *uaddr, int val, u64 val2, int *uaddr2, int val3,
+                               boolean cmp)
+{
+    if (!validate_user_memory(uaddr2, sizeof(int), false))
+        return -EFAULT;
+    u64 key = u64_from_pointer(uaddr);
+    u64 key2 = u64_from_pointer(uaddr2);
+    futex_bucket b = futex_bucket_from_key(p, key);
+    futex_bucket b2 = futex_bucket_from_key(p, key2);
+    sysreturn rv;
+    context ctx = get_current_context(current_cpu());
+    futex_lock_buckets(b, b2);
+    if (cmp) {
+        if (context_set_err(ctx)) {
+            rv = -EFAULT;
+            goto out;
+        }
+        if (*uaddr != val3) {
+            rv = -EAGAIN;
+            goto out_clear_err;
+        }
+    }
+    struct futex *f = futex_lookup(b, key);
+    if (!f) {
+        rv = 0;
+        goto out_clear_err;
+    }
+
+    int woken = futex_wake_many(f, val);
+    int requeued = 0;
+    if (val2 > 0 && key2 != key) {
+        struct futex *dest = futex_lookup_or_create(p, b2, key2);
+        if (dest == INVALID_ADDRESS) {
+            rv = -ENOMEM;
+            goto out_clear_err;
+        }
+        requeued = blockq_transfer_waiters(&dest->bq, &f->bq, val2,
+                                           stack_closure(futex_requeue_handler, f, dest));
+        futex_put(dest);
+        futex_put(f);
+    }
+    rv = woken + requeued;
+  out_clear_err:
+    if (cmp)
+        context_clear_err(ctx);
+  out:
+    futex_unlock_buckets(b, b2);
+    return rv;
+}
+
+static sysreturn futex_wake_op(process p, int *uaddr, int val, u64 val2, int *uaddr2, int val3)
+{
+    unsigned int cmparg = val3 & MASK(12);
+    unsigned int oparg = (val3 >> 12) & MASK(12);
+    unsigned int cmp = (val3 >> 24) & MASK(4);
+    unsigned int op = (val3 >> 28) & MASK(4);
+    int oldval, wake1, wake2, c;
+
+    if (!validate_user_memory(uaddr2, sizeof(int), true))
+        return -EFAULT;
+
+    u64 key = u64_from_pointer(uaddr);
+    u64 key2 = u64_from_pointer(uaddr2);
+    futex_bucket b = futex_bucket_from_key(p, key);
+    futex_bucket b2 = futex_bucket_from_key(p, key2);
+    boolean fault = false;
+    wake1 = wake2 = 0;
+    context ctx = get_current_context(current_cpu());
+    futex_lock_buckets(b, b2);
+    if (context_set_err(ctx)) {
+        fault = true;
+        goto wake_op_done;
+    }
+    oldval = *(int *) uaddr2;
+
+    switch (op) {
+    case FUTEX_OP_SET:   *uaddr2 = oparg; break;
+    case FUTEX_OP_ADD:   *uaddr2 += oparg; break;
+    case FUTEX_OP_OR:    *uaddr2 |= oparg; break;
+    case FUTEX_OP_ANDN:  *uaddr2 &= ~oparg; break;
+    case FUTEX_OP_XOR:   *uaddr2 ^= oparg; break;
+    }
+    context_clear_err(ctx);
+
+    struct futex *f = futex_lookup(b, key);
+    if (f)
+        wake1 = futex_wake_many(f, val);
+
+    c = 0;
+    switch (cmp) {
+    case FUTEX_OP_CMP_EQ: c = (oldval == cmparg) ; break;
+    case FUTEX_OP_CMP_NE: c = (oldval != cmparg); break;
+    case FUTEX_OP_CMP_LT: c = (oldval < cmparg); break;
+    case FUTEX_OP_CMP_LE: c = (oldval <= cmparg); break;
+    case FUTEX_OP_CMP_GT: c = (oldval > cmparg) ; break;
+    case FUTEX_OP_CMP_GE: c = (oldval >= cmparg) ; break;
+    }
+
+    if (c) {
+        struct futex *f2 = futex_lookup(b2, key2);
+        if (f2)
+            wake2 = futex_wake_many(f2, val2);
+    }
+
+  wake_op_done:
+    futex_unlock_buckets(b, b2);
+    return fault ? -EFAULT : wake1 + wake2;
+}
+
 sysreturn futex(int *uaddr, int futex_op, int val,
                 u64 val2, int *uaddr2, int val3)
 {
-    struct futex * f;
     timestamp ts;
     int op;
 
     if (!validate_user_memory(uaddr, sizeof(int), false))
         return set_syscall_error(current, EFAULT);
 
-    f = soft_create_futex(current->p, u64_from_pointer(uaddr));
-    if (f == INVALID_ADDRESS)
-        return set_syscall_error(current, ENOMEM);
-    
+    process p = current->p;
     op = futex_op & 127; // chuck the private bit
     ts = get_timeout_timestamp(op, val2);
     clock_id clkid = (futex_op & FUTEX_CLOCK_REALTIME) ? CLOCK_ID_REALTIME :
             CLOCK_ID_MONOTONIC;
 
-    context ctx = get_current_context(current_cpu());
     switch (op) {
-    case FUTEX_WAIT: {
-        sysreturn rv;
-        futex_lock(f);
-        if (context_set_err(ctx))
-            rv = -EFAULT;
-        else if (*uaddr != val)
-            rv = -EAGAIN;
-        else
-            rv = blockq_check_timeout(f->bq,
-                                      contextual_closure(futex_bh, f, current, ts),
-                                      false, clkid, ts, false);
-        futex_unlock(f);
-        if (rv != -EFAULT)
-            context_clear_err(ctx);
-        return rv;
-    }
-
-    case FUTEX_WAKE: {
-        futex_lock(f);
-        int nr_woken = futex_wake_many(f, val);
-        futex_unlock(f);
-        return nr_woken;
-    }
-
-    case FUTEX_CMP_REQUEUE: {
-        int woken, requeued;
-
-        if (!validate_user_memory(uaddr2, sizeof(int), false))
-            return set_syscall_error(current, EFAULT);
+    case FUTEX_WAIT:
+        return futex_wait(p, uaddr, val, clkid, ts, false);
 
-        sysreturn rv;
-        futex_lock(f);
-        if (context_set_err(ctx)) {
-            rv = -EFAULT;
-            goto cmp_requeue_done;
-        }
-        if (*uaddr != val3) {
-            rv = -EAGAIN;
-            goto cmp_requeue_done;
-        }
+    case FUTEX_WAKE:
+        return futex_wake_key(p, u64_from_pointer(uaddr), val);
 
-        woken = futex_wake_many(f, val);
-
-        requeued = 0;
-        if (val2 > 0) {
-            struct futex * new = soft_create_futex(current->p, u64_from_pointer(uaddr2));
-            if (new == INVALID_ADDRESS) {
-                rv = -ENOMEM;
-                goto cmp_requeue_done;
-            }
-            requeued = blockq_transfer_waiters(new->bq, f->bq, val2,
-                                               stack_closure(futex_requeue_handler, new));
-        }
-        rv = woken + requeued;
-      cmp_requeue_done:
-        futex_unlock(f);
-        if (rv != -EFAULT)
-            context_clear_err(ctx);
-        return rv;
-    }
+    case FUTEX_REQUEUE:
+        return futex_requeue(p, uaddr, val, val2, uaddr2, val3, false);
 
-    case FUTEX_WAKE_OP: {
-        unsigned int cmparg = val3 & MASK(12);
-        unsigned int oparg = (val3 >> 12) & MASK(12);
-        unsigned int cmp = (val3 >> 24) & MASK(4);
-        unsigned int op = (val3 >> 28) & MASK(4);
-        int oldval, wake1, wake2, c;
-
-        if (!validate_user_memory(uaddr2, sizeof(int), true))
-            return set_syscall_error(current, EFAULT);
-
-        struct futex *f2 = soft_create_futex(current->p, u64_from_pointer(uaddr2));
-        if (f2 == INVALID_ADDRESS)
-            return -ENOMEM;
-        boolean fault = false;
-        spin_lock_2(&f->lock, &f2->lock);
-        if (context_set_err(ctx)) {
-            fault = true;
-            goto wake_op_done;
-        }
-        oldval = *(int *) uaddr2;
-        
-        switch (op) {
-        case FUTEX_OP_SET:   *uaddr2 = oparg; break;
-        case FUTEX_OP_ADD:   *uaddr2 += oparg; break;
-        case FUTEX_OP_OR:    *uaddr2 |= oparg; break;
-        case FUTEX_OP_ANDN:  *uaddr2 &= ~oparg; break;
-        case FUTEX_OP_XOR:   *uaddr2 ^= oparg; break;
-        }
-        context_clear_err(ctx);
+    case FUTEX_CMP_REQUEUE:
+        return futex_requeue(p, uaddr, val, val2, uaddr2, val3, true);
 
-        wake1 = futex_wake_many(f, val);
-        
-        c = 0;
-        switch (cmp) {
-        case FUTEX_OP_CMP_EQ: c = (oldval == cmparg) ; break;
-        case FUTEX_OP_CMP_NE: c = (oldval != cmparg); break;
-        case FUTEX_OP_CMP_LT: c = (oldval < cmparg); break;
-        case FUTEX_OP_CMP_LE: c = (oldval <= cmparg); break;
-        case FUTEX_OP_CMP_GT: c = (oldval > cmparg) ; break;
-        case FUTEX_OP_CMP_GE: c = (oldval >= cmparg) ; break;
-        }
-        
-        wake2 = 0;
-        if (c) {
-            wake2 = futex_wake_many(f2, val2);
-        }
+    case FUTEX_WAKE_OP:
+        return futex_wake_op(p, uaddr, val, val2, uaddr2, val3);
 
-      wake_op_done:
-        futex_unlock(f2);
-        futex_unlock(f);
-        return fault ? -EFAULT : wake1 + wake2;
-    }
+    /* Waiters are not filtered by bitset; a waiter woken with a non-matching bitset sees a
+       spurious wakeup, which futex users must tolerate anyway. */
+    case FUTEX_WAIT_BITSET:
+        if (val3 == 0)
+            return -EINVAL;
+        return futex_wait(p, uaddr, val, clkid, ts, true);
 
-    case FUTEX_WAIT_BITSET: {
-        sysreturn rv;
-        futex_lock(f);
-        if (context_set_err(ctx))
-            rv = -EFAULT;
-        else if (*uaddr != val)
-            rv = -EAGAIN;
-        else
-            rv = blockq_check_timeout(f->bq,
-                                      contextual_closure(futex_bh, f, current, ts),
-                                      false, clkid, ts, true);
-        futex_unlock(f);
-        if (rv != -EFAULT)
-            context_clear_err(ctx);
-        return rv;
-    }
+    case FUTEX_WAKE_BITSET:
+        if (val3 == 0)
+            return -EINVAL;
+        return futex_wake_key(p, u64_from_pointer(uaddr), val);
 
-    case FUTEX_REQUEUE: rprintf("futex_requeue not implemented\n"); break;
-    case FUTEX_WAKE_BITSET: rprintf("futex_wake_bitset not implemented\n"); break;
     case FUTEX_LOCK_PI: rprintf("futex_lock_pi not implemented\n"); break;
     case FUTEX_TRYLOCK_PI: rprintf("futex_trylock_pi not implemented\n"); break;
     case FUTEX_UNLOCK_PI: rprintf("futex_unlock_pi not implemented\n"); break;
@@ -319,9 +414,18 @@ void
 init_futices(process p)
 {
     heap h = heap_locked(&p->uh->kh);
-    p->futices = allocate_table(h, futex_key_function, futex_key_equal);
-    if (p->futices == INVALID_ADDRESS)
+    u64 n = U64_FROM_BIT(find_order(total_processors * FUTEX_BUCKETS_PER_CPU));
+    struct futex_table *ft = allocate(h, sizeof(struct futex_table) +
+                                      n * sizeof(struct futex_bucket));
+    if (ft == INVALID_ADDRESS)
         halt("failed to allocate futex table\n");
+    ft->h = h;
+    ft->mask = n - 1;
+    for (u64 i = 0; i < n; i++) {
+        spin_lock_init(&ft->buckets[i].lock);
+        list_init(&ft->buckets[i].futexes);
+    }
+    p->futices = ft;
 }
 
 /* robust mutex handling */
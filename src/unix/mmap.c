@@ -28,8 +28,28 @@
         }                                                               \
     } while(0)
 
-#define vmap_lock(p) u64 _savedflags = spin_lock_irq(&(p)->vmap_lock)
-#define vmap_unlock(p) spin_unlock_irq(&(p)->vmap_lock, _savedflags)
+/* Holders of the vmap lock make vmap_seq odd, so that lockless lookups
+   (vmap_from_vaddr) overlapping a modification retry. */
+static inline u64 vmap_lock_irq(process p)
+{
+    u64 flags = spin_lock_irq(&p->vmap_lock);
+    p->vmap_seq++;
+    write_barrier();
+    return flags;
+}
+
+static inline void vmap_unlock_irq(process p, u64 flags)
+{
+    write_barrier();
+    p->vmap_seq++;
+    spin_unlock_irq(&p->vmap_lock, flags);
+}
+
+#define vmap_lock(p) u64 _savedflags = vmap_lock_irq(p)
+#define vmap_unlock(p) vmap_unlock_irq(p, _savedflags)
+
+#define VMAP_LOOKUP_RETRIES     4
+#define VMAP_LOOKUP_MAX_DEPTH   64  /* bounds walks through a tree being rebalanced */
 
 typedef struct vmap_heap {
     struct heap h;  /* must be first */
@@ -37,14 +57,21 @@ typedef struct vmap_heap {
     boolean randomize;
 } *vmap_heap;
 
+/* transparent huge page modes */
+#define THP_NEVER   0
+#define THP_MADVISE 1
+#define THP_ALWAYS  2
+
 static struct {
     heap h;
     heap virtual_backed;
+    heap block_backed;
+    heap physical;
+    int thp;
+    u64 fault_around;
 
     closure_struct(rb_key_compare, pf_compare);
     closure_struct(rbnode_handler, pf_print);
-
-    struct list pf_freelist;
 } mmap_info;
 
 static status demand_anonymous_page(pending_fault pf, context ctx, vmap vm, u64 vaddr);
@@ -64,6 +91,11 @@ closure_func_basic(rbnode_handler, boolean, pending_fault_print,
     return true;
 }
 
+static inline struct pending_fault_bucket *pending_fault_bucket(process p, u64 addr)
+{
+    return &p->pending_faults[(addr >> PAGELOG) & (PENDING_FAULT_BUCKETS - 1)];
+}
+
 closure_func_basic(status_handler, void, pending_fault_complete,
                    status s)
 {
@@ -77,8 +109,8 @@ closure_func_basic(status_handler, void, pending_fault_complete,
         zero(pointer_from_u64(r.start), range_span(r));
     }
     context ctx;
-    process p = pf->p;
-    u64 flags = spin_lock_irq(&p->faulting_lock);
+    struct pending_fault_bucket *b = pending_fault_bucket(pf->p, pf->addr);
+    u64 flags = spin_lock_irq(&b->lock);
     vector_foreach(pf->dependents, ctx) {
         pf_debug("   wake ctx %p\n", ctx);
 
@@ -86,18 +118,18 @@ closure_func_basic(status_handler, void, pending_fault_complete,
         context_schedule_return(ctx);
     }
     vector_clear(pf->dependents);
-    rbtree_remove_node(&p->pending_faults, &pf->n);
-    list_insert_after(&mmap_info.pf_freelist, &pf->l_free);
-    spin_unlock_irq(&p->faulting_lock, flags);
+    rbtree_remove_node(&b->faults, &pf->n);
+    list_insert_after(&b->free, &pf->l_free);
+    spin_unlock_irq(&b->lock, flags);
     if (!is_ok(s))
         timm_dealloc(s);
 }
 
-static pending_fault new_pending_fault_locked(process p, u64 addr)
+static pending_fault new_pending_fault_locked(process p, struct pending_fault_bucket *b, u64 addr)
 {
     pending_fault pf;
     list l;
-    if ((l = list_get_next(&mmap_info.pf_freelist))) {
+    if ((l = list_get_next(&b->free))) {
         pf = struct_from_list(l, pending_fault, l_free);
         list_delete(l);
     } else {
@@ -111,15 +143,15 @@ static pending_fault new_pending_fault_locked(process p, u64 addr)
     pf->bss_start = 0;
     pf->p = p;
     init_closure_func(&pf->complete, status_handler, pending_fault_complete);
-    assert(rbtree_insert_node(&p->pending_faults, &pf->n));
+    assert(rbtree_insert_node(&b->faults, &pf->n));
     return pf;
 }
 
-static pending_fault find_pending_fault_locked(process p, u64 addr)
+static pending_fault find_pending_fault_locked(struct pending_fault_bucket *b, u64 addr)
 {
     struct pending_fault k;
     k.addr = addr;
-    rbnode n = rbtree_lookup(&p->pending_faults, &k.n);
+    rbnode n = rbtree_lookup(&b->faults, &k.n);
     if (n == INVALID_ADDRESS)
         return 0;
     return (pending_fault)n;
@@ -146,7 +178,7 @@ u64 new_zeroed_pages(u64 v, u64 length, pageflags flags, status_handler complete
 
 static void demand_page_major_fault(pending_fault pf, context ctx)
 {
-    spinlock lock = &pf->p->faulting_lock;
+    spinlock lock = &pending_fault_bucket(pf->p, pf->addr)->lock;
     spin_lock(lock);
     vector_push(pf->dependents, ctx);
     spin_unlock(lock);
@@ -173,9 +205,47 @@ closure_function(4, 1, void, mmap_anon_page,
     closure_finish();
 }
 
+static boolean vmap_thp_eligible(vmap vm)
+{
+    if ((mmap_info.thp == THP_NEVER) || (vm->flags & VMAP_FLAG_NOHUGEPAGE) ||
+        ((mmap_info.thp == THP_MADVISE) && !(vm->flags & VMAP_FLAG_HUGEPAGE)))
+        return false;
+    return (vm->flags & VMAP_FLAG_HEAP) ||
+           ((vm->flags & VMAP_FLAG_MMAP) &&
+            ((vm->flags & VMAP_MMAP_TYPE_MASK) == VMAP_MMAP_TYPE_ANONYMOUS));
+}
+
+/* Try to back the 2MB-aligned block containing vaddr with a zeroed huge page. Falls back to
+   single pages (by returning false) if the block is not entirely within the vmap, if any page
+   in the block is already mapped, or if free memory is running low. */
+static boolean demand_anonymous_block(vmap vm, u64 vaddr, status_handler complete)
+{
+    u64 block = vaddr & ~MASK(PAGELOG_2M);
+    if (!vmap_thp_eligible(vm) || !range_contains(vm->node.r, irangel(block, PAGESIZE_2M)) ||
+        heap_free(mmap_info.physical) < PAGEHEAP_MEMORY_RESERVE + PAGESIZE_2M)
+        return false;
+    void *m = allocate(mmap_info.block_backed, PAGESIZE_2M);
+    if (m == INVALID_ADDRESS)
+        return false;
+    zero(m, PAGESIZE_2M);
+    write_barrier();
+    if (!map_block(block, physical_from_virtual(m), PAGELOG_2M,
+                   pageflags_from_vmflags(vm->flags))) {
+        deallocate(mmap_info.block_backed, m, PAGESIZE_2M);
+        return false;
+    }
+    pf_debug("%s: mapped huge page at 0x%lx\n", func_ss, block);
+    apply(complete, STATUS_OK);
+    return true;
+}
+
 static status demand_anonymous_page(pending_fault pf, context ctx, vmap vm, u64 vaddr)
 {
     status_handler completion = (status_handler)&pf->complete;
+    if (demand_anonymous_block(vm, vaddr, completion)) {
+        count_minor_fault();
+        return STATUS_OK;
+    }
     if (new_zeroed_pages(vaddr & ~MASK(PAGELOG), PAGESIZE, pageflags_from_vmflags(vm->flags),
                          completion) == INVALID_PHYSICAL) {
         if (ctx) {
@@ -194,6 +264,57 @@ static status demand_anonymous_page(pending_fault pf, context ctx, vmap vm, u64
     return STATUS_OK;
 }
 
+/* Returns whether a node offset is in the window last fetched ahead of sequential faults. */
+static boolean vmap_fetched_ahead(vmap vm, u64 node_offset)
+{
+    u64 fetch_ahead = vm->fetch_ahead;
+    return fetch_ahead && point_in_range(irangel(fetch_ahead, mmap_info.fault_around), node_offset);
+}
+
+/* Map filled pages around a file-backed page fault, within an aligned window of fault_around
+   bytes, and fetch the following window asynchronously if faults are sequential; returns true if
+   the following window is being fetched. */
+static boolean demand_filebacked_fault_around(process p, vmap vm, u64 page_addr, u64 node_offset,
+                                              pageflags flags, u64 padlen)
+{
+    u64 window = mmap_info.fault_around;
+    pagecache_node pn = vm->cache_node;
+    if (!window)
+        return false;
+
+    /* limit the window to the vmap, the file and (for the tail bss) the last file page */
+    range r = range_intersection(irangel(page_addr & ~(window - 1), window), vm->node.r);
+    u64 file_end = vm->node.r.start + padlen - vm->node_offset;
+    if (vm->flags & VMAP_FLAG_TAIL_BSS)
+        file_end = MIN(file_end, vm->node.r.start + (vm->bss_offset & ~PAGEMASK));
+    r.end = MIN(r.end, file_end);
+    u64 mapped = 0;
+    if (r.start < page_addr)
+        mapped += pagecache_map_pages_if_filled(pn, node_offset - (page_addr - r.start),
+                                                irange(r.start, page_addr), flags);
+    if (page_addr + PAGESIZE < r.end)
+        mapped += pagecache_map_pages_if_filled(pn, node_offset + PAGESIZE,
+                                                irange(page_addr + PAGESIZE, r.end), flags);
+    if (mapped)
+        fetch_and_add(&p->minor_faults_avoided, mapped);
+
+    /* A fault right past the previous window indicates sequential access. The vmap lock is not
+       held here: concurrent faults on the same vmap update the detection state atomically, so
+       that only one of them fetches the following window. */
+    u64 fault_next = vm->fault_next;
+    boolean sequential = (r.start == fault_next) && (r.start > vm->node.r.start) &&
+        compare_and_swap_64(&vm->fault_next, fault_next, r.end);
+    if (!sequential)
+        vm->fault_next = r.end;
+    pf_debug("   fault-around %R, mapped %ld, sequential %d\n", r, mapped, sequential);
+    if (!sequential || (r.end >= file_end))
+        return false;
+    u64 ra_start = node_offset + (r.end - page_addr);
+    vm->fetch_ahead = ra_start;
+    pagecache_node_fetch_pages(pn, irange(ra_start, ra_start + MIN(window, file_end - r.end)));
+    return true;
+}
+
 define_closure_function(3, 0, void, pending_fault_demand_file_page,
                         vmap, vm, u64, node_offset, pageflags, flags)
 {
@@ -204,8 +325,19 @@ define_closure_function(3, 0, void, pending_fault_demand_file_page,
     pagecache_node pn = vm->cache_node;
     pf_debug("%s: pending_fault %p, node_offset 0x%lx, page_addr 0x%lx, flags 0x%lx\n",
              func_ss, pf, node_offset, pf->addr, flags);
-    pagecache_map_page(pn, node_offset, pf->addr, flags,
+    /* pf may be released as soon as the page is mapped */
+    process p = pf->p;
+    u64 page_addr = pf->addr;
+    pagecache_map_page(pn, node_offset, page_addr, flags,
                        (status_handler)&pf->complete);
+
+    /* sequential major faults fetch ahead as minor ones do, so that the following faults can be
+       served from the page cache; the fixed readahead below would only request the same pages
+       again */
+    if (demand_filebacked_fault_around(p, vm, page_addr, node_offset, flags,
+                                       pad(pagecache_get_node_length(pn), PAGESIZE)) ||
+        vmap_fetched_ahead(vm, node_offset))
+        return;
     range ra = irange(node_offset + PAGESIZE,
         vm->node_offset + range_span(vm->node.r));
     if (range_valid(ra)) {
@@ -244,6 +376,9 @@ static status demand_filebacked_page(process p, context ctx, vmap vm, u64 vaddr,
     if (pagecache_map_page_if_filled(vm->cache_node, node_offset, page_addr, flags, completion)) {
         pf_debug("   immediate completion\n");
         count_minor_fault();
+        if (vmap_fetched_ahead(vm, node_offset))
+            fetch_and_add(&p->major_faults_avoided, 1);
+        demand_filebacked_fault_around(p, vm, page_addr, node_offset, flags, padlen);
         return STATUS_OK;
     }
 
@@ -274,16 +409,17 @@ status do_demand_page(process p, context ctx, u64 vaddr, vmap vm)
              vaddr, vm->flags);
     pf_debug("   vmap %p, context %p\n", vm, ctx);
 
-    u64 flags = spin_lock_irq(&p->faulting_lock);
-    pending_fault pf = find_pending_fault_locked(p, page_addr);
+    struct pending_fault_bucket *b = pending_fault_bucket(p, page_addr);
+    u64 flags = spin_lock_irq(&b->lock);
+    pending_fault pf = find_pending_fault_locked(b, page_addr);
     if (pf) {
         pf_debug("   found pending_fault %p\n", pf);
         vector_push(pf->dependents, ctx);
-        spin_unlock_irq(&p->faulting_lock, flags);
+        spin_unlock_irq(&b->lock, flags);
         count_minor_fault(); /* XXX not precise...stash pt type in faulting thread? */
     } else {
-        pf = new_pending_fault_locked(p, page_addr);
-        spin_unlock_irq(&p->faulting_lock, flags);
+        pf = new_pending_fault_locked(p, b, page_addr);
+        spin_unlock_irq(&b->lock, flags);
         pf_debug("   new pending_fault %p\n", pf);
         if (vm->flags & VMAP_FLAG_MMAP) {
             int mmap_type = vm->flags & VMAP_MMAP_TYPE_MASK;
@@ -312,8 +448,46 @@ static inline vmap vmap_from_vaddr_locked(process p, u64 vaddr)
     return (vmap)rangemap_lookup(p->vmaps, vaddr);
 }
 
+/* Walk the vmap tree without the vmap lock; returns 0 if the walk is cut short by a concurrent
+ * rebalance. Must be called within an epoch read-side section, which keeps removed vmaps from
+ * being freed. */
+static vmap vmap_lookup_lockless(rangemap rm, u64 vaddr)
+{
+    rbnode n = *(rbnode volatile *)&rm->t.root;
+    for (int depth = 0; depth < VMAP_LOOKUP_MAX_DEPTH; depth++) {
+        if (!n)
+            return INVALID_ADDRESS;
+        rmnode rn = (rmnode)n;
+        if (vaddr < rn->r.start)
+            n = *(rbnode volatile *)&n->c[0];
+        else if (vaddr >= rn->r.end)
+            n = *(rbnode volatile *)&n->c[1];
+        else
+            return (vmap)rn;
+    }
+    return 0;
+}
+
+/* Lookups are validated against vmap_seq and fall back to taking the lock only if they keep
+ * overlapping with modifications. */
 vmap vmap_from_vaddr(process p, u64 vaddr)
 {
+    u64 flags = epoch_enter();
+    for (int retry = 0; retry < VMAP_LOOKUP_RETRIES; retry++) {
+        word seq = p->vmap_seq;
+        if (seq & 1) {
+            kern_pause();
+            continue;
+        }
+        read_barrier();
+        vmap vm = vmap_lookup_lockless(p->vmaps, vaddr);
+        read_barrier();
+        if (vm && p->vmap_seq == seq) {
+            epoch_exit(flags);
+            return vm;
+        }
+    }
+    epoch_exit(flags);
     vmap_lock(p);
     vmap vm = vmap_from_vaddr_locked(p, vaddr);
     vmap_unlock(p);
@@ -430,13 +604,20 @@ static void vmap_paranoia_locked(rangemap pvmap)
 #define vmap_paranoia_locked(x)
 #endif
 
+closure_func_basic(thunk, void, vmap_free)
+{
+    vmap vm = struct_from_field(closure_self(), vmap, free);
+    deallocate(mmap_info.h, vm, sizeof(struct vmap));
+}
+
 /* TODO maybe refcount makes more sense now that we have asynchronous faults */
 static void deallocate_vmap_locked(rangemap rm, vmap vm)
 {
     vmap_debug("%s: vm %p %R\n", func_ss, vm, vm->node.r);
     if (!(vm->flags & VMAP_FLAG_TAIL_BSS) && vm->fd)
         fdesc_put(vm->fd);
-    deallocate(rm->h, vm, sizeof(struct vmap));
+    /* a lockless lookup may still be walking through this node */
+    epoch_retire(&vm->retired, init_closure_func(&vm->free, thunk, vmap_free));
 }
 
 static vmap allocate_vmap_locked(rangemap rm, range q, struct vmap k)
@@ -820,13 +1001,17 @@ struct vmap altered_vmap_key(vmap match, u32 flags, u64 offset_delta)
     if (!(flags & VMAP_FLAG_TAIL_BSS))
         k.fd = match->fd;
     vmap_set_offsets(&k, match, offset_delta);
+    k.fault_next = 0;
+    k.fetch_ahead = 0;
     return k;
 }
 
-void vmap_update_protections_intersection(heap h, rangemap pvmap, range q, u32 newflags,
-                                          vmap match)
+/* replace the flags in mask with newflags for the part of match intersecting q */
+static void vmap_update_flags_intersection(rangemap pvmap, range q, u32 mask, u32 newflags,
+                                           vmap match)
 {
     vmap_debug("%s: vm %p %R prev flags 0x%x\n", func_ss, match, match->node.r, match->flags);
+    newflags = (match->flags & ~mask) | newflags;
     if (newflags == match->flags)
         return;
 
@@ -836,9 +1021,6 @@ void vmap_update_protections_intersection(heap h, rangemap pvmap, range q, u32 n
     boolean head = ri.start > rn.start;
     boolean tail = ri.end < rn.end;
 
-    /* protection flags only */
-    newflags = (match->flags & ~(VMAP_FLAG_WRITABLE | VMAP_FLAG_EXEC)) | newflags;
-
     if (!head && !tail) {
         /* updating flags may result in adjacent maps with same attributes;
            removing and reinserting the node will take care of merging */
@@ -874,6 +1056,14 @@ void vmap_update_protections_intersection(heap h, rangemap pvmap, range q, u32 n
     }
 }
 
+void vmap_update_protections_intersection(heap h, rangemap pvmap, range q, u32 newflags,
+                                          vmap match)
+{
+    /* protection flags only */
+    vmap_update_flags_intersection(pvmap, q, VMAP_FLAG_WRITABLE | VMAP_FLAG_EXEC, newflags,
+                                   match);
+}
+
 closure_func_basic(range_handler, boolean, vmap_update_protections_gap,
                    range r)
 {
@@ -1046,6 +1236,126 @@ void truncate_file_maps(process p, fsfile f, u64 new_length)
     vmap_unlock(p);
 }
 
+closure_function(1, 1, boolean, madvise_dontneed_vmap,
+                 range, q,
+                 vmap vm)
+{
+    range rn = vm->node.r;
+    range ri = range_intersection(bound(q), rn);
+    int type = vm->flags & VMAP_MMAP_TYPE_MASK;
+
+    /* Dropping shared anonymous pages would lose data visible through other mappings; custom
+       and program maps are left alone. */
+    if ((vm->flags & VMAP_FLAG_PROG) || (type == VMAP_MMAP_TYPE_CUSTOM) ||
+        ((type == VMAP_MMAP_TYPE_ANONYMOUS) && (vm->flags & VMAP_FLAG_SHARED)))
+        return true;
+    if (!(vm->flags & VMAP_FLAG_MMAP)) {
+        if (!(vm->flags & (VMAP_FLAG_HEAP | VMAP_FLAG_STACK | VMAP_FLAG_BSS)))
+            return true;
+        type = VMAP_MMAP_TYPE_ANONYMOUS;
+    }
+    pf_debug("%s: vm %p, dropping pages %R\n", func_ss, vm, ri);
+    if (type == VMAP_MMAP_TYPE_ANONYMOUS) {
+        unmap_and_free_phys(ri.start, range_span(ri));
+    } else {
+        /* the vmap stays in place: keep tracking writes through shared file mappings */
+        struct vmap k = altered_vmap_key(vm, vm->flags, ri.start - rn.start);
+        pagecache_node_drop_mapped_pages(k.cache_node, ri, k.node_offset);
+    }
+    return true;
+}
+
+/* MADV_FREE only applies to private anonymous memory. */
+closure_function(1, 1, boolean, madvise_free_validate,
+                 boolean *, valid,
+                 vmap vm)
+{
+    boolean anon;
+    if (vm->flags & (VMAP_FLAG_PROG | VMAP_FLAG_SHARED))
+        anon = false;
+    else if (vm->flags & VMAP_FLAG_MMAP)
+        anon = ((vm->flags & VMAP_MMAP_TYPE_MASK) == VMAP_MMAP_TYPE_ANONYMOUS);
+    else
+        anon = ((vm->flags & (VMAP_FLAG_HEAP | VMAP_FLAG_STACK | VMAP_FLAG_BSS)) != 0);
+    if (!anon)
+        *bound(valid) = false;
+    return true;
+}
+
+static sysreturn madvise(void *addr, u64 length, int advice)
+{
+    u64 where = u64_from_pointer(addr);
+    if (where & MASK(PAGELOG))
+        return -EINVAL;
+    u64 len = pad(length, PAGESIZE);
+    if (len == 0)
+        return 0;
+    range q = irangel(where, len);
+    u32 mask = VMAP_FLAG_HUGEPAGE | VMAP_FLAG_NOHUGEPAGE;
+    u32 newflags;
+    switch (advice) {
+    case MADV_NORMAL:
+    case MADV_RANDOM:
+    case MADV_SEQUENTIAL:
+    case MADV_WILLNEED:
+    case MADV_DONTFORK:
+    case MADV_DOFORK:
+    case MADV_MERGEABLE:
+    case MADV_UNMERGEABLE:
+    case MADV_DONTDUMP:
+    case MADV_DODUMP:
+        /* hints with no effect here */
+        return 0;
+    case MADV_DONTNEED:
+    case MADV_FREE: {
+        process p = current->p;
+        if (!validate_user_memory(addr, len, false))
+            return -ENOMEM;
+        if (advice == MADV_FREE) {
+            boolean valid = true;
+            if (vmap_range_walk(p, q, stack_closure(madvise_free_validate, &valid), false) !=
+                RM_MATCH)
+                return -ENOMEM;
+            if (!valid)
+                return -EINVAL;
+        }
+        int res = vmap_range_walk(p, q, stack_closure(madvise_dontneed_vmap, q), false);
+        return (res == RM_MATCH) ? 0 : -ENOMEM;
+    }
+    case MADV_HUGEPAGE:
+        newflags = VMAP_FLAG_HUGEPAGE;
+        break;
+    case MADV_NOHUGEPAGE:
+        newflags = VMAP_FLAG_NOHUGEPAGE;
+        break;
+    default:
+        return -EINVAL;
+    }
+
+    process p = current->p;
+    sysreturn rv = 0;
+    vmap_lock(p);
+    if (!validate_user_memory(addr, len, false) ||
+        (rangemap_range_find_gaps(p->vmaps, q,
+                                  stack_closure_func(range_handler, vmap_update_protections_gap))
+         == RM_ABORT)) {
+        rv = -ENOMEM;
+        goto out;
+    }
+    /* updating flags can lead to merging of nodes, so we cannot traverse */
+    range r = q;
+    while (range_span(r)) {
+        vmap vm = (vmap)rangemap_lookup(p->vmaps, r.start);
+        vmap_assert(vm != INVALID_ADDRESS);
+        vmap_update_flags_intersection(p->vmaps, q, mask, newflags, vm);
+        r.start = MIN(r.end, vm->node.r.end);
+    }
+    vmap_paranoia_locked(p->vmaps);
+  out:
+    vmap_unlock(p);
+    return rv;
+}
+
 closure_func_basic(vmap_handler, boolean, msync_vmap,
                    vmap vm)
 {
@@ -1376,7 +1686,27 @@ void mmap_process_init(process p, tuple root)
     boolean aslr = !get(root, sym(noaslr));
     mmap_info.h = h;
     mmap_info.virtual_backed = (heap)kh->pages;
+    mmap_info.block_backed = (heap)kh->page_backed;
+    mmap_info.physical = (heap)heap_physical(kh);
+    u64 fault_around;
+    if (get_u64(root, sym(fault_around_bytes), &fault_around)) {
+        /* window is a power-of-2 number of pages, or 0 to disable */
+        mmap_info.fault_around = (fault_around >= PAGESIZE) ? U64_FROM_BIT(msb(fault_around)) : 0;
+    } else {
+        mmap_info.fault_around = FILE_FAULT_AROUND_DEFAULT;
+    }
+    value thp = get_string(root, sym(transparent_hugepage));
+    mmap_info.thp = THP_MADVISE;
+    if (thp) {
+        if (!buffer_strcmp(thp, "always"))
+            mmap_info.thp = THP_ALWAYS;
+        else if (!buffer_strcmp(thp, "never"))
+            mmap_info.thp = THP_NEVER;
+        else if (buffer_strcmp(thp, "madvise"))
+            msg_err("invalid transparent_hugepage value \"%b\", using madvise\n", thp);
+    }
     spin_lock_init(&p->vmap_lock);
+    p->vmap_seq = 0;
     u64 min_addr;
     if (get_u64(root, sym(mmap_min_addr), &min_addr))
         p->mmap_min_addr = min_addr;
@@ -1415,11 +1745,23 @@ void mmap_process_init(process p, tuple root)
                                      ivmap(VMAP_FLAG_EXEC, 0, 0, 0, 0)) != INVALID_ADDRESS);
 #endif
 
-    spin_lock_init(&p->faulting_lock);
-    init_rbtree(&p->pending_faults,
-                init_closure_func(&mmap_info.pf_compare, rb_key_compare, pending_fault_compare),
-                init_closure_func(&mmap_info.pf_print, rbnode_handler, pending_fault_print));
-    list_init(&mmap_info.pf_freelist);
+    p->minor_faults_avoided = p->major_faults_avoided = 0;
+    rb_key_compare pf_compare = init_closure_func(&mmap_info.pf_compare, rb_key_compare,
+                                                  pending_fault_compare);
+    rbnode_handler pf_print = init_closure_func(&mmap_info.pf_print, rbnode_handler,
+                                                pending_fault_print);
+    for (int i = 0; i < PENDING_FAULT_BUCKETS; i++) {
+        struct pending_fault_bucket *b = &p->pending_faults[i];
+        spin_lock_init(&b->lock);
+        init_rbtree(&b->faults, pf_compare, pf_print);
+        list_init(&b->free);
+    }
+}
+
+void mmap_fault_stats(process p, buffer b)
+{
+    bprintf(b, "fault_around_minor_avoided %ld\n", p->minor_faults_avoided);
+    bprintf(b, "fetch_ahead_major_avoided %ld\n", p->major_faults_avoided);
 }
 
 void register_mmap_syscalls(struct syscall *map)
@@ -1430,5 +1772,5 @@ void register_mmap_syscalls(struct syscall *map)
     register_syscall(map, msync, msync);
     register_syscall(map, munmap, munmap);
     register_syscall(map, mprotect, mprotect);
-    register_syscall(map, madvise, syscall_ignore);
+    register_syscall(map, madvise, madvise);
 }
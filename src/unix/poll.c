@@ -24,6 +24,7 @@ typedef struct epollfd {
     boolean registered;
     boolean zombie; /* freed or masked by oneshot */
     notify_entry notify_handle;
+    struct list ready;  /* on epoll ready list; protected by e->ready_lock */
 } *epollfd;
 
 typedef struct epoll_blocked *epoll_blocked;
@@ -70,6 +71,10 @@ struct epoll {
     vector events;              /* epollfds indexed by fd */
     int nfds;
     bitmap fds;                 /* fds being watched / epollfd registered */
+    struct spinlock ready_lock;
+    struct list ready_head;     /* epollfds with possibly pending events (epoll only) */
+    u64 ready_count;
+    int busy_poll_fd;           /* last fd with busy polling support that reported events */
 };
 
 closure_func_basic(thunk, void, epoll_free)
@@ -92,6 +97,9 @@ static epoll epoll_alloc_internal(int epoll_type)
     init_refcount(&e->refcount, 1, init_closure_func(&e->free, thunk, epoll_free));
     spin_lock_init(&e->blocked_lock);
     spin_rw_lock_init(&e->fds_lock);
+    spin_lock_init(&e->ready_lock);
+    list_init(&e->ready_head);
+    e->busy_poll_fd = -1;
     e->h = epoll_heap;
     e->events = allocate_vector(e->h, 8);
     if (e->events == INVALID_ADDRESS)
@@ -178,6 +186,20 @@ static inline boolean epoll_wait_notify(epollfd efd, epoll_blocked w, u64 report
 static inline void select_notify(epollfd efd, epoll_blocked w, u64 report);
 static inline u32 report_from_notify_events(epollfd efd, u64 notify_events);
 
+/* Queue an epollfd to be checked by the next epoll_wait(). The ready list
+   holds a reference to each queued epollfd. */
+static void epollfd_set_ready(epollfd efd)
+{
+    epoll e = efd->e;
+    spin_lock(&e->ready_lock);
+    if (!list_inserted(&efd->ready)) {
+        refcount_reserve(&efd->refcount);
+        list_push_back(&e->ready_head, &efd->ready);
+        e->ready_count++;
+    }
+    spin_unlock(&e->ready_lock);
+}
+
 closure_function(1, 2, u64, wait_notify,
                  epollfd, efd,
                  u64 notify_events, void *t)
@@ -239,6 +261,12 @@ closure_function(1, 2, u64, wait_notify,
     }
 out:
     spin_unlock(&efd->e->blocked_lock);
+
+    /* Level-triggered events stay pending after being reported; edge-triggered
+       ones only need queueing if no waiter took them. */
+    if (efd->e->epoll_type == EPOLL_TYPE_EPOLL && events && !efd->zombie &&
+        (!(efd->eventmask & EPOLLET) || !(rv & NOTIFY_RESULT_CONSUMED)))
+        epollfd_set_ready(efd);
     spin_unlock(&efd->lock);
     return rv;
 }
@@ -264,6 +292,8 @@ static boolean register_epollfd(epollfd efd)
     efd->notify_handle = notify_add_with_flags(f->ns, efd->eventmask | POLL_EXCEPTIONS, flags, eh);
     assert(efd->notify_handle != INVALID_ADDRESS);
     fdesc_put(f);   /* if the file descriptor is deallocated, we will be notified via f->ns */
+    if (efd->e->epoll_type == EPOLL_TYPE_EPOLL)
+        epollfd_set_ready(efd);
     return true;
 }
 
@@ -276,6 +306,18 @@ static void epoll_release_epollfds(epoll e)
         release_epollfd(efd);
     }
     spin_wunlock(&e->fds_lock);
+
+    /* drop the references held by the ready list */
+    spin_lock(&e->ready_lock);
+    list l;
+    while ((l = list_get_next(&e->ready_head))) {
+        list_delete(l);
+        e->ready_count--;
+        spin_unlock(&e->ready_lock);
+        refcount_release(&struct_from_list(l, epollfd, ready)->refcount);
+        spin_lock(&e->ready_lock);
+    }
+    spin_unlock(&e->ready_lock);
 }
 
 void epoll_finish(epoll e)
@@ -402,6 +444,8 @@ static inline boolean epoll_wait_notify(epollfd efd, epoll_blocked w, u64 report
 
     /* now that we've reported these events, update last */
     efd->lastevents |= report;
+    if (efd->f->busy_poll)
+        efd->e->busy_poll_fd = efd->fd;
     blockq_wake_one(w->t->thread_bq);
     return true;
 }
@@ -462,6 +506,84 @@ static void epoll_check_epollfds(epoll e, epoll_blocked w)
     }
 }
 
+/* Check a queued epollfd on behalf of an epoll_wait() caller; returns true if
+   the epollfd should remain on the ready list. */
+static boolean epoll_check_ready(epollfd efd, epoll_blocked w)
+{
+    if (efd->zombie || !efd->registered)
+        return false;
+    fdesc f = efd->f;
+    u32 events = apply(f->events, w->t) & (efd->eventmask | POLL_EXCEPTIONS);
+    u32 report = report_from_notify_events(efd, events);
+    if (report && !epoll_wait_notify(efd, w, report))
+        return true;    /* no room in the user buffer; retry on the next wait */
+    if (efd->zombie)
+        return false;
+
+    /* signalfd events depend on the waiting thread */
+    if (f->type == FDESC_TYPE_SIGNALFD)
+        return true;
+
+    /* Level-triggered events remain pending until the condition clears, and
+       are thus rechecked on each wait. Edge-triggered epollfds are queued
+       again on the next rising edge. */
+    return events && !(efd->eventmask & EPOLLET);
+}
+
+static boolean epoll_blocked_full(epoll_blocked w)
+{
+    spin_lock(&w->lock);
+    boolean full = !w->user_events || w->user_events->end >= w->user_events->length;
+    spin_unlock(&w->lock);
+    return full;
+}
+
+/* Unlike select and poll, which evaluate every fd of the set on each call,
+   epoll_wait() only visits epollfds that have been notified since they were
+   last found idle, making its cost proportional to the number of ready fds
+   rather than the number of registered ones. Each epollfd is taken off the
+   ready list before being checked, so that a notification arriving during
+   the check queues it again rather than being lost. */
+static void epoll_check_ready_list(epoll e, epoll_blocked w)
+{
+    struct list requeue;
+    list_init(&requeue);
+    u64 requeue_count = 0;
+    spin_lock(&e->ready_lock);
+    for (u64 n = e->ready_count; n > 0; n--) {
+        list l = list_get_next(&e->ready_head);
+        if (!l)
+            break;
+        list_delete(l);
+        e->ready_count--;
+        spin_unlock(&e->ready_lock);
+
+        epollfd efd = struct_from_list(l, epollfd, ready);
+        spin_lock(&efd->lock);
+        boolean keep = epoll_check_ready(efd, w);
+        if (keep) {
+            /* park the entry so that notifications don't queue it again */
+            spin_lock(&e->ready_lock);
+            list_push_back(&requeue, l);
+            requeue_count++;
+            spin_unlock(&e->ready_lock);
+        }
+        spin_unlock(&efd->lock);
+        if (!keep)
+            refcount_release(&efd->refcount); /* ready list */
+        boolean full = epoll_blocked_full(w);
+        spin_lock(&e->ready_lock);
+        if (full)
+            break;
+    }
+    list_foreach(&requeue, l) {
+        list_delete(l);
+        list_push_back(&e->ready_head, l);
+    }
+    e->ready_count += requeue_count;
+    spin_unlock(&e->ready_lock);
+}
+
 /* It would be nice to devise a way to allow a poll waiter to continue
    to collect events between wakeup (first event) and running. */
 
@@ -508,6 +630,22 @@ closure_function(3, 1, sysreturn, epoll_wait_bh,
     return syscall_return(t, rv);
 }
 
+/* If a file with busy polling support (i.e. a socket with SO_BUSY_POLL set) has recently reported
+   events, poll the device queue that feeds it before blocking, until events are reported to the
+   waiter or the busy polling time expires. */
+static void epoll_busy_poll(epoll e, epoll_blocked w)
+{
+    int fd = e->busy_poll_fd;
+    if (fd < 0 || w->user_events->end)
+        return;
+    fdesc f = fdesc_get(current->p, fd);
+    if (!f)
+        return;
+    if (f->busy_poll)
+        apply(f->busy_poll, &w->user_events->end);
+    fdesc_put(f);
+}
+
 /* Depending on the epoll flags given, we may:
    - notify all waiters on a match (default)
    - notify on a match only once until condition is reset (EPOLLET)
@@ -536,8 +674,10 @@ sysreturn epoll_wait(int epfd,
     spin_unlock(&w->lock);
 
     spin_rlock(&e->fds_lock);
-    epoll_check_epollfds(e, w);
+    epoll_check_ready_list(e, w);
     spin_runlock(&e->fds_lock);
+    if (timeout)
+        epoll_busy_poll(e, w);
 
     timestamp ts = (timeout > 0) ? milliseconds(timeout) : 0;
     return blockq_check_timeout(w->t->thread_bq,
@@ -1,7 +1,9 @@
 #include <unix_internal.h>
 #include <filesystem.h>
 #include <ftrace.h>
+#include <net.h>
 #include <storage.h>
+#include <virtio/virtio.h>
 
 typedef struct special_file {
     sstring path;
@@ -58,6 +60,40 @@ static sysreturn meminfo_read(file f, void *dest, u64 length, u64 offset)
     return buffer_read_at(b, offset, dest, length);
 }
 
+static sysreturn vmstat_read(file f, void *dest, u64 length, u64 offset)
+{
+    buffer b = little_stack_buffer(512);
+    file_readahead_stats(b);
+    mmap_fault_stats(current->p, b);
+    filesystem_log_stats(b);
+    return buffer_read_at(b, offset, dest, length);
+}
+
+static sysreturn net_gro_read(file f, void *dest, u64 length, u64 offset)
+{
+    buffer b = little_stack_buffer(512);
+    net_gro_stats(b);
+    return buffer_read_at(b, offset, dest, length);
+}
+
+static sysreturn net_tso_read(file f, void *dest, u64 length, u64 offset)
+{
+    buffer b = little_stack_buffer(512);
+    net_tso_stats(b);
+    return buffer_read_at(b, offset, dest, length);
+}
+
+static sysreturn virtio_queues_read(file f, void *dest, u64 length, u64 offset)
+{
+    buffer b = allocate_buffer(heap_locked(get_kernel_heaps()), 1024);
+    if (b == INVALID_ADDRESS)
+        return -ENOMEM;
+    virtqueue_stats(b);
+    sysreturn rv = buffer_read_at(b, offset, dest, length);
+    deallocate_buffer(b);
+    return rv;
+}
+
 typedef struct mounts_notify_data *mounts_notify_data;
 
 struct mounts_notify_data {
@@ -211,6 +247,10 @@ static const special_file special_files[] = {
     { ss_static_init("/dev/urandom"), .read = urandom_read, .write = 0, .events = urandom_events },
     { ss_static_init("/dev/null"), .read = null_read, .write = null_write, .events = null_events },
     { ss_static_init("/proc/meminfo"), .read = meminfo_read},
+    { ss_static_init("/proc/vmstat"), .read = vmstat_read},
+    { ss_static_init("/proc/net/gro"), .read = net_gro_read},
+    { ss_static_init("/proc/net/tso"), .read = net_tso_read},
+    { ss_static_init("/proc/virtio/queues"), .read = virtio_queues_read},
     { ss_static_init("/proc/mounts"), .open = mounts_open, .close = mounts_close,
       .read = mounts_read, .events = mounts_events,
       .alloc_size = sizeof(struct mounts_notify_data)},
@@ -429,6 +429,71 @@ out_complete:
     closure_finish();
 }
 
+/* Used when the output file accepts sg lists: the buffers read from the input
+   (e.g. page cache pages) are handed to the output as is, which allows sockets
+   to transmit them without copying. */
+closure_function(7, 1, void, sendfile_sg_bh,
+                 fdesc, in, fdesc, out, long *, offset, sg_list, sg, bytes, readlen, bytes, written, boolean, bh,
+                 sysreturn rv)
+{
+    thread t = current;
+    thread_log(t, "%s: readlen %ld, written %ld, bh %d, rv %ld",
+               func_ss, bound(readlen), bound(written), bound(bh), rv);
+    context ctx = get_current_context(current_cpu());
+    if (!bound(bh)) {
+        /* read complete */
+        if (rv <= 0)
+            goto out_complete;
+        bound(bh) = true;
+        bound(readlen) = rv;
+        if (bound(offset)) {
+            if (!context_set_err(ctx)) {
+                *bound(offset) += rv;
+                context_clear_err(ctx);
+            } else {
+                rv = -EFAULT;
+                goto out_complete;
+            }
+        }
+    } else {
+        if (rv <= 0) {
+            if (rv == -EAGAIN) {
+                /* rewind the input offset past unwritten data */
+                s64 rewind = bound(readlen) - bound(written);
+                if (bound(offset)) {
+                    if (!context_set_err(ctx)) {
+                        *bound(offset) -= rewind;
+                        context_clear_err(ctx);
+                    }
+                } else if (bound(in)->type == FDESC_TYPE_REGULAR) {
+                    ((file)bound(in))->offset -= rewind;
+                }
+                rv = bound(written) == 0 ? -EAGAIN : bound(written);
+                thread_log(t, "   write would block, returning %ld", rv);
+            }
+            goto out_complete;
+        }
+        bound(written) += rv;
+        if (bound(written) == bound(readlen)) {
+            rv = bound(written);
+            goto out_complete;
+        }
+    }
+
+    /* issue next write; the output consumes written data from the sg list */
+    u64 n = bound(readlen) - bound(written);
+    thread_log(t, "   writing %ld bytes", n);
+    apply(bound(out)->sg_write, bound(sg), n, infinity, ctx, true, (io_completion)closure_self());
+    return;
+out_complete:
+    sg_list_release(bound(sg));
+    deallocate_sg_list(bound(sg));
+    fdesc_put(bound(in));
+    fdesc_put(bound(out));
+    syscall_return(t, rv);
+    closure_finish();
+}
+
 /* Should be determined more intelligently based on available
    buffering on output side, modulated by link capacity
    (e.g. bandwidth delay product). Right now assuming the common mode
@@ -471,8 +536,12 @@ static sysreturn sendfile(int out_fd, int in_fd, long *offset, bytes count)
     }
 
     u64 n = MIN(count, SENDFILE_READ_MAX);
-    io_completion read_complete = closure(heap_locked(get_kernel_heaps()), sendfile_bh, infile, outfile,
-                                          offset, sg, 0, n, 0, 0, false);
+    heap h = heap_locked(get_kernel_heaps());
+    io_completion read_complete;
+    if (outfile->sg_write)
+        read_complete = closure(h, sendfile_sg_bh, infile, outfile, offset, sg, 0, 0, false);
+    else
+        read_complete = closure(h, sendfile_bh, infile, outfile, offset, sg, 0, n, 0, 0, false);
     context ctx = get_current_context(current_cpu());
     apply(infile->sg_read, sg, n, read_offset, ctx, false, read_complete);
     return get_syscall_return(current);
@@ -506,6 +575,112 @@ static void begin_file_read(file f, u64 length)
     }
 }
 
+/* O_DIRECT: data bypasses the page cache, going between the filesystem storage reader or writer
+ * and a kernel bounce buffer, which is copied from or to the user buffer. User pages can't be
+ * pinned, so they could be freed (e.g. by a concurrent munmap) while a device accesses them.
+ * Offset, length and buffer address must be aligned to the filesystem block size. */
+static boolean file_direct_aligned(file f, void *buf, u64 offset, u64 length)
+{
+    u64 mask = MASK(f->fs->blocksize_order);
+    return !((u64_from_pointer(buf) | offset | length) & mask);
+}
+
+static void *file_direct_bounce_alloc(u64 length)
+{
+    return allocate((heap)heap_page_backed(get_kernel_heaps()), pad(length, PAGESIZE));
+}
+
+static void file_direct_bounce_free(void *buf, u64 length)
+{
+    deallocate((heap)heap_page_backed(get_kernel_heaps()), buf, pad(length, PAGESIZE));
+}
+
+/* Returns an sg list covering a bounce buffer; buffers are split at page boundaries, since each sg
+ * buffer is handed to storage drivers as a physically contiguous segment. */
+static sg_list file_direct_sg(void *buf, u64 length)
+{
+    sg_list sg = allocate_sg_list();
+    if (sg == INVALID_ADDRESS)
+        return sg;
+    while (length > 0) {
+        u64 len = MIN(length, PAGESIZE - (u64_from_pointer(buf) & PAGEMASK));
+        sg_buf sgb = sg_list_tail_add(sg, len);
+        if (sgb == INVALID_ADDRESS) {
+            deallocate_sg_list(sg);
+            return INVALID_ADDRESS;
+        }
+        sgb->buf = buf;
+        sgb->size = len;
+        sgb->offset = 0;
+        sgb->refcount = 0;
+        buf += len;
+        length -= len;
+    }
+    return sg;
+}
+
+closure_function(7, 1, void, file_read_direct_complete,
+                 file, f, sg_list, sg, void *, bounce, void *, dest, u64, count, boolean, is_file_offset, io_completion, completion,
+                 status s)
+{
+    thread_log(current, "%s: status %v", func_ss, s);
+    sg_list sg = bound(sg);
+    sg_list_release(sg);
+    deallocate_sg_list(sg);
+    sysreturn rv;
+    if (is_ok(s)) {
+        u64 count = bound(count);
+        if (copy_to_user(bound(dest), bound(bounce), count)) {
+            if (bound(is_file_offset)) /* vs specified offset (pread) */
+                bound(f)->offset += count;
+            rv = count;
+        } else {
+            rv = -EFAULT;
+        }
+    } else {
+        rv = sysreturn_from_fs_status_value(s);
+        timm_dealloc(s);
+    }
+    file_direct_bounce_free(bound(bounce), pad(bound(count), fs_blocksize(bound(f)->fs)));
+    apply(bound(completion), rv);
+    closure_finish();
+}
+
+static sysreturn file_read_direct(file f, void *dest, u64 length, u64 offset,
+                                  boolean is_file_offset, context ctx, boolean bh,
+                                  io_completion completion)
+{
+    if (!file_direct_aligned(f, dest, offset, length))
+        return io_complete(completion, -EINVAL);
+    u64 file_length = fsfile_get_length(f->fsf);
+    if (offset >= file_length || length == 0)
+        return io_complete(completion, 0);
+
+    /* the tail of the last block is read, but not copied to the user buffer */
+    u64 count = MIN(length, file_length - offset);
+    length = MIN(length, pad(count, fs_blocksize(f->fs)));
+    if (!validate_user_memory(dest, count, true))
+        return io_complete(completion, -EFAULT);
+    void *bounce = file_direct_bounce_alloc(length);
+    if (bounce == INVALID_ADDRESS)
+        return io_complete(completion, -ENOMEM);
+    sg_list sg = file_direct_sg(bounce, length);
+    if (sg == INVALID_ADDRESS)
+        goto no_mem;
+    status_handler sh = closure_from_context(ctx, file_read_direct_complete, f, sg, bounce, dest,
+                                             count, is_file_offset, completion);
+    if (sh == INVALID_ADDRESS) {
+        deallocate_sg_list(sg);
+        goto no_mem;
+    }
+    begin_file_read(f, count);
+    filesystem_read_direct(f->fsf, sg, irangel(offset, length), sh);
+    return bh ? SYSRETURN_CONTINUE_BLOCKING : thread_maybe_sleep_uninterruptible(current);
+  no_mem:
+    file_direct_bounce_free(bounce, length);
+    return io_complete(completion, -ENOMEM);
+}
+
 closure_function(6, 1, void, file_read_complete,
                  sg_list, sg, void *, dest, u64, limit, file, f, boolean, is_file_offset, io_completion, completion,
                  status s)
@@ -556,6 +731,8 @@ closure_func_basic(file_io, sysreturn, file_read,
     sysreturn rv;
     if (!check_file_read(f, offset, &rv))
         return io_complete(completion, rv);
+    if (f->f.flags & O_DIRECT)
+        return file_read_direct(f, dest, length, offset, is_file_offset, ctx, bh, completion);
     sg_list sg = allocate_sg_list();
     if (sg == INVALID_ADDRESS) {
         thread_log(t, "   unable to allocate sg list");
@@ -664,8 +841,8 @@ static void file_write_complete_internal(file f, u64 len,
     apply(completion, rv);
 }
 
-closure_function(6, 1, void, file_write_complete,
-                 file, f, sg_list, sg, u64, length, boolean, is_file_offset, io_completion, completion, boolean, flush,
+closure_function(7, 1, void, file_write_complete,
+                 file, f, sg_list, sg, void *, bounce, u64, length, boolean, is_file_offset, io_completion, completion, boolean, flush,
                  status s)
 {
     if (!bound(flush)) {
@@ -673,6 +850,8 @@ closure_function(6, 1, void, file_write_complete,
                    func_ss, bound(f), bound(sg), bound(completion), s);
         sg_list_release(bound(sg));
         deallocate_sg_list(bound(sg));
+        if (bound(bounce))
+            file_direct_bounce_free(bound(bounce), bound(length));
         file f = bound(f);
         if (f->f.flags & O_DSYNC) {
             bound(flush) = true;
@@ -699,31 +878,59 @@ closure_func_basic(file_io, sysreturn, file_write,
     sysreturn rv = file_write_check(f, offset, length);
     if (rv < 0)
         return io_complete(completion, rv);
-    sg_list sg = allocate_sg_list();
-    if (sg == INVALID_ADDRESS) {
-        thread_log(t, "   unable to allocate sg list");
-        return io_complete(completion, -ENOMEM);
-    }
-    sg_buf sgb = sg_list_tail_add(sg, length);
-    if (sgb == INVALID_ADDRESS) {
-        thread_log(t, "   unable to allocate sg buf");
-        goto no_mem;
+    boolean direct = (f->f.flags & O_DIRECT) && (length > 0);
+    void *bounce = 0;
+    sg_list sg;
+    if (direct) {
+        if (!file_direct_aligned(f, src, offset, length))
+            return io_complete(completion, -EINVAL);
+        bounce = file_direct_bounce_alloc(length);
+        if (bounce == INVALID_ADDRESS) {
+            thread_log(t, "   unable to allocate bounce buffer");
+            return io_complete(completion, -ENOMEM);
+        }
+        if (!copy_from_user(src, bounce, length)) {
+            file_direct_bounce_free(bounce, length);
+            return io_complete(completion, -EFAULT);
+        }
+        sg = file_direct_sg(bounce, length);
+        if (sg == INVALID_ADDRESS) {
+            thread_log(t, "   unable to allocate sg list");
+            file_direct_bounce_free(bounce, length);
+            return io_complete(completion, -ENOMEM);
+        }
+    } else {
+        sg = allocate_sg_list();
+        if (sg == INVALID_ADDRESS) {
+            thread_log(t, "   unable to allocate sg list");
+            return io_complete(completion, -ENOMEM);
+        }
+        sg_buf sgb = sg_list_tail_add(sg, length);
+        if (sgb == INVALID_ADDRESS) {
+            thread_log(t, "   unable to allocate sg buf");
+            goto no_mem;
+        }
+        sgb->buf = src;
+        sgb->size = length;
+        sgb->offset = 0;
+        sgb->refcount = 0;
     }
-    sgb->buf = src;
-    sgb->size = length;
-    sgb->offset = 0;
-    sgb->refcount = 0;
 
-    status_handler sh = closure_from_context(ctx, file_write_complete, f, sg, length,
+    status_handler sh = closure_from_context(ctx, file_write_complete, f, sg, bounce, length,
                                              is_file_offset, completion, false);
     if (sh == INVALID_ADDRESS)
         goto no_mem;
     begin_file_write(f, length);
-    apply(f->fs_write, sg, irangel(offset, length), sh);
+    if (direct)
+        filesystem_write_direct(f->fsf, sg, irangel(offset, length), sh);
+    else
+        apply(f->fs_write, sg, irangel(offset, length), sh);
     /* possible direct return in top half */
     return bh ? SYSRETURN_CONTINUE_BLOCKING : thread_maybe_sleep_uninterruptible(t);
   no_mem:
     deallocate_sg_list(sg);
+    if (bounce)
+        file_direct_bounce_free(bounce, length);
     return io_complete(completion, -ENOMEM);
 }
 
@@ -853,6 +1060,7 @@ int unix_file_new(filesystem fs, tuple md, int type, int flags, fsfile fsf)
         f->fs_write = fsfile_get_writer(fsf);
         assert(f->fs_write);
         f->fadv = POSIX_FADV_NORMAL;
+        zero(&f->ra, sizeof(f->ra));
         length = fsfile_get_length(fsf);
     } else {
         length = 0;
@@ -1043,9 +1251,7 @@ sysreturn dup2(int oldfd, int newfd)
     if (newfd != oldfd) {
         fdesc newf = fdesc_get(p, newfd);
         if (newf) {
-            process_lock(p);
-            assert(vector_set(p->files, newfd, f));
-            process_unlock(p);
+            replace_fd(p, newfd, f);
             if (fetch_and_add(&newf->refcnt, -2) == 2) {
                 if (newf->close)
                     apply(newf->close, get_current_context(current_cpu()), io_completion_ignore);
@@ -1470,11 +1676,20 @@ sysreturn fdatasync(int fd)
 static sysreturn access_internal(filesystem fs, inode cwd, sstring pathname, int mode)
 {
     tuple m = 0;
-    fs_status fss = filesystem_get_node(&fs, cwd, pathname, false, false, false, false, &m, 0);
-    if (fss != FS_STATUS_OK)
-        return sysreturn_from_fs_status(fss);
-    u32 perms = file_meta_perms(current->p, m);
-    filesystem_put_node(fs, m);
+    u32 perms;
+    filesystem node_fs = fs;
+    u64 irqflags;
+    m = filesystem_get_node_lockless(&node_fs, cwd, pathname, false, 0, &irqflags);
+    if (m) {
+        perms = file_meta_perms(current->p, m);
+        filesystem_put_node_lockless(node_fs, m, irqflags);
+    } else {
+        fs_status fss = filesystem_get_node(&fs, cwd, pathname, false, false, false, false, &m, 0);
+        if (fss != FS_STATUS_OK)
+            return sysreturn_from_fs_status(fss);
+        perms = file_meta_perms(current->p, m);
+        filesystem_put_node(fs, m);
+    }
     if (mode == F_OK)
         return 0;
     if (((mode & R_OK) && !(perms & ACCESS_PERM_READ)) ||
@@ -1629,6 +1844,20 @@ static sysreturn stat_internal(filesystem fs, inode cwd, sstring name, boolean f
     if (!fault_in_user_memory(buf, sizeof(struct stat), true))
         return -EFAULT;
 
+    /* Try first without locking the filesystem; user memory must not be accessed meanwhile. */
+    filesystem node_fs = fs;
+    u64 irqflags;
+    n = filesystem_get_node_lockless(&node_fs, cwd, name, !follow, &fsf, &irqflags);
+    if (n) {
+        struct stat st;
+        fill_stat(file_type_from_tuple(n), node_fs, fsf, n, &st);
+        filesystem_put_node_lockless(node_fs, n, irqflags);
+        if (fsf)
+            fsfile_release(fsf);
+        runtime_memcpy(buf, &st, sizeof(st));
+        return 0;
+    }
+
     fs_status fss = filesystem_get_node(&fs, cwd, name, !follow, false, false, false, &n, &fsf);
     if (fss != FS_STATUS_OK)
         return sysreturn_from_fs_status(fss);
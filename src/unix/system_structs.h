@@ -227,6 +227,21 @@ struct flock {
 #define HUGETLB_FLAG_ENCODE_SHIFT 26
 #define HUGETLB_FLAG_ENCODE_MASK  0x3ful
 
+#define MADV_NORMAL         0
+#define MADV_RANDOM         1
+#define MADV_SEQUENTIAL     2
+#define MADV_WILLNEED       3
+#define MADV_DONTNEED       4
+#define MADV_FREE           8
+#define MADV_DONTFORK       10
+#define MADV_DOFORK         11
+#define MADV_MERGEABLE      12
+#define MADV_UNMERGEABLE    13
+#define MADV_HUGEPAGE       14
+#define MADV_NOHUGEPAGE     15
+#define MADV_DONTDUMP       16
+#define MADV_DODUMP         17
+
 #define MREMAP_MAYMOVE      1
 #define MREMAP_FIXED        2
 
@@ -855,6 +870,8 @@ struct io_uring_params {
 #define SO_ACCEPTCONN   30
 #define SO_PROTOCOL     38
 #define SO_DOMAIN       39
+#define SO_BUSY_POLL    46
+#define SO_ZEROCOPY     60
 
 #define IP_TOS              1
 #define IP_TTL              2
@@ -27,6 +27,46 @@ unix_heaps get_unix_heaps()
     return u_heap;
 }
 
+closure_func_basic(thunk, void, fdtable_free)
+{
+    fdtable t = struct_from_field(closure_self(), fdtable, free);
+    deallocate(t->h, t, sizeof(*t) + t->size * sizeof(fdesc));
+}
+
+static fdtable allocate_fdtable(heap h, u64 size)
+{
+    fdtable t = allocate(h, sizeof(*t) + size * sizeof(fdesc));
+    if (t == INVALID_ADDRESS)
+        return t;
+    t->size = size;
+    t->h = h;
+    zero(t->fds, size * sizeof(fdesc));
+    return t;
+}
+
+/* called with process lock held */
+static boolean fdtable_set(process p, u64 fd, fdesc f)
+{
+    fdtable t = p->fdtable;
+    if (fd >= t->size) {
+        if (!f)
+            return true;
+        u64 size = t->size;
+        while (size <= fd)
+            size *= 2;
+        fdtable n = allocate_fdtable(t->h, size);
+        if (n == INVALID_ADDRESS)
+            return false;
+        runtime_memcpy(n->fds, t->fds, t->size * sizeof(fdesc));
+        write_barrier();
+        p->fdtable = n;
+        epoch_retire(&t->retired, init_closure_func(&t->free, thunk, fdtable_free));
+        t = n;
+    }
+    t->fds[fd] = f;
+    return true;
+}
+
 u64 allocate_fd(process p, void *f)
 {
     process_lock(p);
@@ -35,7 +75,7 @@ u64 allocate_fd(process p, void *f)
         msg_err("fail; maxed out\n");
         goto out;
     }
-    if (!vector_set(p->files, fd, f)) {
+    if (!fdtable_set(p, fd, f)) {
         deallocate_u64((heap)p->fdallocator, fd, 1);
         fd = INVALID_PHYSICAL;
     }
@@ -52,7 +92,7 @@ u64 allocate_fd_gte(process p, u64 min, void *f)
         msg_err("failed\n");
     }
     else {
-        if (!vector_set(p->files, fd, f)) {
+        if (!fdtable_set(p, fd, f)) {
             deallocate_u64((heap)p->fdallocator, fd, 1);
             fd = INVALID_PHYSICAL;
         }
@@ -64,9 +104,23 @@ u64 allocate_fd_gte(process p, u64 min, void *f)
 void deallocate_fd(process p, int fd)
 {
     process_lock(p);
-    assert(vector_set(p->files, fd, 0));
+    assert(fdtable_set(p, fd, 0));
     deallocate_u64((heap)p->fdallocator, fd, 1);
     process_unlock(p);
+
+    /* Wait for lookups that may have found the fdesc before it was removed,
+       so that callers can drop the table reference safely. */
+    epoch_synchronize();
+}
+
+fdesc replace_fd(process p, int fd, fdesc f)
+{
+    process_lock(p);
+    fdesc old = p->fdtable->fds[fd];
+    assert(fdtable_set(p, fd, f));
+    process_unlock(p);
+    epoch_synchronize();
+    return old;
 }
 
 closure_func_basic(io_completion, void, fdesc_io_complete,
@@ -537,8 +591,8 @@ process create_process(unix_heaps uh, tuple root, filesystem fs)
     p->cwd = fs->get_inode(fs, filesystem_getroot(fs));
     p->process_root = root;
     p->fdallocator = create_id_heap(locked, locked, 0, infinity, 1, false);
-    p->files = allocate_vector(locked, 64);
-    zero(p->files, sizeof(p->files));
+    p->fdtable = allocate_fdtable(locked, 64);
+    assert(p->fdtable != INVALID_ADDRESS);
     create_stdfiles(uh, p);
     init_threads(p);
     init_closure_func(&p->fault_handler, fault_handler, unix_fault_handler);
@@ -644,6 +698,8 @@ process init_unix(kernel_heaps kh, tuple root, filesystem fs)
     if (!netsyscall_init(uh, root))
         goto alloc_fail;
 #endif
+    file_readahead_init(root);
+    filesystem_log_config(root);
     process kernel_process = create_process(uh, root, fs);
     dummy_thread = create_thread(kernel_process, kernel_process->pid);
     runtime_memcpy(dummy_thread->name, "dummy_thread",
@@ -18,6 +18,8 @@
 #define VMAP_FLAG_PROG     0x1000
 #define VMAP_FLAG_BSS      0x2000
 #define VMAP_FLAG_TAIL_BSS 0x4000
+#define VMAP_FLAG_HUGEPAGE   0x8000  /* MADV_HUGEPAGE */
+#define VMAP_FLAG_NOHUGEPAGE 0x10000 /* MADV_NOHUGEPAGE */
 
 #define VMAP_MMAP_TYPE_MASK       0x0f00
 #define VMAP_MMAP_TYPE_ANONYMOUS  0x0100
@@ -264,6 +266,15 @@ struct pending_fault;
 declare_closure_struct(3, 0, void, pending_fault_demand_file_page,
                        struct vmap *, vm, u64, node_offset, pageflags, flags);
 
+#define PENDING_FAULT_BUCKETS   16
+
+/* pending faults are hashed by page address; each bucket has its own lock */
+struct pending_fault_bucket {
+    struct spinlock lock;
+    struct rbtree faults;
+    struct list free;
+} __attribute__((aligned(64)));
+
 typedef struct pending_fault {
     struct rbnode n;            /* must be first */
     u64 addr;
@@ -354,6 +365,7 @@ closure_type(fdesc_ioctl, sysreturn, unsigned long request, vlist ap);
 closure_type(fdesc_mmap, sysreturn, struct vmap *vm, u64 offset);
 closure_type(fdesc_close, sysreturn, context ctx, io_completion completion);
 closure_type(fdesc_et_handler, u64, u64 events, u64 lastevents);
+closure_type(fdesc_busy_poll, void, u64 *pending);
 
 #define FDESC_TYPE_REGULAR      1
 #define FDESC_TYPE_DIRECTORY    2
@@ -377,6 +389,7 @@ typedef struct fdesc {
     fdesc_mmap mmap;
     fdesc_close close;
     fdesc_et_handler edge_trigger_handler;
+    fdesc_busy_poll busy_poll;  /* polls the device feeding the file, until *pending is non-zero */
     closure_struct(io_completion, io_complete);
 
     u64 refcnt;
@@ -388,7 +401,17 @@ typedef struct fdesc {
 
 #define IOV_MAX 1024
 
-#define FILE_READAHEAD_DEFAULT  (128 * KB)
+#define FILE_READAHEAD_DEFAULT  (128 * KB)  /* default maximum readahead window */
+#define FILE_READAHEAD_MIN      (16 * KB)   /* default initial readahead window */
+#define FILE_FAULT_AROUND_DEFAULT   (64 * KB)
+
+/* per-open-file sequential readahead state (byte offsets) */
+struct file_readahead {
+    u64 begin, end;         /* range issued for the current stream */
+    u64 size;               /* size of the last window */
+    u64 async_start;        /* reads reaching past this issue the next window */
+    u64 prev_end;           /* end of the previous read */
+};
 
 struct file {
     struct fdesc f;             /* must be first */
@@ -398,6 +421,7 @@ struct file {
         sg_io fs_read;
         sg_io fs_write;
         int fadv;           /* posix_fadvise advice */
+        struct file_readahead ra;
     };
     inode n;                /* filesystem inode number */
     u64 offset;
@@ -426,6 +450,10 @@ typedef struct vmap {
         fdesc fd;
         u64 bss_offset;
     };
+    u64 fault_next;     /* end of last fault-around window, for sequential fault detection */
+    u64 fetch_ahead;    /* start node offset of the window last fetched ahead (0 if none) */
+    struct epoch_retired retired;   /* freed after concurrent lockless lookups */
+    closure_struct(thunk, free);
 } *vmap;
 
 #define ivmap(__f, __af, __o, __c, __fd) (struct vmap) {    \
@@ -473,6 +501,17 @@ typedef struct file *file;
 
 struct syscall;
 
+/* File descriptor table: looked up without locks within an epoch read-side
+   section, updated under the process lock; resized by copying and
+   publishing a new table, retiring the old one. */
+typedef struct fdtable {
+    u64 size;
+    heap h;
+    struct epoch_retired retired;
+    closure_struct(thunk, free);
+    fdesc fds[0];
+} *fdtable;
+
 typedef struct process {
     unix_heaps        uh;       /* non-thread-specific */
     int               pid;
@@ -485,22 +524,24 @@ typedef struct process {
     filesystem        cwd_fs;
     tuple             process_root;
     inode             cwd;
-    table             futices;
+    struct futex_table *futices;
     closure_struct(fault_handler, fault_handler);
     rbtree            threads;
     struct spinlock   threads_lock;
     struct syscall   *syscalls;
-    vector            files;
+    fdtable           fdtable;
     u64               mmap_min_addr;
     struct spinlock   vmap_lock;
+    volatile word     vmap_seq; /* odd while vmaps are being modified */
     rangemap          vmaps;    /* process mappings */
     vmap              stack_map;
     vmap              heap_map;
     struct aux        saved_aux[NAUX];
     char             *saved_args_begin;
     char             *saved_args_end;
-    struct rbtree     pending_faults; /* pending_faults in progress */
-    struct spinlock   faulting_lock;
+    struct pending_fault_bucket pending_faults[PENDING_FAULT_BUCKETS]; /* in progress */
+    word              minor_faults_avoided; /* pages mapped by file fault-around */
+    word              major_faults_avoided; /* faults served from fetched-ahead pages */
     struct sigstate   signals;
     struct sigaction  sigactions[NSIG];
     notify_set        signalfds;
@@ -660,13 +701,16 @@ static inline int fdesc_type(fdesc f)
     return f->type;
 }
 
+/* Removal of an fd from the table waits for concurrent lookups to complete
+   (see deallocate_fd()), so the table reference keeps f alive here. */
 static inline fdesc fdesc_get(process p, int fd)
 {
-    process_lock(p);
-    fdesc f = vector_get(p->files, fd);
+    u64 flags = epoch_enter();
+    fdtable t = p->fdtable;
+    fdesc f = ((u64)fd < t->size) ? t->fds[fd] : 0;
     if (f)
         fetch_and_add(&f->refcnt, 1);
-    process_unlock(p);
+    epoch_exit(flags);
     return f;
 }
 
@@ -683,6 +727,9 @@ u64 allocate_fd_gte(process p, u64 min, void *f);
 
 void deallocate_fd(process p, int fd);
 
+/* Install f at an allocated fd, returning the previous file descriptor. */
+fdesc replace_fd(process p, int fd, fdesc f);
+
 void init_vdso(process p);
 
 boolean copy_from_user(const void *uaddr, void *kaddr, u64 len);
@@ -698,6 +745,7 @@ boolean fault_in_memory(const void *buf, bytes length);
 boolean fault_in_user_memory(const void *buf, bytes length, boolean writable);
 
 void mmap_process_init(process p, tuple root);
+void mmap_fault_stats(process p, buffer b);
 
 /* This "validation" is just a simple limit check right now, but this
    could optionally expand to do more rigorous validation (e.g. vmap
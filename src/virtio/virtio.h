@@ -7,3 +7,4 @@ void init_virtio_scsi(kernel_heaps kh, storage_attach a);
 void init_virtio_socket(kernel_heaps kh);
 
 void virtio_mmio_enum_devs(kernel_heaps kh);
+void virtqueue_stats(buffer b);
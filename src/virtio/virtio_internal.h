@@ -59,6 +59,12 @@ closure_type(vqfinish, void, u64 len);
 /* Modern device */
 #define VIRTIO_F_VERSION_1 U64_FROM_BIT(32)
 
+/* Packed virtqueue layout. */
+#define VIRTIO_F_RING_PACKED U64_FROM_BIT(34)
+
+/* Ring features implemented by the virtqueue code, negotiated on behalf of all drivers. */
+#define VIRTIO_F_RING_FEATURES  (VIRTIO_F_RING_INDIRECT_DESC | VIRTIO_F_RING_PACKED)
+
 closure_type(vtdev_notify, void, u16 queue_index, bytes notify_offset);
 
 typedef struct vtdev {
@@ -127,6 +133,8 @@ physical virtqueue_used_paddr(struct virtqueue *vq);
 u16 virtqueue_entries(virtqueue vq);
 u16 virtqueue_free_entries(virtqueue vq);
 void virtqueue_set_polling(virtqueue vq, boolean enable);
+void virtqueue_set_poll_budget(virtqueue vq, u16 budget);
+u64 virtqueue_busy_poll(virtqueue vq, u64 budget);
 
 typedef struct vqmsg *vqmsg;
 
@@ -43,6 +43,7 @@
 #include "lwip/dhcp.h"
 #include "lwip/inet_chksum.h"
 #include "lwip/timeouts.h"
+#include "lwip/prot/tcp.h"
 #include "netif/ethernet.h"
 #include "virtio_internal.h"
 #include "virtio_mmio.h"
@@ -55,9 +56,23 @@
 # define virtio_net_debug(...) do { } while(0)
 #endif // defined(VIRTIO_NET_DEBUG)
 
+/* default maximum number of received packets processed by each poll of an rx queue */
+#define VNET_RX_POLL_BUDGET 64
+
+/* maximum number of received packets processed by each busy poll of an rx queue */
+#define VNET_BUSY_POLL_BUDGET   8
+
+/* maximum number of TCP segments coalesced into a super-segment */
+#define VNET_TSO_MAX_SEGS   64
+
+/* maximum length of the link, network and transport headers of a super-segment */
+#define VNET_TSO_HDR_MAX    (SIZEOF_ETH_HDR + IP6_HLEN + 60)
+
 #define VIRTIO_NET_DRV_FEATURES \
-    (VIRTIO_NET_F_GUEST_CSUM | VIRTIO_NET_F_MAC | VIRTIO_NET_F_GUEST_TSO4 |         \
-     VIRTIO_NET_F_GUEST_TSO6 | VIRTIO_NET_F_GUEST_ECN | VIRTIO_NET_F_GUEST_UFO |    \
+    (VIRTIO_NET_F_CSUM | VIRTIO_NET_F_GUEST_CSUM | VIRTIO_NET_F_MAC |               \
+     VIRTIO_NET_F_HOST_TSO4 | VIRTIO_NET_F_HOST_TSO6 |                              \
+     VIRTIO_NET_F_GUEST_TSO4 | VIRTIO_NET_F_GUEST_TSO6 | VIRTIO_NET_F_GUEST_ECN |   \
+     VIRTIO_NET_F_GUEST_UFO |                                                       \
      VIRTIO_NET_F_MRG_RXBUF | VIRTIO_F_ANY_LAYOUT | VIRTIO_F_RING_EVENT_IDX |       \
      VIRTIO_NET_F_CTRL_VQ | VIRTIO_NET_F_MQ)
 
@@ -65,14 +80,20 @@ typedef struct vnet_rx {
     virtqueue q;
     u32 seqno;
     struct virtio_net_hdr_mrg_rxbuf *hdr;
+    struct net_gro gro;
+    closure_struct(net_rx_poll, poll);
 } *vnet_rx;
 
+typedef struct vnet_tx_batch *vnet_tx_batch;
+
 typedef struct vnet {
     struct netif_dev ndev;
     vtdev dev;
     u16 port;
     caching_heap rxbuffers;
     caching_heap txhandlers;
+    bytes txhandler_size;
+    vnet_tx_batch tx_batch;     /* per-CPU transmit state */
     closure_struct(mem_cleaner, mem_cleaner);
     bytes net_header_len;
     int rxbuflen;
@@ -101,31 +122,306 @@ typedef struct xpbuf
 } __attribute__((aligned(8))) *xpbuf;
 
 
-closure_function(1, 1, void, tx_complete,
-                 struct pbuf *, p,
-                 u64 len)
+/* Transmit message: a packet, or a super-segment made of in-order TCP segments of a flow, which
+ * the device splits back into segments of gso_size bytes (TCP segmentation offload). */
+typedef struct vnet_tx {
+    vnet vn;
+    closure_struct(vqfinish, complete);
+    struct virtio_net_hdr_mrg_rxbuf hdr;
+    u8 pkt_hdr[VNET_TSO_HDR_MAX];   /* super-segment headers, copied from the first segment */
+    u16 count;
+    struct pbuf *p[];               /* packet, or segments of a super-segment */
+} *vnet_tx;
+
+/* Per-CPU transmit state: while a transmit batch is open, TCP segments are coalesced into a
+ * super-segment, if the device supports TSO, and messages are queued without notifying the device
+ * until the batch is flushed. */
+struct vnet_tx_batch {
+    struct net_tx_flush flush;
+    closure_struct(thunk, flush_handler);
+    virtqueue txq;
+    vnet_tx tso;                /* super-segment being built */
+    vqmsg m;
+    u16 hdr_len;
+    u16 tcp_offset;
+    u16 mss;
+    u16 data_len;
+    u16 desc_count;
+    u16 max_desc;
+    u32 next_seqno;
+    boolean closed;             /* no more segments can be added to the super-segment */
+    boolean kick;               /* messages have been queued without notifying the device */
+} __attribute__((aligned(64)));
+
+closure_func_basic(vqfinish, void, vnet_tx_complete,
+                   u64 len)
 {
-    pbuf_free(bound(p));
-    closure_finish();
+    vnet_tx t = struct_from_closure(vnet_tx, complete);
+    vnet vn = t->vn;
+    for (u16 i = 0; i < t->count; i++)
+        pbuf_free(t->p[i]);
+    deallocate((heap)vn->txhandlers, t, vn->txhandler_size);
 }
 
+static vnet_tx vnet_tx_alloc(vnet vn)
+{
+    vnet_tx t = allocate((heap)vn->txhandlers, vn->txhandler_size);
+    assert(t != INVALID_ADDRESS);
+    t->vn = vn;
+    init_closure_func(&t->complete, vqfinish, vnet_tx_complete);
+    zero(&t->hdr, sizeof(t->hdr));
+    t->count = 0;
+    return t;
+}
 
-static err_t low_level_output(struct netif *netif, struct pbuf *p)
+/* Sets up the device to compute the checksum of a TCP segment whose headers start at frame: the
+ * checksum field is loaded with the pseudo-header sum, which is what the host expects for
+ * partially checksummed packets. */
+static boolean vnet_tx_csum(struct pbuf *p, void *frame, struct virtio_net_hdr *hdr)
 {
-    vnet vn = netif->state;
+    struct eth_hdr *ethhdr = frame;
+    u16 l4_offset = SIZEOF_ETH_HDR;
+    void *iphdr = frame + l4_offset;
+    struct tcp_hdr *tcphdr;
+    u16 tcp_len;
+    if (ethhdr->type == PP_HTONS(ETHTYPE_IP)) {
+        struct ip_hdr *ip4hdr = iphdr;
+        if (IPH_PROTO(ip4hdr) != IP_PROTO_TCP)
+            return false;
+        l4_offset += IPH_HL_BYTES(ip4hdr);
+        assert(p->len >= l4_offset + sizeof(struct tcp_hdr));
+        tcphdr = frame + l4_offset;
+        tcp_len = lwip_ntohs(IPH_LEN(ip4hdr)) - IPH_HL_BYTES(ip4hdr);
+        ip4_addr_t src, dest;
+        ip4_addr_copy(src, ip4hdr->src);
+        ip4_addr_copy(dest, ip4hdr->dest);
+        tcphdr->chksum = ~ip4_chksum_pseudo_partial(p, IP_PROTO_TCP, tcp_len, 0, &src, &dest);
+    } else if (ethhdr->type == PP_HTONS(ETHTYPE_IPV6)) {
+        struct ip6_hdr *ip6hdr = iphdr;
+        if (IP6H_NEXTH(ip6hdr) != IP6_NEXTH_TCP)
+            return false;
+        l4_offset += IP6_HLEN;
+        assert(p->len >= l4_offset + sizeof(struct tcp_hdr));
+        tcphdr = frame + l4_offset;
+        tcp_len = IP6H_PLEN(ip6hdr);
+        ip6_addr_t src, dest;
+        ip6_addr_copy_from_packed(src, ip6hdr->src);
+        ip6_addr_copy_from_packed(dest, ip6hdr->dest);
+        tcphdr->chksum = ~ip6_chksum_pseudo_partial(p, IP6_NEXTH_TCP, tcp_len, 0, &src, &dest);
+    } else {
+        return false;
+    }
+    hdr->flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+    hdr->csum_start = l4_offset;
+    hdr->csum_offset = offsetof(struct tcp_hdr *, chksum);
+    return true;
+}
 
-    virtqueue txq = vn->txq_map[current_cpu()->id];
+static void vnet_tx_queue(vnet vn, virtqueue txq, struct pbuf *p, boolean kick)
+{
     vqmsg m = allocate_vqmsg(txq);
     assert(m != INVALID_ADDRESS);
-    vqmsg_push(txq, m, vn->empty_phys, vn->net_header_len, false);
-
+    vnet_tx t = vnet_tx_alloc(vn);
+    boolean csum = (vn->dev->features & VIRTIO_NET_F_CSUM) && vnet_tx_csum(p, p->payload, &t->hdr.hdr);
+    vqmsg_push(txq, m, csum ? physical_from_virtual(&t->hdr) : vn->empty_phys, vn->net_header_len,
+               false);
     pbuf_ref(p);
-
+    t->p[t->count++] = p;
     for (struct pbuf * q = p; q != NULL; q = q->next)
         vqmsg_push(txq, m, physical_from_virtual(q->payload), q->len, false);
+    vqmsg_commit_seqno(txq, m, (vqfinish)&t->complete, 0, kick);
+}
+
+/* Returns the length of the link, network and transport headers of a TCP segment that can be part
+ * of a super-segment, or 0 if the segment cannot be coalesced with other segments. */
+static u16 vnet_tso_parse(vnet vn, struct pbuf *p, struct tcp_hdr **tcphdr)
+{
+    if (p->len < SIZEOF_ETH_HDR + IP_HLEN)
+        return 0;
+    struct eth_hdr *ethhdr = p->payload;
+    void *iphdr = p->payload + SIZEOF_ETH_HDR;
+    u16 iphdr_len, ip_len;
+    if (ethhdr->type == PP_HTONS(ETHTYPE_IP)) {
+        struct ip_hdr *ip4hdr = iphdr;
+        if (!(vn->dev->features & VIRTIO_NET_F_HOST_TSO4) || (IPH_HL_BYTES(ip4hdr) != IP_HLEN) ||
+            (IPH_PROTO(ip4hdr) != IP_PROTO_TCP) ||
+            (IPH_OFFSET(ip4hdr) & PP_HTONS(IP_OFFMASK | IP_MF)))
+            return 0;
+        iphdr_len = IP_HLEN;
+        ip_len = lwip_ntohs(IPH_LEN(ip4hdr));
+    } else if (ethhdr->type == PP_HTONS(ETHTYPE_IPV6)) {
+        struct ip6_hdr *ip6hdr = iphdr;
+        if (!(vn->dev->features & VIRTIO_NET_F_HOST_TSO6) ||
+            (p->len < SIZEOF_ETH_HDR + IP6_HLEN) || (IP6H_NEXTH(ip6hdr) != IP6_NEXTH_TCP))
+            return 0;
+        iphdr_len = IP6_HLEN;
+        ip_len = IP6_HLEN + IP6H_PLEN(ip6hdr);
+    } else {
+        return 0;
+    }
+    if (p->len < SIZEOF_ETH_HDR + iphdr_len + TCP_HLEN)
+        return 0;
+    struct tcp_hdr *th = iphdr + iphdr_len;
+    u16 hdr_len = SIZEOF_ETH_HDR + iphdr_len + TCPH_HDRLEN_BYTES(th);
+
+    /* headers must be in the first pbuf; ECN and flags other than PSH are not coalesced */
+    if ((hdr_len > VNET_TSO_HDR_MAX) || (p->len < hdr_len) ||
+        (p->tot_len != SIZEOF_ETH_HDR + ip_len) || (p->tot_len <= hdr_len) ||
+        ((TCPH_FLAGS(th) & ~TCP_PSH) != TCP_ACK))
+        return 0;
+    *tcphdr = th;
+    return hdr_len;
+}
+
+static boolean vnet_tso_match(vnet_tx_batch b, struct pbuf *p, u16 hdr_len,
+                              struct tcp_hdr *tcphdr, u16 data_len)
+{
+    vnet_tx t = b->tso;
+    if (b->closed || (hdr_len != b->hdr_len) || (data_len > b->mss) ||
+        (lwip_ntohl(tcphdr->seqno) != b->next_seqno) ||
+        (hdr_len - SIZEOF_ETH_HDR + b->data_len + data_len > U16_MAX) ||
+        (t->count == VNET_TSO_MAX_SEGS) || (b->desc_count + pbuf_clen(p) > b->max_desc))
+        return false;
+    struct tcp_hdr *th = (struct tcp_hdr *)(t->pkt_hdr + b->tcp_offset);
+    if ((tcphdr->src != th->src) || (tcphdr->dest != th->dest) || (tcphdr->ackno != th->ackno))
+        return false;
+
+    /* link header, network addresses and TCP options */
+    bytes addr_offset, addr_len;
+    if (IP_HDR_GET_VERSION(t->pkt_hdr + SIZEOF_ETH_HDR) == 4) {
+        addr_offset = SIZEOF_ETH_HDR + offsetof(struct ip_hdr *, src);
+        addr_len = 2 * sizeof(ip4_addr_p_t);
+    } else {
+        addr_offset = SIZEOF_ETH_HDR + offsetof(struct ip6_hdr *, src);
+        addr_len = 2 * sizeof(ip6_addr_p_t);
+    }
+    return (!runtime_memcmp(p->payload, t->pkt_hdr, SIZEOF_ETH_HDR) &&
+            !runtime_memcmp(p->payload + addr_offset, t->pkt_hdr + addr_offset, addr_len) &&
+            !runtime_memcmp(tcphdr + 1, th + 1, hdr_len - b->tcp_offset - TCP_HLEN));
+}
+
+/* Adds the payload of a segment to the super-segment being built. */
+static void vnet_tso_add(vnet_tx_batch b, struct pbuf *p, u16 data_len, boolean push)
+{
+    vnet_tx t = b->tso;
+    virtqueue txq = b->txq;
+    pbuf_ref(p);
+    t->p[t->count++] = p;
+    if (p->len > b->hdr_len) {
+        vqmsg_push(txq, b->m, physical_from_virtual(p->payload + b->hdr_len), p->len - b->hdr_len,
+                   false);
+        b->desc_count++;
+    }
+    for (struct pbuf *q = p->next; q != NULL; q = q->next) {
+        vqmsg_push(txq, b->m, physical_from_virtual(q->payload), q->len, false);
+        b->desc_count++;
+    }
+    b->data_len += data_len;
+    b->next_seqno += data_len;
+
+    /* PSH applies to the last segment; a short segment can only be the last one */
+    if (push) {
+        struct tcp_hdr *th = (struct tcp_hdr *)(t->pkt_hdr + b->tcp_offset);
+        TCPH_SET_FLAG(th, TCP_PSH);
+    }
+    if (push || (data_len < b->mss))
+        b->closed = true;
+}
+
+static void vnet_tso_start(vnet vn, vnet_tx_batch b, struct pbuf *p, u16 hdr_len,
+                           struct tcp_hdr *tcphdr, u16 data_len, boolean push)
+{
+    vnet_tx t = vnet_tx_alloc(vn);
+    virtqueue txq = b->txq;
+    vqmsg m = allocate_vqmsg(txq);
+    assert(m != INVALID_ADDRESS);
+    runtime_memcpy(t->pkt_hdr, p->payload, hdr_len);
+    vqmsg_push(txq, m, physical_from_virtual(&t->hdr), vn->net_header_len, false);
+    vqmsg_push(txq, m, physical_from_virtual(t->pkt_hdr), hdr_len, false);
+    b->tso = t;
+    b->m = m;
+    b->hdr_len = hdr_len;
+    b->tcp_offset = (void *)tcphdr - p->payload;
+    b->mss = data_len;
+    b->data_len = 0;
+    b->desc_count = 2;
+    b->next_seqno = lwip_ntohl(tcphdr->seqno);
+    b->closed = false;
+    vnet_tso_add(b, p, data_len, push);
+}
+
+/* Queues the super-segment being built, fixing up the copied headers to cover all segments. */
+static void vnet_tso_finish(vnet vn, vnet_tx_batch b)
+{
+    vnet_tx t = b->tso;
+    if (!t)
+        return;
+    void *iphdr = t->pkt_hdr + SIZEOF_ETH_HDR;
+    u16 tcp_len = b->hdr_len - b->tcp_offset + b->data_len;
+    u8 gso_type;
+    if (IP_HDR_GET_VERSION(iphdr) == 4) {
+        struct ip_hdr *ip4hdr = iphdr;
+        IPH_LEN_SET(ip4hdr, lwip_htons(IP_HLEN + tcp_len));
+        IPH_CHKSUM_SET(ip4hdr, 0);
+        IPH_CHKSUM_SET(ip4hdr, inet_chksum(ip4hdr, IP_HLEN));
+        gso_type = VIRTIO_NET_HDR_GSO_TCPV4;
+    } else {
+        IP6H_PLEN_SET((struct ip6_hdr *)iphdr, tcp_len);
+        gso_type = VIRTIO_NET_HDR_GSO_TCPV6;
+    }
+    struct virtio_net_hdr *hdr = &t->hdr.hdr;
+    vnet_tx_csum(t->p[0], t->pkt_hdr, hdr);
+    if (t->count > 1) {
+        hdr->gso_type = gso_type;
+        hdr->hdr_len = b->hdr_len;
+        hdr->gso_size = b->mss;
+        net_tso_count(t->count);
+    }
+    vqmsg_commit_seqno(b->txq, b->m, (vqfinish)&t->complete, 0, false);
+    b->tso = 0;
+    b->kick = true;
+}
+
+/* Called at the end of a transmit batch. */
+closure_func_basic(thunk, void, vnet_tx_flush)
+{
+    vnet_tx_batch b = struct_from_closure(vnet_tx_batch, flush_handler);
+    if (b->tso)
+        vnet_tso_finish(b->tso->vn, b);
+    if (b->kick) {
+        b->kick = false;
+        virtqueue_kick(b->txq);
+    }
+}
+
+static err_t low_level_output(struct netif *netif, struct pbuf *p)
+{
+    vnet vn = netif->state;
+    cpuinfo ci = current_cpu();
+    virtqueue txq = vn->txq_map[ci->id];
+    if (!net_tx_batching()) {
+        vnet_tx_queue(vn, txq, p, true);
+    } else {
+        vnet_tx_batch b = &vn->tx_batch[ci->id];
+        net_tx_batch_defer(&b->flush);
+        struct tcp_hdr *tcphdr;
+        u16 hdr_len = (vn->dev->features & VIRTIO_NET_F_CSUM) ? vnet_tso_parse(vn, p, &tcphdr) : 0;
+        if (hdr_len) {
+            u16 data_len = p->tot_len - hdr_len;
+            boolean push = (TCPH_FLAGS(tcphdr) & TCP_PSH) != 0;
+            if (b->tso && vnet_tso_match(b, p, hdr_len, tcphdr, data_len)) {
+                vnet_tso_add(b, p, data_len, push);
+            } else {
+                vnet_tso_finish(vn, b);
+                vnet_tso_start(vn, b, p, hdr_len, tcphdr, data_len, push);
+            }
+        } else {
+            vnet_tso_finish(vn, b);
+            vnet_tx_queue(vn, txq, p, false);
+            b->kick = true;
+        }
+    }
 
-    vqmsg_commit(txq, m, closure((heap)vn->txhandlers, tx_complete, p));
-    
     MIB2_STATS_NETIF_ADD(netif, ifoutoctets, p->tot_len);
     if (((u8_t *)p->payload)[0] & 1) {
         /* broadcast or multicast packet*/
@@ -274,7 +570,7 @@ closure_func_basic(vqfinish, void, vnet_input,
         }
     }
     if (!err)
-        err = (vn->ndev.n.input(&x->p.pbuf, &vn->ndev.n) != ERR_OK);
+        net_gro_input(&rx->gro, &x->p.pbuf);
   out:
     if (err)
         receive_buffer_release(&x->p.pbuf);
@@ -284,6 +580,16 @@ closure_func_basic(vqfinish, void, vnet_input,
 }
 
 
+/* Busy polling is only done with a non-zero poll-budget (see virtqueue_busy_poll()). */
+closure_func_basic(net_rx_poll, boolean, vnet_rx_poll)
+{
+    vnet_rx rx = struct_from_closure(vnet_rx, poll);
+    if (virtqueue_busy_poll(rx->q, VNET_BUSY_POLL_BUDGET) == 0)
+        return false;
+    net_gro_flush(&rx->gro);
+    return true;
+}
+
 static int post_receive(vnet vn, vnet_rx rx)
 {
     virtqueue rxq = rx->q;
@@ -401,6 +707,10 @@ static err_t virtioif_init(struct netif *netif)
     /* device capabilities */
     /* don't set NETIF_FLAG_ETHARP if this device is not an ethernet one */
     netif->flags = NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP | NETIF_FLAG_UP;
+
+    /* TCP checksums are computed by the host (see vnet_tx_csum()) */
+    if (vn->dev->features & VIRTIO_NET_F_CSUM)
+        NETIF_SET_CHECKSUM_CTRL(netif, NETIF_CHECKSUM_ENABLE_ALL & ~NETIF_CHECKSUM_GEN_TCP);
     return ERR_OK;
 }
 
@@ -433,6 +743,11 @@ closure_func_basic(netif_dev_setup, boolean, virtio_net_setup,
         max_vq_pairs = vq_pairs = 1;
     }
     virtio_net_debug("max vq pairs %d, using %d\n", max_vq_pairs, vq_pairs);
+    u64 poll_budget;
+    if (!config || !get_u64(config, sym_this("poll-budget"), &poll_budget))
+        poll_budget = VNET_RX_POLL_BUDGET;
+    else
+        poll_budget = MIN(poll_budget, U16_MAX);
     u64 cpus_per_vq = total_processors / vq_pairs;
     u64 excess_cpus = total_processors - cpus_per_vq * vq_pairs;
     vnet_rx rx = allocate(h, vq_pairs * sizeof(*rx));
@@ -442,6 +757,11 @@ closure_func_basic(netif_dev_setup, boolean, virtio_net_setup,
     vn->txq_map = allocate(h, total_processors * sizeof(vn->txq_map[0]));
     if (vn->txq_map == INVALID_ADDRESS)
         goto err1;
+    vn->tx_batch = allocate_zero(h, total_processors * sizeof(struct vnet_tx_batch));
+    if (vn->tx_batch == INVALID_ADDRESS) {
+        deallocate(h, vn->txq_map, total_processors * sizeof(vn->txq_map[0]));
+        goto err1;
+    }
     int rxq_entries = 0, txq_entries = 0;
     range cpu_affinity;
     u64 first_cpu = 0, num_cpus = 0;
@@ -457,6 +777,7 @@ closure_func_basic(netif_dev_setup, boolean, virtio_net_setup,
             timm_dealloc(s);
             goto err2;
         }
+        virtqueue_set_poll_budget(vq, poll_budget);
         rx[i].q = vq;
         rx[i].seqno = 0;
         rx[i].hdr = 0;
@@ -469,8 +790,15 @@ closure_func_basic(netif_dev_setup, boolean, virtio_net_setup,
             goto err2;
         }
         virtqueue_set_polling(vq, true);
-        for (u64 j = first_cpu; j < first_cpu + num_cpus; j++)
+        for (u64 j = first_cpu; j < first_cpu + num_cpus; j++) {
             vn->txq_map[j] = vq;
+            vnet_tx_batch b = &vn->tx_batch[j];
+            b->flush.handler = init_closure_func(&b->flush_handler, thunk, vnet_tx_flush);
+            b->txq = vq;
+
+            /* a super-segment must fit in the ring even without indirect descriptors */
+            b->max_desc = virtqueue_entries(vq) / 2;
+        }
         txq_entries += virtqueue_entries(vq);
     }
     if (vq_pairs > 1) {
@@ -485,7 +813,11 @@ closure_func_basic(netif_dev_setup, boolean, virtio_net_setup,
                      rxq_entries, txq_entries);
     bytes rx_allocsize = vn->rxbuflen + sizeof(struct xpbuf);
     bytes rxbuffers_pagesize = find_page_size(rx_allocsize, rxq_entries);
-    bytes tx_handler_size = sizeof(closure_struct_type(tx_complete));
+    boolean tso = (dev->features & VIRTIO_NET_F_CSUM) &&
+        (dev->features & (VIRTIO_NET_F_HOST_TSO4 | VIRTIO_NET_F_HOST_TSO6));
+    bytes tx_handler_size = offsetof(vnet_tx, p) +
+        (tso ? VNET_TSO_MAX_SEGS : 1) * sizeof(struct pbuf *);
+    vn->txhandler_size = tx_handler_size;
     bytes tx_handler_pagesize = find_page_size(tx_handler_size, txq_entries);
     virtio_net_debug("%s: net_header_len %d, rx_allocsize %d, rxbuffers_pagesize %d "
                      "tx_handler_size %d tx_handler_pagesize %d\n", func_ss, vn->net_header_len,
@@ -496,6 +828,9 @@ closure_func_basic(netif_dev_setup, boolean, virtio_net_setup,
     vn->txhandlers = allocate_objcache(h, contiguous, tx_handler_size, tx_handler_pagesize, true);
     if (vn->txhandlers == INVALID_ADDRESS)
         goto err3;
+    for (u16 i = 0; i < vq_pairs; i++)
+        net_gro_init(&rx[i].gro, &vn->ndev.n,
+                     init_closure_func(&rx[i].poll, net_rx_poll, vnet_rx_poll));
     for (u16 i = 0; i < vq_pairs; i++)
         if (post_receive(vn, vn->rx + i) == 0) {
             msg_err("failed to fill rx queues (%d)\n", rxq_entries);
@@ -521,10 +856,13 @@ closure_func_basic(netif_dev_setup, boolean, virtio_net_setup,
     mm_register_mem_cleaner(init_closure_func(&vn->mem_cleaner, mem_cleaner, vnet_mem_cleaner));
     return true;
   err4:
-      destroy_heap((heap)vn->txhandlers);
+    for (u16 i = 0; i < vq_pairs; i++)
+        net_gro_deinit(&rx[i].gro);
+    destroy_heap((heap)vn->txhandlers);
   err3:
     destroy_heap((heap)vn->rxbuffers);
   err2:
+    deallocate(h, vn->tx_batch, total_processors * sizeof(struct vnet_tx_batch));
     deallocate(h, vn->txq_map, total_processors * sizeof(vn->txq_map[0]));
   err1:
     deallocate(h, rx, vq_pairs * sizeof(*rx));
@@ -441,7 +441,7 @@ vtpci attach_vtpci(heap h, backed_heap page_allocator, pci_dev d, u64 feature_ma
         virtio_dev->dev_features = ((u64) f1 << 32) | f0;
 
         // write negotiated features
-        virtio_dev->features = virtio_dev->dev_features & feature_mask;
+        virtio_dev->features = virtio_dev->dev_features & (feature_mask | VIRTIO_F_RING_FEATURES);
         pci_bar_write_4(&dev->common_config, VTPCI_R_DRIVER_FEATURE_SELECT, 0);
         pci_bar_write_4(&dev->common_config, VTPCI_R_DRIVER_FEATURE, virtio_dev->features & MASK(32));
         pci_bar_write_4(&dev->common_config, VTPCI_R_DRIVER_FEATURE_SELECT, 1);
@@ -451,7 +451,7 @@ vtpci attach_vtpci(heap h, backed_heap page_allocator, pci_dev d, u64 feature_ma
         virtio_dev->dev_features = pci_bar_read_4(&dev->common_config, VIRTIO_PCI_HOST_FEATURES);
 
         // write negotiated features
-        virtio_dev->features = virtio_dev->dev_features & feature_mask;
+        virtio_dev->features = virtio_dev->dev_features & (feature_mask | VIRTIO_F_RING_FEATURES);
         pci_bar_write_4(&dev->common_config, VIRTIO_PCI_GUEST_FEATURES, virtio_dev->features);
     }
     virtio_pci_debug("%s: device features 0x%lx, negotiated features 0x%lx\n",
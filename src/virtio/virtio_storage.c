@@ -42,7 +42,8 @@ struct virtio_blk_config {
        u32 opt_io_size;
     } topology;
     u8 writeback;
-    u8 unused0[3];
+    u8 unused0;
+    u16 num_queues;
     u32 max_discard_sectors;
     u32 max_discard_seg;
     u32 discard_sector_alignment;
@@ -60,6 +61,7 @@ struct virtio_blk_config {
 #define VIRTIO_BLK_F_FLUSH      U64_FROM_BIT(9)
 #define VIRTIO_BLK_F_TOPOLOGY   U64_FROM_BIT(10)
 #define VIRTIO_BLK_F_CONFIG_WCE U64_FROM_BIT(11)
+#define VIRTIO_BLK_F_MQ         U64_FROM_BIT(12)
 
 #define VIRTIO_BLK_R_CAPACITY_LOW                (offsetof(struct virtio_blk_config *, capacity))
 #define VIRTIO_BLK_R_CAPACITY_HIGH               (offsetof(struct virtio_blk_config *, capacity) + 4)
@@ -74,6 +76,7 @@ struct virtio_blk_config {
 #define VIRTIO_BLK_R_TOPOLOGY_MIN_IO_SIZE        (offsetof(struct virtio_blk_config *, topology) + offsetof(struct virtio_blk_topology *, min_io_size))
 #define VIRTIO_BLK_R_TOPOLOGY_OPT_IO_SIZE        (offsetof(struct virtio_blk_config *, topology) + offsetof(struct virtio_blk_topology *, opt_io_size))
 #define VIRTIO_BLK_R_WRITEBACK                   (offsetof(struct virtio_blk_config *, writeback))
+#define VIRTIO_BLK_R_NUM_QUEUES                  (offsetof(struct virtio_blk_config *, num_queues))
 #define VIRTIO_BLK_R_MAX_DISCARD_SECTORS         (offsetof(struct virtio_blk_config *, max_discard_sectors))
 #define VIRTIO_BLK_R_MAX_DISCARD_SEG             (offsetof(struct virtio_blk_config *, max_discard_seg))
 #define VIRTIO_BLK_R_DISCARD_SECTOR_ALIGNMENT    (offsetof(struct virtio_blk_config *, discard_sector_alignment))
@@ -93,17 +96,25 @@ struct virtio_blk_config {
 #define VIRTIO_BLK_S_UNSUPP     2
 
 #define VIRTIO_BLK_DRIVER_FEATURES  \
-    (VIRTIO_BLK_F_SEG_MAX | VIRTIO_BLK_F_BLK_SIZE | VIRTIO_BLK_F_CONFIG_WCE | VIRTIO_BLK_F_FLUSH)
+    (VIRTIO_BLK_F_SEG_MAX | VIRTIO_BLK_F_BLK_SIZE | VIRTIO_BLK_F_CONFIG_WCE | VIRTIO_BLK_F_FLUSH | \
+     VIRTIO_BLK_F_MQ)
 
 typedef struct storage {
     vtdev v;
     closure_struct(storage_req_handler, req_handler);
-    struct virtqueue *command;
+    struct virtqueue **vq_map;  /* request queue for each CPU */
     u64 capacity;
     u64 block_size;
     u32 seg_max;
 } *storage;
 
+/* Requests are submitted to the queue of the current CPU, whose interrupt is routed to the
+ * same CPU(s), so that completions are processed where the request has been issued. */
+static inline struct virtqueue *storage_vq(storage st)
+{
+    return st->vq_map[current_cpu()->id];
+}
+
 static virtio_blk_req allocate_virtio_blk_req(storage st, u32 type, u64 sector, u64 *phys)
 {
     virtio_blk_req req = alloc_map(st->v->contiguous, sizeof(struct virtio_blk_req), phys);
@@ -155,7 +166,7 @@ static inline void storage_rw_internal(storage st, boolean write, void * buf,
         apply(sh, timm_oom);
         return;
     }
-    virtqueue vq = st->command;
+    virtqueue vq = storage_vq(st);
     vqmsg m = allocate_vqmsg(vq);
     assert(m != INVALID_ADDRESS);
     vqmsg_push(vq, m, req_phys, VIRTIO_BLK_REQ_HEADER_SIZE, false);
@@ -186,7 +197,7 @@ static void virtio_storage_io_sg(storage st, boolean write, sg_list sg, range bl
     virtio_blk_req req = 0;
     u64 req_phys;
     heap h = st->v->general;
-    virtqueue vq = st->command;
+    virtqueue vq = storage_vq(st);
     vqmsg msg;
     u32 desc_count;
     merge m = 0;
@@ -235,7 +246,7 @@ static void storage_flush(storage st, status_handler s)
         apply(s, timm_oom);
         return;
     }
-    virtqueue vq = st->command;
+    virtqueue vq = storage_vq(st);
     vqmsg m = allocate_vqmsg(vq);
     assert(m != INVALID_ADDRESS);
     vqmsg_push(vq, m, req_phys, VIRTIO_BLK_REQ_HEADER_SIZE, false);
@@ -271,6 +282,53 @@ closure_func_basic(storage_req_handler, void, virtio_storage_req_handler,
     }
 }
 
+/* Allocates one request queue per CPU, up to the number of queues supported by the device; CPUs
+ * are distributed evenly among queues, as done by the virtio-net driver. */
+static boolean virtio_blk_alloc_vqs(heap general, storage s)
+{
+    vtdev v = s->v;
+    u64 num_queues;
+    if (v->features & VIRTIO_BLK_F_MQ) {
+        num_queues = vtdev_cfg_read_2(v, VIRTIO_BLK_R_NUM_QUEUES);
+        if (num_queues == 0)
+            num_queues = 1;
+        num_queues = MIN(num_queues, total_processors);
+    } else {
+        num_queues = 1;
+    }
+    virtio_blk_debug("%s: using %ld queues\n", func_ss, num_queues);
+    s->vq_map = allocate(general, total_processors * sizeof(s->vq_map[0]));
+    if (s->vq_map == INVALID_ADDRESS) {
+        msg_err("cannot allocate queue map\n");
+        return false;
+    }
+    u64 cpus_per_vq = total_processors / num_queues;
+    u64 excess_cpus = total_processors - cpus_per_vq * num_queues;
+    u64 first_cpu = 0, num_cpus = 0;
+    for (u64 i = 0; i < num_queues; i++) {
+        first_cpu += num_cpus;
+        num_cpus = (i < excess_cpus) ? (cpus_per_vq + 1) : cpus_per_vq;
+        virtqueue vq;
+        status st = virtio_alloc_vq_aff(v, ss("virtio blk"), i, irangel(first_cpu, num_cpus), &vq);
+        if (!is_ok(st)) {
+            msg_err("failed to allocate vq: %v\n", st);
+            timm_dealloc(st);
+            if (i == 0) {
+                deallocate(general, s->vq_map, total_processors * sizeof(s->vq_map[0]));
+                return false;
+            }
+
+            /* share the queues allocated so far among the remaining CPUs */
+            for (u64 j = first_cpu; j < total_processors; j++)
+                s->vq_map[j] = s->vq_map[j % first_cpu];
+            break;
+        }
+        for (u64 j = first_cpu; j < first_cpu + num_cpus; j++)
+            s->vq_map[j] = vq;
+    }
+    return true;
+}
+
 static void virtio_blk_attach(heap general, storage_attach a, vtdev v)
 {
     storage s = allocate(general, sizeof(struct storage));
@@ -282,7 +340,10 @@ static void virtio_blk_attach(heap general, storage_attach a, vtdev v)
     s->capacity = (vtdev_cfg_read_4(v, VIRTIO_BLK_R_CAPACITY_LOW) |
 		   ((u64) vtdev_cfg_read_4(v, VIRTIO_BLK_R_CAPACITY_HIGH) << 32)) * s->block_size;
     virtio_blk_debug("%s: capacity 0x%lx, block size 0x%x\n", func_ss, s->capacity, s->block_size);
-    virtio_alloc_virtqueue(v, ss("virtio blk"), 0, &s->command);
+    if (!virtio_blk_alloc_vqs(general, s)) {
+        deallocate(general, s, sizeof(struct storage));
+        return;
+    }
 
     s->seg_max = (v->features & VIRTIO_BLK_F_SEG_MAX) ?
             vtdev_cfg_read_4(v, VIRTIO_BLK_R_SEG_MAX) : 1;
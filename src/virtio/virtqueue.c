@@ -75,6 +75,27 @@ struct vring_used {
     struct vring_used_elem ring[0];
 } __attribute__((packed));
 
+#define VRING_PACKED_DESC_F_AVAIL   (1 << 7)
+#define VRING_PACKED_DESC_F_USED    (1 << 15)
+
+struct vring_packed_desc {
+    u64 addr;
+    u32 len;
+    u16 id;                     /* buffer id */
+    u16 flags;
+} __attribute__((packed));
+
+#define VRING_PACKED_EVENT_FLAG_ENABLE  0
+#define VRING_PACKED_EVENT_FLAG_DISABLE 1
+#define VRING_PACKED_EVENT_FLAG_DESC    2
+#define VRING_PACKED_EVENT_F_WRAP_CTR   15
+
+/* event suppression structure, one for the driver and one for the device */
+struct vring_packed_event {
+    u16 off_wrap;
+    u16 flags;
+} __attribute__((packed));
+
 typedef struct vqmsg {
     struct list l;              /* vq->msg_queue when queued, or chained for bh process */
     union {
@@ -83,6 +104,10 @@ typedef struct vqmsg {
     };
     buffer descv;               /* XXX should be a variable stride vector */
     vqfinish completion;
+    void *indirect;             /* indirect descriptor table, kept across reuse */
+    u64 indirect_phys;
+    bytes indirect_size;
+    u32 indirect_len;           /* length of table in use, 0 if not using indirect descriptors */
 } *vqmsg;
     
 typedef struct virtqueue {
@@ -93,14 +118,32 @@ typedef struct virtqueue {
     bytes notify_offset;
     void *ring_mem;
     volatile struct vring_desc *desc;
-    volatile struct vring_avail *avail;
-    volatile struct vring_used *used;    
+    volatile struct vring_avail *avail; /* driver event area for packed rings */
+    volatile struct vring_used *used;   /* device event area for packed rings */
     u16 *avail_event;
     u16 *used_event;
+    boolean packed;
+    boolean indirect;
+    volatile struct vring_packed_desc *pdesc;
+    volatile struct vring_packed_event *driver_event;
+    volatile struct vring_packed_event *device_event;
+    u16 avail_idx;              /* packed: next descriptor to make available */
+    boolean avail_wrap;         /* packed: driver ring wrap counter */
+    boolean used_wrap;          /* packed: device ring wrap counter */
+    u16 *id_next;               /* packed: buffer id free list */
     boolean polling;
     boolean events_enabled;
+    boolean poll_scheduled;
+    u16 poll_budget;            /* 0 if completions are processed in the interrupt handler */
+    closure_struct(thunk, poll_bh);
+    u64 interrupts;
+    u64 polls;
+    u64 poll_work;              /* completions processed by polls */
+    u64 busy_polls;
+    u64 busy_poll_work;         /* completions processed by busy polls */
+    struct list l;              /* virtqueue_list */
     u64 free_cnt;               /* atomic */
-    u16 desc_idx;               /* head of descriptor free list */
+    u16 desc_idx;               /* head of descriptor (buffer id for packed rings) free list */
     u16 last_used_idx;          /* irq only */
     struct list msg_queue;
     struct list free_msgs;
@@ -109,8 +152,20 @@ typedef struct virtqueue {
     vqmsg msgs[0];
 } *virtqueue;
 
+/* Maximum number of completions collected from the used ring at a time when polling */
+#define VQ_POLL_BATCH   16
+
+static struct list virtqueue_list = {
+        &virtqueue_list, &virtqueue_list
+};
+static struct spinlock virtqueue_list_lock;
+
 /* Most uses here are a chain of 3 or less descriptors. */
 #define VQMSG_DEFAULT_SIZE     3
+
+/* Messages with at least this many descriptors take a single ring slot pointing to an indirect
+ * descriptor table, if the device supports it. */
+#define VQ_INDIRECT_MIN         4
 vqmsg allocate_vqmsg(virtqueue vq)
 {
     vqmsg m;
@@ -127,6 +182,8 @@ vqmsg allocate_vqmsg(virtqueue vq)
             deallocate(h, m, sizeof(struct vqmsg));
             return INVALID_ADDRESS;
         }
+        m->indirect = 0;
+        m->indirect_size = 0;
     } else {
         m = struct_from_list(l, vqmsg, l);
         list_delete(l);
@@ -154,6 +211,56 @@ void vqmsg_push(virtqueue vq, vqmsg m, u64 phys_addr, u32 len, boolean write)
 }
 
 static void virtqueue_fill(virtqueue vq);
+static void vq_enable_events(virtqueue vq);
+static void vq_disable_events(virtqueue vq);
+
+/* number of ring descriptors taken by a queued message */
+static inline u16 vqmsg_ring_count(vqmsg m)
+{
+    return m->indirect_len ? 1 : m->count;
+}
+
+/* Copies the descriptor chain of a message into its indirect table; if the table cannot be
+ * allocated, the message is queued with direct descriptors. */
+static void vqmsg_set_indirect(virtqueue vq, vqmsg m)
+{
+    m->indirect_len = 0;
+    if (!vq->indirect || m->count < VQ_INDIRECT_MIN)
+        return;
+    bytes len = m->count * sizeof(struct vring_desc);
+    if (len > m->indirect_size) {
+        backed_heap contiguous = vq->dev->contiguous;
+        bytes size = pad(len, contiguous->h.pagesize);
+        u64 phys;
+        void *table = alloc_map(contiguous, size, &phys);
+        if (table == INVALID_ADDRESS)
+            return;
+        if (m->indirect)
+            dealloc_unmap(contiguous, m->indirect, m->indirect_phys, m->indirect_size);
+        m->indirect = table;
+        m->indirect_phys = phys;
+        m->indirect_size = size;
+    }
+    for (int i = 0; i < m->count; i++) {
+        struct vring_desc *src = buffer_ref(m->descv, i * sizeof(*src));
+        if (vq->packed) {
+            struct vring_packed_desc *d = (struct vring_packed_desc *)m->indirect + i;
+            d->addr = src->busaddr;
+            d->len = src->len;
+            d->id = 0;
+            d->flags = src->flags;
+        } else {
+            struct vring_desc *d = (struct vring_desc *)m->indirect + i;
+            d->busaddr = src->busaddr;
+            d->len = src->len;
+            d->flags = src->flags;
+            if (i < m->count - 1)
+                d->flags |= VRING_DESC_F_NEXT;
+            d->next = i + 1;
+        }
+    }
+    m->indirect_len = len;
+}
 
 /* If seqno is non-null, the value it points to is set to a sequence number whose value is
  * initialized (when the virtqueue is created) to zero and incremented by one each time this
@@ -164,6 +271,7 @@ void vqmsg_commit_seqno(virtqueue vq, vqmsg m, vqfinish completion, u32 *seqno,
     m->completion = completion;
     virtqueue_debug_verbose("%s: vq %s, vqmsg %p, completion %p (%F)\n",
                             func_ss, vq->name, m, completion, completion);
+    vqmsg_set_indirect(vq, m);
     u64 irqflags = spin_lock_irq(&vq->lock);
     if (seqno)
         *seqno = vq->msg_seqno++;
@@ -181,35 +289,110 @@ void virtqueue_kick(virtqueue vq)
     spin_unlock_irq(lock, irqflags);
 }
 
-static void vq_poll(virtqueue vq)
+/* called with lock held */
+static vqmsg vq_get_used_packed(virtqueue vq)
+{
+    // ensure we see up-to-date descriptor flags (updated by host)
+    memory_barrier();
+
+    volatile struct vring_packed_desc *d = vq->pdesc + vq->last_used_idx;
+    u16 flags = d->flags;
+    boolean avail = (flags & VRING_PACKED_DESC_F_AVAIL) != 0;
+    boolean used = (flags & VRING_PACKED_DESC_F_USED) != 0;
+    if ((avail != used) || (used != vq->used_wrap))
+        return 0;
+    read_barrier();
+    virtqueue_debug_verbose("%s: vq %s: last_used_idx %d, id %d, len %d\n",
+                            func_ss, vq->name, vq->last_used_idx, d->id, d->len);
+    u16 id = d->id;
+    vqmsg m = vq->msgs[id];
+
+    /* the device writes a single used descriptor for the whole chain */
+    u16 dcount = vqmsg_ring_count(m);
+    vq->last_used_idx += dcount;
+    if (vq->last_used_idx >= vq->entries) {
+        vq->last_used_idx -= vq->entries;
+        vq->used_wrap = !vq->used_wrap;
+    }
+    vq->id_next[id] = vq->desc_idx;
+    vq->desc_idx = id;
+
+    fetch_and_add(&vq->free_cnt, dcount);
+    m->len = d->len;
+    vq->msgs[id] = 0;
+    return m;
+}
+
+/* called with lock held; returns the next message used by the device, if any */
+static vqmsg vq_get_used(virtqueue vq)
 {
+    if (vq->packed)
+        return vq_get_used_packed(vq);
+
     // ensure we see up-to-date used->idx (updated by host)
     memory_barrier();
-    
-    while (vq->last_used_idx != vq->used->idx) {
-        volatile struct vring_used_elem *uep = vq->used->ring + (vq->last_used_idx & (vq->entries - 1));
-        virtqueue_debug_verbose("%s: vq %s: last_used_idx %d, id %d, len %d\n",
-                                func_ss, vq->name, vq->last_used_idx, uep->id, uep->len);
-        u16 head = uep->id;
-        vqmsg m = vq->msgs[head];
-
-        /* return descriptor(s) to free list */
-        int dcount = 1;
-        volatile struct vring_desc *d = vq->desc + head;
-        while ((d->flags & VRING_DESC_F_NEXT)) {
-            d = vq->desc + d->next;
-            dcount++;
-        }
-        assert(dcount == m->count);
-        d->next = vq->desc_idx;
-        vq->desc_idx = head;
 
-        vq->last_used_idx++;
-        fetch_and_add(&vq->free_cnt, m->count);
-        m->len = uep->len;
-        vq->msgs[head] = 0;
-        virtqueue_debug("add msg %p\n", m);
+    if (vq->last_used_idx == vq->used->idx)
+        return 0;
+    volatile struct vring_used_elem *uep = vq->used->ring + (vq->last_used_idx & (vq->entries - 1));
+    virtqueue_debug_verbose("%s: vq %s: last_used_idx %d, id %d, len %d\n",
+                            func_ss, vq->name, vq->last_used_idx, uep->id, uep->len);
+    u16 head = uep->id;
+    vqmsg m = vq->msgs[head];
+
+    /* return descriptor(s) to free list */
+    int dcount = 1;
+    volatile struct vring_desc *d = vq->desc + head;
+    while ((d->flags & VRING_DESC_F_NEXT)) {
+        d = vq->desc + d->next;
+        dcount++;
+    }
+    assert(dcount == vqmsg_ring_count(m));
+    d->next = vq->desc_idx;
+    vq->desc_idx = head;
+
+    vq->last_used_idx++;
+    fetch_and_add(&vq->free_cnt, dcount);
+    m->len = uep->len;
+    vq->msgs[head] = 0;
+    virtqueue_debug("add msg %p\n", m);
+    return m;
+}
+
+/* called with lock held */
+static boolean vq_has_used(virtqueue vq)
+{
+    memory_barrier();
+    if (!vq->packed)
+        return vq->last_used_idx != vq->used->idx;
+    u16 flags = vq->pdesc[vq->last_used_idx].flags;
+    return (((flags & VRING_PACKED_DESC_F_AVAIL) != 0) == vq->used_wrap) &&
+        (((flags & VRING_PACKED_DESC_F_USED) != 0) == vq->used_wrap);
+}
+
+/* With VIRTIO_F_RING_EVENT_IDX, moves the used event to the next used descriptor; returns true
+ * if the event has been moved. */
+static boolean vq_update_used_event(virtqueue vq)
+{
+    if (!(vq->dev->features & VIRTIO_F_RING_EVENT_IDX))
+        return false;
+    if (vq->packed) {
+        u16 off_wrap = vq->last_used_idx | (vq->used_wrap << VRING_PACKED_EVENT_F_WRAP_CTR);
+        if (vq->driver_event->off_wrap == off_wrap)
+            return false;
+        vq->driver_event->off_wrap = off_wrap;
+    } else {
+        if (*vq->used_event == vq->last_used_idx)
+            return false;
+        *vq->used_event = vq->last_used_idx;
+    }
+    return true;
+}
 
+static void vq_poll(virtqueue vq)
+{
+    vqmsg m;
+    while ((m = vq_get_used(vq))) {
         async_apply_1(m->completion, (void*)m->len);
 
         /* TODO should probably observe a limit / drain method here */
@@ -226,11 +409,20 @@ closure_function(1, 0, void, vq_interrupt,
                             vq->last_used_idx, vq->used->idx, vq->desc_idx);
 
     spin_lock(&vq->lock);
+    vq->interrupts++;
+    if (vq->poll_budget) {
+        /* further completions are collected by polling until the used ring is drained */
+        if (!vq->poll_scheduled) {
+            vq_disable_events(vq);
+            vq->poll_scheduled = true;
+            async_apply((thunk)&vq->poll_bh);
+        }
+        spin_unlock(&vq->lock);
+        return;
+    }
   poll:
     vq_poll(vq);
-    if (!vq->polling && (vq->dev->features & VIRTIO_F_RING_EVENT_IDX) &&
-        (vq->last_used_idx != *vq->used_event)) {
-        *vq->used_event = vq->last_used_idx;
+    if (!vq->polling && vq_update_used_event(vq)) {
         /* Poll again, to cover cases where a new buffer has been used after the previous poll but
          * before updating used_event. */
         goto poll;
@@ -241,6 +433,62 @@ closure_function(1, 0, void, vq_interrupt,
     spin_unlock(&vq->lock);
 }
 
+/* Processes up to budget completions in the caller context; called with the vq lock held, which is
+ * released while completions are being processed. Returns the number of processed completions. */
+static u64 vq_poll_used(virtqueue vq, u64 budget, u64 *irqflags)
+{
+    struct {
+        vqfinish completion;
+        u64 len;
+    } batch[VQ_POLL_BATCH];
+    u64 work = 0;
+    while (work < budget) {
+        int count = 0;
+        vqmsg m;
+        while ((count < VQ_POLL_BATCH) && (work + count < budget) && (m = vq_get_used(vq))) {
+            batch[count].completion = m->completion;
+            batch[count].len = m->len;
+            count++;
+            list_insert_after(&vq->free_msgs, &m->l);
+        }
+        if (count == 0)
+            break;
+        virtqueue_fill(vq);
+        spin_unlock_irq(&vq->lock, *irqflags);
+        for (int i = 0; i < count; i++)
+            apply(batch[i].completion, batch[i].len);
+        work += count;
+        *irqflags = spin_lock_irq(&vq->lock);
+    }
+    return work;
+}
+
+/* Processes up to poll_budget completions; if the used ring is drained, interrupts are re-enabled,
+ * otherwise the poll is rescheduled, so that other bottom halves can run in the meantime. */
+closure_func_basic(thunk, void, vq_poll_bh)
+{
+    virtqueue vq = struct_from_closure(virtqueue, poll_bh);
+    u64 irqflags = spin_lock_irq(&vq->lock);
+    vq->polls++;
+    u64 work = vq_poll_used(vq, vq->poll_budget, &irqflags);
+    vq->poll_work += work;
+    if (work < vq->poll_budget) {
+        vq_enable_events(vq);
+
+        /* check for completions added before interrupts were enabled */
+        if (!vq_has_used(vq)) {
+            vq->poll_scheduled = false;
+            virtqueue_fill(vq);
+            spin_unlock_irq(&vq->lock, irqflags);
+            return;
+        }
+        vq_disable_events(vq);
+    }
+    virtqueue_fill(vq);
+    spin_unlock_irq(&vq->lock, irqflags);
+    async_apply((thunk)&vq->poll_bh);
+}
+
 status virtqueue_alloc(vtdev dev,
                        sstring name,
                        u16 queue_index,
@@ -250,19 +498,32 @@ status virtqueue_alloc(vtdev dev,
                        virtqueue *vqp,
                        thunk *t)
 {
+    boolean packed = (dev->features & VIRTIO_F_RING_PACKED) != 0;
     u64 vq_alloc_size = sizeof(struct virtqueue) + size * sizeof(vqmsg);
+    if (packed)
+        vq_alloc_size += size * sizeof(u16);    /* id_next */
     virtqueue vq = allocate_zero(dev->general, vq_alloc_size);
-    bytes avail_offset = size * sizeof(struct vring_desc);
-    bytes used_offset = pad(avail_offset + sizeof(*vq->avail) + sizeof(vq->avail->ring[0]) * size +
-                            sizeof(u16) /* used_event */, align);
-    bytes alloc = used_offset + pad(sizeof(*vq->used) + sizeof(vq->used->ring[0]) * size +
-                                    sizeof(u16) /* avail_event */, align);
+    bytes avail_offset, used_offset, alloc;
+    if (packed) {
+        /* descriptor ring, followed by driver and device event suppression areas */
+        avail_offset = size * sizeof(struct vring_packed_desc);
+        used_offset = avail_offset + sizeof(struct vring_packed_event);
+        alloc = used_offset + sizeof(struct vring_packed_event);
+    } else {
+        avail_offset = size * sizeof(struct vring_desc);
+        used_offset = pad(avail_offset + sizeof(*vq->avail) + sizeof(vq->avail->ring[0]) * size +
+                          sizeof(u16) /* used_event */, align);
+        alloc = used_offset + pad(sizeof(*vq->used) + sizeof(vq->used->ring[0]) * size +
+                                  sizeof(u16) /* avail_event */, align);
+    }
     
     if (vq == INVALID_ADDRESS) 
         return timm("status", "cannot allocate virtqueue");
     
     vq->dev = dev;
     vq->name = name;
+    vq->packed = packed;
+    vq->indirect = (dev->features & VIRTIO_F_RING_INDIRECT_DESC) != 0;
     virtqueue_debug("%s: vq %s: idx %d, size %d, alloc %d\n",
                     func_ss, vq->name, queue_index, size, alloc);
     vq->queue_index = queue_index;
@@ -278,22 +539,42 @@ status virtqueue_alloc(vtdev dev,
         return(timm("status", "cannot allocate memory for virtqueue ring"));
     }
 
-    vq->desc = (struct vring_desc *) vq->ring_mem;
     vq->avail = (struct vring_avail *) (vq->ring_mem + avail_offset);
     vq->used = (struct vring_used *) (vq->ring_mem + used_offset);
-    virtqueue_debug("%s: vq %p: desc %p, avail %p, used %p\n",
-                    func_ss, vq, vq->desc, vq->avail, vq->used);
-    vq->avail_event = (void *)(vq->used + 1) + sizeof(vq->used->ring[0]) * size;
-    vq->used_event = (void *)(vq->avail + 1) + sizeof(vq->avail->ring[0]) * size;
     vq->events_enabled = true;
+    if (packed) {
+        vq->pdesc = (struct vring_packed_desc *) vq->ring_mem;
+        vq->driver_event = (struct vring_packed_event *) vq->avail;
+        vq->device_event = (struct vring_packed_event *) vq->used;
+        virtqueue_debug("%s: vq %p: packed desc %p, driver event %p, device event %p\n",
+                        func_ss, vq, vq->pdesc, vq->driver_event, vq->device_event);
+        vq->avail_wrap = vq->used_wrap = true;
+        vq_enable_events(vq);
 
-    // initialize descriptor chains
-    for (int i = 0; i < vq->entries - 1; i++)
-        vq->desc[i].next = i + 1;
-    vq->desc[vq->entries - 1].next = VQ_RING_DESC_CHAIN_END;
+        // initialize buffer id free list
+        vq->id_next = (u16 *)&vq->msgs[size];
+        for (int i = 0; i < vq->entries - 1; i++)
+            vq->id_next[i] = i + 1;
+        vq->id_next[vq->entries - 1] = VQ_RING_DESC_CHAIN_END;
+    } else {
+        vq->desc = (struct vring_desc *) vq->ring_mem;
+        virtqueue_debug("%s: vq %p: desc %p, avail %p, used %p\n",
+                        func_ss, vq, vq->desc, vq->avail, vq->used);
+        vq->avail_event = (void *)(vq->used + 1) + sizeof(vq->used->ring[0]) * size;
+        vq->used_event = (void *)(vq->avail + 1) + sizeof(vq->avail->ring[0]) * size;
+
+        // initialize descriptor chains
+        for (int i = 0; i < vq->entries - 1; i++)
+            vq->desc[i].next = i + 1;
+        vq->desc[vq->entries - 1].next = VQ_RING_DESC_CHAIN_END;
+    }
 
+    init_closure_func(&vq->poll_bh, thunk, vq_poll_bh);
     *t = closure(dev->general, vq_interrupt, vq);
     *vqp = vq;
+    spin_lock(&virtqueue_list_lock);
+    list_push_back(&virtqueue_list, &vq->l);
+    spin_unlock(&virtqueue_list_lock);
     return STATUS_OK;
 }
 
@@ -324,7 +605,16 @@ u16 virtqueue_free_entries(virtqueue vq)
 
 static void vq_enable_events(virtqueue vq)
 {
-    if (vq->dev->features & VIRTIO_F_RING_EVENT_IDX)
+    if (vq->packed) {
+        if (vq->dev->features & VIRTIO_F_RING_EVENT_IDX) {
+            vq->driver_event->off_wrap = vq->last_used_idx |
+                (vq->used_wrap << VRING_PACKED_EVENT_F_WRAP_CTR);
+            write_barrier();
+            vq->driver_event->flags = VRING_PACKED_EVENT_FLAG_DESC;
+        } else {
+            vq->driver_event->flags = VRING_PACKED_EVENT_FLAG_ENABLE;
+        }
+    } else if (vq->dev->features & VIRTIO_F_RING_EVENT_IDX)
         *vq->used_event = vq->last_used_idx;
     else
         vq->avail->flags &= ~VRING_AVAIL_F_NO_INTERRUPT;
@@ -333,7 +623,9 @@ static void vq_enable_events(virtqueue vq)
 
 static void vq_disable_events(virtqueue vq)
 {
-    if (vq->dev->features & VIRTIO_F_RING_EVENT_IDX)
+    if (vq->packed)
+        vq->driver_event->flags = VRING_PACKED_EVENT_FLAG_DISABLE;
+    else if (vq->dev->features & VIRTIO_F_RING_EVENT_IDX)
         /* set an arbitrary value, we will still receive an interrupt every 64K messages */
         *vq->used_event = (u16)-1;
     else
@@ -350,13 +642,85 @@ void virtqueue_set_polling(virtqueue vq, boolean enable)
     vq->polling = enable;
 }
 
+/* Enables adaptive interrupt/poll mode: an interrupt disables further interrupts and schedules
+ * polling of the used ring, processing at most budget completions per poll, until the ring is
+ * drained. A zero budget restores processing of completions in the interrupt handler. */
+void virtqueue_set_poll_budget(virtqueue vq, u16 budget)
+{
+    u64 irqflags = spin_lock_irq(&vq->lock);
+    vq->poll_budget = budget;
+    spin_unlock_irq(&vq->lock, irqflags);
+}
+
+/* Busy polling: processes up to budget completions in the caller context. Completions must be
+ * processed in order, thus busy polling is only done in poll mode (where completions are not queued
+ * to bottom halves by the interrupt handler), and only if no poll is already in progress: the busy
+ * poller takes over the poll_scheduled state for the duration of the poll, so that neither the
+ * interrupt handler nor another poller can process completions concurrently. */
+u64 virtqueue_busy_poll(virtqueue vq, u64 budget)
+{
+    u64 irqflags = spin_lock_irq(&vq->lock);
+    if (!vq->poll_budget || vq->poll_scheduled) {
+        spin_unlock_irq(&vq->lock, irqflags);
+        return 0;
+    }
+    vq_disable_events(vq);
+    vq->poll_scheduled = true;
+    u64 work = vq_poll_used(vq, budget, &irqflags);
+    vq->busy_polls++;
+    vq->busy_poll_work += work;
+    vq_enable_events(vq);
+
+    /* completions added before interrupts were enabled are handed over to the poll bottom half */
+    boolean pending = vq_has_used(vq);
+    if (pending)
+        vq_disable_events(vq);
+    else
+        vq->poll_scheduled = false;
+    virtqueue_fill(vq);
+    spin_unlock_irq(&vq->lock, irqflags);
+    if (pending)
+        async_apply((thunk)&vq->poll_bh);
+    return work;
+}
+
+void virtqueue_stats(buffer b)
+{
+    spin_lock(&virtqueue_list_lock);
+    list_foreach(&virtqueue_list, l) {
+        virtqueue vq = struct_from_list(l, virtqueue, l);
+        u64 polls = vq->polls;
+        u64 work = polls ? vq->poll_work * 100 / polls : 0;
+        bprintf(b, "%s %d: interrupts %ld polls %ld work/poll %ld.%02ld busy polls %ld (work %ld)\n",
+                vq->name, vq->queue_index, vq->interrupts, polls, work / 100, work % 100,
+                vq->busy_polls, vq->busy_poll_work);
+    }
+    spin_unlock(&virtqueue_list_lock);
+}
+
+/* added is the number of new available ring entries: message heads for the split ring, descriptors
+ * for the packed ring */
 static int virtqueue_notify(virtqueue vq, u16 added)
 {
     // ensure used->flags update is visible to us
     // and updated avail->idx is visible to host
     memory_barrier();
     int should_notify;
-    if (vq->dev->features & VIRTIO_F_RING_EVENT_IDX)
+    if (vq->packed) {
+        u16 off_wrap = vq->device_event->off_wrap;
+        u16 flags = vq->device_event->flags;
+        if (flags == VRING_PACKED_EVENT_FLAG_DESC) {
+            /* The ring index wraps at vq->entries: express the event index relative to the current
+             * wrap counter, so that it can be compared with the new and old ring indexes in
+             * 16-bit modular arithmetic, where new - old is the number of added descriptors. */
+            u16 event_idx = off_wrap & ~(1 << VRING_PACKED_EVENT_F_WRAP_CTR);
+            if ((off_wrap >> VRING_PACKED_EVENT_F_WRAP_CTR) != vq->avail_wrap)
+                event_idx -= vq->entries;
+            should_notify = (u16)(vq->avail_idx - event_idx - 1) < added;
+        } else {
+            should_notify = (flags != VRING_PACKED_EVENT_FLAG_DISABLE);
+        }
+    } else if (vq->dev->features & VIRTIO_F_RING_EVENT_IDX)
         should_notify = ((vq->avail->idx - *vq->avail_event - 1) < added) || (added == vq->entries);
     else
         should_notify = ((vq->used->flags & VRING_USED_F_NO_NOTIFY) == 0);
@@ -366,30 +730,18 @@ static int virtqueue_notify(virtqueue vq, u16 added)
 }
 
 /* called with lock held */
-static void virtqueue_fill(virtqueue vq)
+static void vq_add_split(virtqueue vq, vqmsg m)
 {
-    virtqueue_debug("%s: ENTRY: vq %s: entries %d, desc_idx %d, avail->idx %d, avail->flags 0x%x\n",
-                    func_ss, vq->name, vq->entries, vq->desc_idx, vq->avail->idx, vq->avail->flags);
-
-    list n = list_get_next(&vq->msg_queue);
-    u16 added = 0;
-  begin:
-    if (vq->polling)
-        vq_poll(vq);
-    while (n && n != &vq->msg_queue) {
-        vqmsg m = struct_from_list(n, vqmsg, l);
-        virtqueue_debug_verbose("   vqmsg %p, count %d\n", m, m->count);
-        if (vq->free_cnt < m->count) {
-            virtqueue_debug_verbose("      vq %s: queue full (vq->free_cnt %ld)\n",
-                vq->name, vq->free_cnt);
-            break;
-        }
-        assert(vq->free_cnt <= vq->entries);
-
-        assert(m->completion);
-        u16 head = vq->desc_idx;
-        vq->msgs[head] = m;
+    u16 head = vq->desc_idx;
+    vq->msgs[head] = m;
 
+    if (m->indirect_len) {
+        volatile struct vring_desc *d = vq->desc + head;
+        d->busaddr = m->indirect_phys;
+        d->len = m->indirect_len;
+        d->flags = VRING_DESC_F_INDIRECT;
+        vq->desc_idx = d->next;
+    } else {
         for (int i = 0; i < m->count; i++) {
             struct vring_desc *src = buffer_ref(m->descv, i * sizeof(*src));
             volatile struct vring_desc *d = vq->desc + vq->desc_idx;
@@ -404,16 +756,91 @@ static void virtqueue_fill(virtqueue vq)
                                     "len 0x%x, flags 0x%x, next %d\n", vq->desc_idx, d, d->busaddr,
                                     d->len, d->flags, d->next);
         }
+    }
 
-        u16 avail_idx = vq->avail->idx & (vq->entries - 1);
-        vq->avail->ring[avail_idx] = head;
-        virtqueue_debug_verbose("      avail->ring[%d] = %d\n", avail_idx, head);
-        fetch_and_add(&vq->free_cnt, -m->count);
-        added++;
+    u16 avail_idx = vq->avail->idx & (vq->entries - 1);
+    vq->avail->ring[avail_idx] = head;
+    virtqueue_debug_verbose("      avail->ring[%d] = %d\n", avail_idx, head);
+
+    // ensure desc and avail ring updates above are visible before updating avail->idx
+    write_barrier();
+    vq->avail->idx++;
+}
+
+/* called with lock held */
+static void vq_add_packed(virtqueue vq, vqmsg m)
+{
+    u16 id = vq->desc_idx;
+    vq->desc_idx = vq->id_next[id];
+    vq->msgs[id] = m;
+
+    u16 head = vq->avail_idx;
+    u16 head_flags = 0;
+    u16 count = vqmsg_ring_count(m);
+    for (int i = 0; i < count; i++) {
+        volatile struct vring_packed_desc *d = vq->pdesc + vq->avail_idx;
+        u16 flags;
+        if (m->indirect_len) {
+            d->addr = m->indirect_phys;
+            d->len = m->indirect_len;
+            flags = VRING_DESC_F_INDIRECT;
+        } else {
+            struct vring_desc *src = buffer_ref(m->descv, i * sizeof(*src));
+            d->addr = src->busaddr;
+            d->len = src->len;
+            flags = src->flags;
+            if (i < count - 1)
+                flags |= VRING_DESC_F_NEXT;
+        }
+        d->id = id;
+        flags |= vq->avail_wrap ? VRING_PACKED_DESC_F_AVAIL : VRING_PACKED_DESC_F_USED;
+        virtqueue_debug_verbose("      - desc %d, id %d, addr 0x%lx, len 0x%x, flags 0x%x\n",
+                                vq->avail_idx, id, d->addr, d->len, flags);
+        if (i == 0)
+            head_flags = flags;
+        else
+            d->flags = flags;
+        if (++vq->avail_idx == vq->entries) {
+            vq->avail_idx = 0;
+            vq->avail_wrap = !vq->avail_wrap;
+        }
+    }
 
-        // ensure desc and avail ring updates above are visible before updating avail->idx
-        write_barrier();
-        vq->avail->idx++;
+    // make the whole chain visible to the device at once by writing the head flags last
+    write_barrier();
+    vq->pdesc[head].flags = head_flags;
+}
+
+/* called with lock held */
+static void virtqueue_fill(virtqueue vq)
+{
+    virtqueue_debug("%s: ENTRY: vq %s: entries %d, desc_idx %d, free_cnt %ld\n",
+                    func_ss, vq->name, vq->entries, vq->desc_idx, vq->free_cnt);
+
+    list n = list_get_next(&vq->msg_queue);
+    u16 added = 0, added_descs = 0;
+  begin:
+    if (vq->polling)
+        vq_poll(vq);
+    while (n && n != &vq->msg_queue) {
+        vqmsg m = struct_from_list(n, vqmsg, l);
+        u16 ring_count = vqmsg_ring_count(m);
+        virtqueue_debug_verbose("   vqmsg %p, count %d, ring count %d\n", m, m->count, ring_count);
+        if (vq->free_cnt < ring_count) {
+            virtqueue_debug_verbose("      vq %s: queue full (vq->free_cnt %ld)\n",
+                vq->name, vq->free_cnt);
+            break;
+        }
+        assert(vq->free_cnt <= vq->entries);
+
+        assert(m->completion);
+        if (vq->packed)
+            vq_add_packed(vq, m);
+        else
+            vq_add_split(vq, m);
+        fetch_and_add(&vq->free_cnt, -ring_count);
+        added++;
+        added_descs += ring_count;
 
         list nn = list_get_next(n);
         list_delete(n);
@@ -433,7 +860,7 @@ static void virtqueue_fill(virtqueue vq)
 
     int notified = 0;
     if (added > 0)
-        notified = virtqueue_notify(vq, added);
+        notified = virtqueue_notify(vq, vq->packed ? added_descs : added);
     (void) notified;
     virtqueue_debug_verbose("   added %d, notified %d, desc_idx %d\n", added, notified, vq->desc_idx);
 }
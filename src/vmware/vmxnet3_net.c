@@ -30,6 +30,7 @@ typedef struct vmxnet3 {
     thunk rx_intr_handler;
     thunk rx_service;           /* for bhqueue processing */
     queue rx_servicequeue;
+    struct net_gro gro;
 } *vmxnet3;
 
 typedef struct xpbuf
@@ -250,14 +251,14 @@ closure_function(1, 0, void, vmxnet3_rx_service_bh,
             assert(i);
             xpbuf rxb = struct_from_list(i, xpbuf, l);
             list_delete(i);
-            struct netif *n = &vn->ndev.n;
-            err_enum_t err = n->input((struct pbuf *)rxb, n);
-            if (err != ERR_OK) {
+            err_enum_t err = net_gro_input(&vn->gro, (struct pbuf *)rxb);
+            if (err != ERR_OK)
                 msg_err("vmxnet3: rx drop by stack, err %d\n", err);
-                receive_buffer_release((struct pbuf *)rxb);
-            }
         }
     }
+    err_enum_t err = net_gro_flush(&vn->gro);
+    if (err != ERR_OK)
+        msg_err("vmxnet3: rx drop by stack, err %d\n", err);
 }
 
 void vmxnet3_newbuf(vmxnet3 vdev, int rid);
@@ -417,6 +418,7 @@ static void vmxnet3_net_attach(heap general, heap page_allocator, pci_dev d)
               vn,
               vmxif_init,
               ethernet_input);
+    net_gro_init(&vn->gro, &vn->ndev.n, 0);
     vmxnet3_interrupts_enable(dev);
 }
 
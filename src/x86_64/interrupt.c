@@ -185,6 +185,7 @@ void common_handler()
 
     // if we were idle, we are no longer
     bitmap_set_atomic(idle_cpu_mask, ci->id, 0);
+    page_invalidate_idle_exit();
 
     int_debug("[%02d] # %d (%s), state %s, frame %p, rip 0x%lx, cr2 0x%lx\n",
               ci->id, i, interrupt_names[i], state_strings[ci->state],
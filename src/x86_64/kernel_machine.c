@@ -75,6 +75,52 @@ static void seg_desc_set(seg_desc_t *d, u32 base, u16 limit, u16 flags)
     d->data[7] = (base >> 24) & 0xff;
 }
 
+/* Called on the cpu being initialized. Sharing groups are derived from the
+ * (x2)APIC id shifted by the width of the SMT and cache sharing id fields;
+ * the NUMA node is looked up from the (x2)APIC id in the firmware affinity
+ * table. */
+static void init_cpu_topology(cpuinfo ci)
+{
+    u32 v[4];
+    u32 max_fn = cpuid_highest_fn(false);
+    cpuid(1, 0, v);
+    u32 id = v[1] >> 24;
+    u32 smt_shift = 0;
+    if (max_fn >= 0xb) {
+        cpuid(0xb, 0, v);
+        if (v[1]) {
+            id = v[3];
+            if (((v[2] >> 8) & 0xff) == 1)  /* level type SMT */
+                smt_shift = v[0] & 0x1f;
+        }
+    }
+    ci->numa_node = numa_node_from_hw_id(id);
+    ci->smt_group = id >> smt_shift;
+
+    /* Intel enumerates caches with leaf 4, AMD with leaf 0x8000001d (leaf 4 reads as zeros) */
+    u32 cache_fn = 0;
+    if (max_fn >= 4) {
+        cpuid(4, 0, v);
+        if (v[0] & 0x1f)
+            cache_fn = 4;
+    }
+    if (!cache_fn && (cpuid_highest_fn(true) >= 0x8000001d)) {
+        cpuid(0x8000001d, 0, v);
+        if (v[0] & 0x1f)
+            cache_fn = 0x8000001d;
+    }
+    if (!cache_fn)
+        return;
+    u32 llc_sharing = 0;
+    for (u32 i = 0; i < 8; i++) {
+        cpuid(cache_fn, i, v);
+        if ((v[0] & 0x1f) == 0) /* no more caches */
+            break;
+        llc_sharing = (v[0] >> 14) & 0xfff;
+    }
+    ci->llc_group = id >> find_order(llc_sharing + 1);
+}
+
 void init_cpuinfo_machine(cpuinfo ci, heap backed)
 {
     ci->m.self = &ci->m;
@@ -106,6 +152,7 @@ void init_cpuinfo_machine(cpuinfo ci, heap backed)
     u64 gdt_base = u64_from_pointer(gdt);
     runtime_memcpy(&ci->m.gdt_pointer.base, &gdt_base, sizeof(gdt_base));
     install_gdt64_and_tss(&ci->m.gdt.tss_desc, &ci->m.tss, gdt, &ci->m.gdt_pointer);
+    init_cpu_topology(ci);
 }
 
 #ifdef KERNEL
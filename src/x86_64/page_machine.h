@@ -2,6 +2,7 @@
 
 #define PAGE_NO_EXEC       U64_FROM_BIT(63)
 #define PAGE_NO_PS         0x0200 /* AVL[0] */
+#define PAGE_SPLIT         0x0400 /* AVL[1]: page split from a block mapping */
 #define PAGE_PS            0x0080
 #define PAGE_DIRTY         0x0040
 #define PAGE_ACCESSED      0x0020
@@ -149,6 +150,17 @@ static inline u64 flags_from_pte(u64 pte)
     return pte & (PAGE_FLAGS_MASK | page_encr_mask);
 }
 
+/* flags for the next-level entries replacing a block mapping */
+static inline u64 flags_from_block_pte(u64 pte)
+{
+    return (flags_from_pte(pte) & ~PAGE_PS) | PAGE_SPLIT;
+}
+
+static inline boolean pte_is_split(pte entry)
+{
+    return (entry & PAGE_SPLIT) != 0;
+}
+
 static inline pageflags pageflags_from_pte(pte pte)
 {
     return (pageflags){.w = flags_from_pte(pte)};
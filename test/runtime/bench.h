@@ -0,0 +1,174 @@
+/* Common code for the *_bench programs
+
+   The benchmarks are built along with the runtime tests, but are not part of the runtime-tests
+   target: they are run manually and report rates instead of checking results. bench_run() runs
+   an operation in a loop in a number of threads for a given time, and bench_loop() does the
+   same in the calling thread; bench_sweep() repeats a run for 1, 2, 4... threads up to a
+   maximum. The remaining helpers are shared with the client/server benchmarks.
+*/
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../test_utils.h"
+
+#define BENCH_MAX_THREADS   256
+#define BENCH_OP_TYPES      2
+
+static inline uint64_t clock_ns(clockid_t clk)
+{
+    struct timespec ts;
+    clock_gettime(clk, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline uint64_t now_ns(void)
+{
+    return clock_ns(CLOCK_MONOTONIC);
+}
+
+static inline uint64_t xorshift(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+/* Sends or receives exactly len bytes; returns -1 on error or end of file. */
+static inline int bench_xfer(int fd, void *buf, size_t len, int send)
+{
+    size_t done = 0;
+    while (done < len) {
+        ssize_t rv = send ? write(fd, buf + done, len - done) : read(fd, buf + done, len - done);
+        if (rv <= 0)
+            return -1;
+        done += rv;
+    }
+    return 0;
+}
+
+/* Reads a "name value" statistic from a file such as /proc/vmstat; returns -1 if the statistic
+ * is not available (e.g. on Linux). */
+static inline int64_t bench_read_stat(const char *path, const char *name)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -1;
+    char key[64], val[32];
+    int64_t rv = -1;
+    while (fscanf(f, "%63s %31s", key, val) == 2) {
+        if (!strcmp(key, name)) {
+            rv = atoll(val);
+            break;
+        }
+    }
+    fclose(f);
+    return rv;
+}
+
+struct bench_worker {
+    int id;
+    uint64_t seed;
+    uint64_t ops[BENCH_OP_TYPES];   /* operations done, by type */
+    void *priv;
+    pthread_t thread;
+} __attribute__((aligned(64)));
+
+struct bench {
+    void (*start)(struct bench_worker *w);  /* optional, called by each thread before the loop */
+    void (*op)(struct bench_worker *w);     /* one iteration, accounted for in w->ops */
+    void (*end)(struct bench_worker *w);    /* optional, called by each thread after the loop */
+};
+
+struct bench_result {
+    uint64_t elapsed;                       /* in nanoseconds */
+    uint64_t ops[BENCH_OP_TYPES];
+};
+
+static inline double bench_rate(struct bench_result *r, int type)
+{
+    return r->ops[type] * 1e9 / r->elapsed;
+}
+
+static const struct bench *bench_current;
+static volatile int bench_stop;
+
+static void *bench_thread(void *arg)
+{
+    struct bench_worker *w = arg;
+    if (bench_current->start)
+        bench_current->start(w);
+    while (!bench_stop)
+        bench_current->op(w);
+    if (bench_current->end)
+        bench_current->end(w);
+    return NULL;
+}
+
+/* Runs the benchmark in nthreads threads for the given time and returns the operation totals. */
+static inline struct bench_result bench_run(const struct bench *b, int nthreads, int seconds)
+{
+    test_assert(nthreads > 0 && nthreads <= BENCH_MAX_THREADS);
+    struct bench_worker *workers = aligned_alloc(64, nthreads * sizeof(*workers));
+    test_assert(workers);
+    memset(workers, 0, nthreads * sizeof(*workers));
+    bench_current = b;
+    bench_stop = 0;
+    uint64_t start = now_ns();
+    for (int i = 0; i < nthreads; i++) {
+        workers[i].id = i;
+        workers[i].seed = start + (i + 1) * 0x9e3779b97f4a7c15ull;
+        if (pthread_create(&workers[i].thread, NULL, bench_thread, &workers[i]))
+            test_perror("pthread_create");
+    }
+    sleep(seconds);
+    bench_stop = 1;
+    struct bench_result r = {0};
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(workers[i].thread, NULL);
+        for (int t = 0; t < BENCH_OP_TYPES; t++)
+            r.ops[t] += workers[i].ops[t];
+    }
+    r.elapsed = now_ns() - start;
+    free(workers);
+    return r;
+}
+
+/* Calls op(arg) in a loop in the calling thread for the given time; returns the call rate. */
+static inline double bench_loop(void (*op)(void *arg), void *arg, int seconds)
+{
+    uint64_t calls = 0;
+    uint64_t start = now_ns();
+    uint64_t end = start + seconds * 1000000000ull;
+    uint64_t t;
+    do {
+        op(arg);
+        calls++;
+        t = now_ns();
+    } while (t < end);
+    return calls * 1e9 / (t - start);
+}
+
+/* Calls run(nthreads) for 1, 2, 4... threads up to max_threads. */
+static inline void bench_sweep(int max_threads, void (*run)(int nthreads))
+{
+    test_assert(max_threads > 0 && max_threads <= BENCH_MAX_THREADS);
+    for (int nthreads = 1; ; nthreads *= 2) {
+        if (nthreads > max_threads)
+            nthreads = max_threads;
+        run(nthreads);
+        if (nthreads == max_threads)
+            break;
+    }
+}
+
+#endif
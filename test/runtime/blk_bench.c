@@ -0,0 +1,119 @@
+/* Random 4K block I/O benchmark
+
+   A fio-like harness: each thread issues synchronous random 4K reads and
+   writes at block-aligned offsets within a file, opened with O_DIRECT and
+   O_DSYNC so that every operation results in a storage request. The file is
+   written in full beforehand, so that reads are not served from holes. The
+   aggregate rate is reported for 1, 2, 4... threads up to the maximum. Usage:
+
+   blk_bench [max threads] [seconds] [read percentage] [file size in MB]
+*/
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <sys/sysinfo.h>
+
+#include "bench.h"
+
+#define BENCH_FILE          "/blk_bench.tmp"
+#define BLOCK_SIZE          4096
+#define FILL_SIZE           (1024 * 1024)
+#define DEFAULT_SECONDS     2
+#define DEFAULT_READ_PCT    70
+#define DEFAULT_FILE_MB     64
+#define MAX_THREADS         64
+
+enum {
+    OP_READ,
+    OP_WRITE,
+};
+
+static int bench_fd;
+static int read_pct;
+static int seconds;
+static uint64_t file_blocks;
+
+static void io_start(struct bench_worker *w)
+{
+    if (posix_memalign(&w->priv, BLOCK_SIZE, BLOCK_SIZE))
+        test_error("posix_memalign");
+    memset(w->priv, 0x5a, BLOCK_SIZE);
+}
+
+static void io_op(struct bench_worker *w)
+{
+    uint64_t r = xorshift(&w->seed);
+    off_t offset = (r % file_blocks) * BLOCK_SIZE;
+    if ((r >> 32) % 100 < read_pct) {
+        if (pread(bench_fd, w->priv, BLOCK_SIZE, offset) != BLOCK_SIZE)
+            test_perror("pread");
+        w->ops[OP_READ]++;
+    } else {
+        if (pwrite(bench_fd, w->priv, BLOCK_SIZE, offset) != BLOCK_SIZE)
+            test_perror("pwrite");
+        w->ops[OP_WRITE]++;
+    }
+}
+
+static void io_end(struct bench_worker *w)
+{
+    free(w->priv);
+}
+
+static const struct bench io_bench = {
+    .start = io_start,
+    .op = io_op,
+    .end = io_end,
+};
+
+static void fill_file(const char *path, uint64_t size)
+{
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        test_perror("open");
+    char *buf = malloc(FILL_SIZE);
+    test_assert(buf);
+    memset(buf, 0xa5, FILL_SIZE);
+    for (uint64_t offset = 0; offset < size; offset += FILL_SIZE) {
+        if (pwrite(fd, buf, FILL_SIZE, offset) != FILL_SIZE)
+            test_perror("pwrite");
+    }
+    if (fsync(fd) < 0)
+        test_perror("fsync");
+    close(fd);
+    free(buf);
+}
+
+static void run_io(int nthreads)
+{
+    struct bench_result r = bench_run(&io_bench, nthreads, seconds);
+    double reads = bench_rate(&r, OP_READ), writes = bench_rate(&r, OP_WRITE);
+    printf("%3d threads: %.0f IOPS (read %.0f, write %.0f)\n", nthreads, reads + writes, reads,
+           writes);
+}
+
+int main(int argc, char **argv)
+{
+    int ncpus = get_nprocs();
+    int max_threads = argc > 1 ? atoi(argv[1]) : ncpus;
+    seconds = argc > 2 ? atoi(argv[2]) : DEFAULT_SECONDS;
+    read_pct = argc > 3 ? atoi(argv[3]) : DEFAULT_READ_PCT;
+    int file_mb = argc > 4 ? atoi(argv[4]) : DEFAULT_FILE_MB;
+    test_assert(max_threads > 0 && max_threads <= MAX_THREADS);
+    test_assert(seconds > 0);
+    test_assert(read_pct >= 0 && read_pct <= 100);
+    test_assert(file_mb > 0);
+
+    uint64_t file_size = (uint64_t)file_mb * 1024 * 1024;
+    file_blocks = file_size / BLOCK_SIZE;
+    fill_file(BENCH_FILE, file_size);
+    bench_fd = open(BENCH_FILE, O_RDWR | O_DIRECT | O_DSYNC);
+    if (bench_fd < 0)
+        test_perror("open");
+    printf("blk_bench: %d cpus, %d MB file, %d%% reads\n", ncpus, file_mb, read_pct);
+    bench_sweep(max_threads, run_io);
+    close(bench_fd);
+    if (unlink(BENCH_FILE) < 0)
+        test_perror("unlink");
+    printf("blk_bench: done\n");
+    return EXIT_SUCCESS;
+}
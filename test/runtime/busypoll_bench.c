@@ -0,0 +1,152 @@
+/* TCP ping-pong latency benchmark for socket busy polling
+
+   The server echoes fixed-size messages on each accepted connection; the
+   client sends a message, waits for the echo and records the round-trip time.
+   At the start of each connection the client sends the SO_BUSY_POLL value
+   (in microseconds) that the server sets on the connection, so that a single
+   client run measures latency percentiles both without and with busy polling.
+   Run the server in the unikernel and the client on the host, e.g.:
+
+   make run TARGET=busypoll_bench
+   output/test/runtime/bin/busypoll_bench client 127.0.0.1
+
+   Usage:
+   busypoll_bench [server [port]]
+   busypoll_bench client <address> [port] [round trips] [busy poll us] [message size]
+*/
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "bench.h"
+
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL        46
+#endif
+
+#define BENCH_PORT          8080
+#define DEFAULT_ROUND_TRIPS 20000
+#define DEFAULT_BUSY_POLL   50
+#define DEFAULT_MSG_SIZE    64
+#define MAX_MSG_SIZE        4096
+
+static void set_sockopts(int fd, int busy_poll)
+{
+    int val = 1;
+    if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(val)) < 0)
+        test_perror("setsockopt(TCP_NODELAY)");
+
+    /* raising SO_BUSY_POLL may require privileges on the host: not fatal */
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll, sizeof(busy_poll)) < 0)
+        printf("setsockopt(SO_BUSY_POLL, %d) failed: %s\n", busy_poll, strerror(errno));
+}
+
+static void run_server(int port)
+{
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (lfd < 0)
+        test_perror("socket");
+    int val = 1;
+    if (setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val)) < 0)
+        test_perror("setsockopt(SO_REUSEADDR)");
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        test_perror("bind");
+    if (listen(lfd, 1) < 0)
+        test_perror("listen");
+    printf("busypoll_bench: server listening on port %d\n", port);
+    char buf[MAX_MSG_SIZE];
+    while (1) {
+        int fd = accept(lfd, NULL, NULL);
+        if (fd < 0)
+            test_perror("accept");
+        uint32_t hdr[2];    /* busy poll time, message size */
+        if (bench_xfer(fd, hdr, sizeof(hdr), 0) < 0 || hdr[1] == 0 || hdr[1] > MAX_MSG_SIZE) {
+            close(fd);
+            continue;
+        }
+        set_sockopts(fd, hdr[0]);
+        printf("busypoll_bench: connection with busy poll %d us, message size %d\n",
+               hdr[0], hdr[1]);
+        while ((bench_xfer(fd, buf, hdr[1], 0) == 0) && (bench_xfer(fd, buf, hdr[1], 1) == 0));
+        close(fd);
+    }
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void run_client(const char *host, int port, int round_trips, int busy_poll, int msg_size)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+    };
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1)
+        test_error("invalid address %s", host);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        test_perror("socket");
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        test_perror("connect");
+    set_sockopts(fd, busy_poll);
+    uint32_t hdr[2] = { busy_poll, msg_size };
+    if (bench_xfer(fd, hdr, sizeof(hdr), 1) < 0)
+        test_perror("write");
+    uint64_t *rtt = malloc(round_trips * sizeof(*rtt));
+    test_assert(rtt);
+    char buf[MAX_MSG_SIZE];
+    memset(buf, 0xa5, msg_size);
+
+    /* warm-up round trips are not measured */
+    for (int i = -round_trips / 10; i < round_trips; i++) {
+        uint64_t start = now_ns();
+        if (bench_xfer(fd, buf, msg_size, 1) < 0)
+            test_perror("write");
+        if (bench_xfer(fd, buf, msg_size, 0) < 0)
+            test_perror("read");
+        if (i >= 0)
+            rtt[i] = now_ns() - start;
+    }
+    close(fd);
+    qsort(rtt, round_trips, sizeof(*rtt), cmp_u64);
+    printf("busy poll %3d us: p50 %6.1f us, p99 %6.1f us, p99.9 %6.1f us\n", busy_poll,
+           rtt[round_trips / 2] / 1000.0, rtt[round_trips * 99 / 100] / 1000.0,
+           rtt[round_trips * 999 / 1000] / 1000.0);
+    free(rtt);
+}
+
+int main(int argc, char **argv)
+{
+    if ((argc > 1) && !strcmp(argv[1], "client")) {
+        if (argc < 3)
+            test_error("usage: %s client <address> [port] [round trips] [busy poll us] "
+                       "[message size]", argv[0]);
+        int port = argc > 3 ? atoi(argv[3]) : BENCH_PORT;
+        int round_trips = argc > 4 ? atoi(argv[4]) : DEFAULT_ROUND_TRIPS;
+        int busy_poll = argc > 5 ? atoi(argv[5]) : DEFAULT_BUSY_POLL;
+        int msg_size = argc > 6 ? atoi(argv[6]) : DEFAULT_MSG_SIZE;
+        test_assert(round_trips >= 100);
+        test_assert(busy_poll > 0);
+        test_assert(msg_size > 0 && msg_size <= MAX_MSG_SIZE);
+        printf("busypoll_bench: %d round trips, %d-byte messages\n", round_trips, msg_size);
+        run_client(argv[2], port, round_trips, 0, msg_size);
+        run_client(argv[2], port, round_trips, busy_poll, msg_size);
+        printf("busypoll_bench: done\n");
+        return EXIT_SUCCESS;
+    }
+    if ((argc > 1) && strcmp(argv[1], "server"))
+        test_error("invalid mode %s", argv[1]);
+    run_server(argc > 2 ? atoi(argv[2]) : BENCH_PORT);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,111 @@
+/* epoll_wait() scaling benchmark
+
+   Registers increasing numbers of eventfds (level-triggered, EPOLLIN) with an
+   epoll instance, makes a fixed number of them readable, and measures the
+   rate of non-blocking epoll_wait() calls. Each call returns exactly the
+   active fds, so the rate should depend on the number of active fds rather
+   than on the number of registered ones. Usage:
+
+   epoll_bench [max registered fds] [active fds] [seconds]
+*/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+
+#include "bench.h"
+
+#define DEFAULT_MAX_FDS     8192
+#define DEFAULT_ACTIVE      4
+#define DEFAULT_SECONDS     1
+#define MIN_FDS             16
+#define RESERVED_FDS        16
+
+struct waits {
+    int epfd;
+    int active;
+    int stride;
+    struct epoll_event *events;
+};
+
+static void wait_op(void *arg)
+{
+    struct waits *w = arg;
+    int rv = epoll_wait(w->epfd, w->events, w->active, 0);
+    if (rv != w->active)
+        test_error("epoll_wait returned %d (errno %d), expected %d", rv, errno, w->active);
+    for (int j = 0; j < rv; j++)
+        test_assert(w->events[j].data.u32 % w->stride == 0);
+}
+
+static double run_waits(int nfds, int active, int seconds)
+{
+    int *fds = malloc(nfds * sizeof(*fds));
+    struct epoll_event *events = malloc(active * sizeof(*events));
+    test_assert(fds && events);
+    int epfd = epoll_create1(0);
+    if (epfd < 0)
+        test_perror("epoll_create1");
+    for (int i = 0; i < nfds; i++) {
+        fds[i] = eventfd(0, EFD_NONBLOCK);
+        if (fds[i] < 0)
+            test_perror("eventfd");
+        struct epoll_event ev = { .events = EPOLLIN, .data.u32 = i };
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fds[i], &ev) < 0)
+            test_perror("epoll_ctl");
+    }
+
+    /* spread the active fds across the set */
+    int stride = nfds / active;
+    for (int i = 0; i < active; i++) {
+        if (eventfd_write(fds[i * stride], 1) < 0)
+            test_perror("eventfd_write");
+    }
+
+    struct waits w = {
+        .epfd = epfd,
+        .active = active,
+        .stride = stride,
+        .events = events,
+    };
+    double rate = bench_loop(wait_op, &w, seconds);
+
+    for (int i = 0; i < nfds; i++)
+        close(fds[i]);
+    close(epfd);
+    free(events);
+    free(fds);
+    return rate;
+}
+
+int main(int argc, char **argv)
+{
+    int max_fds = argc > 1 ? atoi(argv[1]) : DEFAULT_MAX_FDS;
+    int active = argc > 2 ? atoi(argv[2]) : DEFAULT_ACTIVE;
+    int seconds = argc > 3 ? atoi(argv[3]) : DEFAULT_SECONDS;
+    test_assert(max_fds >= MIN_FDS);
+    test_assert(active > 0 && active <= MIN_FDS);
+    test_assert(seconds > 0);
+
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0)
+        test_perror("getrlimit");
+    if (rl.rlim_cur != RLIM_INFINITY && max_fds > rl.rlim_cur - RESERVED_FDS)
+        max_fds = rl.rlim_cur - RESERVED_FDS;
+    printf("epoll_bench: %d active fds, up to %d registered\n", active, max_fds);
+
+    double base = 0;
+    for (int nfds = MIN_FDS; ; nfds *= 4) {
+        if (nfds > max_fds)
+            nfds = max_fds;
+        double rate = run_waits(nfds, active, seconds);
+        if (!base)
+            base = rate;
+        printf("%6d fds: %.0f waits/s, %.2fx\n", nfds, rate, rate / base);
+        if (nfds == max_fds)
+            break;
+    }
+    printf("epoll_bench: done\n");
+    return EXIT_SUCCESS;
+}
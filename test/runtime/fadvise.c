@@ -1,4 +1,6 @@
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
@@ -16,6 +18,69 @@ void test_fadvise(int fd, int64_t off, uint64_t len, int adv, int exp, char *nam
     }
 }
 
+/* Returns the value of a /proc/vmstat counter, or -1 if not available. */
+static long long vmstat_get(const char *name)
+{
+    char buf[1024];
+    int fd = open("/proc/vmstat", O_RDONLY);
+    if (fd < 0)
+        return -1;
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0)
+        return -1;
+    buf[n] = '\0';
+    size_t len = strlen(name);
+    for (char *p = buf; p && *p; p = strchr(p, '\n'), p = p ? p + 1 : 0) {
+        if (!strncmp(p, name, len) && p[len] == ' ')
+            return strtoll(p + len + 1, 0, 10);
+    }
+    return -1;
+}
+
+#define RA_FILE_SIZE    (1024 * 1024)
+#define RA_READ_SIZE    4096
+
+static void test_readahead(void)
+{
+    static char buf[RA_READ_SIZE];
+    int fd = open("test_readahead", O_CREAT | O_RDWR, 0644);
+    if (fd < 0)
+        test_perror("open");
+    for (int i = 0; i < RA_FILE_SIZE / RA_READ_SIZE; i++) {
+        memset(buf, i, sizeof(buf));
+        if (write(fd, buf, sizeof(buf)) != sizeof(buf))
+            test_perror("write");
+    }
+
+    long long hits = vmstat_get("readahead_hit_bytes");
+    for (off_t off = 0; off < RA_FILE_SIZE; off += RA_READ_SIZE) {
+        if (pread(fd, buf, sizeof(buf), off) != sizeof(buf))
+            test_perror("sequential pread");
+        if (buf[0] != (char)(off / RA_READ_SIZE))
+            test_error("unexpected data at offset %ld", off);
+    }
+    if (hits >= 0) {
+        long long delta = vmstat_get("readahead_hit_bytes") - hits;
+        /* all but the first read fall in a readahead window */
+        if (delta < RA_FILE_SIZE - RA_READ_SIZE)
+            test_error("sequential readahead hits %lld", delta);
+    }
+
+    test_fadvise(fd, 0, 0, POSIX_FADV_RANDOM, 0, "set random");
+    long long issued = vmstat_get("readahead_issued_bytes");
+    for (int i = 0; i < 64; i++) {
+        off_t off = (off_t)(i * 37 % (RA_FILE_SIZE / RA_READ_SIZE)) * RA_READ_SIZE;
+        if (pread(fd, buf, sizeof(buf), off) != sizeof(buf))
+            test_perror("random pread");
+    }
+    if (issued >= 0 && vmstat_get("readahead_issued_bytes") != issued)
+        test_error("readahead issued with POSIX_FADV_RANDOM");
+    close(fd);
+    if (unlink("test_readahead") < 0)
+        test_perror("unlink");
+}
+
 int main(int argc, char **argv)
 {
     int fd = open("test_fadvise", O_CREAT|O_RDWR, 0644);
@@ -31,6 +96,7 @@ int main(int argc, char **argv)
     test_fadvise(fd, 0, 128, 9999, EINVAL, "use bad advice");
     close(fd);
     test_fadvise(fd, 0, 128, 9999, EBADF, "use bad fd");
+    test_readahead();
     printf("fadvise test passed\n");
     exit(EXIT_SUCCESS);
 }
@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/stat.h>
 #include <sys/vfs.h>
 #include <assert.h>
 #include <errno.h>
@@ -11,6 +12,8 @@
 
 #define BIGDATA "bigfile"
 #define NEWFILE "newfile"
+#define FRAGDIR "fragdir"
+#define FRAG_FILE_SIZE (64 * 1024)
 #define SECTOR_SIZE 512
 #define NUM_WRITE_RETRIES 2
 /* this could be up to log ext size */
@@ -84,6 +87,47 @@ out:
     return b;
 }
 
+/* Fills the free space with small files, then deletes every other file, so that the free space
+   is split into small extents; returns the number of files created. */
+int fragment_free_space(int bs)
+{
+    char path[32];
+    int nb = FRAG_FILE_SIZE / bs;
+    int n;
+
+    assert(mkdir(FRAGDIR, 0755) == 0);
+    for (n = 0; ; n++) {
+        snprintf(path, sizeof(path), FRAGDIR "/%d", n);
+        int fd = open(path, O_CREAT|O_RDWR, 0644);
+        if (fd < 0) {
+            assert(errno == ENOSPC);
+            break;
+        }
+        int written = write_blocks(fd, nb, bs);
+        close(fd);
+        assert(written >= 0);
+        if (written < nb) {
+            n++;
+            break;
+        }
+    }
+    for (int i = 0; i < n; i += 2) {
+        snprintf(path, sizeof(path), FRAGDIR "/%d", i);
+        assert(unlink(path) == 0);
+    }
+    return n;
+}
+
+void remove_fragments(int n)
+{
+    char path[32];
+    for (int i = 1; i < n; i += 2) {
+        snprintf(path, sizeof(path), FRAGDIR "/%d", i);
+        assert(unlink(path) == 0);
+    }
+    assert(rmdir(FRAGDIR) == 0);
+}
+
 int main(int argc, char **argv)
 {
     struct statfs statbuf;
@@ -142,6 +186,33 @@ int main(int argc, char **argv)
     close(fd);
     assert(remove(NEWFILE) == 0);
     assert(open(BIGDATA, O_RDWR) < 0);
+
+    /* check that the holes left in fragmented free space can be filled */
+    int nfrag = fragment_free_space(BLOCKSIZE);
+    sync();
+    usleep(1000*1000);
+    assert(statfs(argv[0], &statbuf) == 0);
+    int64_t frag_bfree = statbuf.f_bfree;
+    printf("after fragmenting free space with %d files: free bytes: %lu\n", nfrag, frag_bfree * statbuf.f_bsize);
+    assert(nfrag >= 2);
+    assert(frag_bfree >= (nfrag / 2) * (FRAG_FILE_SIZE / BLOCKSIZE));
+    fd = open(NEWFILE, O_CREAT|O_RDWR, 0644);
+    assert(fd >= 0);
+    int64_t frag_bwritten = write_blocks(fd, frag_bfree, BLOCKSIZE);
+    printf("wrote %ld blocks to fragmented free space\n", frag_bwritten);
+    assert(frag_bwritten >= frag_bfree - 2 * MAX_FREE_BYTES/BLOCKSIZE);
+    assert(lseek(fd, 0, SEEK_SET) == 0);
+    assert(check_blocks(fd, frag_bwritten, BLOCKSIZE) == frag_bwritten);
+    close(fd);
+
+    /* remove all files and verify that the freed extents are available again */
+    assert(remove(NEWFILE) == 0);
+    remove_fragments(nfrag);
+    sync();
+    usleep(1000*1000);
+    assert(statfs(argv[0], &statbuf) == 0);
+    printf("after delete fragmented files: free bytes: %lu\n", statbuf.f_bfree * statbuf.f_bsize);
+    assert((bfree - statbuf.f_bfree) < bfree/10);
     printf("filesystem full test successful\n");
     return 0;
 }
@@ -0,0 +1,134 @@
+/* Concurrent fsync benchmark
+
+   Each thread repeatedly writes a block to its own file and syncs it, either
+   appending to the file (so that each sync needs a metadata log write) or
+   overwriting a block that has already been written (so that fdatasync only
+   needs the file data to reach storage). The aggregate sync rate is reported
+   for 1, 2, 4... threads up to the maximum, together with the average number
+   of syncs served by each filesystem log write, as read from /proc/vmstat, so
+   that batching of concurrent syncs into shared log writes shows up. Usage:
+
+   fsync_bench [max threads] [seconds]
+*/
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sysinfo.h>
+
+#include "bench.h"
+
+#define BENCH_DIR           "/fsync_bench"
+#define BLOCK_SIZE          4096
+#define DEFAULT_SECONDS     2
+#define MAX_THREADS         64
+#define OVERWRITE_BLOCKS    16
+
+static int seconds;
+static int fds[MAX_THREADS];
+static char buf[BLOCK_SIZE];
+
+static void append_fsync(struct bench_worker *w)
+{
+    if (write(fds[w->id], buf, sizeof(buf)) != sizeof(buf))
+        test_perror("write");
+    if (fsync(fds[w->id]) < 0)
+        test_perror("fsync");
+    w->ops[0]++;
+}
+
+static void overwrite_fdatasync(struct bench_worker *w)
+{
+    off_t offset = (w->ops[0] % OVERWRITE_BLOCKS) * BLOCK_SIZE;
+    if (pwrite(fds[w->id], buf, sizeof(buf), offset) != sizeof(buf))
+        test_perror("pwrite");
+    if (fdatasync(fds[w->id]) < 0)
+        test_perror("fdatasync");
+    w->ops[0]++;
+}
+
+static const struct bench append_bench = {
+    .op = append_fsync,
+};
+
+static const struct bench overwrite_bench = {
+    .op = overwrite_fdatasync,
+};
+
+static void open_files(int nthreads, int overwrite)
+{
+    char path[64];
+    char zero[BLOCK_SIZE];
+    memset(zero, 0, sizeof(zero));
+    for (int i = 0; i < nthreads; i++) {
+        snprintf(path, sizeof(path), BENCH_DIR "/f%d", i);
+        int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            test_perror("open %s", path);
+        if (overwrite) {
+            /* allocate and initialize the blocks that are going to be overwritten */
+            for (int b = 0; b < OVERWRITE_BLOCKS; b++)
+                if (write(fd, zero, sizeof(zero)) != sizeof(zero))
+                    test_perror("write");
+            if (fsync(fd) < 0)
+                test_perror("fsync");
+        }
+        fds[i] = fd;
+    }
+}
+
+static void close_files(int nthreads)
+{
+    char path[64];
+    for (int i = 0; i < nthreads; i++) {
+        close(fds[i]);
+        snprintf(path, sizeof(path), BENCH_DIR "/f%d", i);
+        if (unlink(path) < 0)
+            test_perror("unlink %s", path);
+    }
+}
+
+static void run_op(int nthreads, int overwrite)
+{
+    open_files(nthreads, overwrite);
+    int64_t log_writes = bench_read_stat("/proc/vmstat", "tfs_log_writes");
+    int64_t log_syncs = bench_read_stat("/proc/vmstat", "tfs_log_syncs");
+    struct bench_result r = bench_run(overwrite ? &overwrite_bench : &append_bench, nthreads,
+                                      seconds);
+    printf("%3d threads, %-21s %9.0f syncs/s", nthreads,
+           overwrite ? "overwrite+fdatasync:" : "append+fsync:", bench_rate(&r, 0));
+    if (log_writes >= 0) {
+        log_writes = bench_read_stat("/proc/vmstat", "tfs_log_writes") - log_writes;
+        log_syncs = bench_read_stat("/proc/vmstat", "tfs_log_syncs") - log_syncs;
+        printf(", %lld log writes, %.2f syncs per log write", (long long)log_writes,
+               log_writes ? (double)log_syncs / log_writes : 0.0);
+    }
+    printf("\n");
+    close_files(nthreads);
+}
+
+static void run_ops(int nthreads)
+{
+    run_op(nthreads, 0);
+    run_op(nthreads, 1);
+}
+
+int main(int argc, char **argv)
+{
+    int ncpus = get_nprocs();
+    int max_threads = argc > 1 ? atoi(argv[1]) : 4 * ncpus;
+    if (argc <= 1 && max_threads > MAX_THREADS)
+        max_threads = MAX_THREADS;
+    seconds = argc > 2 ? atoi(argv[2]) : DEFAULT_SECONDS;
+    test_assert(max_threads > 0 && max_threads <= MAX_THREADS);
+    test_assert(seconds > 0);
+
+    memset(buf, 0x5a, sizeof(buf));
+    if (mkdir(BENCH_DIR, 0755) < 0)
+        test_perror("mkdir");
+    printf("fsync_bench: %d cpus\n", ncpus);
+    bench_sweep(max_threads, run_ops);
+    if (rmdir(BENCH_DIR) < 0)
+        test_perror("rmdir");
+    printf("fsync_bench: done\n");
+    return EXIT_SUCCESS;
+}
@@ -21,6 +21,7 @@ int wake_test_futex = FUTEX_INITIALIZER;
 int empty_futex = FUTEX_INITIALIZER;
 int wait_test_futex = FUTEX_INITIALIZER;
 int wait_bitset_test_futex = FUTEX_INITIALIZER;
+int wake_bitset_test_futex = FUTEX_INITIALIZER;
 int cmp_requeue_test_futex_1 = FUTEX_INITIALIZER;
 int cmp_requeue_test_futex_2 = FUTEX_INITIALIZER;
 int wake_op_test_futex_1 = FUTEX_INITIALIZER;
@@ -30,6 +31,7 @@ int wake_op_test_futex_2 = FUTEX_INITIALIZER;
 static void *futex_wake_test_thread(void *arg);
 static void *futex_cmp_requeue_test_thread(void *arg);
 static void *futex_wake_op_test_thread(void *arg);
+static void *futex_wake_bitset_test_thread(void *arg);
 
 /* FUTEX_WAKE test: Creates num_to_wake threads which wait
 on uaddr and then wakes up all the threads */
@@ -164,6 +166,56 @@ static boolean futex_wait_bitset_test_2()
     return false;
 }
 
+/* FUTEX_WAKE_BITSET test: Creates a group of threads waiting
+on uaddr with FUTEX_WAIT_BITSET and wakes them with FUTEX_WAKE_BITSET.
+A zero bitset is invalid for both operations. */
+static boolean futex_wake_bitset_test()
+{
+    int *uaddr = (int*)(&wake_bitset_test_futex);
+    int num_threads = 10;
+    pthread_t threads[num_threads];
+
+    if ((syscall(SYS_futex, uaddr, FUTEX_WAIT_BITSET, FUTEX_INITIALIZER, 0, NULL, 0) != -1) ||
+        (errno != EINVAL) ||
+        (syscall(SYS_futex, uaddr, FUTEX_WAKE_BITSET, 1, 0, NULL, 0) != -1) ||
+        (errno != EINVAL)) {
+        printf("wake_bitset test: zero bitset not rejected\n");
+        return false;
+    }
+    for (int index = 0; index < num_threads; index++) {
+        if (pthread_create(&(threads[index]), NULL, futex_wake_bitset_test_thread, (void*)(uaddr))) {
+            printf("Unable to create thread. wake_bitset test failed.\n");
+            return false;
+        }
+    }
+    sleep(1); /* for main thread */
+    int woken = syscall(SYS_futex, uaddr, FUTEX_WAKE_BITSET, INT_MAX, 0, NULL, 0xffffffff);
+    for (int i = 0; i < num_threads; i++) {
+        if (pthread_join(threads[i], NULL) != 0) {
+            printf("Unable to join thread. wake_bitset test: failed.\n");
+            return false;
+        }
+    }
+    if (woken != num_threads) {
+        printf("wake_bitset test: woke %d threads, expected %d\n", woken, num_threads);
+        return false;
+    }
+
+    /* the futex has no waiters left: waking must not find any */
+    if (syscall(SYS_futex, uaddr, FUTEX_WAKE, INT_MAX, 0, NULL, 0) != 0) {
+        printf("wake_bitset test: unexpected waiters after wakeup\n");
+        return false;
+    }
+    printf("wake_bitset test: passed\n");
+    return true;
+}
+
+static void *futex_wake_bitset_test_thread(void *arg)
+{
+    syscall(SYS_futex, (int*)(arg), FUTEX_WAIT_BITSET, FUTEX_INITIALIZER, 0, NULL, 0x1);
+    return NULL;
+}
+
 /* FUTEX_CMP_REQUEUE test 1: Check for error -1 because
 the value at uaddr does not match val3 */
 static boolean futex_cmp_requeue_test_1() 
@@ -405,6 +457,8 @@ boolean basic_test()
         num_failed++; 
     if (!futex_wait_bitset_test_2())
         num_failed++;
+    if (!futex_wake_bitset_test())
+        num_failed++;
 
     /* Cmp_Requeue Tests */
     printf("---FUTEX_CMP_REQUEUE TESTS--- \n");
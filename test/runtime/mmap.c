@@ -1305,6 +1305,61 @@ void multithread_filebacked_test(heap h, int n_threads)
     close(mt.fd);
 }
 
+#define MT_FAULT_PAGES  256
+
+struct mt_fault_arg {
+    unsigned char *base;
+    int n;
+};
+
+static void *mt_fault_worker(void *z)
+{
+    struct mt_fault_arg *a = z;
+    unsigned char *p = a->base + a->n * MT_FAULT_PAGES * PAGESIZE;
+    for (int i = 0; i < MT_FAULT_PAGES; i++)
+        p[i * PAGESIZE] = a->n + i;
+    for (int i = 0; i < MT_FAULT_PAGES; i++) {
+        if (p[i * PAGESIZE] != (unsigned char)(a->n + i))
+            test_error("thread %d: page %d data mismatch", a->n, i);
+    }
+    return NULL;
+}
+
+/* Threads fault in disjoint parts of a mapping while the memory map is being
+   modified elsewhere, exercising lookups that race with vmap updates. */
+static void multithread_anon_fault_test(int n_threads)
+{
+    printf("** starting multithread anonymous fault test\n");
+    unsigned long len = n_threads * MT_FAULT_PAGES * PAGESIZE;
+    unsigned char *base = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                               -1, 0);
+    if (base == MAP_FAILED)
+        test_perror("mmap");
+    pthread_t threads[n_threads];
+    struct mt_fault_arg args[n_threads];
+    for (int i = 0; i < n_threads; i++) {
+        args[i].base = base;
+        args[i].n = i;
+        if (pthread_create(&threads[i], NULL, mt_fault_worker, &args[i]))
+            test_error("pthread_create");
+    }
+    for (int i = 0; i < 64; i++) {
+        void *q = mmap(NULL, 4 * PAGESIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (q == MAP_FAILED)
+            test_perror("churn mmap");
+        if (mprotect(q + PAGESIZE, PAGESIZE, PROT_READ))
+            test_perror("churn mprotect");
+        __munmap(q, 4 * PAGESIZE);
+    }
+    for (int i = 0; i < n_threads; i++) {
+        if (pthread_join(threads[i], NULL) != 0)
+            test_error("pthread_join");
+    }
+    __munmap(base, len);
+    printf("** multithread anonymous fault test passed\n");
+}
+
 static volatile int expect_sigbus = 0;
 static sigjmp_buf sjb;
 
@@ -1322,6 +1377,128 @@ static void handle_sigbus(int sig, siginfo_t *si, void *ucontext)
 }
 
 #define MAP_SIZE 4096
+#define HUGEPAGE_SIZE  (2 * 1024 * 1024)
+
+static void madvise_test(void)
+{
+    printf("** starting madvise tests\n");
+    unsigned long maplen = 4 * HUGEPAGE_SIZE;
+    void *map = mmap(NULL, maplen, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED)
+        test_perror("mmap");
+    unsigned char *p = (unsigned char *)(((unsigned long)map + HUGEPAGE_SIZE - 1) &
+                                         ~(HUGEPAGE_SIZE - 1));
+    unsigned long len = 2 * HUGEPAGE_SIZE;
+    if (madvise(p, len, MADV_HUGEPAGE) < 0)
+        test_perror("madvise(MADV_HUGEPAGE)");
+    memset(p, 0xa5, len);
+
+    /* dropping a page in the middle of a huge page must not affect its neighbors */
+    unsigned char *q = p + HUGEPAGE_SIZE / 2;
+    if (madvise(q, PAGESIZE, MADV_DONTNEED) < 0)
+        test_perror("madvise(MADV_DONTNEED)");
+    if (memcmp(q, zero_data, PAGESIZE))
+        test_error("page not zeroed after MADV_DONTNEED");
+    if ((q[-1] != 0xa5) || (q[PAGESIZE] != 0xa5))
+        test_error("MADV_DONTNEED dropped adjacent pages");
+
+    /* protection change within a huge page */
+    q = p + HUGEPAGE_SIZE + HUGEPAGE_SIZE / 2;
+    if (mprotect(q, PAGESIZE, PROT_READ) < 0)
+        test_perror("mprotect");
+    if (q[0] != 0xa5)
+        test_error("page content changed after mprotect");
+    q[-1] = 0x5a;
+    q[PAGESIZE] = 0x5a;
+    if (mprotect(q, PAGESIZE, PROT_READ | PROT_WRITE) < 0)
+        test_perror("mprotect 2");
+
+    /* partial unmap of a huge page */
+    if (munmap(p + PAGESIZE, PAGESIZE) < 0)
+        test_perror("munmap");
+    if ((p[0] != 0xa5) || (p[2 * PAGESIZE] != 0xa5))
+        test_error("munmap of a page affected adjacent pages");
+
+    if (madvise(p + 1, PAGESIZE, MADV_DONTNEED) == 0 || errno != EINVAL)
+        test_error("madvise with unaligned address should have failed with EINVAL");
+    if (madvise(p, PAGESIZE, 1000) == 0 || errno != EINVAL)
+        test_error("madvise with invalid advice should have failed with EINVAL");
+    if (madvise(p, 2 * PAGESIZE, MADV_NOHUGEPAGE) == 0 || errno != ENOMEM)
+        test_error("madvise on unmapped range should have failed with ENOMEM");
+    if (madvise(p + 2 * PAGESIZE, PAGESIZE, MADV_NOHUGEPAGE) < 0)
+        test_perror("madvise(MADV_NOHUGEPAGE)");
+    if (madvise(p + 2 * PAGESIZE, PAGESIZE, MADV_FREE) < 0)
+        test_perror("madvise(MADV_FREE)");
+    if (munmap(map, maplen) < 0)
+        test_perror("munmap 2");
+    printf("** madvise tests passed\n");
+}
+
+/* Writes through a shared file mapping must still reach the file after MADV_DONTNEED. */
+static void madvise_shared_file_test(void)
+{
+    printf("** starting madvise shared file mapping test\n");
+    const int npages = 4;
+    int fd = open("madvise_file", O_CREAT | O_RDWR | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd < 0)
+        test_perror("open");
+    if (ftruncate(fd, npages * PAGESIZE) < 0)
+        test_perror("ftruncate");
+    unsigned char *p = mmap(NULL, npages * PAGESIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+        test_perror("mmap");
+    memset(p, 0x11, npages * PAGESIZE);
+
+    /* dirty pages being dropped must not lose their contents */
+    if (madvise(p + PAGESIZE, 2 * PAGESIZE, MADV_DONTNEED) < 0)
+        test_perror("madvise(MADV_DONTNEED)");
+    for (int i = 0; i < npages * PAGESIZE; i++)
+        if (p[i] != 0x11)
+            test_error("shared mapping content lost after MADV_DONTNEED (offset %d)", i);
+
+    /* writes after MADV_DONTNEED must still be tracked as dirty */
+    memset(p + PAGESIZE, 0x22, PAGESIZE);
+    memset(p + 3 * PAGESIZE, 0x33, PAGESIZE);
+    if (madvise(p, npages * PAGESIZE, MADV_DONTNEED) < 0)
+        test_perror("madvise(MADV_DONTNEED) 2");
+    p[2 * PAGESIZE] = 0x44;
+    if (msync(p, npages * PAGESIZE, MS_SYNC) < 0)
+        test_perror("msync");
+    unsigned char buf[PAGESIZE];
+    const unsigned char expected[] = { 0x11, 0x22, 0x44, 0x33 };
+    for (int i = 0; i < npages; i++) {
+        if (pread(fd, buf, PAGESIZE, i * PAGESIZE) != PAGESIZE)
+            test_perror("pread");
+        if ((buf[0] != expected[i]) || (buf[PAGESIZE - 1] != ((i == 2) ? 0x11 : expected[i])))
+            test_error("file page %d: unexpected contents 0x%x 0x%x after msync", i, buf[0],
+                       buf[PAGESIZE - 1]);
+    }
+
+    /* MADV_FREE only applies to private anonymous memory */
+    if (madvise(p, PAGESIZE, MADV_FREE) == 0 || errno != EINVAL)
+        test_error("MADV_FREE on a shared file mapping should have failed with EINVAL");
+    if (munmap(p, npages * PAGESIZE) < 0)
+        test_perror("munmap");
+    p = mmap(NULL, PAGESIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED)
+        test_perror("mmap private");
+    if (madvise(p, PAGESIZE, MADV_FREE) == 0 || errno != EINVAL)
+        test_error("MADV_FREE on a private file mapping should have failed with EINVAL");
+    if (munmap(p, PAGESIZE) < 0)
+        test_perror("munmap private");
+    p = mmap(NULL, PAGESIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        test_perror("mmap shared anonymous");
+    if (madvise(p, PAGESIZE, MADV_FREE) == 0 || errno != EINVAL)
+        test_error("MADV_FREE on a shared anonymous mapping should have failed with EINVAL");
+    if (munmap(p, PAGESIZE) < 0)
+        test_perror("munmap shared anonymous");
+    close(fd);
+    if (unlink("madvise_file") < 0)
+        test_perror("unlink");
+    printf("** madvise shared file mapping test passed\n");
+}
+
 static void check_fault_in_user_memory(void)
 {
     printf("** check MAP_POPULATE\n");
@@ -1445,8 +1622,11 @@ int main(int argc, char * argv[])
     mincore_test();
     mremap_test();
     mprotect_test();
+    madvise_test();
+    madvise_shared_file_test();
     filebacked_test(h);
     multithread_filebacked_test(h, MT_N_THREADS);
+    multithread_anon_fault_test(MT_N_THREADS);
     filebacked_sigbus_test();
     check_fault_in_user_memory();
 
@@ -0,0 +1,110 @@
+/* Page cache read benchmark
+
+   Creates a file, reads it once to bring it into the page cache, then has
+   increasing numbers of threads (1, 2, 4, ... up to the maximum) issue
+   pread() calls at random block-aligned offsets of the file. All reads are
+   cache hits, so the throughput reported for each thread count shows how
+   cached reads scale across cpus. Usage:
+
+   pagecache_bench [max threads] [file size in MB] [read size] [seconds]
+*/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/sysinfo.h>
+
+#include "bench.h"
+
+#define BENCH_FILE          "pagecache_bench.dat"
+#define DEFAULT_FILE_MB     16
+#define DEFAULT_READ_SIZE   4096
+#define DEFAULT_SECONDS     2
+#define MAX_THREADS         256
+
+static int fd;
+static int seconds;
+static size_t file_size;
+static size_t read_size;
+static double base_rate;
+
+static void read_start(struct bench_worker *w)
+{
+    w->priv = malloc(read_size);
+    test_assert(w->priv);
+}
+
+static void read_op(struct bench_worker *w)
+{
+    off_t offset = (off_t)(xorshift(&w->seed) % (file_size / read_size)) * read_size;
+    ssize_t rv = pread(fd, w->priv, read_size, offset);
+    if (rv != read_size)
+        test_error("pread returned %ld (errno %d)", rv, errno);
+    w->ops[0]++;
+}
+
+static void read_end(struct bench_worker *w)
+{
+    free(w->priv);
+}
+
+static const struct bench read_bench = {
+    .start = read_start,
+    .op = read_op,
+    .end = read_end,
+};
+
+static void run_readers(int nthreads)
+{
+    struct bench_result r = bench_run(&read_bench, nthreads, seconds);
+    double rate = bench_rate(&r, 0);
+    if (!base_rate)
+        base_rate = rate;
+    printf("%3d threads: %.0f reads/s, %.1f MB/s, %.2fx\n", nthreads, rate,
+           rate * read_size / (1024 * 1024), rate / base_rate);
+}
+
+static void create_file(void)
+{
+    fd = open(BENCH_FILE, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        test_perror("open");
+    char *buf = malloc(read_size);
+    test_assert(buf);
+    for (size_t offset = 0; offset < file_size; offset += read_size) {
+        memset(buf, offset / read_size, read_size);
+        if (write(fd, buf, read_size) != read_size)
+            test_perror("write");
+    }
+    if (fsync(fd) < 0)
+        test_perror("fsync");
+
+    /* populate the page cache */
+    for (size_t offset = 0; offset < file_size; offset += read_size) {
+        if (pread(fd, buf, read_size, offset) != read_size)
+            test_perror("pread");
+        test_assert(buf[0] == (char)(offset / read_size));
+    }
+    free(buf);
+}
+
+int main(int argc, char **argv)
+{
+    int ncpus = get_nprocs();
+    int max_threads = argc > 1 ? atoi(argv[1]) : ncpus;
+    int file_mb = argc > 2 ? atoi(argv[2]) : DEFAULT_FILE_MB;
+    read_size = argc > 3 ? atoi(argv[3]) : DEFAULT_READ_SIZE;
+    seconds = argc > 4 ? atoi(argv[4]) : DEFAULT_SECONDS;
+    test_assert(max_threads > 0 && max_threads <= MAX_THREADS);
+    test_assert(file_mb > 0);
+    test_assert(read_size > 0 && read_size <= file_mb * 1024 * 1024);
+    test_assert(seconds > 0);
+    file_size = (size_t)file_mb * 1024 * 1024 / read_size * read_size;
+    printf("pagecache_bench: %d cpus, %d MB file, %ld byte reads\n", ncpus, file_mb, read_size);
+    create_file();
+    bench_sweep(max_threads, run_readers);
+    close(fd);
+    if (unlink(BENCH_FILE) < 0)
+        test_perror("unlink");
+    printf("pagecache_bench: done\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,161 @@
+/* TCP accept rate benchmark
+
+   Runs N worker threads accepting connections on a loopback port, while the
+   same number of client threads connect and reset connections as fast as
+   possible. In "shared" mode all workers accept on a single listening
+   socket; in "reuseport" mode each worker has its own listening socket in a
+   SO_REUSEPORT group. Usage:
+
+   reuseport_bench [max threads] [seconds]
+*/
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/sysinfo.h>
+
+#include "bench.h"
+
+#define BENCH_PORT          9090
+#define DEFAULT_SECONDS     2
+#define MAX_THREADS         64
+
+static volatile int stop;
+static int seconds;
+static int shared_fd;
+static int acceptors_done;
+
+static int listen_socket(int reuseport)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        test_perror("socket");
+    int one = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0)
+        test_perror("setsockopt(SO_REUSEADDR)");
+    if (reuseport) {
+        if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0)
+            test_perror("setsockopt(SO_REUSEPORT)");
+        int val;
+        socklen_t len = sizeof(val);
+        if (getsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &val, &len) < 0)
+            test_perror("getsockopt(SO_REUSEPORT)");
+        test_assert(val == 1);
+    }
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(BENCH_PORT),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        test_perror("bind");
+    if (listen(fd, 128) < 0)
+        test_perror("listen");
+    return fd;
+}
+
+struct worker {
+    int fd;
+    uint64_t count;
+    pthread_t thread;
+} __attribute__((aligned(64)));
+
+static void *acceptor(void *arg)
+{
+    struct worker *w = arg;
+    while (!stop) {
+        int fd = accept(w->fd, NULL, NULL);
+        if (fd < 0)
+            test_perror("accept");
+        close(fd);
+        w->count++;
+    }
+    __atomic_fetch_add(&acceptors_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static int connect_once(void)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(BENCH_PORT),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    /* reset connections on close to avoid exhausting ports in TIME_WAIT */
+    struct linger lin = { .l_onoff = 1, .l_linger = 0 };
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        test_perror("socket");
+    if (setsockopt(fd, SOL_SOCKET, SO_LINGER, &lin, sizeof(lin)) < 0)
+        test_perror("setsockopt(SO_LINGER)");
+    int rv = connect(fd, (struct sockaddr *)&addr, sizeof(addr));
+    close(fd);
+    return rv;
+}
+
+static void connect_op(struct bench_worker *w)
+{
+    if (connect_once() == 0)
+        w->ops[0]++;
+}
+
+static const struct bench connect_bench = {
+    .op = connect_op,
+};
+
+/* The acceptors run for the duration of the connect benchmark; they are not run with bench_run()
+ * because they have to be woken up from accept() at the end. */
+static double run_accepts(int nthreads, int reuseport)
+{
+    struct worker *acceptors = aligned_alloc(64, nthreads * sizeof(*acceptors));
+    test_assert(acceptors);
+    memset(acceptors, 0, nthreads * sizeof(*acceptors));
+    if (!reuseport)
+        shared_fd = listen_socket(0);
+    stop = 0;
+    acceptors_done = 0;
+    for (int i = 0; i < nthreads; i++) {
+        acceptors[i].fd = reuseport ? listen_socket(1) : shared_fd;
+        if (pthread_create(&acceptors[i].thread, NULL, acceptor, &acceptors[i]))
+            test_perror("pthread_create");
+    }
+    struct bench_result r = bench_run(&connect_bench, nthreads, seconds);
+    stop = 1;
+
+    /* wake up acceptors still blocked in accept() */
+    while (__atomic_load_n(&acceptors_done, __ATOMIC_ACQUIRE) < nthreads)
+        connect_once();
+    uint64_t accepts = 0;
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(acceptors[i].thread, NULL);
+        accepts += acceptors[i].count;
+        if (reuseport)
+            close(acceptors[i].fd);
+    }
+    if (!reuseport)
+        close(shared_fd);
+    free(acceptors);
+    return accepts * 1e9 / r.elapsed;
+}
+
+static void run_modes(int nthreads)
+{
+    double shared = run_accepts(nthreads, 0);
+    double reuseport = run_accepts(nthreads, 1);
+    printf("%3d threads: shared %.0f accepts/s, reuseport %.0f accepts/s, %.2fx\n",
+           nthreads, shared, reuseport, reuseport / shared);
+}
+
+int main(int argc, char **argv)
+{
+    int ncpus = get_nprocs();
+    int max_threads = argc > 1 ? atoi(argv[1]) : ncpus;
+    seconds = argc > 2 ? atoi(argv[2]) : DEFAULT_SECONDS;
+    test_assert(max_threads > 0 && max_threads <= MAX_THREADS);
+    test_assert(seconds > 0);
+    printf("reuseport_bench: %d cpus\n", ncpus);
+    bench_sweep(max_threads, run_modes);
+    printf("reuseport_bench: done\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,223 @@
+/* Scheduler benchmark
+
+   pingpong: pairs of threads bounce a token through a futex word; each
+             handoff requires a wakeup of the peer thread.
+   fanout:   one producer thread wakes a set of worker threads, each blocked
+             on its own futex, and waits for all of them to check in.
+
+   Reports throughput and average/maximum wakeup latency (time from the
+   FUTEX_WAKE call to the woken thread running). Usage:
+
+   sched_bench [pairs] [fanout workers] [seconds]
+*/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <sys/sysinfo.h>
+
+#include "bench.h"
+
+#define DEFAULT_SECONDS 2
+
+static volatile int stop;
+
+static void futex_wait(int *uaddr, int val)
+{
+    if (syscall(SYS_futex, uaddr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0) < 0 &&
+        errno != EAGAIN && errno != EINTR)
+        test_perror("futex wait");
+}
+
+static void futex_wake(int *uaddr, int n)
+{
+    if (syscall(SYS_futex, uaddr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0) < 0)
+        test_perror("futex wake");
+}
+
+struct latency {
+    uint64_t total;
+    uint64_t max;
+    uint64_t count;
+};
+
+static void latency_add(struct latency *l, uint64_t wake_ts)
+{
+    uint64_t d = now_ns() - wake_ts;
+    l->total += d;
+    if (d > l->max)
+        l->max = d;
+    l->count++;
+}
+
+static void latency_merge(struct latency *dst, struct latency *src)
+{
+    dst->total += src->total;
+    if (src->max > dst->max)
+        dst->max = src->max;
+    dst->count += src->count;
+}
+
+/* pingpong */
+
+struct pp_pair {
+    int turn;                   /* 0: ping's turn, 1: pong's turn */
+    volatile uint64_t wake_ts;
+    uint64_t handoffs;
+    struct latency lat[2];
+} __attribute__((aligned(64)));
+
+struct pp_arg {
+    struct pp_pair *pair;
+    int side;
+};
+
+static void *pp_thread(void *arg)
+{
+    struct pp_arg *a = arg;
+    struct pp_pair *p = a->pair;
+    int side = a->side;
+    while (!stop) {
+        while (__atomic_load_n(&p->turn, __ATOMIC_ACQUIRE) != side) {
+            if (stop)
+                goto out;
+            futex_wait(&p->turn, !side);
+        }
+        if (p->wake_ts)
+            latency_add(&p->lat[side], p->wake_ts);
+        if (side == 0)
+            p->handoffs++;
+        p->wake_ts = now_ns();
+        __atomic_store_n(&p->turn, !side, __ATOMIC_RELEASE);
+        futex_wake(&p->turn, 1);
+    }
+  out:
+    /* release the peer */
+    __atomic_store_n(&p->turn, !side, __ATOMIC_RELEASE);
+    futex_wake(&p->turn, 1);
+    return NULL;
+}
+
+static void run_pingpong(int npairs, int seconds)
+{
+    struct pp_pair *pairs = aligned_alloc(64, npairs * sizeof(*pairs));
+    pthread_t *threads = malloc(2 * npairs * sizeof(pthread_t));
+    struct pp_arg *args = malloc(2 * npairs * sizeof(struct pp_arg));
+    test_assert(pairs && threads && args);
+    memset(pairs, 0, npairs * sizeof(*pairs));
+    stop = 0;
+    uint64_t start = now_ns();
+    for (int i = 0; i < 2 * npairs; i++) {
+        args[i].pair = &pairs[i / 2];
+        args[i].side = i & 1;
+        if (pthread_create(&threads[i], NULL, pp_thread, &args[i]))
+            test_perror("pthread_create");
+    }
+    sleep(seconds);
+    stop = 1;
+    for (int i = 0; i < 2 * npairs; i++)
+        pthread_join(threads[i], NULL);
+    uint64_t elapsed = now_ns() - start;
+    uint64_t handoffs = 0;
+    struct latency lat = {0};
+    for (int i = 0; i < npairs; i++) {
+        handoffs += pairs[i].handoffs;
+        latency_merge(&lat, &pairs[i].lat[0]);
+        latency_merge(&lat, &pairs[i].lat[1]);
+    }
+    printf("pingpong: %d pairs, %.0f round trips/s, wakeup latency avg %lu ns max %lu ns\n",
+           npairs, handoffs * 1e9 / elapsed, lat.count ? lat.total / lat.count : 0, lat.max);
+    free(args);
+    free(threads);
+    free(pairs);
+}
+
+/* fanout */
+
+struct fo_worker {
+    int seq;
+    struct latency lat;
+    pthread_t thread;
+} __attribute__((aligned(64)));
+
+static struct fo_worker *workers;
+static int fo_pending;
+static volatile uint64_t fo_wake_ts;
+
+static void *fo_thread(void *arg)
+{
+    struct fo_worker *w = arg;
+    int seen = 0;
+    while (1) {
+        int seq;
+        while ((seq = __atomic_load_n(&w->seq, __ATOMIC_ACQUIRE)) == seen)
+            futex_wait(&w->seq, seen);
+        if (stop)
+            break;
+        latency_add(&w->lat, fo_wake_ts);
+        seen = seq;
+        if (__atomic_sub_fetch(&fo_pending, 1, __ATOMIC_ACQ_REL) == 0)
+            futex_wake(&fo_pending, 1);
+    }
+    return NULL;
+}
+
+static void run_fanout(int nworkers, int seconds)
+{
+    workers = aligned_alloc(64, nworkers * sizeof(*workers));
+    test_assert(workers);
+    memset(workers, 0, nworkers * sizeof(*workers));
+    stop = 0;
+    for (int i = 0; i < nworkers; i++) {
+        if (pthread_create(&workers[i].thread, NULL, fo_thread, &workers[i]))
+            test_perror("pthread_create");
+    }
+    uint64_t rounds = 0;
+    uint64_t start = now_ns();
+    uint64_t end = start + seconds * 1000000000ull;
+    int seq = 0;
+    while (now_ns() < end) {
+        seq++;
+        __atomic_store_n(&fo_pending, nworkers, __ATOMIC_RELEASE);
+        fo_wake_ts = now_ns();
+        for (int i = 0; i < nworkers; i++) {
+            __atomic_store_n(&workers[i].seq, seq, __ATOMIC_RELEASE);
+            futex_wake(&workers[i].seq, 1);
+        }
+        int pending;
+        while ((pending = __atomic_load_n(&fo_pending, __ATOMIC_ACQUIRE)) != 0)
+            futex_wait(&fo_pending, pending);
+        rounds++;
+    }
+    uint64_t elapsed = now_ns() - start;
+    stop = 1;
+    seq++;
+    for (int i = 0; i < nworkers; i++) {
+        __atomic_store_n(&workers[i].seq, seq, __ATOMIC_RELEASE);
+        futex_wake(&workers[i].seq, 1);
+    }
+    struct latency lat = {0};
+    for (int i = 0; i < nworkers; i++) {
+        pthread_join(workers[i].thread, NULL);
+        latency_merge(&lat, &workers[i].lat);
+    }
+    printf("fanout: %d workers, %.0f rounds/s, wakeup latency avg %lu ns max %lu ns\n",
+           nworkers, rounds * 1e9 / elapsed, lat.count ? lat.total / lat.count : 0, lat.max);
+    free(workers);
+}
+
+int main(int argc, char **argv)
+{
+    int ncpus = get_nprocs();
+    int npairs = argc > 1 ? atoi(argv[1]) : (ncpus > 1 ? ncpus / 2 : 1);
+    int nworkers = argc > 2 ? atoi(argv[2]) : ncpus * 2;
+    int seconds = argc > 3 ? atoi(argv[3]) : DEFAULT_SECONDS;
+    test_assert(npairs > 0 && 2 * npairs <= BENCH_MAX_THREADS);
+    test_assert(nworkers > 0 && nworkers <= BENCH_MAX_THREADS);
+    test_assert(seconds > 0);
+    printf("sched_bench: %d cpus\n", ncpus);
+    run_pingpong(npairs, seconds);
+    run_fanout(nworkers, seconds);
+    printf("sched_bench: done\n");
+    return EXIT_SUCCESS;
+}
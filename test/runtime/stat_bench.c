@@ -0,0 +1,127 @@
+/* Path resolution benchmark
+
+   Creates a directory tree with a number of files, then has each thread
+   repeatedly resolve the path of a randomly chosen file, either with stat()
+   or with open() followed by close(). The aggregate rate of each operation is
+   reported for 1, 2, 4... threads up to the maximum, so that serialization of
+   path lookups within a filesystem shows up as a rate that does not scale
+   with the number of threads. Usage:
+
+   stat_bench [max threads] [seconds] [directories] [files per directory]
+*/
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sysinfo.h>
+
+#include "bench.h"
+
+#define BENCH_DIR           "/stat_bench"
+#define DEFAULT_SECONDS     2
+#define DEFAULT_DIRS        16
+#define DEFAULT_FILES       64
+#define MAX_THREADS         64
+
+static int seconds;
+static int ndirs, nfiles;
+
+static void random_path(struct bench_worker *w, char *path, size_t len)
+{
+    uint64_t r = xorshift(&w->seed);
+    snprintf(path, len, BENCH_DIR "/d%d/f%d", (int)(r % ndirs), (int)((r >> 32) % nfiles));
+}
+
+static void stat_op(struct bench_worker *w)
+{
+    char path[64];
+    struct stat st;
+    random_path(w, path, sizeof(path));
+    if (stat(path, &st) < 0)
+        test_perror("stat %s", path);
+    w->ops[0]++;
+}
+
+static void open_op(struct bench_worker *w)
+{
+    char path[64];
+    random_path(w, path, sizeof(path));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        test_perror("open %s", path);
+    close(fd);
+    w->ops[0]++;
+}
+
+static const struct bench stat_bench = {
+    .op = stat_op,
+};
+
+static const struct bench open_bench = {
+    .op = open_op,
+};
+
+static void create_tree(void)
+{
+    char path[64];
+    if (mkdir(BENCH_DIR, 0755) < 0)
+        test_perror("mkdir");
+    for (int d = 0; d < ndirs; d++) {
+        snprintf(path, sizeof(path), BENCH_DIR "/d%d", d);
+        if (mkdir(path, 0755) < 0)
+            test_perror("mkdir %s", path);
+        for (int f = 0; f < nfiles; f++) {
+            snprintf(path, sizeof(path), BENCH_DIR "/d%d/f%d", d, f);
+            int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0)
+                test_perror("open %s", path);
+            if (write(fd, path, strlen(path)) < 0)
+                test_perror("write");
+            close(fd);
+        }
+    }
+}
+
+static void remove_tree(void)
+{
+    char path[64];
+    for (int d = 0; d < ndirs; d++) {
+        for (int f = 0; f < nfiles; f++) {
+            snprintf(path, sizeof(path), BENCH_DIR "/d%d/f%d", d, f);
+            if (unlink(path) < 0)
+                test_perror("unlink %s", path);
+        }
+        snprintf(path, sizeof(path), BENCH_DIR "/d%d", d);
+        if (rmdir(path) < 0)
+            test_perror("rmdir %s", path);
+    }
+    if (rmdir(BENCH_DIR) < 0)
+        test_perror("rmdir");
+}
+
+static void run_ops(int nthreads)
+{
+    struct bench_result stat_r = bench_run(&stat_bench, nthreads, seconds);
+    struct bench_result open_r = bench_run(&open_bench, nthreads, seconds);
+    printf("%3d threads: %.0f stat/s, %.0f open+close/s\n", nthreads, bench_rate(&stat_r, 0),
+           bench_rate(&open_r, 0));
+}
+
+int main(int argc, char **argv)
+{
+    int ncpus = get_nprocs();
+    int max_threads = argc > 1 ? atoi(argv[1]) : ncpus;
+    seconds = argc > 2 ? atoi(argv[2]) : DEFAULT_SECONDS;
+    ndirs = argc > 3 ? atoi(argv[3]) : DEFAULT_DIRS;
+    nfiles = argc > 4 ? atoi(argv[4]) : DEFAULT_FILES;
+    test_assert(max_threads > 0 && max_threads <= MAX_THREADS);
+    test_assert(seconds > 0);
+    test_assert(ndirs > 0 && nfiles > 0);
+
+    create_tree();
+    printf("stat_bench: %d cpus, %d directories, %d files per directory\n", ncpus, ndirs,
+           nfiles);
+    bench_sweep(max_threads, run_ops);
+    remove_tree();
+    printf("stat_bench: done\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,177 @@
+/* TCP bulk transfer throughput benchmark
+
+   The server accepts connections and, depending on the direction requested by
+   the client, either sends or receives bulk data for the requested number of
+   seconds. At the end of each connection the server reports the throughput
+   and the CPU time spent per transferred byte, together with the number of
+   TCP segmentation offload packets and the average number of segments per
+   packet, as read from /proc/net/tso, so that the effect of segmentation
+   offload on transmit shows up. Run the server in the unikernel and the client
+   on the host, e.g.:
+
+   make run TARGET=tcp_bench
+   output/test/runtime/bin/tcp_bench client 127.0.0.1
+
+   Usage:
+   tcp_bench [server [port]]
+   tcp_bench client <address> [port] [seconds] [write size]
+*/
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "bench.h"
+
+#define BENCH_PORT          8080
+#define DEFAULT_SECONDS     5
+#define DEFAULT_WRITE_SIZE  (128 * 1024)
+#define MAX_WRITE_SIZE      (1024 * 1024)
+
+enum {
+    DIR_SERVER_SEND,
+    DIR_SERVER_RECV,
+};
+
+/* Transfers data in the given direction until the peer closes the connection
+   (when receiving) or until the given number of seconds elapses (when
+   sending); returns the number of bytes transferred. */
+static uint64_t bulk_xfer(int fd, char *buf, int write_size, int send, int seconds)
+{
+    uint64_t bytes = 0;
+    uint64_t end = now_ns() + seconds * 1000000000ull;
+    while (1) {
+        if (send) {
+            if (now_ns() >= end)
+                break;
+            if (bench_xfer(fd, buf, write_size, 1) < 0)
+                break;
+            bytes += write_size;
+        } else {
+            ssize_t rv = read(fd, buf, write_size);
+            if (rv <= 0)
+                break;
+            bytes += rv;
+        }
+    }
+    return bytes;
+}
+
+static void report(const char *who, const char *dir, uint64_t bytes, uint64_t elapsed,
+                   uint64_t cpu)
+{
+    printf("%s %s: %lld bytes, %.2f Gbit/s, %.3f CPU ns/byte\n", who, dir, (long long)bytes,
+           elapsed ? bytes * 8.0 / elapsed : 0.0, bytes ? (double)cpu / bytes : 0.0);
+}
+
+static void run_server(int port)
+{
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (lfd < 0)
+        test_perror("socket");
+    int val = 1;
+    if (setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val)) < 0)
+        test_perror("setsockopt(SO_REUSEADDR)");
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    if (bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        test_perror("bind");
+    if (listen(lfd, 1) < 0)
+        test_perror("listen");
+    printf("tcp_bench: server listening on port %d\n", port);
+    char *buf = malloc(MAX_WRITE_SIZE);
+    test_assert(buf);
+    memset(buf, 0xa5, MAX_WRITE_SIZE);
+    while (1) {
+        int fd = accept(lfd, NULL, NULL);
+        if (fd < 0)
+            test_perror("accept");
+        uint32_t hdr[3];    /* direction, seconds, write size */
+        if (bench_xfer(fd, hdr, sizeof(hdr), 0) < 0 || hdr[0] > DIR_SERVER_RECV || hdr[1] == 0 ||
+            hdr[2] == 0 || hdr[2] > MAX_WRITE_SIZE) {
+            close(fd);
+            continue;
+        }
+        int send = (hdr[0] == DIR_SERVER_SEND);
+        int64_t tso_packets = bench_read_stat("/proc/net/tso", "tso_packets");
+        int64_t tso_segments = bench_read_stat("/proc/net/tso", "tso_segments");
+        uint64_t cpu = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+        uint64_t start = now_ns();
+        uint64_t bytes = bulk_xfer(fd, buf, hdr[2], send, hdr[1]);
+        if (send)
+            shutdown(fd, SHUT_WR);
+        uint64_t elapsed = now_ns() - start;
+        cpu = clock_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+        report("server", send ? "send" : "receive", bytes, elapsed, cpu);
+        if (tso_packets >= 0) {
+            tso_packets = bench_read_stat("/proc/net/tso", "tso_packets") - tso_packets;
+            tso_segments = bench_read_stat("/proc/net/tso", "tso_segments") - tso_segments;
+            printf("server tso: %lld packets, %.2f segments per packet\n",
+                   (long long)tso_packets,
+                   tso_packets ? (double)tso_segments / tso_packets : 0.0);
+        }
+        close(fd);
+    }
+}
+
+static void run_client(const char *host, int port, int dir, int seconds, int write_size)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+    };
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1)
+        test_error("invalid address %s", host);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        test_perror("socket");
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        test_perror("connect");
+    uint32_t hdr[3] = { dir, seconds, write_size };
+    if (bench_xfer(fd, hdr, sizeof(hdr), 1) < 0)
+        test_perror("write");
+    char *buf = malloc(write_size);
+    test_assert(buf);
+    memset(buf, 0x5a, write_size);
+    uint64_t cpu = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+    uint64_t start = now_ns();
+
+    /* the client does the opposite of what the server does */
+    int send = (dir == DIR_SERVER_RECV);
+    uint64_t bytes = bulk_xfer(fd, buf, write_size, send, seconds);
+    if (send) {
+        /* wait for the server to drain the connection */
+        shutdown(fd, SHUT_WR);
+        while (read(fd, buf, write_size) > 0);
+    }
+    uint64_t elapsed = now_ns() - start;
+    cpu = clock_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+    close(fd);
+    report("client", send ? "send" : "receive", bytes, elapsed, cpu);
+    free(buf);
+}
+
+int main(int argc, char **argv)
+{
+    if ((argc > 1) && !strcmp(argv[1], "client")) {
+        if (argc < 3)
+            test_error("usage: %s client <address> [port] [seconds] [write size]", argv[0]);
+        int port = argc > 3 ? atoi(argv[3]) : BENCH_PORT;
+        int seconds = argc > 4 ? atoi(argv[4]) : DEFAULT_SECONDS;
+        int write_size = argc > 5 ? atoi(argv[5]) : DEFAULT_WRITE_SIZE;
+        test_assert(seconds > 0);
+        test_assert(write_size > 0 && write_size <= MAX_WRITE_SIZE);
+        printf("tcp_bench: %d seconds, %d-byte writes\n", seconds, write_size);
+        run_client(argv[2], port, DIR_SERVER_SEND, seconds, write_size);
+        run_client(argv[2], port, DIR_SERVER_RECV, seconds, write_size);
+        printf("tcp_bench: done\n");
+        return EXIT_SUCCESS;
+    }
+    if ((argc > 1) && strcmp(argv[1], "server"))
+        test_error("invalid mode %s", argv[1]);
+    run_server(argc > 2 ? atoi(argv[2]) : BENCH_PORT);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,78 @@
+/* virtio storage request rate benchmark
+
+   Measures the rate of synchronous writes to a file: each write is followed
+   by fdatasync(), so that every iteration results in a write and a flush
+   request to the storage device. Small writes take a short descriptor chain
+   per request, while large writes take a long scatter-gather list, which uses
+   an indirect descriptor table if the device supports it. To compare split
+   and packed virtqueues, run with and without packed rings in QEMU, e.g.:
+
+   make run TARGET=virtio_bench STORAGE=virtio-blk
+   make run TARGET=virtio_bench STORAGE=virtio-blk VIRTIO_PACKED=1
+
+   Usage: virtio_bench [seconds]
+*/
+#define _GNU_SOURCE
+#include <fcntl.h>
+
+#include "bench.h"
+
+#define BENCH_FILE          "/virtio_bench.tmp"
+#define DEFAULT_SECONDS     2
+#define FILE_SIZE           (16 * 1024 * 1024)
+#define MAX_WRITE_SIZE      (1024 * 1024)
+
+struct writes {
+    int fd;
+    const void *buf;
+    size_t size;
+    off_t offset;
+};
+
+static void write_op(void *arg)
+{
+    struct writes *w = arg;
+    if (pwrite(w->fd, w->buf, w->size, w->offset) != w->size)
+        test_perror("pwrite");
+    if (fdatasync(w->fd) < 0)
+        test_perror("fdatasync");
+    w->offset += w->size;
+    if (w->offset + w->size > FILE_SIZE)
+        w->offset = 0;
+}
+
+int main(int argc, char **argv)
+{
+    int seconds = argc > 1 ? atoi(argv[1]) : DEFAULT_SECONDS;
+    test_assert(seconds > 0);
+    char *buf = malloc(MAX_WRITE_SIZE);
+    test_assert(buf);
+    memset(buf, 0xa5, MAX_WRITE_SIZE);
+    int fd = open(BENCH_FILE, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        test_perror("open");
+
+    /* allocate file extents in advance, so that the measured writes do not extend the file */
+    if (fallocate(fd, 0, 0, FILE_SIZE) < 0)
+        test_perror("fallocate");
+    if (fsync(fd) < 0)
+        test_perror("fsync");
+
+    printf("virtio_bench: %d seconds per size\n", seconds);
+    for (size_t size = 4096; size <= MAX_WRITE_SIZE; size *= 16) {
+        struct writes w = {
+            .fd = fd,
+            .buf = buf,
+            .size = size,
+        };
+        double rate = bench_loop(write_op, &w, seconds);
+        printf("%7ld bytes: %.0f requests/s, %.1f MB/s\n", size, rate,
+               rate * size / (1024 * 1024));
+    }
+    close(fd);
+    if (unlink(BENCH_FILE) < 0)
+        test_perror("unlink");
+    free(buf);
+    printf("virtio_bench: done\n");
+    return EXIT_SUCCESS;
+}
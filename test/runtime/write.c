@@ -5,6 +5,7 @@
 #include <limits.h>
 #include <ctype.h>
 #include <errno.h>
+#include <pthread.h>
 #include <time.h>
 #include <sys/time.h>
 #include <sys/eventfd.h>
@@ -288,6 +289,178 @@ void sync_write_test(void)
     writetest_debug("sync write test passed\n");
 }
 
+#define DIRECT_BLOCKSIZE    512
+#define DIRECT_LEN          (4 * 4096)
+
+/* Uncached I/O must see data written through the page cache, and cached reads must see data
+ * written with O_DIRECT. */
+void direct_io_test(void)
+{
+    const char *name = "direct_io";
+    unsigned char *buf = aligned_alloc(4096, 2 * DIRECT_LEN);
+    unsigned char *dbuf = aligned_alloc(4096, DIRECT_LEN);
+    test_assert(buf && dbuf);
+    int fd = open(name, O_CREAT | O_RDWR | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd < 0)
+        test_perror("direct_io open");
+    int dfd = open(name, O_RDWR | O_DIRECT);
+    if (dfd < 0)
+        test_perror("direct_io open O_DIRECT");
+
+    /* cached write, uncached read */
+    for (int i = 0; i < DIRECT_LEN; i++)
+        buf[i] = i % 251;
+    test_assert(pwrite(fd, buf, DIRECT_LEN, 0) == DIRECT_LEN);
+    test_assert(pread(dfd, dbuf, DIRECT_LEN, 0) == DIRECT_LEN);
+    test_assert(!memcmp(buf, dbuf, DIRECT_LEN));
+
+    /* cached read, uncached overwrite, cached read */
+    test_assert(pread(fd, buf, DIRECT_LEN, 0) == DIRECT_LEN);
+    memset(dbuf, 0xa5, DIRECT_LEN);
+    test_assert(pwrite(dfd, dbuf + DIRECT_BLOCKSIZE, 2 * DIRECT_BLOCKSIZE, 4096) ==
+                2 * DIRECT_BLOCKSIZE);
+    test_assert(pread(fd, buf, DIRECT_LEN, 0) == DIRECT_LEN);
+    for (int i = 0; i < DIRECT_LEN; i++) {
+        unsigned char expected = (i >= 4096 && i < 4096 + 2 * DIRECT_BLOCKSIZE) ? 0xa5 : i % 251;
+        if (buf[i] != expected)
+            test_error("direct_io: offset %d: 0x%x, expected 0x%x", i, buf[i], expected);
+    }
+
+    /* uncached append, then a short read at the unaligned end of file */
+    test_assert(lseek(dfd, 0, SEEK_END) == DIRECT_LEN);
+    test_assert(write(dfd, dbuf, DIRECT_BLOCKSIZE) == DIRECT_BLOCKSIZE);
+    struct stat st;
+    test_assert(fstat(fd, &st) == 0 && st.st_size == DIRECT_LEN + DIRECT_BLOCKSIZE);
+    test_assert(pwrite(fd, buf, 1, DIRECT_LEN + DIRECT_BLOCKSIZE) == 1);
+    test_assert(pread(dfd, dbuf, DIRECT_LEN, DIRECT_LEN) == DIRECT_BLOCKSIZE + 1);
+    test_assert(dbuf[DIRECT_BLOCKSIZE] == buf[0]);
+    test_assert(pread(dfd, dbuf, DIRECT_BLOCKSIZE, DIRECT_LEN + 2 * DIRECT_BLOCKSIZE) == 0);
+
+    /* misaligned buffer, offset or length */
+    test_assert(pread(dfd, dbuf + 1, DIRECT_BLOCKSIZE, 0) == -1 && errno == EINVAL);
+    test_assert(pread(dfd, dbuf, DIRECT_BLOCKSIZE, 1) == -1 && errno == EINVAL);
+    test_assert(pwrite(dfd, dbuf, DIRECT_BLOCKSIZE - 1, 0) == -1 && errno == EINVAL);
+
+    close(dfd);
+    close(fd);
+    unlink(name);
+    free(dbuf);
+    free(buf);
+    writetest_debug("direct I/O test passed\n");
+}
+
+#define SYNC_THREADS    8
+#define SYNC_ITERATIONS 64
+#define SYNC_BLOCKSIZE  4096
+#define SYNC_TIMEOUT    60  /* seconds */
+
+struct sync_worker {
+    pthread_t thread;
+    int index;
+    int datasync;       /* fdatasync() instead of fsync() */
+    int dirty_md;       /* appends (dirty metadata) instead of overwrites of initialized blocks */
+    int completed;      /* syncs returned so far */
+};
+
+/* Returns -1 if the counter is not available (e.g. on Linux). */
+static long long read_vmstat(const char *name)
+{
+    FILE *f = fopen("/proc/vmstat", "r");
+    if (!f)
+        return -1;
+    char key[64];
+    long long val, rv = -1;
+    while (fscanf(f, "%63s %lld", key, &val) == 2) {
+        if (!strcmp(key, name)) {
+            rv = val;
+            break;
+        }
+    }
+    fclose(f);
+    return rv;
+}
+
+static void *sync_worker(void *arg)
+{
+    struct sync_worker *w = arg;
+    char name[32];
+    unsigned char buf[SYNC_BLOCKSIZE];
+    sprintf(name, "sync_test_%d", w->index);
+    int fd = open(name, O_CREAT | O_RDWR | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd < 0)
+        test_perror("sync test open");
+    if (!w->dirty_md) {
+        memset(buf, 0, SYNC_BLOCKSIZE);
+        for (int i = 0; i < SYNC_ITERATIONS; i++)
+            test_assert(write(fd, buf, SYNC_BLOCKSIZE) == SYNC_BLOCKSIZE);
+        test_assert(fsync(fd) == 0);
+    }
+    for (int i = 0; i < SYNC_ITERATIONS; i++) {
+        memset(buf, w->index * SYNC_ITERATIONS + i, SYNC_BLOCKSIZE);
+        long long log_writes = read_vmstat("tfs_log_writes");
+        test_assert(pwrite(fd, buf, SYNC_BLOCKSIZE, i * SYNC_BLOCKSIZE) == SYNC_BLOCKSIZE);
+        if ((w->datasync ? fdatasync(fd) : fsync(fd)) < 0)
+            test_perror("%s", w->datasync ? "fdatasync" : "fsync");
+
+        /* metadata staged by this sync must be in a log write issued after the data write */
+        if (w->dirty_md && (log_writes >= 0) && (read_vmstat("tfs_log_writes") <= log_writes))
+            test_error("sync test: %s of %s returned before a log write",
+                       w->datasync ? "fdatasync" : "fsync", name);
+        __atomic_add_fetch(&w->completed, 1, __ATOMIC_RELEASE);
+    }
+    struct stat st;
+    test_assert(fstat(fd, &st) == 0 && st.st_size == SYNC_ITERATIONS * SYNC_BLOCKSIZE);
+    for (int i = 0; i < SYNC_ITERATIONS; i++) {
+        test_assert(pread(fd, buf, SYNC_BLOCKSIZE, i * SYNC_BLOCKSIZE) == SYNC_BLOCKSIZE);
+        unsigned char expected = w->index * SYNC_ITERATIONS + i;
+        for (int j = 0; j < SYNC_BLOCKSIZE; j++)
+            if (buf[j] != expected)
+                test_error("sync test: %s offset %d: 0x%x, expected 0x%x", name,
+                           i * SYNC_BLOCKSIZE + j, buf[j], expected);
+    }
+    close(fd);
+    unlink(name);
+    return NULL;
+}
+
+/* Concurrent fsync() and fdatasync() calls, on files with and without dirty metadata, must all
+ * complete, and none may complete before the metadata it depends on is written to the log. When
+ * run with the fsync_batch_us option, syncs are coalesced into shared log writes. */
+void concurrent_sync_test(void)
+{
+    struct sync_worker workers[SYNC_THREADS];
+    for (int i = 0; i < SYNC_THREADS; i++) {
+        struct sync_worker *w = &workers[i];
+        w->index = i;
+        w->datasync = i & 1;
+        w->dirty_md = (i >> 1) & 1;
+        w->completed = 0;
+        if (pthread_create(&w->thread, NULL, sync_worker, w))
+            test_error("sync test: pthread_create");
+    }
+    int total = SYNC_THREADS * SYNC_ITERATIONS;
+    int completed;
+    for (int ms = 0; ; ms += 10) {
+        completed = 0;
+        for (int i = 0; i < SYNC_THREADS; i++)
+            completed += __atomic_load_n(&workers[i].completed, __ATOMIC_ACQUIRE);
+        if ((completed == total) || (ms >= SYNC_TIMEOUT * 1000))
+            break;
+        usleep(10 * 1000);
+    }
+    if (completed != total) {
+        for (int i = 0; i < SYNC_THREADS; i++)
+            printf("sync test: worker %d (%s, %s): %d of %d syncs completed\n", i,
+                   workers[i].datasync ? "fdatasync" : "fsync",
+                   workers[i].dirty_md ? "append" : "overwrite",
+                   workers[i].completed, SYNC_ITERATIONS);
+        test_error("sync test: syncs not completed after %d seconds", SYNC_TIMEOUT);
+    }
+    for (int i = 0; i < SYNC_THREADS; i++)
+        pthread_join(workers[i].thread, NULL);
+    writetest_debug("concurrent sync test passed\n");
+}
+
 void truncate_test(const char *prog)
 {
     char name_too_long[NAME_MAX + 2];
@@ -697,7 +870,8 @@ enum {
     WRITE_OP_ALL,
     WRITE_OP_BASIC_ONLY,
     WRITE_OP_BULK_ONLY,
-    WRITE_OP_PERSISTENCE_ONLY
+    WRITE_OP_PERSISTENCE_ONLY,
+    WRITE_OP_SYNC_ONLY
 };
 
 static void usage(const char *program_name)
@@ -707,6 +881,7 @@ static void usage(const char *program_name)
     printf("Usage: %s [-b file-size]\n"
            "\n"
            "-b - run basic tests only (no bulk / performance tests)\n"
+           "-f - run concurrent sync test only\n"
            "-p - run persistence test only\n"
            "-w - run bulk data write test only\n"
            "-s - set bulk data size; size may be expressed by suffix\n"
@@ -793,7 +968,7 @@ int main(int argc, char **argv)
     long long size = DEFAULT_BULK_SIZE;
     char *endptr;
 
-    while ((c = getopt(argc, argv, "hbws:p")) != EOF) {
+    while ((c = getopt(argc, argv, "hbws:pf")) != EOF) {
         switch (c) {
         case 'h':
             usage(argv[0]);
@@ -807,6 +982,9 @@ int main(int argc, char **argv)
         case 'p':
             op = WRITE_OP_PERSISTENCE_ONLY;
             break;
+        case 'f':
+            op = WRITE_OP_SYNC_ONLY;
+            break;
         case 's':
             size = strtoll(optarg, &endptr, 0);
             if (size <= 0) {
@@ -846,6 +1024,8 @@ int main(int argc, char **argv)
         scatter_write_test(1 << 18, 64, 1 << 12);
         append_write_test();
         sync_write_test();
+        direct_io_test();
+        concurrent_sync_test();
         truncate_test(argv[0]);
         write_exec_test(argv[0]);
         fs_stress_test();
@@ -859,6 +1039,10 @@ int main(int argc, char **argv)
         persistence_write_test();
     }
 
+    if (op == WRITE_OP_SYNC_ONLY) {
+        concurrent_sync_test();
+    }
+
     printf("write test passed\n");
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,168 @@
+/* Tests for the TFS free storage allocator: placement at a goal block, continuation from the
+   allocation cursor, best-fit allocation from fragmented free space, and coalescing of freed
+   extents. */
+
+//#define ENABLE_MSG_DEBUG
+#include <tfs_internal.h>
+
+#include "../test_utils.h"
+
+#define TEST_FS_SIZE    (64 * MB)
+
+extern heap init_process_runtime();
+
+/* The filesystem contents are not needed: writes are discarded and reads return zeros. */
+closure_func_basic(storage_req_handler, void, null_storage,
+                   storage_req req)
+{
+    switch (req->op) {
+    case STORAGE_OP_WRITESG:
+        sg_consume(req->data, range_span(req->blocks) << SECTOR_OFFSET);
+        break;
+    case STORAGE_OP_READSG:
+        sg_zero_fill(req->data, range_span(req->blocks) << SECTOR_OFFSET);
+        break;
+    case STORAGE_OP_FLUSH:
+        break;
+    default:
+        test_error("invalid storage op %d", req->op);
+    }
+    apply(req->completion, STATUS_OK);
+}
+
+/* Returns the number of free extents, after checking that they are disjoint and not adjacent
+ * (i.e. fully coalesced) and that their total length matches the free block count. */
+static u64 free_extents(tfs fs)
+{
+    u64 count = 0, blocks = 0;
+    u64 prev_end = INVALID_PHYSICAL;
+    rangemap_foreach(fs->free_space, n) {
+        test_assert(range_span(n->r) > 0);
+        test_assert((prev_end == INVALID_PHYSICAL) || (n->r.start > prev_end));
+        prev_end = n->r.end;
+        blocks += range_span(n->r);
+        count++;
+    }
+    test_assert(blocks == fs->free_blocks);
+    return count;
+}
+
+static boolean is_free(tfs fs, range r)
+{
+    rmnode n = rangemap_lookup(fs->free_space, r.start);
+    return (n != INVALID_ADDRESS) && (n->r.end >= r.end);
+}
+
+/* Returns the start of a free area of at least nblocks blocks. */
+static u64 find_free(tfs fs, u64 nblocks)
+{
+    rangemap_foreach(fs->free_space, n) {
+        if (range_span(n->r) >= nblocks)
+            return n->r.start;
+    }
+    test_error("no free extent of %llu blocks", nblocks);
+}
+
+static void goal_test(tfs fs)
+{
+    u64 free_blocks = fs->free_blocks;
+    u64 extents = free_extents(fs);
+    u64 area = find_free(fs, 1024);
+
+    /* placement at the goal block, splitting a free extent */
+    u64 goal = area + 100;
+    test_assert(filesystem_allocate_storage(fs, 8, goal) == goal);
+    test_assert(fs->free_blocks == free_blocks - 8);
+    test_assert(!is_free(fs, irangel(goal, 8)));
+    test_assert(free_extents(fs) == extents + 1);
+
+    /* without a goal, allocation continues from the cursor */
+    test_assert(filesystem_allocate_storage(fs, 8, INVALID_PHYSICAL) == goal + 8);
+    test_assert(filesystem_allocate_storage(fs, 16, INVALID_PHYSICAL) == goal + 16);
+
+    /* a goal in allocated space is satisfied from the following free extent */
+    test_assert(filesystem_allocate_storage(fs, 4, goal + 8) == goal + 32);
+    test_assert(fs->free_blocks == free_blocks - 36);
+
+    /* reservation of allocated and free blocks */
+    test_assert(!filesystem_reserve_storage(fs, irangel(goal, 4)));
+    test_assert(filesystem_reserve_storage(fs, irangel(area, 4)));
+    test_assert(!is_free(fs, irangel(area, 4)));
+    test_assert(fs->free_blocks == free_blocks - 40);
+
+    /* freeing everything in any order restores the original free extents */
+    test_assert(filesystem_free_storage(fs, irangel(goal + 8, 8)));
+    test_assert(filesystem_free_storage(fs, irangel(area, 4)));
+    test_assert(filesystem_free_storage(fs, irangel(goal + 32, 4)));
+    test_assert(filesystem_free_storage(fs, irangel(goal, 8)));
+    test_assert(filesystem_free_storage(fs, irangel(goal + 16, 16)));
+    test_assert(fs->free_blocks == free_blocks);
+    test_assert(free_extents(fs) == extents);
+    test_assert(is_free(fs, irangel(area, 1024)));
+}
+
+static void fragmentation_test(tfs fs)
+{
+    u64 free_blocks = fs->free_blocks;
+    u64 extents = free_extents(fs);
+    u64 area = find_free(fs, 2048);
+
+    /* allocate a region and free blocks from it so as to leave holes of different sizes */
+    test_assert(filesystem_reserve_storage(fs, irangel(area, 1024)));
+    test_assert(filesystem_free_storage(fs, irangel(area + 100, 16)));
+    test_assert(filesystem_free_storage(fs, irangel(area + 200, 4)));
+    test_assert(filesystem_free_storage(fs, irangel(area + 300, 8)));
+    test_assert(fs->free_blocks == free_blocks - 1024 + 28);
+    test_assert(free_extents(fs) == extents + 3);
+
+    /* with no free space at or after the goal, the smallest extent that fits is used */
+    u64 no_space = fs->fs.size >> fs->fs.blocksize_order;
+    test_assert(filesystem_allocate_storage(fs, 4, no_space) == area + 200);
+    test_assert(filesystem_allocate_storage(fs, 5, no_space) == area + 300);
+    test_assert(filesystem_allocate_storage(fs, 9, no_space) == area + 100);
+    test_assert(filesystem_allocate_storage(fs, 3, no_space) == area + 305);
+    test_assert(free_extents(fs) == extents + 1);
+
+    /* a goal in a hole that is too small is satisfied from the following free extent */
+    test_assert(filesystem_allocate_storage(fs, 8, area + 109) == area + 1024);
+    test_assert(filesystem_free_storage(fs, irangel(area + 1024, 8)));
+    test_assert(filesystem_allocate_storage(fs, 7, area + 109) == area + 109);
+    test_assert(fs->free_blocks == free_blocks - 1024);
+    test_assert(free_extents(fs) == extents);
+
+    /* freeing blocks that are already free is a no-op */
+    test_assert(filesystem_free_storage(fs, irangel(area, 100)));
+    test_assert(filesystem_free_storage(fs, irangel(area + 50, 100)));
+    test_assert(fs->free_blocks == free_blocks - 1024 + 150);
+    test_assert(free_extents(fs) == extents + 1);
+
+    /* freeing the rest of the region merges it back into a single extent */
+    test_assert(filesystem_free_storage(fs, irange(area + 150, area + 1024)));
+    test_assert(fs->free_blocks == free_blocks);
+    test_assert(free_extents(fs) == extents);
+    test_assert(is_free(fs, irangel(area, 1024)));
+}
+
+closure_func_basic(filesystem_complete, void, tfs_test_fs_complete,
+                   filesystem fs, status s)
+{
+    test_assert(is_ok(s));
+    tfs t = (tfs)fs;
+    u64 total = fs->size >> fs->blocksize_order;
+    test_assert(t->free_blocks > 0 && t->free_blocks < total);
+    goal_test(t);
+    fragmentation_test(t);
+    filesystem_flush(fs, ignore_status);
+    msg_debug("tfs test passed\n");
+    exit(EXIT_SUCCESS);
+}
+
+int main(int argc, char **argv)
+{
+    heap h = init_process_runtime();
+    init_pagecache(h, h, PAGESIZE);
+    create_filesystem(h, SECTOR_SIZE, TEST_FS_SIZE,
+                      closure_func(h, storage_req_handler, null_storage), false, sstring_empty(),
+                      closure_func(h, filesystem_complete, tfs_test_fs_complete));
+    test_error("filesystem creation did not complete");
+}